@@ -189,9 +189,10 @@ static void isAnsweringMachine(struct ast_channel *chan, void *data)
 				initialSilence, greeting, afterGreetingSilence, totalAnalysisTime,
 				minimumWordLength, betweenWordsSilence, maximumNumberOfWords, silenceThreshold, maximumWordLength);
 
-	/* Set read format to signed linear so we get signed linear frames in */
+	/* Set read format to signed linear, unless it is already ulaw or alaw,
+	   which the silence detector takes as they are */
 	readFormat = chan->readformat;
-	if (ast_set_read_format(chan, AST_FORMAT_SLINEAR) < 0 ) {
+	if (ast_set_read_format(chan, DSP_SILENCE_FORMATS) < 0 ) {
 		ast_log(LOG_WARNING, "AMD: Channel [%s]. Unable to set to linear mode, giving up\n", chan->name );
 		pbx_builtin_setvar_helper(chan , "AMDSTATUS", "");
 		pbx_builtin_setvar_helper(chan , "AMDCAUSE", "");
@@ -29,19 +29,11 @@
 
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 96147 $")
 
-#include <sys/time.h>
-#include <signal.h>
-
-#include "asterisk/lock.h"
 #include "asterisk/file.h"
 #include "asterisk/channel.h"
-#include "asterisk/frame.h"
 #include "asterisk/pbx.h"
 #include "asterisk/module.h"
-#include "asterisk/translate.h"
-
-#define LOCAL_MPG_123 "/usr/local/bin/mpg123"
-#define MPG_123 "/usr/bin/mpg123"
+#include "asterisk/mp3.h"
 
 static char *app = "MP3Player";
 
@@ -50,176 +42,21 @@ static char *synopsis = "Play an MP3 file or stream";
 static char *descrip = 
 "  MP3Player(location): Executes mpg123 to play the given location,\n"
 "which typically would be a filename or a URL. User can exit by pressing\n"
-"any key on the dialpad, or by hanging up."; 
-
-
-static int mp3play(char *filename, int fd)
-{
-	int res;
-	int x;
-	sigset_t fullset, oldset;
-
-	sigfillset(&fullset);
-	pthread_sigmask(SIG_BLOCK, &fullset, &oldset);
-
-	res = fork();
-	if (res < 0) 
-		ast_log(LOG_WARNING, "Fork failed\n");
-	if (res) {
-		pthread_sigmask(SIG_SETMASK, &oldset, NULL);
-		return res;
-	}
-	if (ast_opt_high_priority)
-		ast_set_priority(0);
-	signal(SIGPIPE, SIG_DFL);
-	pthread_sigmask(SIG_UNBLOCK, &fullset, NULL);
-
-	dup2(fd, STDOUT_FILENO);
-	for (x=STDERR_FILENO + 1;x<256;x++) {
-		if (x != STDOUT_FILENO)
-			close(x);
-	}
-	/* Execute mpg123, but buffer if it's a net connection */
-	if (!strncasecmp(filename, "http://", 7)) {
-		/* Most commonly installed in /usr/local/bin */
-	    execl(LOCAL_MPG_123, "mpg123", "-q", "-s", "-b", "1024", "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-		/* But many places has it in /usr/bin */
-	    execl(MPG_123, "mpg123", "-q", "-s", "-b", "1024","-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-		/* As a last-ditch effort, try to use PATH */
-	    execlp("mpg123", "mpg123", "-q", "-s", "-b", "1024",  "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-	}
-	else {
-		/* Most commonly installed in /usr/local/bin */
-	    execl(MPG_123, "mpg123", "-q", "-s", "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-		/* But many places has it in /usr/bin */
-	    execl(LOCAL_MPG_123, "mpg123", "-q", "-s", "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-		/* As a last-ditch effort, try to use PATH */
-	    execlp("mpg123", "mpg123", "-q", "-s", "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-	}
-	ast_log(LOG_WARNING, "Execute of mpg123 failed\n");
-	_exit(0);
-}
+"any key on the dialpad, or by hanging up.  If format_mp3 is loaded, the\n"
+"full path to a local .mp3 file is decoded in-process instead.  Channels\n"
+"playing the same http:// URL share one mpg123 unless broadcast is turned\n"
+"off in mp3.conf.";
 
-static int timed_read(int fd, void *data, int datalen, int timeout)
-{
-	int res;
-	struct pollfd fds[1];
-	fds[0].fd = fd;
-	fds[0].events = POLLIN;
-	res = poll(fds, 1, timeout);
-	if (res < 1) {
-		ast_log(LOG_NOTICE, "Poll timed out/errored out with %d\n", res);
-		return -1;
-	}
-	return read(fd, data, datalen);
-	
-}
 
 static int mp3_exec(struct ast_channel *chan, void *data)
 {
-	int res=0;
-	int fds[2];
-	int ms = -1;
-	int pid = -1;
-	int owriteformat;
-	int timeout = 2000;
-	struct timeval next;
-	struct ast_frame *f;
-	struct myframe {
-		struct ast_frame f;
-		char offset[AST_FRIENDLY_OFFSET];
-		short frdata[160];
-	} myf;
-	
 	if (ast_strlen_zero(data)) {
 		ast_log(LOG_WARNING, "MP3 Playback requires an argument (filename)\n");
 		return -1;
 	}
 
-	if (pipe(fds)) {
-		ast_log(LOG_WARNING, "Unable to create pipe\n");
-		return -1;
-	}
-	
-	ast_stopstream(chan);
-
-	owriteformat = chan->writeformat;
-	res = ast_set_write_format(chan, AST_FORMAT_SLINEAR);
-	if (res < 0) {
-		ast_log(LOG_WARNING, "Unable to set write format to signed linear\n");
-		return -1;
-	}
-	
-	res = mp3play((char *)data, fds[1]);
-	if (!strncasecmp((char *)data, "http://", 7)) {
-		timeout = 10000;
-	}
-	/* Wait 1000 ms first */
-	next = ast_tvnow();
-	next.tv_sec += 1;
-	if (res >= 0) {
-		pid = res;
-		/* Order is important -- there's almost always going to be mp3...  we want to prioritize the
-		   user */
-		for (;;) {
-			ms = ast_tvdiff_ms(next, ast_tvnow());
-			if (ms <= 0) {
-				res = timed_read(fds[0], myf.frdata, sizeof(myf.frdata), timeout);
-				if (res > 0) {
-					myf.f.frametype = AST_FRAME_VOICE;
-					myf.f.subclass = AST_FORMAT_SLINEAR;
-					myf.f.datalen = res;
-					myf.f.samples = res / 2;
-					myf.f.mallocd = 0;
-					myf.f.offset = AST_FRIENDLY_OFFSET;
-					myf.f.src = __PRETTY_FUNCTION__;
-					myf.f.delivery.tv_sec = 0;
-					myf.f.delivery.tv_usec = 0;
-					myf.f.data = myf.frdata;
-					if (ast_write(chan, &myf.f) < 0) {
-						res = -1;
-						break;
-					}
-				} else {
-					ast_debug(1, "No more mp3\n");
-					res = 0;
-					break;
-				}
-				next = ast_tvadd(next, ast_samp2tv(myf.f.samples, 8000));
-			} else {
-				ms = ast_waitfor(chan, ms);
-				if (ms < 0) {
-					ast_debug(1, "Hangup detected\n");
-					res = -1;
-					break;
-				}
-				if (ms) {
-					f = ast_read(chan);
-					if (!f) {
-						ast_debug(1, "Null frame == hangup() detected\n");
-						res = -1;
-						break;
-					}
-					if (f->frametype == AST_FRAME_DTMF) {
-						ast_debug(1, "User pressed a key\n");
-						ast_frfree(f);
-						res = 0;
-						break;
-					}
-					ast_frfree(f);
-				} 
-			}
-		}
-	}
-	close(fds[0]);
-	close(fds[1]);
-	
-	if (pid > -1)
-		kill(pid, SIGKILL);
-	if (!res && owriteformat)
-		ast_set_write_format(chan, owriteformat);
-	
-	return res;
+	/* Any key just ends playback */
+	return (ast_mp3_play(chan, data, AST_DIGIT_ANY, -1, -1, NULL) < 0) ? -1 : 0;
 }
 
 static int unload_module(void)
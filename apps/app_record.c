@@ -233,7 +233,8 @@ static int record_exec(struct ast_channel *chan, void *data)
 
 	if (silence > 0) {
 		rfmt = chan->readformat;
-		res = ast_set_read_format(chan, AST_FORMAT_SLINEAR);
+		/* The silence detector takes ulaw and alaw frames as they are */
+		res = ast_set_read_format(chan, DSP_SILENCE_FORMATS);
 		if (res < 0) {
 			ast_log(LOG_WARNING, "Unable to set to linear mode, giving up\n");
 			return -1;
@@ -98,7 +98,7 @@ static int background_detect_exec(struct ast_channel *chan, void *data)
 		}
 
 		origrformat = chan->readformat;
-		if ((ast_set_read_format(chan, AST_FORMAT_SLINEAR))) {
+		if ((ast_set_read_format(chan, DSP_SILENCE_FORMATS))) {
 			ast_log(LOG_WARNING, "Unable to set read format to linear!\n");
 			res = -1;
 			break;
@@ -142,7 +142,7 @@ static int background_detect_exec(struct ast_channel *chan, void *data)
 						ast_frfree(fr);
 						break;
 					}
-				} else if ((fr->frametype == AST_FRAME_VOICE) && (fr->subclass == AST_FORMAT_SLINEAR)) {
+				} else if ((fr->frametype == AST_FRAME_VOICE) && (fr->subclass & DSP_SILENCE_FORMATS)) {
 					int totalsilence;
 					int ms;
 					res = ast_dsp_silence(dsp, fr, &totalsilence);
@@ -77,8 +77,8 @@ static int do_waiting(struct ast_channel *chan, int silencereqd, time_t waitstar
 	struct ast_dsp *sildet;	 /* silence detector dsp */
  	time_t now;
 
-	rfmt = chan->readformat; /* Set to linear mode */
-	res = ast_set_read_format(chan, AST_FORMAT_SLINEAR);
+	rfmt = chan->readformat; /* Set to linear mode, unless it is already ulaw or alaw */
+	res = ast_set_read_format(chan, DSP_SILENCE_FORMATS);
 	if (res < 0) {
 		ast_log(LOG_WARNING, "Unable to set channel to linear mode, giving up\n");
 		return -1;
@@ -12064,6 +12064,7 @@ static int load_module(void)
 		ast_log(LOG_ERROR, "Failed to create scheduler context\n");
 		return AST_MODULE_LOAD_FAILURE;
 	}
+	sched_context_set_name(sched, "chan_iax2");
 
 	if (!(io = io_context_create())) {
 		ast_log(LOG_ERROR, "Failed to create I/O context\n");
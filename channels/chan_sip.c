@@ -176,6 +176,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 141567 $")
 #include "asterisk/ast_version.h"
 #include "asterisk/event.h"
 #include "asterisk/tcptls.h"
+#include "asterisk/udpbatch.h"
 
 #ifndef FALSE
 #define FALSE    0
@@ -231,6 +232,7 @@ static int default_expiry = DEFAULT_DEFAULT_EXPIRY;
                                                       \todo Use known T1 for timeout (peerpoke)
                                                       */
 #define DEFAULT_TRANS_TIMEOUT        -1               /* Use default SIP transaction timeout */
+#define SIP_SCHED_TICK               10               /*!< Resolution (ms) of the timing wheel that SIP timers are kept on */
 #define MAX_AUTHTRIES                3                /*!< Try authentication three times, then fail */
 
 #define SIP_MAX_HEADERS              64               /*!< Max amount of SIP headers to read */
@@ -631,6 +633,10 @@ static const struct cfsip_options {
 #define DEFAULT_QUALIFY		FALSE
 #define DEFAULT_REGEXTENONQUALIFY FALSE
 #define DEFAULT_T1MIN		100		/*!< 100 MS for minimal roundtrip time */
+#define DEFAULT_UDPWORKERS	0		/*!< Handle UDP messages in the monitor thread */
+#define SIP_WORKER_QUEUE_MAX	1000		/*!< UDP messages a worker thread may have waiting */
+#define SIP_READ_MAX		64		/*!< UDP messages the monitor thread reads at once */
+#define SIP_WORKER_FLUSH_MS	5		/*!< Longest a busy worker thread keeps what it sends queued */
 #define DEFAULT_MAX_CALL_BITRATE (384)		/*!< Max bitrate for video */
 #ifndef DEFAULT_USERAGENT
 #define DEFAULT_USERAGENT "Asterisk PBX"	/*!< Default Useragent: header unless re-defined in sip.conf */
@@ -722,6 +728,7 @@ static enum transfermodes global_allowtransfer;	/*!< SIP Refer restriction schem
 static struct sip_proxy global_outboundproxy;	/*!< Outbound proxy */
 static int global_matchexterniplocally; /*!< Match externip/externhost setting against localnet setting */
 static int global_qualifyfreq; /*!< Qualify frequency */
+static int global_udpworkers;	/*!< Threads to handle UDP messages in, 0 for the monitor thread */
 
 
 /*! \brief Codecs that we support by default: */
@@ -824,6 +831,38 @@ struct sip_request {
 	struct sip_socket socket;	/*!< The socket used for this request */
 };
 
+/*! \brief A UDP message waiting for a worker thread */
+struct sip_queued_req {
+	AST_LIST_ENTRY(sip_queued_req) list;
+	struct sockaddr_in sin;		/*!< Where it came from */
+	struct sip_request req;
+};
+
+/*! \brief A thread that handles UDP messages, and its queue.  Messages go
+ * to a worker by the hash of their Call-ID. */
+struct sip_worker {
+	pthread_t thread;
+	ast_mutex_t lock;
+	ast_cond_t cond;		/*!< Signalled when a message is queued, or to stop */
+	AST_LIST_HEAD_NOLOCK(, sip_queued_req) queue;
+	unsigned int queued;		/*!< Messages in queue */
+	unsigned int dropped;		/*!< Messages dropped because the queue was full */
+	int stop;			/*!< Set to stop, once the queue is empty */
+};
+
+/*! \brief The UDP worker threads.  Only the monitor thread queues messages
+ * and (on reload) starts and stops the workers, so this needs no lock. */
+static struct sip_worker *sip_workers;
+static int sip_workers_count;
+
+/*! \brief Buffers the monitor thread reads UDP messages into, several at a
+ * time.  Those handed to a worker are replaced on the next read. */
+static struct sip_queued_req *sip_read_bufs[SIP_READ_MAX];
+
+/*! \brief Where the monitor thread queues what it sends over UDP, until it
+ * goes back to waiting */
+static struct ast_udp_batch *monitor_batch;
+
 /*! \brief structure used in transfers */
 struct sip_dual {
 	struct ast_channel *chan1;	/*!< First channel involved */
@@ -1160,6 +1199,8 @@ struct sip_st_cfg {
  */
 struct sip_pvt {
 	struct sip_pvt *next;			/*!< Next dialog in chain */
+	struct sip_pvt *prev;			/*!< Previous dialog in chain */
+	struct sip_pvt *next_callid;		/*!< Next dialog in the same Call-ID hash bucket */
 	ast_mutex_t pvt_lock;			/*!< Dialog private lock */
 	enum invitestates invitestate;		/*!< Track state of SIP_INVITEs */
 	int method;				/*!< SIP method that opened this dialog */
@@ -1316,7 +1357,19 @@ struct sip_pvt {
  */
 static struct sip_pvt *dialoglist = NULL;
 
-/*! \brief Protect the SIP dialog list (of sip_pvt's) */
+/*! Buckets the dialog hash starts with; a power of two */
+#define DIALOG_HASH_INITIAL	256
+
+/*! \brief The dialogs of dialoglist again, hashed by Call-ID into
+ * dialog_hashsize buckets (a power of two), so that an incoming message
+ * finds its dialog without walking the whole list.  The buckets double
+ * when there are more dialogs than buckets. */
+static struct sip_pvt *dialog_hash_initial[DIALOG_HASH_INITIAL];
+static struct sip_pvt **dialog_hash = dialog_hash_initial;
+static unsigned int dialog_hashsize = DIALOG_HASH_INITIAL;
+static unsigned int dialog_count;
+
+/*! \brief Protect the SIP dialog list (of sip_pvt's), and the hash */
 AST_MUTEX_DEFINE_STATIC(dialoglock);
 
 #ifndef DETECT_DEADLOCKS
@@ -1337,6 +1390,84 @@ static void dialoglist_unlock(void)
 #define dialoglist_unlock(x) ast_mutex_unlock(&dialoglock)
 #endif
 
+/*! \brief The first dialog in the hash bucket for a Call-ID; follow
+ * next_callid for the others.  Call with the dialog list locked. */
+static struct sip_pvt *dialog_find_callid(const char *callid)
+{
+	return dialog_hash[(unsigned int) ast_str_hash(callid) & (dialog_hashsize - 1)];
+}
+
+/*! \brief Put a dialog in the Call-ID hash, with the dialog list locked */
+static void dialog_hash_add(struct sip_pvt *p)
+{
+	struct sip_pvt **hash, *cur, *next;
+	unsigned int i, bucket;
+
+	if (dialog_count >= dialog_hashsize && (hash = ast_calloc(dialog_hashsize * 2, sizeof(*hash)))) {
+		for (i = 0; i < dialog_hashsize; i++) {
+			for (cur = dialog_hash[i]; cur; cur = next) {
+				next = cur->next_callid;
+				bucket = (unsigned int) ast_str_hash(cur->callid) & (dialog_hashsize * 2 - 1);
+				cur->next_callid = hash[bucket];
+				hash[bucket] = cur;
+			}
+		}
+		if (dialog_hash != dialog_hash_initial)
+			ast_free(dialog_hash);
+		dialog_hash = hash;
+		dialog_hashsize *= 2;
+	}
+
+	bucket = (unsigned int) ast_str_hash(p->callid) & (dialog_hashsize - 1);
+	p->next_callid = dialog_hash[bucket];
+	dialog_hash[bucket] = p;
+	dialog_count++;
+}
+
+/*! \brief Take a dialog out of the Call-ID hash, with the dialog list locked
+ * \return 0 if it was there, -1 if not */
+static int dialog_hash_remove(struct sip_pvt *p)
+{
+	struct sip_pvt **prev, *cur;
+
+	for (prev = &dialog_hash[(unsigned int) ast_str_hash(p->callid) & (dialog_hashsize - 1)]; (cur = *prev); prev = &cur->next_callid) {
+		if (cur == p) {
+			*prev = p->next_callid;
+			dialog_count--;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*! \brief Add a dialog to the dialog list, with the list locked */
+static void dialog_link(struct sip_pvt *p)
+{
+	p->prev = NULL;
+	if ((p->next = dialoglist))
+		dialoglist->prev = p;
+	dialoglist = p;
+	dialog_hash_add(p);
+}
+
+/*! \brief Take a dialog out of the dialog list, with the list locked
+ * \return 0 if it was there, -1 if not */
+static int dialog_unlink(struct sip_pvt *p)
+{
+	if (dialog_hash_remove(p))
+		return -1;
+	if (p->prev)
+		p->prev->next = p->next;
+	else
+		dialoglist = p->next;
+	if (p->next)
+		p->next->prev = p->prev;
+	p->next = p->prev = NULL;
+
+	return 0;
+}
+
 #define sip_pvt_lock(x) ast_mutex_lock(&x->pvt_lock)
 #define sip_pvt_trylock(x) ast_mutex_trylock(&x->pvt_lock)
 #define sip_pvt_unlock(x) ast_mutex_unlock(&x->pvt_lock)
@@ -1715,7 +1846,7 @@ static int sip_parse_host(char *line, int lineno, char **hostname, int *portnum,
 
 /*--- Transmitting responses and requests */
 static int sipsock_read(int *id, int fd, short events, void *ignore);
-static int __sip_xmit(struct sip_pvt *p, char *data, int len);
+static int __sip_xmit(struct sip_pvt *p, char *data, int len, int now);
 static int __sip_reliable_xmit(struct sip_pvt *p, int seqno, int resp, char *data, int len, int fatal, int sipmethod);
 static int __transmit_response(struct sip_pvt *p, const char *msg, const struct sip_request *req, enum xmittype reliable);
 static int retrans_pkt(const void *data);
@@ -2573,8 +2704,10 @@ static inline const char *get_transport_pvt(struct sip_pvt *p)
 	Sends a SIP request or response on a given socket (in the pvt)
 	Called by retrans_pkt, send_request, send_response and 
 	__sip_reliable_xmit
+	\param now Send over UDP right away even if the thread queues what it
+	sends, so errors are returned (for packets that are retransmitted)
 */
-static int __sip_xmit(struct sip_pvt *p, char *data, int len)
+static int __sip_xmit(struct sip_pvt *p, char *data, int len, int now)
 {
 	int res = 0;
 	const struct sockaddr_in *dst = sip_real_dst(p);
@@ -2587,8 +2720,10 @@ static int __sip_xmit(struct sip_pvt *p, char *data, int len)
 	if (p->socket.ser)
 		ast_mutex_lock(&p->socket.ser->lock);
 
-	if (p->socket.type & SIP_TRANSPORT_UDP) 
-		res = sendto(p->socket.fd, data, len, 0, (const struct sockaddr *)dst, sizeof(struct sockaddr_in));
+	if ((p->socket.type & SIP_TRANSPORT_UDP) && now)
+		res = ast_udp_sendto_now(p->socket.fd, data, len, dst);
+	else if (p->socket.type & SIP_TRANSPORT_UDP) 
+		res = ast_udp_sendto(p->socket.fd, data, len, dst);
 	else {
 		if (p->socket.ser->f) 
 			res = ast_tcptls_server_write(p->socket.ser, data, len);
@@ -2774,7 +2909,7 @@ static int retrans_pkt(const void *data)
 		}
 
 		append_history(pkt->owner, "ReTx", "%d %s", reschedule, pkt->data);
-		xmitres = __sip_xmit(pkt->owner, pkt->data, pkt->packetlen);
+		xmitres = __sip_xmit(pkt->owner, pkt->data, pkt->packetlen, 1);
 		sip_pvt_unlock(pkt->owner);
 		if (xmitres == XMIT_ERROR)
 			ast_log(LOG_WARNING, "Network error on retransmit in dialog %s\n", pkt->owner->callid);
@@ -2867,7 +3002,7 @@ static enum sip_result __sip_reliable_xmit(struct sip_pvt *p, int seqno, int res
 	/* I removed the code from retrans_pkt that does the same thing so it doesn't get loaded into the scheduler */
 	/* According to the RFC some packets need to be retransmitted even if its TCP, so this needs to get revisited */
 	if (!(p->socket.type & SIP_TRANSPORT_UDP)) {
-		xmitres = __sip_xmit(dialog_ref(p), data, len);	/* Send packet */
+		xmitres = __sip_xmit(dialog_ref(p), data, len, 1);	/* Send packet */
 		if (xmitres == XMIT_ERROR) {	/* Serious network trouble, no need to try again */
 			append_history(p, "XmitErr", "%s", fatal ? "(Critical)" : "(Non-critical)");
 			return AST_FAILURE;
@@ -2899,7 +3034,7 @@ static enum sip_result __sip_reliable_xmit(struct sip_pvt *p, int seqno, int res
 	if (sipdebug)
 		ast_debug(4, "*** SIP TIMER: Initializing retransmit timer on packet: Id  #%d\n", pkt->retransid);
 
-	xmitres = __sip_xmit(pkt->owner, pkt->data, pkt->packetlen);	/* Send packet */
+	xmitres = __sip_xmit(pkt->owner, pkt->data, pkt->packetlen, 1);	/* Send packet */
 
 	if (xmitres == XMIT_ERROR) {	/* Serious network trouble, no need to try again */
 		append_history(pkt->owner, "XmitErr", "%s", pkt->is_fatal ? "(Critical)" : "(Non-critical)");
@@ -3142,7 +3277,7 @@ static int send_response(struct sip_pvt *p, struct sip_request *req, enum xmitty
 	}
 	res = (reliable) ?
 		 __sip_reliable_xmit(p, seqno, 1, req->data, req->len, (reliable == XMIT_CRITICAL), req->method) :
-		__sip_xmit(p, req->data, req->len);
+		__sip_xmit(p, req->data, req->len, 0);
 	if (res > 0)
 		return 0;
 	return res;
@@ -3174,7 +3309,7 @@ static int send_request(struct sip_pvt *p, struct sip_request *req, enum xmittyp
 	}
 	res = (reliable) ?
 		__sip_reliable_xmit(p, seqno, 0, req->data, req->len, (reliable == XMIT_CRITICAL), req->method) :
-		__sip_xmit(p, req->data, req->len);
+		__sip_xmit(p, req->data, req->len, 0);
 	return res;
 }
 
@@ -4073,11 +4208,17 @@ static int create_addr_from_peer(struct sip_pvt *dialog, struct sip_peer *peer)
 		if (!dialog->initreq.headers) {
 			char *c;
 			char *tmpcall = ast_strdupa(dialog->callid);
+			int hashed;
 
 			c = strchr(tmpcall, '@');
 			if (c) {
 				*c = '\0';
+				dialoglist_lock();
+				hashed = !dialog_hash_remove(dialog);
 				ast_string_field_build(dialog, callid, "%s@%s", tmpcall, peer->fromdomain);
+				if (hashed)
+					dialog_hash_add(dialog);
+				dialoglist_unlock();
 			}
 		}
 	}
@@ -4324,8 +4465,8 @@ static void sip_registry_destroy(struct sip_registry *reg)
 /*! \brief Execute destruction of SIP dialog structure, release memory */
 static int __sip_destroy(struct sip_pvt *p, int lockowner, int lockdialoglist)
 {
-	struct sip_pvt *cur, *prev = NULL;
 	struct sip_pkt *cp;
+	int res;
 
 	/* We absolutely cannot destroy the rtp struct while a bridge is active or we WILL crash */
 	if (p->rtp && ast_rtp_get_bridged(p->rtp)) {
@@ -4423,15 +4564,10 @@ static int __sip_destroy(struct sip_pvt *p, int lockowner, int lockdialoglist)
 	/* Lock dialog list before removing ourselves from the list */
 	if (lockdialoglist)
 		dialoglist_lock();
-	for (prev = NULL, cur = dialoglist; cur; prev = cur, cur = cur->next) {
-		if (cur == p) {
-			UNLINK(cur, dialoglist, prev);
-			break;
-		}
-	}
+	res = dialog_unlink(p);
 	if (lockdialoglist)
 		dialoglist_unlock();
-	if (!cur) {
+	if (res) {
 		ast_log(LOG_WARNING, "Trying to destroy \"%s\", not found in dialog list?!?! \n", p->callid);
 		return 0;
 	} 
@@ -5752,11 +5888,17 @@ static char *generate_random_string(char *buf, size_t size)
 static void build_callid_pvt(struct sip_pvt *pvt)
 {
 	char buf[33];
+	int hashed;
 
 	const char *host = S_OR(pvt->fromdomain, ast_inet_ntoa(pvt->ourip.sin_addr));
 	
+	/* A dialog in the list has to move to the hash bucket of its new Call-ID */
+	dialoglist_lock();
+	hashed = !dialog_hash_remove(pvt);
 	ast_string_field_build(pvt, callid, "%s@%s", generate_random_string(buf, sizeof(buf)), host);
-
+	if (hashed)
+		dialog_hash_add(pvt);
+	dialoglist_unlock();
 }
 
 /*! \brief Build SIP Call-ID value for a REGISTER transaction */
@@ -5929,8 +6071,7 @@ static struct sip_pvt *sip_alloc(ast_string_field callid, struct sockaddr_in *si
 
 	/* Add to active dialog list */
 	dialoglist_lock();
-	p->next = dialoglist;
-	dialoglist = dialog_ref(p);
+	dialog_link(dialog_ref(p));
 	dialoglist_unlock();
 	ast_debug(1, "Allocating new SIP dialog for %s - %s (%s)\n", callid ? callid : "(No Call-ID)", sip_methods[intended_method].text, p->rtp ? "With RTP" : "No RTP");
 	return p;
@@ -5987,7 +6128,7 @@ static struct sip_pvt *find_call(struct sip_request *req, struct sockaddr_in *si
 
 	dialoglist_lock();
 restartsearch:
-	for (p = dialoglist; p; p = p->next) {
+	for (p = dialog_find_callid(callid); p; p = p->next_callid) {
 		/* In pedantic, we do not want packets with bad syntax to be connected to a PVT */
 		int found = FALSE;
 		if (ast_strlen_zero(p->callid))
@@ -10810,7 +10951,7 @@ static struct sip_pvt *get_sip_pvt_byid_locked(const char *callid, const char *t
 
 	/* Search dialogs and find the match */
 	dialoglist_lock();
-	for (sip_pvt_ptr = dialoglist; sip_pvt_ptr; sip_pvt_ptr = sip_pvt_ptr->next) {
+	for (sip_pvt_ptr = dialog_find_callid(callid); sip_pvt_ptr; sip_pvt_ptr = sip_pvt_ptr->next_callid) {
 		if (!strcmp(sip_pvt_ptr->callid, callid)) {
 			int match = 1;
 			char *ourtag = sip_pvt_ptr->tag;
@@ -13025,6 +13166,10 @@ static char *sip_show_settings(struct ast_cli_entry *e, int cmd, struct ast_cli_
 	ast_cli(a->fd, "----------------\n");
 	ast_cli(a->fd, "  UDP SIP Port:           %d\n", ntohs(bindaddr.sin_port));
 	ast_cli(a->fd, "  UDP Bindaddress:        %s\n", ast_inet_ntoa(bindaddr.sin_addr));
+	if (sip_workers_count)
+		ast_cli(a->fd, "  UDP workers:            %d\n", sip_workers_count);
+	else
+		ast_cli(a->fd, "  UDP workers:            None (monitor thread)\n");
 	ast_cli(a->fd, "  TCP SIP Port:           ");
 	if (sip_tcp_desc.sin.sin_family == AF_INET) {
 		ast_cli(a->fd, "%d\n", ntohs(sip_tcp_desc.sin.sin_port));
@@ -18458,6 +18603,141 @@ static int handle_incoming(struct sip_pvt *p, struct sip_request *req, struct so
 	return res;
 }
 
+/*! \brief Hash of the Call-ID of a message that has not been parsed yet,
+ * to pick the worker thread for it.  0 if there is no Call-ID. */
+static unsigned int sip_raw_callid_hash(const char *data)
+{
+	const char *line, *c;
+	unsigned int hash;
+
+	for (line = data; *line && *line != '\r' && *line != '\n'; line = c + 1) {
+		if (!strncasecmp(line, "Call-ID", 7))
+			c = ast_skip_blanks(line + 7);
+		else if (*line == 'i' || *line == 'I')	/* compact form */
+			c = ast_skip_blanks(line + 1);
+		else
+			c = line;
+		if (*c == ':') {
+			for (hash = 5381, c = ast_skip_blanks(c + 1); *c > ' '; c++)
+				hash = hash * 33 ^ *c;
+			return hash;
+		}
+		if (!(c = strchr(c, '\n')))
+			break;
+	}
+
+	return 0;
+}
+
+/*! \brief Put a UDP message on the queue of the worker thread for its
+ * Call-ID, so the messages of a dialog are handled in the order they came */
+static void sip_worker_queue(struct sip_queued_req *q)
+{
+	struct sip_worker *w = &sip_workers[sip_raw_callid_hash(q->req.data) % sip_workers_count];
+
+	ast_mutex_lock(&w->lock);
+	if (w->queued >= SIP_WORKER_QUEUE_MAX) {
+		/* The sender will retransmit, if it is still interested */
+		if (!(w->dropped++ % SIP_WORKER_QUEUE_MAX))
+			ast_log(LOG_WARNING, "SIP worker thread has %d messages waiting, dropping new ones\n", w->queued);
+		ast_mutex_unlock(&w->lock);
+		ast_free(q);
+		return;
+	}
+	AST_LIST_INSERT_TAIL(&w->queue, q, list);
+	w->queued++;
+	ast_cond_signal(&w->cond);
+	ast_mutex_unlock(&w->lock);
+}
+
+static void *sip_worker_thread(void *data)
+{
+	struct sip_worker *w = data;
+	struct sip_queued_req *q;
+	struct ast_udp_batch *batch = ast_udp_batch_create();
+	struct timeval flushed = ast_tvnow();
+
+	/* Queue what we send while there are messages waiting for us */
+	ast_udp_batch_use(batch);
+	for (;;) {
+		ast_mutex_lock(&w->lock);
+		if (AST_LIST_EMPTY(&w->queue) && !w->stop) {
+			ast_mutex_unlock(&w->lock);
+			ast_udp_batch_flush();
+			flushed = ast_tvnow();
+			ast_mutex_lock(&w->lock);
+		}
+		while (!(q = AST_LIST_REMOVE_HEAD(&w->queue, list)) && !w->stop)
+			ast_cond_wait(&w->cond, &w->lock);
+		if (q)
+			w->queued--;
+		ast_mutex_unlock(&w->lock);
+		/* Only stop once the queue is empty */
+		if (!q)
+			break;
+		handle_request_do(&q->req, &q->sin);
+		ast_free(q);
+		/* Under load the queue may not run dry for a while; don't hold
+		   replies back for long meanwhile */
+		if (ast_tvdiff_ms(ast_tvnow(), flushed) >= SIP_WORKER_FLUSH_MS) {
+			ast_udp_batch_flush();
+			flushed = ast_tvnow();
+		}
+	}
+	ast_udp_batch_use(NULL);
+	if (batch)
+		ast_udp_batch_destroy(batch);
+
+	return NULL;
+}
+
+/*! \brief Start count worker threads for UDP messages; with none, the
+ * monitor thread handles them as it reads them */
+static void sip_workers_start(int count)
+{
+	int i;
+
+	if (!count || !(sip_workers = ast_calloc(count, sizeof(*sip_workers))))
+		return;
+	for (i = 0; i < count; i++) {
+		ast_mutex_init(&sip_workers[i].lock);
+		ast_cond_init(&sip_workers[i].cond, NULL);
+		if (ast_pthread_create(&sip_workers[i].thread, NULL, sip_worker_thread, &sip_workers[i])) {
+			ast_log(LOG_WARNING, "Unable to start SIP worker thread %d of %d\n", i + 1, count);
+			ast_cond_destroy(&sip_workers[i].cond);
+			ast_mutex_destroy(&sip_workers[i].lock);
+			break;
+		}
+	}
+	if (!(sip_workers_count = i)) {
+		ast_free(sip_workers);
+		sip_workers = NULL;
+	} else
+		ast_verb(3, "Handling SIP UDP messages in %d worker thread%s\n", i, ESS(i));
+}
+
+/*! \brief Stop the worker threads, once they have handled what they have queued */
+static void sip_workers_stop(void)
+{
+	int i;
+
+	for (i = 0; i < sip_workers_count; i++) {
+		ast_mutex_lock(&sip_workers[i].lock);
+		sip_workers[i].stop = 1;
+		ast_cond_signal(&sip_workers[i].cond);
+		ast_mutex_unlock(&sip_workers[i].lock);
+	}
+	for (i = 0; i < sip_workers_count; i++) {
+		pthread_join(sip_workers[i].thread, NULL);
+		ast_cond_destroy(&sip_workers[i].cond);
+		ast_mutex_destroy(&sip_workers[i].lock);
+	}
+	if (sip_workers)
+		ast_free(sip_workers);
+	sip_workers = NULL;
+	sip_workers_count = 0;
+}
+
 /*! \brief Read data from SIP socket
 \note sipsock_read locks the owner channel while we are processing the SIP message
 \return 1 on error, 0 on success
@@ -18465,14 +18745,24 @@ static int handle_incoming(struct sip_pvt *p, struct sip_request *req, struct so
 */
 static int sipsock_read(int *id, int fd, short events, void *ignore)
 {
-	struct sip_request req;
-	struct sockaddr_in sin = { 0, };
-	int res;
-	socklen_t len = sizeof(sin);
+	struct ast_udp_msg msgs[SIP_READ_MAX];
+	struct sip_queued_req *q;
+	int i, res, count;
 
-	memset(&req, 0, sizeof(req));
-	res = recvfrom(fd, req.data, sizeof(req.data) - 1, 0, (struct sockaddr *)&sin, &len);
-	if (res < 0) {
+	/* Read all that is waiting (up to a limit) with one call.  With worker
+	   threads the messages go straight into their queues, so the monitor
+	   thread goes round its loop once per batch of messages instead of once
+	   per message */
+	for (count = 0; count < SIP_READ_MAX; count++) {
+		if (!sip_read_bufs[count] && !(sip_read_bufs[count] = ast_calloc(1, sizeof(*q))))
+			break;
+		msgs[count].buf = sip_read_bufs[count]->req.data;
+		msgs[count].size = sizeof(sip_read_bufs[count]->req.data) - 1;
+	}
+	if (!count)
+		return 1;
+
+	if ((res = ast_udp_recv(fd, msgs, count, 0)) < 0) {
 #if !defined(__FreeBSD__)
 		if (errno == EAGAIN)
 			ast_log(LOG_NOTICE, "SIP: Received packet with bad UDP checksum\n");
@@ -18482,18 +18772,29 @@ static int sipsock_read(int *id, int fd, short events, void *ignore)
 			ast_log(LOG_WARNING, "Recv error: %s\n", strerror(errno));
 		return 1;
 	}
-	if (res == sizeof(req.data) - 1)
-		ast_debug(1, "Received packet exceeds buffer. Data is possibly lost\n");
 
-	req.data[res] = '\0';
-	req.len = res;
+	for (i = 0; i < res; i++) {
+		q = sip_read_bufs[i];
+		if (msgs[i].len == sizeof(q->req.data) - 1)
+			ast_debug(1, "Received packet exceeds buffer. Data is possibly lost\n");
 
-	req.socket.fd 	= sipsock;
-	req.socket.type = SIP_TRANSPORT_UDP;
-	req.socket.ser	= NULL;
-	req.socket.port = bindaddr.sin_port;
+		q->req.data[msgs[i].len] = '\0';
+		q->req.len = msgs[i].len;
+		q->sin = msgs[i].sin;
 
-	handle_request_do(&req, &sin);
+		q->req.socket.fd 	= sipsock;
+		q->req.socket.type = SIP_TRANSPORT_UDP;
+		q->req.socket.ser	= NULL;
+		q->req.socket.port = bindaddr.sin_port;
+
+		if (sip_workers_count) {
+			sip_read_bufs[i] = NULL;
+			sip_worker_queue(q);
+		} else {
+			handle_request_do(&q->req, &q->sin);
+			memset(q, 0, sizeof(*q));
+		}
+	}
 
 	return 1;
 }
@@ -18528,15 +18829,18 @@ static int handle_request_do(struct sip_request *req, struct sockaddr_in *sin)
 	if (req->headers < 2)	/* Must have at least two headers */
 		return 1;
 
-	/* Process request, with netlock held, and with usual deadlock avoidance */
+	/* Process request with the dialog locked, and with usual deadlock
+	   avoidance.  netlock is only held to find the dialog, so that two
+	   threads cannot create the same one; the worker threads, and the TCP
+	   threads, handle messages of different dialogs in parallel */
 	for (lockretry = 100; lockretry > 0; lockretry--) {
 		ast_mutex_lock(&netlock);
 
 		/* Find the active SIP dialog or create a new one */
 		p = find_call(req, sin, req->method);	/* returns p locked */
+		ast_mutex_unlock(&netlock);
 		if (p == NULL) {
 			ast_debug(1, "Invalid SIP message - rejected , no callid, len %d\n", req->len);
-			ast_mutex_unlock(&netlock);
 			return 1;
 		}
 
@@ -18548,7 +18852,6 @@ static int handle_request_do(struct sip_request *req, struct sockaddr_in *sin)
 			break;	/* locking succeeded */
 		ast_debug(1, "Failed to grab owner channel lock, trying again. (SIP call %s)\n", p->callid);
 		sip_pvt_unlock(p);
-		ast_mutex_unlock(&netlock);
 		/* Sleep for a very short amount of time */
 		usleep(1);
 	}
@@ -18580,7 +18883,6 @@ static int handle_request_do(struct sip_request *req, struct sockaddr_in *sin)
 	if (p->owner && !nounlock)
 		ast_channel_unlock(p->owner);
 	sip_pvt_unlock(p);
-	ast_mutex_unlock(&netlock);
 
 	return 1;
 }
@@ -18900,6 +19202,11 @@ static void *do_monitor(void *data)
 	/* Add an I/O event to our SIP UDP socket */
 	if (sipsock > -1) 
 		sipsock_read_id = ast_io_add(io, sipsock, sipsock_read, AST_IO_IN, NULL);
+
+	/* Queue what we send over UDP while going round the loop */
+	if (!monitor_batch)
+		monitor_batch = ast_udp_batch_create();
+	ast_udp_batch_use(monitor_batch);
 	
 	/* From here on out, we die whenever asked */
 	for(;;) {
@@ -18910,6 +19217,8 @@ static void *do_monitor(void *data)
 		ast_mutex_unlock(&sip_reload_lock);
 		if (reloading) {
 			ast_verb(1, "Reloading SIP\n");
+			/* The reload may close the socket it was queued for */
+			ast_udp_batch_flush();
 			sip_do_reload(sip_reloadreason);
 
 			/* Change the I/O fd of our UDP socket */
@@ -18955,6 +19264,8 @@ restartsearch:
 		}
 		dialoglist_unlock();
 
+		/* Send what the dialog walk queued before waiting */
+		ast_udp_batch_flush();
 		pthread_testcancel();
 		/* Wait for sched or io */
 		res = ast_sched_wait(sched);
@@ -18970,6 +19281,8 @@ restartsearch:
 				ast_debug(1, "chan_sip: ast_sched_runq ran %d all at once\n", res);
 		}
 		ast_mutex_unlock(&monlock);
+		/* Send the replies to what was read before walking the dialogs */
+		ast_udp_batch_flush();
 	}
 
 	/* Never reached */
@@ -20851,6 +21164,7 @@ static int reload_config(enum channelreloadreason reason)
 	global_timer_b = 64 * SIP_TIMER_T1;
 	global_t1min = DEFAULT_T1MIN;
 	global_qualifyfreq = DEFAULT_QUALIFYFREQ;
+	global_udpworkers = DEFAULT_UDPWORKERS;
 
 	global_matchexterniplocally = FALSE;
 
@@ -20908,6 +21222,11 @@ static int reload_config(enum channelreloadreason reason)
 			global_timer_b = global_t1 * 64;
 		} else if (!strcasecmp(v->name, "t1min")) {
 			global_t1min = atoi(v->value);
+		} else if (!strcasecmp(v->name, "udpworkers")) {
+			if (sscanf(v->value, "%d", &global_udpworkers) != 1 || global_udpworkers < 0) {
+				ast_log(LOG_WARNING, "Invalid udpworkers '%s' at line %d of %s, handling UDP in the monitor thread\n", v->value, v->lineno, config);
+				global_udpworkers = 0;
+			}
 		} else if (!strcasecmp(v->name, "tcpenable")) {
 			sip_tcp_desc.sin.sin_family = ast_false(v->value) ? 0 : AF_INET;
 			ast_debug(2, "Enabling TCP socket for listening\n");
@@ -21933,7 +22252,10 @@ static void sip_send_all_registers(void)
 /*! \brief Reload module */
 static int sip_do_reload(enum channelreloadreason reason)
 {
+	/* Let the workers finish what they have queued before anything changes */
+	sip_workers_stop();
 	reload_config(reason);
+	sip_workers_start(global_udpworkers);
 
 	/* Prune peers who still are supposed to be deleted */
 	ASTOBJ_CONTAINER_PRUNE_MARKED(&peerl, sip_destroy_peer);
@@ -22022,6 +22344,11 @@ static int load_module(void)
 		ast_log(LOG_ERROR, "Unable to create scheduler context\n");
 		return AST_MODULE_LOAD_FAILURE;
 	}
+	sched_context_set_name(sched, "chan_sip");
+	/* Thousands of peers mean thousands of qualify and registration timers,
+	   none of which need to be more precise than the tick */
+	if (sched_context_set_wheel(sched, SIP_SCHED_TICK))
+		ast_log(LOG_WARNING, "Unable to put the SIP timers on a timing wheel, keeping them in a heap\n");
 
 	if (!(io = io_context_create())) {
 		ast_log(LOG_ERROR, "Unable to create I/O context\n");
@@ -22078,6 +22405,8 @@ static int load_module(void)
 	sip_poke_all_peers();	
 	sip_send_all_registers();
 	
+	sip_workers_start(global_udpworkers);
+
 	/* And start the monitor for the first time */
 	restart_monitor();
 
@@ -22090,6 +22419,7 @@ static int unload_module(void)
 	struct sip_pvt *p, *pl;
 	struct sip_threadinfo *th;
 	struct ast_context *con;
+	int i;
 	
 	/* First, take us out of the channel type list */
 	ast_channel_unregister(&sip_tech);
@@ -22154,6 +22484,16 @@ static int unload_module(void)
 	monitor_thread = AST_PTHREADT_STOP;
 	ast_mutex_unlock(&monlock);
 
+	sip_workers_stop();
+	for (i = 0; i < SIP_READ_MAX; i++) {
+		if (sip_read_bufs[i])
+			ast_free(sip_read_bufs[i]);
+		sip_read_bufs[i] = NULL;
+	}
+	if (monitor_batch)
+		ast_udp_batch_destroy(monitor_batch);
+	monitor_batch = NULL;
+
 restartdestroy:
 	dialoglist_lock();
 	/* Destroy all the dialogs and free their memory */
@@ -22163,13 +22503,16 @@ restartdestroy:
 		p = p->next;
 		if (__sip_destroy(pl, TRUE, TRUE) < 0) {
 			/* Something is still bridged, let it react to getting a hangup */
-			dialoglist = p;
+			dialog_unlink(pl);
 			dialoglist_unlock();
 			usleep(1);
 			goto restartdestroy;
 		}
 	}
-	dialoglist = NULL;
+	if (dialog_hash != dialog_hash_initial)
+		ast_free(dialog_hash);
+	dialog_hash = dialog_hash_initial;
+	dialog_hashsize = DIALOG_HASH_INITIAL;
 	dialoglist_unlock();
 
 	/* Free memory for local network address mask */
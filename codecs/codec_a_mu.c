@@ -74,6 +74,32 @@ static int ulawtoalaw_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	return 0;
 }
 
+/*! \brief convert a whole buffer, for ast_translate_batch() */
+static int alawtoulaw_framein_batch(struct ast_trans_pvt *pvt, void *out, const void *in, int samples)
+{
+	const unsigned char *src = in;
+	unsigned char *dst = out;
+	int x;
+
+	for (x = 0; x < samples; x++)
+		dst[x] = a2mu[src[x]];
+
+	return samples;
+}
+
+/*! \brief convert a whole buffer, for ast_translate_batch() */
+static int ulawtoalaw_framein_batch(struct ast_trans_pvt *pvt, void *out, const void *in, int samples)
+{
+	const unsigned char *src = in;
+	unsigned char *dst = out;
+	int x;
+
+	for (x = 0; x < samples; x++)
+		dst[x] = mu2a[src[x]];
+
+	return samples;
+}
+
 /*
  * alawToLin_Sample. Just random data, somehow...
  */
@@ -110,6 +136,7 @@ static struct ast_translator alawtoulaw = {
 	.srcfmt = AST_FORMAT_ALAW,
 	.dstfmt = AST_FORMAT_ULAW,
 	.framein = alawtoulaw_framein,
+	.framein_batch = alawtoulaw_framein_batch,
 	.sample = alawtoulaw_sample,
 	.buffer_samples = BUFFER_SAMPLES,
 	.buf_size = BUFFER_SAMPLES,
@@ -120,6 +147,7 @@ static struct ast_translator ulawtoalaw = {
 	.srcfmt = AST_FORMAT_ULAW,
 	.dstfmt = AST_FORMAT_ALAW,
 	.framein = ulawtoalaw_framein,
+	.framein_batch = ulawtoalaw_framein_batch,
 	.sample = ulawtoalaw_sample,
 	.buffer_samples = BUFFER_SAMPLES,
 	.buf_size = BUFFER_SAMPLES,
@@ -50,8 +50,7 @@ static int alawtolin_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	pvt->samples += i;
 	pvt->datalen += i * 2;	/* 2 bytes/sample */
 	
-	while (i--)
-		*dst++ = AST_ALAW(*src++);
+	ast_alaw_decode(dst, src, i);
 
 	return 0;
 }
@@ -66,12 +65,27 @@ static int lintoalaw_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	pvt->samples += i;
 	pvt->datalen += i;	/* 1 byte/sample */
 
-	while (i--) 
-		*dst++ = AST_LIN2A(*src++);
+	ast_alaw_encode((unsigned char *) dst, src, i);
 
 	return 0;
 }
 
+/*! \brief convert a whole buffer, for ast_translate_batch() */
+static int alawtolin_framein_batch(struct ast_trans_pvt *pvt, void *out, const void *in, int samples)
+{
+	ast_alaw_decode(out, in, samples);
+
+	return samples;
+}
+
+/*! \brief convert a whole buffer, for ast_translate_batch() */
+static int lintoalaw_framein_batch(struct ast_trans_pvt *pvt, void *out, const void *in, int samples)
+{
+	ast_alaw_encode(out, in, samples);
+
+	return samples;
+}
+
 /*! \brief alawToLin_Sample */
 static struct ast_frame *alawtolin_sample(void)
 {
@@ -107,6 +121,7 @@ static struct ast_translator alawtolin = {
 	.srcfmt = AST_FORMAT_ALAW,
 	.dstfmt = AST_FORMAT_SLINEAR,
 	.framein = alawtolin_framein,
+	.framein_batch = alawtolin_framein_batch,
 	.sample = alawtolin_sample,
 	.buffer_samples = BUFFER_SAMPLES,
 	.buf_size = BUFFER_SAMPLES * 2,
@@ -118,6 +133,7 @@ static struct ast_translator lintoalaw = {
 	.srcfmt = AST_FORMAT_SLINEAR,
 	.dstfmt = AST_FORMAT_ALAW,
 	.framein = lintoalaw_framein,
+	.framein_batch = lintoalaw_framein_batch,
 	.sample = lintoalaw_sample,
 	.buffer_samples = BUFFER_SAMPLES,
 	.buf_size = BUFFER_SAMPLES,
@@ -189,6 +189,41 @@ static struct ast_frame *lintogsm_frameout(struct ast_trans_pvt *pvt)
 	return ast_trans_frameout(pvt, datalen, samples);
 }
 
+/*! \brief decode a whole buffer of 33 byte GSM frames, for ast_translate_batch() */
+static int gsmtolin_framein_batch(struct ast_trans_pvt *pvt, void *out, const void *in, int samples)
+{
+	struct gsm_translator_pvt *tmp = pvt->pvt;
+	const unsigned char *src = in;
+	int16_t *dst = out;
+	int x;
+
+	for (x = 0; x < samples; x += GSM_SAMPLES) {
+		if (gsm_decode(tmp->gsm, (gsm_byte *) src, dst + x)) {
+			ast_log(LOG_WARNING, "Invalid GSM data\n");
+			return -1;
+		}
+		src += GSM_FRAME_LEN;
+	}
+
+	return samples;
+}
+
+/*! \brief encode a whole buffer into 33 byte GSM frames, for ast_translate_batch() */
+static int lintogsm_framein_batch(struct ast_trans_pvt *pvt, void *out, const void *in, int samples)
+{
+	struct gsm_translator_pvt *tmp = pvt->pvt;
+	const int16_t *src = in;
+	gsm_byte *dst = out;
+	int x;
+
+	for (x = 0; x < samples; x += GSM_SAMPLES) {
+		gsm_encode(tmp->gsm, (gsm_signal *) src + x, dst);
+		dst += GSM_FRAME_LEN;
+	}
+
+	return samples;
+}
+
 static void gsm_destroy_stuff(struct ast_trans_pvt *pvt)
 {
 	struct gsm_translator_pvt *tmp = pvt->pvt;
@@ -202,6 +237,8 @@ static struct ast_translator gsmtolin = {
 	.dstfmt = AST_FORMAT_SLINEAR,
 	.newpvt = gsm_new,
 	.framein = gsmtolin_framein,
+	.framein_batch = gsmtolin_framein_batch,
+	.batch_samples = GSM_SAMPLES,
 	.destroy = gsm_destroy_stuff,
 	.sample = gsmtolin_sample,
 	.buffer_samples = BUFFER_SAMPLES,
@@ -217,6 +254,8 @@ static struct ast_translator lintogsm = {
 	.newpvt = gsm_new,
 	.framein = lintogsm_framein,
 	.frameout = lintogsm_frameout,
+	.framein_batch = lintogsm_framein_batch,
+	.batch_samples = GSM_SAMPLES,
 	.destroy = gsm_destroy_stuff,
 	.sample = lintogsm_sample,
 	.desc_size = sizeof (struct gsm_translator_pvt ),
@@ -51,8 +51,7 @@ static int ulawtolin_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	pvt->datalen += i * 2;	/* 2 bytes/sample */
 
 	/* convert and copy in outbuf */
-	while (i--)
-		*dst++ = AST_MULAW(*src++);
+	ast_ulaw_decode(dst, src, i);
 
 	return 0;
 }
@@ -67,12 +66,27 @@ static int lintoulaw_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	pvt->samples += i;
 	pvt->datalen += i;	/* 1 byte/sample */
 
-	while (i--)
-		*dst++ = AST_LIN2MU(*src++);
+	ast_ulaw_encode((unsigned char *) dst, src, i);
 
 	return 0;
 }
 
+/*! \brief convert a whole buffer, for ast_translate_batch() */
+static int ulawtolin_framein_batch(struct ast_trans_pvt *pvt, void *out, const void *in, int samples)
+{
+	ast_ulaw_decode(out, in, samples);
+
+	return samples;
+}
+
+/*! \brief convert a whole buffer, for ast_translate_batch() */
+static int lintoulaw_framein_batch(struct ast_trans_pvt *pvt, void *out, const void *in, int samples)
+{
+	ast_ulaw_encode(out, in, samples);
+
+	return samples;
+}
+
 /*!  * \brief ulawToLin_Sample */
 static struct ast_frame *ulawtolin_sample(void)
 {
@@ -116,6 +130,7 @@ static struct ast_translator ulawtolin = {
 	.srcfmt = AST_FORMAT_ULAW,
 	.dstfmt = AST_FORMAT_SLINEAR,
 	.framein = ulawtolin_framein,
+	.framein_batch = ulawtolin_framein_batch,
 	.sample = ulawtolin_sample,
 	.buffer_samples = BUFFER_SAMPLES,
 	.buf_size = BUFFER_SAMPLES * 2,
@@ -131,6 +146,7 @@ static struct ast_translator lintoulaw = {
 	.srcfmt = AST_FORMAT_SLINEAR,
 	.dstfmt = AST_FORMAT_ULAW,
 	.framein = lintoulaw_framein,
+	.framein_batch = lintoulaw_framein_batch,
 	.sample = lintoulaw_sample,
 	.buf_size = BUFFER_SAMPLES,
 	.buffer_samples = BUFFER_SAMPLES,
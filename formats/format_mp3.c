@@ -0,0 +1,908 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief MPEG-1 Layer 3 streams, decoded in-process with libmpg123.
+ * \arg File name extension: mp3
+ *
+ * Files are decoded, downmixed and resampled to 8kHz signed linear as
+ * they are read, so playback needs neither an external mpg123 process
+ * nor a pipe.  Writing MP3 files is not supported.
+ *
+ * Decoded audio is kept in a process-wide cache, keyed by the file's
+ * identity and modification time and bounded by an LRU memory cap
+ * (see mp3.conf), so files played over and over are only decoded once.
+ * The first play of a file starts a thread that decodes it into the cache
+ * while playback reads what has been decoded so far; anyone else opening
+ * the file meanwhile plays from the same entry.  Files whose length says
+ * they are too big for the cache are never decoded into it; one that turns
+ * out too big while being decoded is remembered as such, and its players
+ * go on decoding it themselves.
+ * Files played without the cache seek with the index in their .idx file,
+ * which jumps to the right frame instead of decoding up to it.  A file
+ * without one has it built and saved in the background the first time it
+ * is opened, never on the channel's thread.
+ * \ingroup formats
+ */
+
+/*** MODULEINFO
+	<depend>mpg123</depend>
+ ***/
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <mpg123.h>
+
+#include "asterisk/mod_format.h"
+#include "asterisk/module.h"
+#include "asterisk/config.h"
+#include "asterisk/cli.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/linkedlists.h"
+#include "asterisk/mp3.h"
+
+/*
+ * this is the number of samples we deal with. Samples are converted
+ * to SLINEAR so each one uses 2 bytes in the buffer.
+ */
+#define SAMPLES_MAX 160
+#define	BUF_SIZE	(2*SAMPLES_MAX)
+
+/*! Growth step of the buffer a file is decoded into, in samples */
+#define DECODE_CHUNK	(32 * 1024)
+
+/*! MP3 data fed to the decoding thread's decoder at a time */
+#define FEED_CHUNK	(16 * 1024)
+
+/*! Longest a stream waits for the decoding thread before decoding the
+ * file itself, in ms */
+#define CACHE_WAIT	200
+
+/*! Growth step of the decoder's frame index, in frames */
+#define INDEX_STEP	1000
+
+/*! Default limit on decoded audio held in the cache, in kilobytes */
+#define DEFAULT_CACHE_SIZE	8192
+
+static const char config[] = "mp3.conf";
+
+/*! \brief Decoded audio of one MP3 file, shared by every stream playing it */
+struct mp3_cache_entry {
+	dev_t dev;		/*!< Identity of the source file... */
+	ino_t ino;
+	time_t mtime;		/*!< ...and the version of it that was decoded */
+	off_t size;
+	off_t estimate;		/*!< Samples expected, going by the file's length */
+	const unsigned char *map;	/*!< The file, for the decoding thread */
+	ast_mutex_t lock;	/*!< Protects the fields below it */
+	ast_cond_t cond;	/*!< Signalled as audio is decoded, and when it is done */
+	size_t samples;		/*!< Number of 8kHz samples in data so far */
+	size_t alloced;		/*!< Room in data, in samples */
+	short *data;
+	unsigned int done:1;	/*!< Decoding is over */
+	unsigned int failed:1;	/*!< The audio is not cached: too big, or undecodable */
+	/* These are protected by the mp3_cache list lock */
+	size_t bytes;		/*!< What the entry counts for in cache_bytes */
+	int listed;		/*!< Whether the entry is in the cache */
+	int filling;		/*!< Whether it is still being decoded into */
+	AST_LIST_ENTRY(mp3_cache_entry) list;
+};
+
+/*! Cached files, most recently used first */
+static AST_LIST_HEAD_STATIC(mp3_cache, mp3_cache_entry);
+
+/* All of these are protected by the mp3_cache list lock */
+static size_t cache_max = DEFAULT_CACHE_SIZE * 1024;
+static size_t cache_bytes;
+static unsigned int cache_hits;
+static unsigned int cache_misses;
+static unsigned int cache_evictions;
+/*! Decoding threads running */
+static int decoding;
+/*! Signalled when a decoding thread is done */
+static ast_cond_t decoding_cond;
+
+struct mp3_desc {	/* format specific parameters */
+	/*! \brief The libmpg123 decoder handle, when decoding from the file. */
+	mpg123_handle *mh;
+	/*! \brief The cached audio, when playing from memory. */
+	struct mp3_cache_entry *cached;
+	/*! \brief Current position in the cached audio, in samples. */
+	size_t pos;
+	/*! \brief Length of the audio in samples, if known from an index. */
+	off_t samples;
+};
+
+static void cache_entry_destructor(void *obj)
+{
+	struct mp3_cache_entry *entry = obj;
+
+	if (entry->data)
+		ast_free(entry->data);
+	ast_mutex_destroy(&entry->lock);
+	ast_cond_destroy(&entry->cond);
+}
+
+/*! \brief Take an entry out of the cache.
+ * \note Must be called with the cache locked. */
+static void cache_remove(struct mp3_cache_entry *entry)
+{
+	AST_LIST_REMOVE(&mp3_cache, entry, list);
+	entry->listed = 0;
+	cache_bytes -= entry->bytes;
+	entry->bytes = 0;
+	ao2_ref(entry, -1);
+}
+
+/*! \brief Drop the least recently used entries until the cache fits its cap,
+ * or all of them if the cache is off.
+ * \note Must be called with the cache locked. */
+static void cache_trim(void)
+{
+	struct mp3_cache_entry *entry;
+
+	while ((cache_bytes > cache_max || !cache_max) && (entry = mp3_cache.last)) {
+		cache_remove(entry);
+		cache_evictions++;
+	}
+}
+
+/*! \brief Find a file in the cache.  Must be called with the cache locked.
+ * \return the entry, moved to the front, or NULL */
+static struct mp3_cache_entry *cache_lookup(const struct stat *st)
+{
+	struct mp3_cache_entry *entry;
+
+	AST_LIST_TRAVERSE(&mp3_cache, entry, list) {
+		if (entry->dev == st->st_dev && entry->ino == st->st_ino)
+			break;
+	}
+	if (!entry)
+		return NULL;
+	if (entry->mtime != st->st_mtime || entry->size != st->st_size) {
+		/* The file has changed since it was decoded */
+		cache_remove(entry);
+		return NULL;
+	}
+	AST_LIST_REMOVE(&mp3_cache, entry, list);
+	AST_LIST_INSERT_HEAD(&mp3_cache, entry, list);
+
+	return entry;
+}
+
+/*!
+ * \brief Look up the decoded audio of a file.
+ * \return a reference to the cache entry, or NULL if the file (or this
+ * version of it) is not being decoded nor has been.
+ */
+static struct mp3_cache_entry *cache_find(const struct stat *st)
+{
+	struct mp3_cache_entry *found;
+
+	AST_LIST_LOCK(&mp3_cache);
+	if ((found = cache_lookup(st))) {
+		ao2_ref(found, +1);
+		cache_hits++;
+	} else
+		cache_misses++;
+	AST_LIST_UNLOCK(&mp3_cache);
+
+	return found;
+}
+
+/*! \brief Set up a decoder that produces 8kHz signed linear */
+static mpg123_handle *decoder_new(void)
+{
+	mpg123_handle *mh;
+	int err = MPG123_OK;
+
+	if (!(mh = mpg123_new(NULL, &err))) {
+		ast_log(LOG_ERROR, "Unable to create MP3 decoder: %s\n", mpg123_plain_strerror(err));
+		return NULL;
+	}
+
+	/* Let the decoder do the downmix and the resampling, so that every
+	 * sample it hands out is ready to go in a SLINEAR frame. */
+	mpg123_param(mh, MPG123_FLAGS, MPG123_MONO_MIX | MPG123_QUIET, 0);
+	mpg123_param(mh, MPG123_FORCE_RATE, DEFAULT_SAMPLE_RATE, 0);
+	/* A negative size lets the index grow to cover every frame */
+	mpg123_param(mh, MPG123_INDEX_SIZE, -INDEX_STEP, 0);
+	mpg123_format_none(mh);
+	if (mpg123_format(mh, DEFAULT_SAMPLE_RATE, MPG123_MONO, MPG123_ENC_SIGNED_16) != MPG123_OK) {
+		ast_log(LOG_ERROR, "MP3 decoder cannot produce 8kHz signed linear: %s\n", mpg123_strerror(mh));
+		mpg123_delete(mh);
+		return NULL;
+	}
+
+	return mh;
+}
+
+/*!
+ * \brief Count more memory of an entry being decoded toward the cache,
+ * dropping the least recently used files already decoded to make room.
+ *
+ * An entry that does not fit beside the others being decoded is taken
+ * out of the cache, so that a later play can try again.  One that does
+ * not fit on its own stays in the cache, to be remembered as too big.
+ *
+ * \retval -1 if there is no room for it
+ */
+static int cache_reserve(struct mp3_cache_entry *entry, size_t bytes)
+{
+	struct mp3_cache_entry *cur, *victim;
+	int res = 0;
+
+	AST_LIST_LOCK(&mp3_cache);
+	if (!entry->listed || entry->bytes + bytes > cache_max) {
+		AST_LIST_UNLOCK(&mp3_cache);
+		return -1;
+	}
+	while (cache_bytes + bytes > cache_max) {
+		victim = NULL;
+		AST_LIST_TRAVERSE(&mp3_cache, cur, list) {
+			if (!cur->filling)
+				victim = cur;
+		}
+		if (!victim) {
+			cache_remove(entry);
+			res = -1;
+			break;
+		}
+		cache_remove(victim);
+		cache_evictions++;
+	}
+	if (!res) {
+		entry->bytes += bytes;
+		cache_bytes += bytes;
+	}
+	AST_LIST_UNLOCK(&mp3_cache);
+
+	return res;
+}
+
+/*!
+ * \brief Add decoded audio to an entry and wake up whoever waits for it.
+ * \retval -1 if it would not fit in the cache
+ */
+static int cache_append(struct mp3_cache_entry *entry, const unsigned char *buf, size_t bytes)
+{
+	size_t grow, samples = bytes / sizeof(*entry->data);
+	short *tmp;
+	int res = -1;
+
+	ast_mutex_lock(&entry->lock);
+	if (entry->samples + samples > entry->alloced) {
+		grow = MAX(samples, DECODE_CHUNK);
+		/* Memory is counted as it is taken, not once decoding is over */
+		if (cache_reserve(entry, grow * sizeof(*tmp)))
+			goto done;
+		if (!(tmp = ast_realloc(entry->data, (entry->alloced + grow) * sizeof(*tmp))))
+			goto done;
+		entry->data = tmp;
+		entry->alloced += grow;
+	}
+	memcpy(entry->data + entry->samples, buf, samples * sizeof(*entry->data));
+	entry->samples += samples;
+	ast_cond_broadcast(&entry->cond);
+	res = 0;
+done:
+	ast_mutex_unlock(&entry->lock);
+
+	return res;
+}
+
+/*! \brief Mark the decoding of an entry done, and count what it ended up
+ * holding toward the cache.  Drops the decoding thread's reference. */
+static void cache_finish(struct mp3_cache_entry *entry, int failed)
+{
+	short *tmp;
+
+	ast_mutex_lock(&entry->lock);
+	if (failed || !entry->samples) {
+		/* Kept, empty, so the file is not decoded again until it changes */
+		if (entry->data)
+			ast_free(entry->data);
+		entry->data = NULL;
+		entry->samples = entry->alloced = 0;
+		entry->failed = 1;
+	} else if ((tmp = ast_realloc(entry->data, entry->samples * sizeof(*tmp)))) {
+		/* Give back the slack of the last chunk */
+		entry->data = tmp;
+		entry->alloced = entry->samples;
+	}
+	entry->done = 1;
+	ast_cond_broadcast(&entry->cond);
+	ast_mutex_unlock(&entry->lock);
+
+	AST_LIST_LOCK(&mp3_cache);
+	entry->filling = 0;
+	if (entry->listed) {
+		cache_bytes -= entry->bytes;
+		entry->bytes = entry->alloced * sizeof(*entry->data);
+		cache_bytes += entry->bytes;
+		cache_trim();
+	}
+	ao2_ref(entry, -1);
+	decoding--;
+	ast_cond_broadcast(&decoding_cond);
+	AST_LIST_UNLOCK(&mp3_cache);
+}
+
+/*! \brief Decode a whole file into its cache entry, from memory */
+static void *decode_thread(void *data)
+{
+	struct mp3_cache_entry *entry = data;
+	unsigned char buf[DECODE_CHUNK / 4];
+	mpg123_handle *mh;
+	size_t pos = 0, len, done;
+	int res = MPG123_NEED_MORE, failed = 1;
+
+	if ((mh = decoder_new()) && mpg123_open_feed(mh) == MPG123_OK) {
+		for (;;) {
+			if (res == MPG123_NEED_MORE) {
+				if (pos == (size_t) entry->size) {
+					/* All of it fed and decoded */
+					failed = 0;
+					break;
+				}
+				len = MIN(FEED_CHUNK, entry->size - pos);
+				if (mpg123_feed(mh, entry->map + pos, len) != MPG123_OK)
+					break;
+				pos += len;
+			}
+			done = 0;
+			res = mpg123_read(mh, buf, sizeof(buf), &done);
+			if (res != MPG123_OK && res != MPG123_NEW_FORMAT && res != MPG123_NEED_MORE && res != MPG123_DONE)
+				break;
+			if (done && cache_append(entry, buf, done))
+				break;
+			if (res == MPG123_DONE) {
+				failed = 0;
+				break;
+			}
+		}
+	}
+	if (mh)
+		mpg123_delete(mh);
+	munmap((void *) entry->map, entry->size);
+	entry->map = NULL;
+
+	cache_finish(entry, failed);
+
+	return NULL;
+}
+
+/*!
+ * \brief Start decoding a file into the cache, unless it is too big for it
+ * or someone else already started.
+ * \param st The file's status
+ * \param fd The file
+ * \param estimate Samples the audio is expected to have, or negative if unknown
+ * \return a reference to the cache entry to play from, or NULL
+ */
+static struct mp3_cache_entry *cache_start(const struct stat *st, int fd, off_t estimate)
+{
+	struct mp3_cache_entry *entry;
+	pthread_t thread;
+	void *map;
+
+	AST_LIST_LOCK(&mp3_cache);
+	if ((entry = cache_lookup(st))) {
+		ao2_ref(entry, +1);
+		AST_LIST_UNLOCK(&mp3_cache);
+		return entry;
+	}
+	if (estimate < 0 || (size_t) estimate * sizeof(*entry->data) > cache_max || !st->st_size) {
+		AST_LIST_UNLOCK(&mp3_cache);
+		return NULL;
+	}
+	if (!(entry = ao2_alloc(sizeof(*entry), cache_entry_destructor))) {
+		AST_LIST_UNLOCK(&mp3_cache);
+		return NULL;
+	}
+	ast_mutex_init(&entry->lock);
+	ast_cond_init(&entry->cond, NULL);
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->mtime = st->st_mtime;
+	entry->size = st->st_size;
+	entry->estimate = estimate;
+	if ((map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		AST_LIST_UNLOCK(&mp3_cache);
+		ao2_ref(entry, -1);
+		return NULL;
+	}
+	entry->map = map;
+
+	/* One reference for the cache, one for the thread and one for the caller */
+	ao2_ref(entry, +2);
+	AST_LIST_INSERT_HEAD(&mp3_cache, entry, list);
+	entry->listed = 1;
+	entry->filling = 1;
+	decoding++;
+	AST_LIST_UNLOCK(&mp3_cache);
+
+	if (ast_pthread_create_detached_background(&thread, NULL, decode_thread, entry)) {
+		ast_log(LOG_WARNING, "Unable to start MP3 decoding thread\n");
+		munmap(map, st->st_size);
+		entry->map = NULL;
+		/* Not worth remembering; the next play can try again */
+		AST_LIST_LOCK(&mp3_cache);
+		if (entry->listed)
+			cache_remove(entry);
+		AST_LIST_UNLOCK(&mp3_cache);
+		cache_finish(entry, 1);
+		ao2_ref(entry, -1);
+		return NULL;
+	}
+
+	return entry;
+}
+
+/*!
+ * \brief Give the decoder the index of the file from its .idx file.
+ *
+ * An exact index becomes the decoder's frame index.  A table of contents
+ * from a Xing or VBRI header is only approximate, so the decoder is told
+ * to seek with it (fuzzy seeking) rather than scan the file.
+ *
+ * \retval 1 if the file's index was found
+ * \retval 0 if not
+ */
+static int use_index(struct mp3_desc *tmp, int fd)
+{
+	struct ast_mp3_index *idx;
+	const struct ast_mp3_index_header *hdr;
+	const uint64_t *entries;
+	off_t *offsets;
+	uint32_t i;
+	int res = 1;
+
+	if (!(idx = ast_mp3_index_find(fd)))
+		return 0;
+	hdr = ast_mp3_index_header(idx);
+	entries = ast_mp3_index_entries(idx);
+
+	if (hdr->type == AST_MP3_INDEX_SCAN) {
+		if ((offsets = ast_malloc(hdr->entries * sizeof(*offsets)))) {
+			for (i = 0; i < hdr->entries; i++)
+				offsets[i] = entries[i];
+			res = (mpg123_set_index(tmp->mh, offsets, hdr->step, hdr->entries) == MPG123_OK);
+			ast_free(offsets);
+		} else
+			res = 0;
+	} else
+		mpg123_param(tmp->mh, MPG123_ADD_FLAGS, MPG123_FUZZY, 0);
+	if (res)
+		tmp->samples = (off_t) hdr->duration * DEFAULT_SAMPLE_RATE / 1000;
+	ao2_ref(idx, -1);
+
+	return res;
+}
+
+/*! \brief Open a decoder reading the file from the start */
+static int decoder_open(struct mp3_desc *tmp, int fd)
+{
+	if (!(tmp->mh = decoder_new()))
+		return -1;
+
+	if (lseek(fd, 0, SEEK_SET) < 0 || mpg123_open_fd(tmp->mh, fd) != MPG123_OK) {
+		ast_log(LOG_ERROR, "Input does not appear to be an MP3 stream: %s\n", mpg123_strerror(tmp->mh));
+		mpg123_delete(tmp->mh);
+		tmp->mh = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*! \brief Give a decoder that plays from the file the index of it */
+static void decoder_index(struct mp3_desc *tmp, int fd)
+{
+	/* Until the index is built, the decoder indexes the frames it has
+	 * played and estimates the length from the bit rate. */
+	if (!use_index(tmp, fd))
+		ast_mp3_index_queue(fd);
+}
+
+/*!
+ * \brief Play a stream that was playing from the cache with its own
+ * decoder, from where it was, as its file turned out not to fit or the
+ * decoding thread fell behind.
+ */
+static int uncache(struct ast_filestream *fs)
+{
+	struct mp3_desc *s = (struct mp3_desc *)fs->_private;
+
+	ao2_ref(s->cached, -1);
+	s->cached = NULL;
+	if (decoder_open(s, fileno(fs->f)))
+		return -1;
+	decoder_index(s, fileno(fs->f));
+	if (s->pos && mpg123_seek(s->mh, s->pos, SEEK_SET) < 0) {
+		ast_log(LOG_WARNING, "Unable to seek MP3 stream: %s\n", mpg123_strerror(s->mh));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Set up an MP3 filestream, from the cache if possible.
+ * \param s File that points to on disk storage of the MP3 data.
+ * \return 0 on success, -1 on error.
+ */
+static int mp3_open(struct ast_filestream *s)
+{
+	struct mp3_desc *tmp = (struct mp3_desc *)s->_private;
+	struct stat st;
+	int caching;
+
+	AST_LIST_LOCK(&mp3_cache);
+	caching = cache_max > 0;
+	AST_LIST_UNLOCK(&mp3_cache);
+
+	if (caching && fstat(fileno(s->f), &st))
+		caching = 0;
+	if (caching && (tmp->cached = cache_find(&st))) {
+		ast_mutex_lock(&tmp->cached->lock);
+		caching = !tmp->cached->failed;
+		ast_mutex_unlock(&tmp->cached->lock);
+		if (caching)
+			return 0;
+		/* Known not to fit */
+		ao2_ref(tmp->cached, -1);
+		tmp->cached = NULL;
+	}
+
+	if (decoder_open(tmp, fileno(s->f)))
+		return -1;
+
+	/* First play of this file: have it decoded into the cache, going by
+	 * the length the decoder expects, and play from there as it is. */
+	if (caching && (tmp->cached = cache_start(&st, fileno(s->f), mpg123_length(tmp->mh)))) {
+		mpg123_close(tmp->mh);
+		mpg123_delete(tmp->mh);
+		tmp->mh = NULL;
+		return 0;
+	}
+	if (caching && mpg123_seek(tmp->mh, 0, SEEK_SET) < 0) {
+		ast_log(LOG_ERROR, "Unable to rewind MP3 stream: %s\n", mpg123_strerror(tmp->mh));
+		mpg123_delete(tmp->mh);
+		tmp->mh = NULL;
+		return -1;
+	}
+
+	decoder_index(tmp, fileno(s->f));
+
+	return 0;
+}
+
+/*!
+ * \brief Copy cached audio from a stream's position, waiting (a while)
+ * for the decoding thread if it has not got that far yet.
+ * \param s The stream
+ * \param buf Where to copy it
+ * \param samples The most to copy; set to the number copied
+ * \retval -1 if the file turned out not to fit in the cache, or the
+ * decoding thread is too slow to keep up
+ */
+static int cache_read(struct mp3_desc *s, short *buf, size_t *samples)
+{
+	struct mp3_cache_entry *entry = s->cached;
+	struct timeval tv = ast_tvadd(ast_tvnow(), ast_samp2tv(CACHE_WAIT, 1000));
+	struct timespec ts;
+	size_t count = 0;
+	int behind = 0;
+
+	ts.tv_sec = tv.tv_sec;
+	ts.tv_nsec = tv.tv_usec * 1000;
+
+	ast_mutex_lock(&entry->lock);
+	while (!entry->done && entry->samples < s->pos + *samples && !behind)
+		behind = (ast_cond_timedwait(&entry->cond, &entry->lock, &ts) == ETIMEDOUT);
+	if (entry->failed || behind) {
+		ast_mutex_unlock(&entry->lock);
+		return -1;
+	}
+	if (s->pos < entry->samples) {
+		count = MIN(*samples, entry->samples - s->pos);
+		memcpy(buf, entry->data + s->pos, count * sizeof(*buf));
+	}
+	ast_mutex_unlock(&entry->lock);
+
+	s->pos += count;
+	*samples = count;
+
+	return 0;
+}
+
+/*!
+ * \brief Close an MP3 filestream.
+ * \param fs An MP3 filestream.
+ */
+static void mp3_close(struct ast_filestream *fs)
+{
+	struct mp3_desc *s = (struct mp3_desc *)fs->_private;
+
+	if (s->cached) {
+		ao2_ref(s->cached, -1);
+		s->cached = NULL;
+	}
+	if (s->mh) {
+		mpg123_close(s->mh);
+		mpg123_delete(s->mh);
+		s->mh = NULL;
+	}
+}
+
+/*!
+ * \brief Read a frame full of audio data from the filestream.
+ * \param fs The filestream.
+ * \param whennext Number of sample times to schedule the next call.
+ * \return A pointer to a frame containing audio data or NULL if there is no more audio data.
+ */
+static struct ast_frame *mp3_read(struct ast_filestream *fs, int *whennext)
+{
+	struct mp3_desc *s = (struct mp3_desc *)fs->_private;
+	size_t bytes_out = 0;
+	size_t done;
+	int res;
+
+	fs->fr.frametype = AST_FRAME_VOICE;
+	fs->fr.subclass = AST_FORMAT_SLINEAR;
+	fs->fr.mallocd = 0;
+	AST_FRAME_SET_BUFFER(&fs->fr, fs->buf, AST_FRIENDLY_OFFSET, BUF_SIZE);
+
+	if (s->cached) {
+		done = SAMPLES_MAX;
+		if (!cache_read(s, fs->fr.data, &done))
+			bytes_out = done * 2;
+		else if (uncache(fs))
+			return NULL;
+	}
+	if (!s->cached) {
+		while (bytes_out < BUF_SIZE) {
+			done = 0;
+			res = mpg123_read(s->mh, (unsigned char *)fs->fr.data + bytes_out, BUF_SIZE - bytes_out, &done);
+			bytes_out += done;
+			if (res == MPG123_NEW_FORMAT)
+				continue;
+			if (res != MPG123_OK) {
+				if (res != MPG123_DONE)
+					ast_log(LOG_WARNING, "Error decoding MP3 stream: %s\n", mpg123_strerror(s->mh));
+				break;
+			}
+		}
+	}
+
+	/* Never hand out half a sample */
+	bytes_out &= ~1;
+	if (!bytes_out)
+		return NULL;
+
+	fs->fr.datalen = bytes_out;
+	fs->fr.samples = bytes_out / 2;
+	*whennext = fs->fr.samples;
+
+	return &fs->fr;
+}
+
+static int mp3_write(struct ast_filestream *fs, struct ast_frame *f)
+{
+	ast_log(LOG_WARNING, "Writing is not supported on MP3 streams!\n");
+	return -1;
+}
+
+static int mp3_trunc(struct ast_filestream *fs)
+{
+	ast_log(LOG_WARNING, "Truncation is not supported on MP3 streams!\n");
+	return -1;
+}
+
+/*!
+ * \brief Seek to a specific position in an MP3 filestream.
+ * \param fs The filestream.
+ * \param sample_offset New position for the filestream, measured in 8kHz samples.
+ * \param whence Location to measure from, as for fseek().
+ * \return 0 on success, -1 on failure.
+ */
+static int mp3_seek(struct ast_filestream *fs, off_t sample_offset, int whence)
+{
+	struct mp3_desc *s = (struct mp3_desc *)fs->_private;
+	off_t max = 0;
+	int failed = 0;
+
+	if (s->cached) {
+		/* The length is only known once it has all been decoded */
+		ast_mutex_lock(&s->cached->lock);
+		max = s->cached->done ? s->cached->samples : MAX(s->cached->estimate, s->cached->samples);
+		failed = s->cached->failed;
+		ast_mutex_unlock(&s->cached->lock);
+		if (failed && uncache(fs))
+			return -1;
+	}
+
+	if (s->cached) {
+		if (whence == SEEK_CUR)
+			sample_offset += s->pos;
+		else if (whence == SEEK_END)
+			sample_offset += max;
+		s->pos = (sample_offset < 0) ? 0 : MIN(sample_offset, max);
+		return 0;
+	}
+
+	/* The exact length is only known from the file's index */
+	if (whence == SEEK_END && s->samples) {
+		sample_offset += s->samples;
+		whence = SEEK_SET;
+	}
+	if (mpg123_seek(s->mh, sample_offset, whence) < 0) {
+		ast_log(LOG_WARNING, "Unable to seek MP3 stream: %s\n", mpg123_strerror(s->mh));
+		return -1;
+	}
+	return 0;
+}
+
+static off_t mp3_tell(struct ast_filestream *fs)
+{
+	struct mp3_desc *s = (struct mp3_desc *)fs->_private;
+
+	if (s->cached)
+		return s->pos;
+	return mpg123_tell(s->mh);
+}
+
+static const struct ast_format mp3_f = {
+	.name = "mp3",
+	.exts = "mp3",
+	.format = AST_FORMAT_SLINEAR,
+	.open = mp3_open,
+	.write = mp3_write,
+	.seek =	mp3_seek,
+	.trunc = mp3_trunc,
+	.tell = mp3_tell,
+	.read = mp3_read,
+	.close = mp3_close,
+	.buf_size = BUF_SIZE + AST_FRIENDLY_OFFSET,
+	.desc_size = sizeof(struct mp3_desc),
+	.needs_fd = 1,	/* mpg123 reads the file by descriptor */
+};
+
+static char *handle_cli_mp3_show_cache(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	unsigned int entries = 0;
+	struct mp3_cache_entry *entry;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "mp3 show cache";
+		e->usage =
+			"Usage: mp3 show cache\n"
+			"       Shows usage statistics of the decoded MP3 audio cache.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != e->args)
+		return CLI_SHOWUSAGE;
+
+	AST_LIST_LOCK(&mp3_cache);
+	AST_LIST_TRAVERSE(&mp3_cache, entry, list)
+		entries++;
+	ast_cli(a->fd, "Cache size:     %lu of %lu kB\n", (unsigned long) cache_bytes / 1024, (unsigned long) cache_max / 1024);
+	ast_cli(a->fd, "Cached files:   %u\n", entries);
+	ast_cli(a->fd, "Hits:           %u\n", cache_hits);
+	ast_cli(a->fd, "Misses:         %u\n", cache_misses);
+	ast_cli(a->fd, "Evictions:      %u\n", cache_evictions);
+	ast_cli(a->fd, "Decoding:       %d\n", decoding);
+	AST_LIST_UNLOCK(&mp3_cache);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_mp3[] = {
+	AST_CLI_DEFINE(handle_cli_mp3_show_cache, "Show MP3 decoded audio cache statistics"),
+};
+
+static int parse_config(int reload)
+{
+	struct ast_flags config_flags = { reload ? CONFIG_FLAG_FILEUNCHANGED : 0 };
+	struct ast_config *cfg = ast_config_load(config, config_flags);
+	struct ast_variable *var;
+	size_t max = DEFAULT_CACHE_SIZE * 1024;
+	int res;
+
+	if (cfg == CONFIG_STATUS_FILEUNCHANGED)
+		return 0;
+
+	if (cfg) {
+		for (var = ast_variable_browse(cfg, "general"); var; var = var->next) {
+			if (!strcasecmp(var->name, "cachesize")) {
+				if (sscanf(var->value, "%d", &res) == 1 && res >= 0)
+					max = (size_t) res * 1024;
+				else
+					ast_log(LOG_WARNING, "Invalid cachesize '%s' at line %d of %s\n", var->value, var->lineno, config);
+			}
+		}
+		ast_config_destroy(cfg);
+	}
+
+	AST_LIST_LOCK(&mp3_cache);
+	cache_max = max;
+	cache_trim();
+	AST_LIST_UNLOCK(&mp3_cache);
+
+	return 0;
+}
+
+static int reload(void)
+{
+	if (parse_config(1))
+		return AST_MODULE_LOAD_DECLINE;
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+static int load_module(void)
+{
+	if (mpg123_init() != MPG123_OK) {
+		ast_log(LOG_ERROR, "Unable to initialize libmpg123\n");
+		return AST_MODULE_LOAD_DECLINE;
+	}
+	ast_cond_init(&decoding_cond, NULL);
+	parse_config(0);
+	if (ast_format_register(&mp3_f)) {
+		ast_cond_destroy(&decoding_cond);
+		mpg123_exit();
+		return AST_MODULE_LOAD_FAILURE;
+	}
+	ast_cli_register_multiple(cli_mp3, ARRAY_LEN(cli_mp3));
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+static int unload_module(void)
+{
+	int res = ast_format_unregister(mp3_f.name);
+
+	if (res)
+		return res;
+
+	ast_cli_unregister_multiple(cli_mp3, ARRAY_LEN(cli_mp3));
+
+	/* Decoding threads give up once the cache is off */
+	AST_LIST_LOCK(&mp3_cache);
+	cache_max = 0;
+	cache_trim();
+	while (decoding)
+		ast_cond_wait(&decoding_cond, &mp3_cache.lock);
+	AST_LIST_UNLOCK(&mp3_cache);
+	ast_cond_destroy(&decoding_cond);
+
+	mpg123_exit();
+	return 0;
+}
+
+AST_MODULE_INFO(ASTERISK_GPL_KEY, AST_MODFLAG_DEFAULT, "MP3 audio (libmpg123)",
+		.load = load_module,
+		.unload = unload_module,
+		.reload = reload,
+	       );
@@ -0,0 +1,106 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief MP3 file information dialplan functions
+ *
+ * \ingroup functions
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/module.h"
+#include "asterisk/pbx.h"
+#include "asterisk/app.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/mp3.h"
+#include "asterisk/utils.h"
+
+static int mp3_duration(struct ast_channel *chan, const char *cmd, char *data,
+			char *buf, size_t len)
+{
+	struct ast_mp3_index *idx;
+	const struct ast_mp3_index_header *hdr;
+	unsigned int duration;
+	AST_DECLARE_APP_ARGS(args,
+		AST_APP_ARG(filename);
+		AST_APP_ARG(unit);
+	);
+
+	AST_STANDARD_APP_ARGS(args, data);
+
+	if (ast_strlen_zero(args.filename)) {
+		ast_log(LOG_WARNING, "Syntax: MP3_DURATION(<filename>[,<unit>]) - missing argument!\n");
+		return -1;
+	}
+
+	/* Scanning the file would hold up the channel; have it done elsewhere */
+	if (!(idx = ast_mp3_index_get(args.filename, 0))) {
+		if (ast_mp3_index_queue_file(args.filename)) {
+			ast_log(LOG_WARNING, "Unable to find the length of '%s'\n", args.filename);
+			return -1;
+		}
+		*buf = '\0';
+		return 0;
+	}
+	hdr = ast_mp3_index_header(idx);
+	duration = hdr->duration;
+	ao2_ref(idx, -1);
+
+	if (ast_strlen_zero(args.unit) || !strcasecmp(args.unit, "s"))
+		snprintf(buf, len, "%u", duration / 1000);
+	else if (!strcasecmp(args.unit, "ms"))
+		snprintf(buf, len, "%u", duration);
+	else if (!strcasecmp(args.unit, "samples"))
+		snprintf(buf, len, "%u", duration * 8);
+	else {
+		ast_log(LOG_WARNING, "Unknown unit '%s' for MP3_DURATION\n", args.unit);
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct ast_custom_function mp3_duration_function = {
+	.name = "MP3_DURATION",
+	.synopsis = "Get the length of an MP3 file",
+	.syntax = "MP3_DURATION(<filename>[,<unit>])",
+	.desc =
+"Returns the length of the MP3 file <filename>, given as a full path.\n"
+"<unit> is one of:\n"
+"  s       - whole seconds (the default)\n"
+"  ms      - milliseconds\n"
+"  samples - samples at 8000 Hz, as used by STREAM MP3 offsets\n"
+"The length is read from the file's index (see 'mp3 index').  If the\n"
+"index is missing or out of date, it is built in the background and\n"
+"this returns an empty string until it is ready.\n",
+	.read = mp3_duration,
+};
+
+static int unload_module(void)
+{
+	return ast_custom_function_unregister(&mp3_duration_function);
+}
+
+static int load_module(void)
+{
+	return ast_custom_function_register(&mp3_duration_function);
+}
+
+AST_MODULE_INFO_STANDARD(ASTERISK_GPL_KEY, "MP3 file information dialplan functions");
@@ -32,8 +32,14 @@ void ast_event_init(void);		/*!< Provided by event.c */
 int ast_device_state_engine_init(void);	/*!< Provided by devicestate.c */
 int astobj2_init(void);			/*!< Provided by astobj2.c */
 int ast_file_init(void);		/*!< Provided by file.c */
+void ast_g711_init(void);		/*!< Provided by g711.c */
+void ast_goertzel_init(void);		/*!< Provided by goertzel.c */
+int ast_mp3_init(void);			/*!< Provided by mp3.c */
+int ast_mp3_reload(void);		/*!< Provided by mp3.c */
 int ast_features_init(void);            /*!< Provided by features.c */
 void ast_autoservice_init(void);    /*!< Provided by autoservice.c */
+void ast_sched_init(void);		/*!< Provided by sched.c */
+void ast_translate_init(void);		/*!< Provided by translate.c */
 
 /*!
  * \brief Reload asterisk modules.
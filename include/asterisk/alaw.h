@@ -83,4 +83,15 @@ static inline unsigned char AST_LIN2A(short sample)
 
 #define AST_ALAW(a) (__ast_alaw[(int)(a)])
 
+/*!
+ * \brief Decode a buffer of A-law samples to signed linear
+ *
+ * Gives the same results as AST_ALAW() on each sample, using the fastest
+ * instructions the CPU has.
+ */
+void ast_alaw_decode(int16_t *dst, const unsigned char *src, int samples);
+
+/*! \brief Encode a buffer of signed linear samples to A-law, as AST_LIN2A() would */
+void ast_alaw_encode(unsigned char *dst, const int16_t *src, int samples);
+
 #endif /* _ASTERISK_ALAW_H */
@@ -42,6 +42,14 @@
 #define DSP_PROGRESS_CONGESTION		(1 << 19)		/*!< Enable congestion tone detection */
 #define DSP_FEATURE_CALL_PROGRESS	(DSP_PROGRESS_TALK | DSP_PROGRESS_RINGING | DSP_PROGRESS_BUSY | DSP_PROGRESS_CONGESTION)
 
+/*! Features that need the audio as signed linear.  Without any of them,
+   ast_dsp_process() only measures the energy of frames, straight from
+   ulaw or alaw ones. */
+#define DSP_FEATURE_TONES	(DSP_FEATURE_DTMF_DETECT | DSP_FEATURE_FAX_DETECT | DSP_FEATURE_CALL_PROGRESS)
+
+/*! Formats ast_dsp_silence() takes, for ast_set_read_format() */
+#define DSP_SILENCE_FORMATS	(AST_FORMAT_SLINEAR | AST_FORMAT_ULAW | AST_FORMAT_ALAW)
+
 #define DSP_FAXMODE_DETECT_CNG	(1 << 0)
 #define DSP_FAXMODE_DETECT_CED	(1 << 1)
 #define DSP_FAXMODE_DETECT_ALL	(DSP_FAXMODE_DETECT_CNG | DSP_FAXMODE_DETECT_CED)
@@ -81,7 +89,7 @@ int ast_dsp_set_call_progress_zone(struct ast_dsp *dsp, char *zone);
 struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp, struct ast_frame *inf);
 
 /*! \brief Return non-zero if this is silence.  Updates "totalsilence" with the total
-   number of seconds of silence  */
+   number of seconds of silence.  The frame must be in one of DSP_SILENCE_FORMATS. */
 int ast_dsp_silence(struct ast_dsp *dsp, struct ast_frame *f, int *totalsilence);
 
 /*! \brief Return non-zero if historically this should be a busy, request that
@@ -181,6 +181,20 @@ int ast_waitstream_full(struct ast_channel *c, const char *breakon, int audiofd,
  */
 struct ast_filestream *ast_readfile(const char *filename, const char *type, const char *comment, int flags, int check, mode_t mode);
 
+/*!
+ * \brief Starts reading from a file, through a memory mapping of it
+ * \param filename the name of the file to read from
+ * \param type format of file you wish to read from
+ *
+ * Like ast_readfile(), but for reading whole files in bulk: the file is
+ * read from a memory mapping, where the system and the format allow it,
+ * rather than with a read() call for each block.
+ *
+ * \retval a struct ast_filestream on success.
+ * \retval NULL on failure.
+ */
+struct ast_filestream *ast_readfile_mapped(const char *filename, const char *type);
+
 /*! 
  * \brief Starts writing a file 
  * \param filename the name of the file to write to
@@ -315,6 +329,21 @@ off_t ast_tellstream(struct ast_filestream *fs);
  */ 
 struct ast_frame *ast_readframe(struct ast_filestream *s);
 
+/*!
+ * \brief Copy a whole stream into another one, converting it to the format
+ * of the destination
+ * \param in stream to read, from ast_readfile()
+ * \param out stream to write, from ast_writefile()
+ *
+ * When every step of the translation path can convert whole buffers (see
+ * ast_translate_batch()), samples are converted in batches of about a
+ * second, rather than a frame at a time.
+ *
+ * \retval 0 on success.
+ * \retval -1 on failure.
+ */
+int ast_stream_convert(struct ast_filestream *in, struct ast_filestream *out);
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
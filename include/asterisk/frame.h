@@ -134,6 +134,10 @@ enum {
 	 *  The dsp cannot be free'd if the frame inside of it still has
 	 *  this flag set. */
 	AST_FRFLAG_FROM_DSP = (1 << 2),
+	/*! The header of this frame (with its data and source, if ast_frdup()
+	 *  made it) came from a per-thread frame pool, and is returned there
+	 *  when freed. */
+	AST_FRFLAG_FROM_POOL = (1 << 3),
 };
 
 /*! \brief Data structure associated with a single frame of data
@@ -617,6 +621,36 @@ int ast_frame_adjust_volume(struct ast_frame *f, int adjustment);
  */
 int ast_frame_slinear_sum(struct ast_frame *f1, struct ast_frame *f2);
 
+/*!
+  \brief Adjusts the volume of a buffer of signed linear samples.
+  \param data The samples
+  \param samples The number of samples
+  \param adjustment Multiply the samples by this if positive, or divide them by
+         minus this if negative, clipping the results
+
+  This is what ast_frame_adjust_volume() does to the samples of a frame.
+ */
+void ast_slinear_adjust_volume(short *data, int samples, int adjustment);
+
+/*!
+  \brief Adds a buffer of signed linear samples to another, clipping the results.
+  \param dst The samples to add to (which will contain the result)
+  \param src The samples to add
+  \param samples The number of samples in each
+ */
+void ast_slinear_sum(short *dst, const short *src, int samples);
+
+/*!
+  \brief Adds several buffers of signed linear samples to another.
+  \param dst The samples to add to (which will contain the result)
+  \param src The buffers to add
+  \param sources The number of buffers in src
+  \param samples The number of samples in each
+
+  Gives the same result as calling ast_slinear_sum() once for each buffer.
+ */
+void ast_slinear_sum_multiple(short *dst, const short * const *src, int sources, int samples);
+
 /*!
  * \brief Get the sample rate for a given format.
  */
@@ -88,6 +88,9 @@ struct ast_format {
 	 */
 	int buf_size;			/*!< size of frame buffer, if any, aligned to 8 bytes. */
 	int desc_size;			/*!< size of private descriptor, if any */
+	/*! Set if the format uses the descriptor of the file (fileno(s->f)),
+	 * so it cannot be given a file read from memory by ast_readfile_mapped() */
+	int needs_fd;
 
 	struct ast_module *module;
 };
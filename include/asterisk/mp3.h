@@ -0,0 +1,211 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief MP3 playback support shared by STREAM MP3, MP3Player() and music on hold
+ */
+
+#ifndef _ASTERISK_MP3_H
+#define _ASTERISK_MP3_H
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+struct ast_channel;
+struct ast_filestream;
+struct ast_mp3_index;
+
+/*! Identifies an MP3 index file (and its version) */
+#define AST_MP3_INDEX_MAGIC "MP3IDX1"
+
+/*! \brief Where the entries of an MP3 index came from */
+enum ast_mp3_index_type {
+	/*! Exact offset of every step'th frame, found by parsing every frame header */
+	AST_MP3_INDEX_SCAN = 0,
+	/*! The table of contents of a Xing (or Info) header: offsets at each 1% of the length */
+	AST_MP3_INDEX_XING,
+	/*! The table of contents of a VBRI header: approximate offsets every step frames */
+	AST_MP3_INDEX_VBRI,
+};
+
+/*!
+ * \brief Start of an MP3 index, followed by its entries as uint64_t byte offsets
+ *
+ * An index is kept next to its MP3 file, named after it with ".idx" added,
+ * in the byte order of the host that wrote it.  It is rebuilt whenever the
+ * size or modification time of the MP3 no longer match.
+ */
+struct ast_mp3_index_header {
+	char magic[8];			/*!< AST_MP3_INDEX_MAGIC */
+	uint64_t size;			/*!< Size of the MP3 when it was indexed... */
+	int64_t mtime;			/*!< ...and its modification time */
+	uint32_t type;			/*!< enum ast_mp3_index_type */
+	uint32_t rate;			/*!< Sample rate of the MP3 */
+	uint32_t frame_samples;		/*!< Samples per MPEG frame */
+	uint32_t frames;		/*!< Number of MPEG frames */
+	uint32_t duration;		/*!< Length, in ms */
+	uint32_t step;			/*!< Frames from one entry to the next (SCAN and VBRI) */
+	uint32_t entries;		/*!< Number of entries following */
+	uint32_t reserved;
+};
+
+/*!
+ * \brief Open a local MP3 file for playback through the file format layer
+ *
+ * \param chan channel to play on
+ * \param filename full path to the file, including its .mp3 extension
+ *
+ * Works when format_mp3 is loaded and filename is an absolute path to an
+ * .mp3 file.  If mp3.conf asks for renditions in other formats, the ones
+ * that are missing or older than the MP3 are (re)written in the background,
+ * and the stream opened is the one that best suits the channel, so plays
+ * after the first need neither decoding nor transcoding.
+ *
+ * \return the stream, ready for ast_applystream(), or NULL if the location
+ * has to be played by an external decoder instead.
+ */
+struct ast_filestream *ast_mp3_openstream(struct ast_channel *chan, const char *filename);
+
+/*!
+ * \brief Play an MP3 file or stream on a channel
+ *
+ * \param chan channel to play on
+ * \param location file name or URL to play
+ * \param breakon DTMF digits that stop playback
+ * \param audiofd if > -1, audio received from the channel is written here
+ * \param cmdfd if > -1, playback stops when this fd becomes readable
+ * \param offset if not NULL, playback starts *offset samples in, and
+ *        *offset is set to the sample position where playback stopped
+ *
+ * Local .mp3 files are played with ast_mp3_openstream() when possible.
+ * Anything else is decoded by mpg123, whose output is sent by a generator
+ * on the channel's timing, one frame per tick.  If the decoder falls
+ * behind, silence is sent in place of the missing audio rather than
+ * stalling the channel.
+ *
+ * For http:// URLs, a shared I/O thread reads the decoder ahead of
+ * playback into a buffer, and audio is sent only once enough has been
+ * buffered to start or, after running dry, to resume.  In broadcast mode
+ * (see mp3.conf) all channels playing the same URL share one decoder.
+ *
+ * \retval 0 when the file or stream ended, or the decoder timed out
+ * \retval digit if one of the breakon digits was pressed
+ * \retval 1 if cmdfd became readable
+ * \retval -1 on hangup or error
+ */
+int ast_mp3_play(struct ast_channel *chan, const char *location, const char *breakon, int audiofd, int cmdfd, long *offset);
+
+/*!
+ * \brief Play an MP3 file, letting the caller skip back and forth in it
+ *
+ * \param chan channel to play on
+ * \param location file name or URL to play
+ * \param fwd digits that skip forward skipms
+ * \param rev digits that skip back skipms
+ * \param stop digits that stop playback
+ * \param pause digits that pause and resume playback
+ * \param skipms how far to skip, in ms
+ *
+ * Works like ast_control_streamfile() for files ast_mp3_openstream() can
+ * open.  Anything else cannot be skipped in, and is played as by
+ * ast_mp3_play() with only the stop digits active.
+ *
+ * \return the stop digit pressed, 0 at the end of the file, -1 on hangup
+ */
+int ast_mp3_control(struct ast_channel *chan, const char *location, const char *fwd, const char *rev,
+	const char *stop, const char *pause, int skipms);
+
+/*!
+ * \brief Start a decoder process writing audio to a pipe
+ *
+ * \param path program to run, or NULL to run mpg123 from /usr/local/bin,
+ *        /usr/bin or the PATH
+ * \param argv its arguments, terminated by NULL
+ * \param dir directory to run it in, or NULL
+ * \param pid where to put the process id, for ast_mp3_decoder_stop()
+ *
+ * The process is started with vfork() where it works, so starting one does
+ * not copy the address space of Asterisk.  No more than maxdecoders (see
+ * mp3.conf) are run at once.
+ *
+ * \return the read end of the pipe connected to the decoder's standard
+ * output, or -1 on failure
+ */
+int ast_mp3_decoder_spawn(const char *path, char *const argv[], const char *dir, pid_t *pid);
+
+/*!
+ * \brief Stop a decoder started by ast_mp3_decoder_spawn()
+ *
+ * The process is sent SIGHUP, then SIGTERM and SIGKILL if it keeps running,
+ * and is reaped by a background thread, so this does not block.
+ */
+void ast_mp3_decoder_stop(pid_t pid);
+
+/*!
+ * \brief Get the index of an MP3 file
+ *
+ * \param filename full path to the MP3 file
+ * \param build if the index file is missing or stale, build the index and
+ *        try to save it, instead of failing
+ *
+ * Indexes are read from their file with a single mmap() and kept for a
+ * while, where ast_mp3_index_find() can find them.
+ *
+ * \return a reference to the index, to be released with ao2_ref(), or NULL
+ */
+struct ast_mp3_index *ast_mp3_index_get(const char *filename, int build);
+
+/*!
+ * \brief Find the index of an open MP3 file, if it was recently loaded
+ * by ast_mp3_index_get()
+ * \return a reference to the index, to be released with ao2_ref(), or NULL
+ */
+struct ast_mp3_index *ast_mp3_index_find(int fd);
+
+/*!
+ * \brief Have the index of an open MP3 file built and saved in the background
+ *
+ * The file is found again by name through /proc/self/fd, and left alone
+ * where that does not work.  Once built, ast_mp3_index_find() finds the
+ * index.  Files already being indexed are not indexed twice.
+ *
+ * \retval 0 if the index is being built
+ * \retval -1 if not
+ */
+int ast_mp3_index_queue(int fd);
+
+/*!
+ * \brief Have the index of an MP3 file built and saved in the background
+ * \param filename full path to the MP3 file
+ * \retval 0 if the index is being built
+ * \retval -1 if not
+ */
+int ast_mp3_index_queue_file(const char *filename);
+
+const struct ast_mp3_index_header *ast_mp3_index_header(const struct ast_mp3_index *idx);
+
+/*! \brief The byte offsets making up the index, ast_mp3_index_header(idx)->entries of them */
+const uint64_t *ast_mp3_index_entries(const struct ast_mp3_index *idx);
+
+/*! \brief Byte offset in the MP3 of a frame at or (a little) before ms milliseconds in */
+off_t ast_mp3_index_offset(const struct ast_mp3_index *idx, unsigned int ms);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_MP3_H */
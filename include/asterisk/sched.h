@@ -80,6 +80,25 @@ struct sched_context;
  */
 struct sched_context *sched_context_create(void);
 
+/*! \brief Name a schedule context
+ * Names the context in "core show sched", which lists only contexts that
+ * have a name.
+ * \param con Context to name
+ * \param name Name, which must stay valid as long as the context
+ */
+void sched_context_set_name(struct sched_context *con, const char *name);
+
+/*! \brief Keep the events of a context on a timing wheel
+ * Events on a wheel are added and deleted in constant time however many
+ * there are, and run at tick resolution: up to one tick late, and in no
+ * particular order among those due in the same tick.  Suits contexts with
+ * many coarse timers; without a wheel, events are kept in a heap.
+ * \param con Context, which must have no events scheduled
+ * \param tick Length of a tick in ms, or 0 to go back to the heap
+ * \return Returns 0 on success, -1 on failure
+ */
+int sched_context_set_wheel(struct sched_context *con, unsigned int tick);
+
 /*! \brief destroys a schedule context
  * Destroys (free's) the given sched_context structure
  * \param c Context to free
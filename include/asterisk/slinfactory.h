@@ -28,15 +28,22 @@
 extern "C" {
 #endif
 
+/*! Samples a slinfactory holds; a power of two.  When more than this are
+ * fed in without being read, the oldest are dropped. */
+#define AST_SLINFACTORY_SIZE 16384
+/*! Most samples ast_slinfactory_peek() hands out at once */
 #define AST_SLINFACTORY_MAX_HOLD 1280
 
 struct ast_slinfactory {
-	AST_LIST_HEAD_NOLOCK(, ast_frame) queue;
+	/*! AST_SLINFACTORY_SIZE samples, followed by a copy of the first
+	 * AST_SLINFACTORY_MAX_HOLD of them, so any AST_SLINFACTORY_MAX_HOLD
+	 * samples in the ring can be read in one piece.  Allocated on the
+	 * first feed. */
+	short *ring;
+	unsigned int head;		/*!< Samples read so far; wraps around */
+	unsigned int tail;		/*!< Samples fed so far; wraps around */
 	struct ast_trans_pvt *trans;
-	short hold[AST_SLINFACTORY_MAX_HOLD];
-	short *offset;
-	size_t holdlen;			/*!< in samples */
-	unsigned int size;		/*!< in samples */
+	int batch;			/*!< ast_translator_batch_samples() of trans */
 	unsigned int format;
 };
 
@@ -55,8 +62,40 @@ void ast_slinfactory_init(struct ast_slinfactory *sf);
  */
 void ast_slinfactory_destroy(struct ast_slinfactory *sf);
 
+/*!
+ * \brief Add the audio of a frame, translated to signed linear
+ *
+ * Where the translation path allows, the frame is translated straight into
+ * the slinfactory, without an intermediate frame.
+ *
+ * \return the number of samples available afterwards, 0 on failure
+ */
 int ast_slinfactory_feed(struct ast_slinfactory *sf, struct ast_frame *f);
+
+/*! \brief Copy up to samples samples out of the slinfactory
+ * \return the number of samples copied */
 int ast_slinfactory_read(struct ast_slinfactory *sf, short *buf, size_t samples);
+
+/*!
+ * \brief Look at the next samples without copying them
+ *
+ * \arg sf the slinfactory
+ * \arg buf set to the first of the samples, inside the slinfactory
+ * \arg samples how many are wanted
+ *
+ * The samples stay valid, and may be modified in place, until the next
+ * call that feeds, reads or flushes the slinfactory.  Pass them on to
+ * ast_slinfactory_consume() when done with them.
+ *
+ * \return how many samples are at *buf: the smallest of samples, the
+ * samples available and AST_SLINFACTORY_MAX_HOLD
+ */
+unsigned int ast_slinfactory_peek(struct ast_slinfactory *sf, short **buf, size_t samples);
+
+/*! \brief Drop samples from the front of the slinfactory, after
+ * ast_slinfactory_peek() */
+void ast_slinfactory_consume(struct ast_slinfactory *sf, size_t samples);
+
 unsigned int ast_slinfactory_available(const struct ast_slinfactory *sf);
 void ast_slinfactory_flush(struct ast_slinfactory *sf);
 
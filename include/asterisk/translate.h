@@ -92,6 +92,16 @@ struct ast_translator {
 
 	struct ast_frame * (*sample)(void);	/*!< Generate an example frame */
 
+	/*! \brief Optional callback converting a whole buffer in one call.
+	 * Converts 'samples' samples, packed in 'in' as in a frame of srcfmt,
+	 * into 'out', bypassing outbuf.  Used for bulk conversion by
+	 * ast_translate_batch().  Returns the number of samples written to
+	 * 'out', or -1 on error.
+	 */
+	int (*framein_batch)(struct ast_trans_pvt *pvt, void *out, const void *in, int samples);
+
+	int batch_samples;		/*!< framein_batch needs a multiple of this many samples, 0 for any */
+
 	/*! \brief size of outbuf, in samples. Leave it 0 if you want the framein
 	 * callback deal with the frame. Set it appropriately if you
 	 * want the code to checks if the incoming frame fits the
@@ -113,6 +123,14 @@ struct ast_translator {
 
 	int cost;			/*!< Cost in milliseconds for encoding/decoding 1 second of sound */
 	int active;			/*!< Whether this translator should be used or not */
+
+	/* Descriptors are kept for reuse by translate.c, which also owns these */
+	struct ast_trans_pvt *pool;	/*!< Descriptors kept for reuse, linked by next */
+	int pool_size;			/*!< Number of descriptors in pool */
+	int inuse;			/*!< Number of descriptors in use */
+	unsigned int reused;		/*!< Descriptors taken from pool */
+	unsigned int created;		/*!< Descriptors allocated */
+
 	AST_LIST_ENTRY(ast_translator) list;	/*!< link field */
 };
 
@@ -230,6 +248,31 @@ void ast_translator_free_path(struct ast_trans_pvt *tr);
  */
 struct ast_frame *ast_translate(struct ast_trans_pvt *tr, struct ast_frame *f, int consume);
 
+/*!
+ * \brief Find out whether a translator path can convert whole buffers
+ * \param path translator path, from ast_translator_build_path()
+ * \return 0 if some step of the path has no framein_batch callback, otherwise
+ * the number of samples that a buffer given to ast_translate_batch() must
+ * be a multiple of.
+ */
+int ast_translator_batch_samples(struct ast_trans_pvt *path);
+
+/*!
+ * \brief Translate a buffer of samples with one call per step of the path
+ * \param path translator path, for which ast_translator_batch_samples() is non-zero
+ * \param out where the translated samples are stored.  It must have space for
+ * ast_codec_get_len() bytes of as many samples in the destination format.
+ * \param in the samples to translate, packed as in a frame of the source format
+ * \param samples number of samples in 'in', a multiple of
+ * ast_translator_batch_samples()
+ * \return the number of samples in 'out', or -1 on failure
+ *
+ * This is meant for converting files and other bulk work, where the cost of
+ * a call to ast_translate() per frame is significant.  The timing information
+ * and packet loss concealment of ast_translate() are not applied.
+ */
+int ast_translate_batch(struct ast_trans_pvt *path, void *out, const void *in, int samples);
+
 /*!
  * \brief Returns the number of steps required to convert from 'src' to 'dest'.
  * \param dest destination format
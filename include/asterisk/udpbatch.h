@@ -0,0 +1,107 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Batched UDP reads and writes
+ *
+ * A thread that services many UDP sockets from one poll loop can read all
+ * the datagrams waiting on a socket with one system call, and can queue
+ * what it sends while going round the loop and write the queue out once per
+ * iteration, with one system call per run of datagrams for the same socket.
+ * Uses recvmmsg() and sendmmsg() where the system has them, and falls back
+ * to recvfrom() and sendto() where it does not.
+ */
+
+#ifndef _ASTERISK_UDPBATCH_H
+#define _ASTERISK_UDPBATCH_H
+
+#include "asterisk/network.h"
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+/*! Most datagrams read by one call to ast_udp_recv() */
+#define AST_UDP_RECV_MAX	64
+
+/*! \brief One datagram for ast_udp_recv() */
+struct ast_udp_msg {
+	void *buf;			/*!< Where to put the datagram */
+	size_t size;			/*!< Size of buf */
+	size_t len;			/*!< Length of the datagram read */
+	struct sockaddr_in sin;		/*!< Who sent it */
+};
+
+/*! \brief Read the datagrams waiting on a socket
+ * Waits for the first datagram, unless flags has MSG_DONTWAIT, then reads
+ * whatever else is waiting without blocking.
+ * \param fd Socket to read
+ * \param msgs Buffers to read into
+ * \param count Number of buffers, at most AST_UDP_RECV_MAX
+ * \param flags Flags for the first read, as for recvfrom()
+ * \return Returns the number of datagrams read, or -1 with errno set if
+ * none could be
+ */
+int ast_udp_recv(int fd, struct ast_udp_msg *msgs, int count, int flags);
+
+struct ast_udp_batch;
+
+/*! \brief Create a queue of outgoing datagrams
+ * \return Returns the queue, NULL on failure
+ */
+struct ast_udp_batch *ast_udp_batch_create(void);
+
+/*! \brief Destroy a queue of outgoing datagrams
+ * The queue must not be in use by any thread.
+ */
+void ast_udp_batch_destroy(struct ast_udp_batch *batch);
+
+/*! \brief Queue what the calling thread sends with ast_udp_sendto()
+ * Datagrams stay queued until the thread calls ast_udp_batch_flush(), which
+ * a poll loop does before it goes back to waiting, or until the queue is
+ * full.
+ * \param batch Queue to use, or NULL to send immediately again (after
+ * flushing the queue in use)
+ */
+void ast_udp_batch_use(struct ast_udp_batch *batch);
+
+/*! \brief Send what the calling thread has queued
+ * \return Returns the number of datagrams sent
+ */
+int ast_udp_batch_flush(void);
+
+/*! \brief Send a datagram, or queue it if the calling thread has a queue
+ * Queued datagrams are copied, so data may be reused on return, but fd
+ * must stay open until the queue is flushed.  Errors sending a queued
+ * datagram are only logged, at debug level, so use ast_udp_sendto_now()
+ * where the caller acts on them.
+ * \return Returns len on success, -1 with errno set on failure, as for
+ * sendto()
+ */
+int ast_udp_sendto(int fd, const void *data, size_t len, const struct sockaddr_in *sin);
+
+/*! \brief Send a datagram right away, after anything the calling thread has
+ * queued, for callers that need to know whether sending it failed
+ * \return Returns len on success, -1 with errno set on failure, as for
+ * sendto()
+ */
+int ast_udp_sendto_now(int fd, const void *data, size_t len, const struct sockaddr_in *sin);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_UDPBATCH_H */
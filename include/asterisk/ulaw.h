@@ -84,4 +84,15 @@ static inline unsigned char AST_LIN2MU(short sample)
 
 #define AST_MULAW(a) (__ast_mulaw[(a)])
 
+/*!
+ * \brief Decode a buffer of u-law samples to signed linear
+ *
+ * Gives the same results as AST_MULAW() on each sample, using the fastest
+ * instructions the CPU has.
+ */
+void ast_ulaw_decode(int16_t *dst, const unsigned char *src, int samples);
+
+/*! \brief Encode a buffer of signed linear samples to u-law, as AST_LIN2MU() would */
+void ast_ulaw_encode(unsigned char *dst, const int16_t *src, int samples);
+
 #endif /* _ASTERISK_ULAW_H */
@@ -644,7 +644,8 @@ static int __ast_play_and_record(struct ast_channel *chan, const char *playfile,
 		}
 		ast_dsp_set_threshold(sildet, silencethreshold);
 		rfmt = chan->readformat;
-		res = ast_set_read_format(chan, AST_FORMAT_SLINEAR);
+		/* The silence detector takes ulaw and alaw frames as they are */
+		res = ast_set_read_format(chan, DSP_SILENCE_FORMATS);
 		if (res < 0) {
 			ast_log(LOG_WARNING, "Unable to set to linear mode, giving up\n");
 			ast_dsp_free(sildet);
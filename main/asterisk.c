@@ -3293,12 +3293,17 @@ int main(int argc, char *argv[])
 		}
 	}
 #endif
+	ast_g711_init();
+	ast_goertzel_init();
+
 	threadstorage_init();
 
 	astobj2_init();
 
 	ast_autoservice_init();
 
+	ast_sched_init();
+
 	if (load_modules(1)) {		/* Load modules, pre-load only */
 		printf("%s", term_quit());
 		exit(1);
@@ -3342,6 +3347,11 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if (ast_mp3_init()) {
+		printf("%s", term_quit());
+		exit(1);
+	}
+
 	if (load_pbx()) {
 		printf("%s", term_quit());
 		exit(1);
@@ -3359,6 +3369,8 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	ast_translate_init();
+
 	if (ast_enum_init()) {
 		printf("%s", term_quit());
 		exit(1);
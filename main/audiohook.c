@@ -150,15 +150,38 @@ int ast_audiohook_write_frame(struct ast_audiohook *audiohook, enum ast_audiohoo
 	return 0;
 }
 
+/*!
+ * \brief Get samples out of a factory, in place where they are in one piece
+ * \param buf where to copy them to otherwise
+ * \return the samples, or NULL if there are not enough; pass them to
+ * factory_done() when finished with them
+ */
+static short *factory_get(struct ast_slinfactory *factory, short *buf, size_t samples)
+{
+	short *data;
+
+	if (ast_slinfactory_peek(factory, &data, samples) == samples)
+		return data;
+
+	return ast_slinfactory_read(factory, buf, samples) == samples ? buf : NULL;
+}
+
+/*! \brief Consume samples factory_get() left in the factory */
+static void factory_done(struct ast_slinfactory *factory, short *data, short *buf, size_t samples)
+{
+	if (data && data != buf)
+		ast_slinfactory_consume(factory, samples);
+}
+
 static struct ast_frame *audiohook_read_frame_single(struct ast_audiohook *audiohook, size_t samples, enum ast_audiohook_direction direction)
 {
 	struct ast_slinfactory *factory = (direction == AST_AUDIOHOOK_DIRECTION_READ ? &audiohook->read_factory : &audiohook->write_factory);
 	int vol = (direction == AST_AUDIOHOOK_DIRECTION_READ ? audiohook->options.read_volume : audiohook->options.write_volume);
 	short buf[samples];
+	struct ast_frame *dup;
 	struct ast_frame frame = {
 		.frametype = AST_FRAME_VOICE,
 		.subclass = AST_FORMAT_SLINEAR,
-		.data = buf,
 		.datalen = sizeof(buf),
 		.samples = samples,
 	};
@@ -168,20 +191,24 @@ static struct ast_frame *audiohook_read_frame_single(struct ast_audiohook *audio
 		return NULL;
 	
 	/* Read data in from factory */
-	if (!ast_slinfactory_read(factory, buf, samples))
+	if (!(frame.data = factory_get(factory, buf, samples)))
 		return NULL;
 
 	/* If a volume adjustment needs to be applied apply it */
 	if (vol)
 		ast_frame_adjust_volume(&frame, vol);
 
-	return ast_frdup(&frame);
+	dup = ast_frdup(&frame);
+	factory_done(factory, frame.data, buf, samples);
+
+	return dup;
 }
 
 static struct ast_frame *audiohook_read_frame_both(struct ast_audiohook *audiohook, size_t samples)
 {
-	int i = 0, usable_read, usable_write;
-	short buf1[samples], buf2[samples], *read_buf = NULL, *write_buf = NULL, *final_buf = NULL, *data1 = NULL, *data2 = NULL;
+	int usable_read, usable_write;
+	short buf1[samples], buf2[samples], *read_buf = NULL, *write_buf = NULL, *final_buf = NULL;
+	struct ast_frame *dup;
 	struct ast_frame frame = {
 		.frametype = AST_FRAME_VOICE,
 		.subclass = AST_FORMAT_SLINEAR,
@@ -212,40 +239,23 @@ static struct ast_frame *audiohook_read_frame_both(struct ast_audiohook *audioho
 		return NULL;
 	}
 
-	/* Start with the read factory... if there are enough samples, read them in */
+	/* Start with the read factory... if there are enough samples, read them
+	   in; they are left in the factory, and mixed there, when they can be */
 	if (usable_read) {
-		if (ast_slinfactory_read(&audiohook->read_factory, buf1, samples)) {
-			read_buf = buf1;
+		if ((read_buf = factory_get(&audiohook->read_factory, buf1, samples))) {
 			/* Adjust read volume if need be */
-			if (audiohook->options.read_volume) {
-				int count = 0;
-				short adjust_value = abs(audiohook->options.read_volume);
-				for (count = 0; count < samples; count++) {
-					if (audiohook->options.read_volume > 0)
-						ast_slinear_saturated_multiply(&buf1[count], &adjust_value);
-					else if (audiohook->options.read_volume < 0)
-						ast_slinear_saturated_divide(&buf1[count], &adjust_value);
-				}
-			}
+			if (audiohook->options.read_volume)
+				ast_slinear_adjust_volume(read_buf, samples, audiohook->options.read_volume);
 		}
 	} else if (option_debug)
 		ast_log(LOG_DEBUG, "Failed to get %d samples from read factory %p\n", (int)samples, &audiohook->read_factory);
 
 	/* Move on to the write factory... if there are enough samples, read them in */
 	if (usable_write) {
-		if (ast_slinfactory_read(&audiohook->write_factory, buf2, samples)) {
-			write_buf = buf2;
+		if ((write_buf = factory_get(&audiohook->write_factory, buf2, samples))) {
 			/* Adjust write volume if need be */
-			if (audiohook->options.write_volume) {
-				int count = 0;
-				short adjust_value = abs(audiohook->options.write_volume);
-				for (count = 0; count < samples; count++) {
-					if (audiohook->options.write_volume > 0)
-						ast_slinear_saturated_multiply(&buf2[count], &adjust_value);
-					else if (audiohook->options.write_volume < 0)
-						ast_slinear_saturated_divide(&buf2[count], &adjust_value);
-				}
-			}
+			if (audiohook->options.write_volume)
+				ast_slinear_adjust_volume(write_buf, samples, audiohook->options.write_volume);
 		}
 	} else if (option_debug)
 		ast_log(LOG_DEBUG, "Failed to get %d samples from write factory %p\n", (int)samples, &audiohook->write_factory);
@@ -254,19 +264,23 @@ static struct ast_frame *audiohook_read_frame_both(struct ast_audiohook *audioho
 	if (!read_buf && !write_buf)
 		return NULL;
 	else if (read_buf && write_buf) {
-		for (i = 0, data1 = read_buf, data2 = write_buf; i < samples; i++, data1++, data2++)
-			ast_slinear_saturated_add(data1, data2);
-		final_buf = buf1;
+		ast_slinear_sum(read_buf, write_buf, samples);
+		final_buf = read_buf;
 	} else if (read_buf)
-		final_buf = buf1;
+		final_buf = read_buf;
 	else if (write_buf)
-		final_buf = buf2;
+		final_buf = write_buf;
 
 	/* Make the final buffer part of the frame, so it gets duplicated fine */
 	frame.data = final_buf;
 
 	/* Yahoo, a combined copy of the audio! */
-	return ast_frdup(&frame);
+	dup = ast_frdup(&frame);
+
+	factory_done(&audiohook->read_factory, read_buf, buf1, samples);
+	factory_done(&audiohook->write_factory, write_buf, buf2, samples);
+
+	return dup;
 }
 
 /*! \brief Reads a frame in from the audiohook structure
@@ -529,8 +543,7 @@ static struct ast_frame *audio_audiohook_write_list(struct ast_channel *chan, st
 
 	/* If this frame is being written out to the channel then we need to use whisper sources */
 	if (direction == AST_AUDIOHOOK_DIRECTION_WRITE && !AST_LIST_EMPTY(&audiohook_list->whisper_list)) {
-		int i = 0;
-		short read_buf[samples], combine_buf[samples], *data1 = NULL, *data2 = NULL;
+		short buf[samples], *read_buf, combine_buf[samples];
 		memset(&combine_buf, 0, sizeof(combine_buf));
 		AST_LIST_TRAVERSE_SAFE_BEGIN(&audiohook_list->whisper_list, audiohook, list) {
 			ast_audiohook_lock(audiohook);
@@ -541,17 +554,16 @@ static struct ast_frame *audio_audiohook_write_list(struct ast_channel *chan, st
 				ast_audiohook_unlock(audiohook);
 				continue;
 			}
-			if (ast_slinfactory_available(&audiohook->write_factory) >= samples && ast_slinfactory_read(&audiohook->write_factory, read_buf, samples)) {
+			if (ast_slinfactory_available(&audiohook->write_factory) >= samples && (read_buf = factory_get(&audiohook->write_factory, buf, samples))) {
 				/* Take audio from this whisper source and combine it into our main buffer */
-				for (i = 0, data1 = combine_buf, data2 = read_buf; i < samples; i++, data1++, data2++)
-					ast_slinear_saturated_add(data1, data2);
+				ast_slinear_sum(combine_buf, read_buf, samples);
+				factory_done(&audiohook->write_factory, read_buf, buf, samples);
 			}
 			ast_audiohook_unlock(audiohook);
 		}
 		AST_LIST_TRAVERSE_SAFE_END
 		/* We take all of the combined whisper sources and combine them into the audio being written out */
-		for (i = 0, data1 = middle_frame->data, data2 = combine_buf; i < samples; i++, data1++, data2++)
-			ast_slinear_saturated_add(data1, data2);
+		ast_slinear_sum(middle_frame->data, combine_buf, samples);
 		end_frame = middle_frame;
 	}
 
@@ -1481,6 +1481,7 @@ int ast_cdr_engine_init(void)
 		ast_log(LOG_ERROR, "Unable to create schedule context.\n");
 		return -1;
 	}
+	sched_context_set_name(sched, "cdr");
 
 	ast_cli_register(&cli_status);
 
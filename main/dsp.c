@@ -54,6 +54,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 130130 $")
 #include "asterisk/utils.h"
 #include "asterisk/options.h"
 
+#include "goertzel.h"
+
 /*! Number of goertzels for progress detect */
 enum gsamp_size {
 	GSAMP_SIZE_NA = 183,			/*!< North America - 350, 440, 480, 620, 950, 1400, 1800 Hz */
@@ -193,14 +195,6 @@ enum gsamp_thresh {
 #define SAMPLES_IN_FRAME	160
 
 
-typedef struct {
-	int v2;
-	int v3;
-	int chunky;
-	int fac;
-	int samples;
-} goertzel_state_t;
-
 typedef struct {
 	int value;
 	int power;
@@ -272,32 +266,6 @@ static char dtmf_positions[] = "123A" "456B" "789C" "*0#D";
 
 static char bell_mf_positions[] = "1247C-358A--69*---0B----#";
 
-static inline void goertzel_sample(goertzel_state_t *s, short sample)
-{
-	int v1;
-	
-	v1 = s->v2;
-	s->v2 = s->v3;
-	
-	s->v3 = (s->fac * s->v2) >> 15;
-	s->v3 = s->v3 - v1 + (sample >> s->chunky);
-	if (abs(s->v3) > 32768) {
-		s->chunky++;
-		s->v3 = s->v3 >> 1;
-		s->v2 = s->v2 >> 1;
-		v1 = v1 >> 1;
-	}
-}
-
-static inline void goertzel_update(goertzel_state_t *s, short *samps, int count)
-{
-	int i;
-	
-	for (i=0;i<count;i++) 
-		goertzel_sample(s, samps[i]);
-}
-
-
 static inline float goertzel_result(goertzel_state_t *s)
 {
 	goertzel_result_t r;
@@ -568,6 +536,10 @@ static int dtmf_detect(digit_detect_state_t *s, int16_t amp[], int samples,
 	int best_col;
 	int hit;
 	int limit;
+	goertzel_state_t *const filters[8] = {
+		&s->td.dtmf.row_out[0], &s->td.dtmf.row_out[1], &s->td.dtmf.row_out[2], &s->td.dtmf.row_out[3],
+		&s->td.dtmf.col_out[0], &s->td.dtmf.col_out[1], &s->td.dtmf.col_out[2], &s->td.dtmf.col_out[3],
+	};
 
 	hit = 0;
 	for (sample = 0;  sample < samples;  sample = limit) {
@@ -576,22 +548,12 @@ static int dtmf_detect(digit_detect_state_t *s, int16_t amp[], int samples,
 			limit = sample + (102 - s->td.dtmf.current_sample);
 		else
 			limit = samples;
-		/* The following unrolled loop takes only 35% (rough estimate) of the 
-		   time of a rolled loop on the machine on which it was developed */
 		for (j = sample; j < limit; j++) {
 			famp = amp[j];
 			s->td.dtmf.energy += famp*famp;
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			goertzel_sample(s->td.dtmf.row_out, amp[j]);
-			goertzel_sample(s->td.dtmf.col_out, amp[j]);
-			goertzel_sample(s->td.dtmf.row_out + 1, amp[j]);
-			goertzel_sample(s->td.dtmf.col_out + 1, amp[j]);
-			goertzel_sample(s->td.dtmf.row_out + 2, amp[j]);
-			goertzel_sample(s->td.dtmf.col_out + 2, amp[j]);
-			goertzel_sample(s->td.dtmf.row_out + 3, amp[j]);
-			goertzel_sample(s->td.dtmf.col_out + 3, amp[j]);
 		}
+		/* All eight row and column filters at once */
+		goertzel_bank(filters, 8, amp + sample, limit - sample);
 		s->td.dtmf.current_sample += (limit - sample);
 		if (s->td.dtmf.current_sample < 102) {
 			if (hit && !((digitmode & DSP_DIGITMODE_NOQUELCH))) {
@@ -681,12 +643,14 @@ static int mf_detect(digit_detect_state_t *s, int16_t amp[],
 	float energy[6];
 	int best;
 	int second_best;
-	float famp;
 	int i;
-	int j;
 	int sample;
 	int hit;
 	int limit;
+	goertzel_state_t *const filters[6] = {
+		&s->td.mf.tone_out[0], &s->td.mf.tone_out[1], &s->td.mf.tone_out[2],
+		&s->td.mf.tone_out[3], &s->td.mf.tone_out[4], &s->td.mf.tone_out[5],
+	};
 
 	hit = 0;
 	for (sample = 0;  sample < samples;  sample = limit) {
@@ -695,19 +659,8 @@ static int mf_detect(digit_detect_state_t *s, int16_t amp[],
 			limit = sample + (MF_GSIZE - s->td.mf.current_sample);
 		else
 			limit = samples;
-		/* The following unrolled loop takes only 35% (rough estimate) of the 
-		   time of a rolled loop on the machine on which it was developed */
-		for (j = sample;  j < limit;  j++) {
-			famp = amp[j];
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			goertzel_sample(s->td.mf.tone_out, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 1, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 2, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 3, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 4, amp[j]);
-			goertzel_sample(s->td.mf.tone_out + 5, amp[j]);
-		}
+		/* All six tone filters at once */
+		goertzel_bank(filters, 6, amp + sample, limit - sample);
 		s->td.mf.current_sample += (limit - sample);
 		if (s->td.mf.current_sample < MF_GSIZE) {
 			if (hit && !((digitmode & DSP_DIGITMODE_NOQUELCH))) {
@@ -890,16 +843,18 @@ static int __ast_dsp_call_progress(struct ast_dsp *dsp, short *s, int len)
 	int pass;
 	int newstate = DSP_TONE_STATE_SILENCE;
 	int res = 0;
+	goertzel_state_t *filters[7];
+
+	for (y = 0; y < dsp->freqcount; y++)
+		filters[y] = &dsp->freqs[y];
 	while (len) {
 		/* Take the lesser of the number of samples we need and what we have */
 		pass = len;
 		if (pass > dsp->gsamp_size - dsp->gsamps) 
 			pass = dsp->gsamp_size - dsp->gsamps;
-		for (x=0;x<pass;x++) {
-			for (y=0;y<dsp->freqcount;y++) 
-				goertzel_sample(&dsp->freqs[y], s[x]);
+		goertzel_bank(filters, dsp->freqcount, s, pass);
+		for (x=0;x<pass;x++)
 			dsp->genergy += s[x] * s[x];
-		}
 		s += pass;
 		dsp->gsamps += pass;
 		len -= pass;
@@ -1021,19 +976,44 @@ int ast_dsp_call_progress(struct ast_dsp *dsp, struct ast_frame *inf)
 	return __ast_dsp_call_progress(dsp, inf->data, inf->datalen / 2);
 }
 
-static int __ast_dsp_silence(struct ast_dsp *dsp, short *s, int len, int *totalsilence)
+/*! \brief Average energy (absolute sample value) of len samples of audio
+ * \note Works on ulaw and alaw directly; the magnitudes come from the
+ * decoding tables, without converting the frame to signed linear first.
+ * \return -1 for formats it does not know */
+static int dsp_energy(int format, const void *data, int len)
 {
-	int accum;
+	const short *s = data;
+	const unsigned char *c = data;
+	int accum = 0;
 	int x;
+
+	switch (format) {
+	case AST_FORMAT_SLINEAR:
+		for (x = 0; x < len; x++)
+			accum += abs(s[x]);
+		break;
+	case AST_FORMAT_ULAW:
+		for (x = 0; x < len; x++)
+			accum += abs(AST_MULAW(c[x]));
+		break;
+	case AST_FORMAT_ALAW:
+		for (x = 0; x < len; x++)
+			accum += abs(AST_ALAW(c[x]));
+		break;
+	default:
+		return -1;
+	}
+
+	return len ? accum / len : 0;
+}
+
+static int __ast_dsp_silence(struct ast_dsp *dsp, int energy, int len, int *totalsilence)
+{
 	int res = 0;
 
 	if (!len)
 		return 0;
-	accum = 0;
-	for (x=0;x<len; x++) 
-		accum += abs(s[x]);
-	accum /= len;
-	if (accum < dsp->threshold) {
+	if (energy < dsp->threshold) {
 		/* Silent */
 		dsp->totalsilence += len/8;
 		if (dsp->totalnoise) {
@@ -1166,20 +1146,20 @@ int ast_dsp_busydetect(struct ast_dsp *dsp)
 
 int ast_dsp_silence(struct ast_dsp *dsp, struct ast_frame *f, int *totalsilence)
 {
-	short *s;
-	int len;
-	
+	int len, energy;
+
 	if (f->frametype != AST_FRAME_VOICE) {
 		ast_log(LOG_WARNING, "Can't calculate silence on a non-voice frame\n");
 		return 0;
 	}
-	if (f->subclass != AST_FORMAT_SLINEAR) {
-		ast_log(LOG_WARNING, "Can only calculate silence on signed-linear frames :(\n");
+	len = ast_codec_get_samples(f);
+	if (!len)
+		return 0;
+	if ((energy = dsp_energy(f->subclass, f->data, len)) < 0) {
+		ast_log(LOG_WARNING, "Can only calculate silence on signed-linear, ulaw or alaw frames :(\n");
 		return 0;
 	}
-	s = f->data;
-	len = f->datalen/2;
-	return __ast_dsp_silence(dsp, s, len, totalsilence);
+	return __ast_dsp_silence(dsp, energy, len, totalsilence);
 }
 
 struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp, struct ast_frame *af)
@@ -1216,18 +1196,26 @@ struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp,
 		return af;
 	odata = af->data;
 	len = af->datalen;
-	/* Make sure we have short data */
+	/* Make sure we have short data, if a tone detector needs it */
 	switch (af->subclass) {
 	case AST_FORMAT_SLINEAR:
 		shortdata = af->data;
 		len = af->datalen / 2;
 		break;
 	case AST_FORMAT_ULAW:
+		if (!(dsp->features & DSP_FEATURE_TONES)) {
+			shortdata = NULL;
+			break;
+		}
 		shortdata = alloca(af->datalen * 2);
 		for (x = 0;x < len; x++) 
 			shortdata[x] = AST_MULAW(odata[x]);
 		break;
 	case AST_FORMAT_ALAW:
+		if (!(dsp->features & DSP_FEATURE_TONES)) {
+			shortdata = NULL;
+			break;
+		}
 		shortdata = alloca(af->datalen * 2);
 		for (x = 0; x < len; x++) 
 			shortdata[x] = AST_ALAW(odata[x]);
@@ -1236,7 +1224,8 @@ struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp,
 		ast_log(LOG_WARNING, "Inband DTMF is not supported on codec %s. Use RFC2833\n", ast_getformatname(af->subclass));
 		return af;
 	}
-	silence = __ast_dsp_silence(dsp, shortdata, len, NULL);
+	/* Without tone detectors, this is all the work done on the frame */
+	silence = __ast_dsp_silence(dsp, dsp_energy(af->subclass, af->data, len), len, NULL);
 	if ((dsp->features & DSP_FEATURE_SILENCE_SUPPRESS) && silence) {
 		memset(&dsp->f, 0, sizeof(dsp->f));
 		dsp->f.frametype = AST_FRAME_NULL;
@@ -29,6 +29,9 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 134087 $")
 
 #include <dirent.h>
 #include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "asterisk/_private.h"	/* declare ast_file_init() */
 #include "asterisk/paths.h"	/* use ast_config_AST_DATA_DIR */
@@ -633,6 +636,149 @@ struct ast_frame *ast_readframe(struct ast_filestream *s)
 	return f;
 }
 
+/*! \brief Samples given to each ast_translate_batch() call by
+ * ast_stream_convert(), one second at 8kHz */
+#define CONVERT_BATCH_SAMPLES	8000
+
+/*! \brief State of a conversion by ast_stream_convert() */
+struct stream_convert {
+	struct ast_filestream *out;
+	struct ast_trans_pvt *path;
+	int src;		/*!< format read */
+	int batch;		/*!< samples converted must be a multiple of this */
+	int chunk;		/*!< samples per frame written */
+	int samples;		/*!< samples waiting in inbuf */
+	int size;		/*!< samples inbuf and outbuf have space for */
+	char *inbuf;
+	char *outbuf;
+};
+
+/*!
+ * \brief Convert the samples waiting in the input buffer and write them out
+ *
+ * Only a multiple of the path's block size is converted; the remaining
+ * samples are moved to the start of the buffer.
+ */
+static int convert_flush(struct stream_convert *c)
+{
+	struct ast_frame f = { AST_FRAME_VOICE, };
+	int samples = c->samples - c->samples % c->batch, done;
+
+	if (!samples)
+		return 0;
+	if ((samples = ast_translate_batch(c->path, c->outbuf, c->inbuf, samples)) < 0)
+		return -1;
+
+	f.subclass = c->out->fmt->format;
+	f.src = "ast_stream_convert";
+	/* Write frames of the size the input came in, as ast_writestream() would
+	   have been given */
+	for (done = 0; done < samples; done += f.samples) {
+		f.samples = MIN(c->chunk, samples - done);
+		f.datalen = ast_codec_get_len(f.subclass, f.samples);
+		f.data = c->outbuf + ast_codec_get_len(f.subclass, done);
+		if (ast_writestream(c->out, &f))
+			return -1;
+	}
+
+	c->samples -= samples;
+	if (c->samples)
+		memmove(c->inbuf, c->inbuf + ast_codec_get_len(c->src, samples), ast_codec_get_len(c->src, c->samples));
+
+	return 0;
+}
+
+/*! \brief Add a frame to the input buffer, converting it first if it is full
+ * \retval 1 the frame cannot be batched */
+static int convert_add(struct stream_convert *c, struct ast_frame *f)
+{
+	int size;
+	char *inbuf, *outbuf;
+
+	if (f->frametype != AST_FRAME_VOICE || f->subclass != c->src || f->samples <= 0 ||
+	    f->datalen != ast_codec_get_len(c->src, f->samples))
+		return 1;
+
+	if (!c->chunk)
+		c->chunk = MAX(c->batch, f->samples - f->samples % c->batch);
+
+	if (c->samples + f->samples > c->size) {
+		if (convert_flush(c))
+			return -1;
+	}
+	if (c->samples + f->samples > c->size) {
+		size = MAX(CONVERT_BATCH_SAMPLES, c->samples + f->samples);
+		if (!(inbuf = ast_realloc(c->inbuf, ast_codec_get_len(c->src, size))))
+			return 1;
+		c->inbuf = inbuf;
+		if (!(outbuf = ast_realloc(c->outbuf, ast_codec_get_len(c->out->fmt->format, size))))
+			return 1;
+		c->outbuf = outbuf;
+		c->size = size;
+	}
+
+	memcpy(c->inbuf + ast_codec_get_len(c->src, c->samples), f->data, f->datalen);
+	c->samples += f->samples;
+
+	return 0;
+}
+
+/*! \brief Write out everything batched so far, and stop batching */
+static int convert_finish(struct stream_convert *c)
+{
+	struct ast_frame rest = { AST_FRAME_VOICE, };
+
+	if (convert_flush(c))
+		return -1;
+	c->batch = 0;
+	if (!c->samples)
+		return 0;
+
+	/* Less than a block is left, let the translator deal with it */
+	rest.subclass = c->src;
+	rest.samples = c->samples;
+	rest.datalen = ast_codec_get_len(c->src, c->samples);
+	rest.data = c->inbuf;
+	rest.src = "ast_stream_convert";
+	c->samples = 0;
+
+	return ast_writestream(c->out, &rest);
+}
+
+int ast_stream_convert(struct ast_filestream *in, struct ast_filestream *out)
+{
+	struct stream_convert c = { .out = out, .src = in->fmt->format, };
+	struct ast_frame *f;
+	int res = 0;
+
+	if (c.src != out->fmt->format && (c.src & AST_FORMAT_AUDIO_MASK) &&
+	    (c.path = ast_translator_build_path(out->fmt->format, c.src)))
+		c.batch = ast_translator_batch_samples(c.path);
+
+	while (!res && (f = ast_readframe(in))) {
+		if (c.batch) {
+			if (!(res = convert_add(&c, f)))
+				continue;
+			/* Anything that cannot be batched ends batching */
+			if (res < 0 || (res = convert_finish(&c)))
+				break;
+		}
+		res = ast_writestream(out, f);
+	}
+
+	if (!res && c.batch)
+		res = convert_finish(&c);
+
+	if (c.path)
+		ast_translator_free_path(c.path);
+	if (c.inbuf)
+		ast_free(c.inbuf);
+	if (c.outbuf)
+		ast_free(c.outbuf);
+
+	return res ? -1 : 0;
+}
+
 enum fsread_res {
 	FSREAD_FAILURE,
 	FSREAD_SUCCESS_SCHED,
@@ -892,7 +1038,121 @@ int ast_streamfile(struct ast_channel *chan, const char *filename, const char *p
 	return -1;
 }
 
-struct ast_filestream *ast_readfile(const char *filename, const char *type, const char *comment, int flags, int check, mode_t mode)
+#if defined(HAVE_MMAP) && (defined(HAVE_FUNOPEN) || defined(HAVE_FOPENCOOKIE))
+#define HAVE_MAPPED_READ
+
+/*! \brief A file mapped in memory, read through the FILE of fopen_mapped() */
+struct mapped_file {
+	char *data;
+	off_t size;
+	off_t pos;
+};
+
+#if defined(HAVE_FUNOPEN)	/* the BSD interface */
+static int mapped_read(void *cookie, char *buf, int size)
+#else
+static ssize_t mapped_read(void *cookie, char *buf, size_t size)
+#endif
+{
+	struct mapped_file *m = cookie;
+
+	if (size > m->size - m->pos)
+		size = m->size - m->pos;
+	memcpy(buf, m->data + m->pos, size);
+	m->pos += size;
+
+	return size;
+}
+
+/*! \brief Work out a new position, like lseek() \return -1 if it is outside the file */
+static off_t mapped_position(struct mapped_file *m, off_t offset, int whence)
+{
+	if (whence == SEEK_CUR)
+		offset += m->pos;
+	else if (whence == SEEK_END)
+		offset += m->size;
+	if (offset < 0 || offset > m->size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return m->pos = offset;
+}
+
+#if defined(HAVE_FUNOPEN)
+static fpos_t mapped_seek(void *cookie, fpos_t offset, int whence)
+{
+	return mapped_position(cookie, offset, whence);
+}
+#else
+static int mapped_seek(void *cookie, off64_t *offset, int whence)
+{
+	off_t pos = mapped_position(cookie, *offset, whence);
+
+	if (pos < 0)
+		return -1;
+	*offset = pos;
+
+	return 0;
+}
+#endif
+
+static int mapped_close(void *cookie)
+{
+	struct mapped_file *m = cookie;
+
+	munmap(m->data, m->size);
+	ast_free(m);
+
+	return 0;
+}
+
+/*!
+ * \brief Open a file for reading from a memory mapping of it
+ * \return NULL if the file cannot be mapped, e.g. because it is empty
+ */
+static FILE *fopen_mapped(const char *fn)
+{
+	struct mapped_file *m;
+	struct stat st;
+	FILE *f = NULL;
+	int fd;
+
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size || !(m = ast_calloc(1, sizeof(*m)))) {
+		close(fd);
+		return NULL;
+	}
+	m->size = st.st_size;
+	m->data = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m->data == MAP_FAILED) {
+		ast_free(m);
+		return NULL;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(m->data, m->size, MADV_SEQUENTIAL);
+#endif
+
+#if defined(HAVE_FUNOPEN)
+	f = funopen(m, mapped_read, NULL, mapped_seek, mapped_close);
+#else
+	{
+		static const cookie_io_functions_t cookie_funcs = {
+			mapped_read, NULL, mapped_seek, mapped_close
+		};
+		f = fopencookie(m, "r", cookie_funcs);
+	}
+#endif
+	if (!f)
+		mapped_close(m);
+
+	return f;
+}
+#endif /* HAVE_MMAP */
+
+static struct ast_filestream *readfile(const char *filename, const char *type, int flags, mode_t mode, int mapped)
 {
 	FILE *bfile;
 	struct ast_format *f;
@@ -911,12 +1171,20 @@ struct ast_filestream *ast_readfile(const char *filename, const char *type, cons
 
 		fn = build_filename(filename, type);
 		errno = 0;
-		bfile = fopen(fn, "r");
+		bfile = NULL;
+#ifdef HAVE_MAPPED_READ
+		if (mapped && !f->needs_fd)
+			bfile = fopen_mapped(fn);
+#endif
+		if (!bfile)
+			bfile = fopen(fn, "r");
 
 		if (!bfile || (fs = get_filestream(f, bfile)) == NULL || open_wrapper(fs) ) {
 			ast_log(LOG_WARNING, "Unable to open %s\n", fn);
-			if (fs)
+			if (fs) {
 				ast_free(fs);
+				fs = NULL;
+			}
 			if (bfile)
 				fclose(bfile);
 			ast_free(fn);
@@ -939,6 +1207,16 @@ struct ast_filestream *ast_readfile(const char *filename, const char *type, cons
 	return fs;
 }
 
+struct ast_filestream *ast_readfile(const char *filename, const char *type, const char *comment, int flags, int check, mode_t mode)
+{
+	return readfile(filename, type, flags, mode, 0);
+}
+
+struct ast_filestream *ast_readfile_mapped(const char *filename, const char *type)
+{
+	return readfile(filename, type, O_RDONLY, 0, 1);
+}
+
 struct ast_filestream *ast_writefile(const char *filename, const char *type, const char *comment, int flags, int check, mode_t mode)
 {
 	int fd, myflags = 0;
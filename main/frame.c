@@ -39,36 +39,101 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 129046 $")
 #include "asterisk/translate.h"
 #include "asterisk/dsp.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #ifdef TRACE_FRAMES
 static int headers;
 static AST_LIST_HEAD_STATIC(headerlist, ast_frame);
 #endif
 
 #if !defined(LOW_MEMORY)
-static void frame_cache_cleanup(void *data);
+/*!
+ * \brief Per-thread pools of frames
+ *
+ * Frames made by ast_frame_header_new() and ast_frdup() come from a pool
+ * belonging to the thread, in one of a few size classes, and go back to it
+ * when freed, so passing audio along does not call malloc() and free() for
+ * every packet.  A frame is often freed by another thread than the one that
+ * made it (the bridge thread frees what a channel driver's monitor thread
+ * read, for example); such frames are pushed, without a lock, on a stack
+ * the owning thread takes back whenever a free list of its runs out.
+ *
+ * A pool is freed once its thread has exited and all of its frames have
+ * come back.
+ */
+
+/*! Room for data (and source) after AST_FRIENDLY_OFFSET in each size class;
+ *  class 0 is a header alone */
+static const size_t frame_pool_payloads[] = {
+	0,
+	64,	/* GSM, G.729, iLBC, DTMF, control frames */
+	192,	/* 20ms of G.711 */
+	352,	/* 20ms of signed linear */
+	672,	/* 20ms of 16kHz or 40ms of 8kHz signed linear */
+	1312,	/* 40ms of 16kHz signed linear */
+};
 
-/*! \brief A per-thread cache of frame headers */
-AST_THREADSTORAGE_CUSTOM(frame_cache, NULL, frame_cache_cleanup);
+#define FRAME_POOL_CLASSES	ARRAY_LEN(frame_pool_payloads)
 
-/*! 
- * \brief Maximum ast_frame cache size
- *
- * In most cases where the frame header cache will be useful, the size
- * of the cache will stay very small.  However, it is not always the case that
- * the same thread that allocates the frame will be the one freeing them, so
- * sometimes a thread will never have any frames in its cache, or the cache
- * will never be pulled from.  For the latter case, we limit the maximum size. 
- */ 
-#define FRAME_CACHE_MAX_SIZE	10
-
-/*! \brief This is just so ast_frames, a list head struct for holding a list of
- *  ast_frame structures, is defined. */
-AST_LIST_HEAD_NOLOCK(ast_frames, ast_frame);
-
-struct ast_frame_cache {
-	struct ast_frames list;
-	size_t size;
+/*! Most frames of each size class a thread keeps for reuse */
+#define FRAME_POOL_MAX		64
+
+struct frame_pool;
+
+/*! \brief Precedes each frame from a pool */
+struct frame_block {
+	struct frame_pool *pool;
+	struct frame_block *next;
+	unsigned int class;
 };
+
+struct frame_pool_stats {
+	/*! Frames handed out from the free list */
+	unsigned long hits;
+	/*! Frames that had to be malloc'd */
+	unsigned long misses;
+	/*! Frames returned by other threads */
+	unsigned long remote;
+	/*! Frames freed because the free list was full */
+	unsigned long frees;
+};
+
+struct frame_pool {
+	struct frame_block *free[FRAME_POOL_CLASSES];
+	unsigned int count[FRAME_POOL_CLASSES];
+	/*! Frames freed by other threads */
+	struct frame_block * volatile returned;
+#if !defined(HAVE_GCC_ATOMICS)
+	ast_mutex_t lock;
+#endif
+	/*! One for the owning thread, and one for each frame in existence */
+	volatile int refs;
+	/*! Set when the owning thread has exited */
+	volatile int dead;
+	struct frame_pool_stats stats[FRAME_POOL_CLASSES];
+	/*! Frames too big for any size class */
+	unsigned long oversize;
+	AST_LIST_ENTRY(frame_pool) list;
+};
+
+struct frame_pool_ref {
+	struct frame_pool *pool;
+};
+
+static int frame_pool_init(void *data);
+static void frame_pool_cleanup(void *data);
+
+/*! \brief The pool of each thread */
+AST_THREADSTORAGE_CUSTOM(frame_pool_ts, frame_pool_init, frame_pool_cleanup);
+
+/*! The pools of running threads, for the CLI */
+static AST_LIST_HEAD_STATIC(frame_pools, frame_pool);
+
+/*! Statistics of pools whose thread has exited */
+static struct frame_pool_stats frame_pool_totals[FRAME_POOL_CLASSES];
+static unsigned long frame_pool_oversize;
 #endif
 
 #define SMOOTHER_SIZE 8000
@@ -257,30 +322,240 @@ void ast_smoother_free(struct ast_smoother *s)
 	ast_free(s);
 }
 
-static struct ast_frame *ast_frame_header_new(void)
+#if !defined(LOW_MEMORY)
+static size_t frame_pool_size(unsigned int class)
 {
-	struct ast_frame *f;
+	return sizeof(struct ast_frame) + (class ? AST_FRIENDLY_OFFSET + frame_pool_payloads[class] : 0);
+}
 
-#if !defined(LOW_MEMORY)
-	struct ast_frame_cache *frames;
-
-	if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames)))) {
-		if ((f = AST_LIST_REMOVE_HEAD(&frames->list, frame_list))) {
-			size_t mallocd_len = f->mallocd_hdr_len;
-			memset(f, 0, sizeof(*f));
-			f->mallocd_hdr_len = mallocd_len;
-			f->mallocd = AST_MALLOCD_HDR;
-			frames->size--;
-			return f;
+static int frame_pool_init(void *data)
+{
+	struct frame_pool_ref *ref = data;
+	struct frame_pool *pool;
+
+	if (!(pool = ast_calloc(1, sizeof(*pool))))
+		return -1;
+	pool->refs = 1;
+#if !defined(HAVE_GCC_ATOMICS)
+	ast_mutex_init(&pool->lock);
+#endif
+	AST_LIST_LOCK(&frame_pools);
+	AST_LIST_INSERT_TAIL(&frame_pools, pool, list);
+	AST_LIST_UNLOCK(&frame_pools);
+	ref->pool = pool;
+
+	return 0;
+}
+
+static void frame_pool_unref(struct frame_pool *pool)
+{
+	if (!ast_atomic_dec_and_test(&pool->refs))
+		return;
+#if !defined(HAVE_GCC_ATOMICS)
+	ast_mutex_destroy(&pool->lock);
+#endif
+	ast_free(pool);
+}
+
+static void frame_block_destroy(struct frame_block *b)
+{
+	struct frame_pool *pool = b->pool;
+
+	ast_free(b);
+	frame_pool_unref(pool);
+}
+
+/*! \brief Give a frame of another thread back to its pool */
+static void frame_pool_push(struct frame_pool *pool, struct frame_block *b)
+{
+#if defined(HAVE_GCC_ATOMICS)
+	do {
+		b->next = pool->returned;
+	} while (!__sync_bool_compare_and_swap(&pool->returned, b->next, b));
+#else
+	ast_mutex_lock(&pool->lock);
+	b->next = pool->returned;
+	pool->returned = b;
+	ast_mutex_unlock(&pool->lock);
+#endif
+}
+
+/*! \brief Take all of the frames given back by other threads */
+static struct frame_block *frame_pool_take(struct frame_pool *pool)
+{
+	struct frame_block *b;
+
+#if defined(HAVE_GCC_ATOMICS)
+	b = __sync_lock_test_and_set(&pool->returned, NULL);
+#else
+	ast_mutex_lock(&pool->lock);
+	b = pool->returned;
+	pool->returned = NULL;
+	ast_mutex_unlock(&pool->lock);
+#endif
+
+	return b;
+}
+
+/*! \brief Put a frame on its free list, by the owning thread */
+static void frame_pool_put(struct frame_pool *pool, struct frame_block *b)
+{
+	if (pool->count[b->class] < FRAME_POOL_MAX) {
+		b->next = pool->free[b->class];
+		pool->free[b->class] = b;
+		pool->count[b->class]++;
+	} else {
+		pool->stats[b->class].frees++;
+		frame_block_destroy(b);
+	}
+}
+
+/*! \brief Free the frames given back to a pool whose thread has exited */
+static void frame_pool_drain(struct frame_pool *pool)
+{
+	struct frame_block *b, *next;
+
+	for (b = frame_pool_take(pool); b; b = next) {
+		next = b->next;
+		frame_block_destroy(b);
+	}
+}
+
+static void frame_pool_cleanup(void *data)
+{
+	struct frame_pool_ref *ref = data;
+	struct frame_pool *pool = ref->pool;
+	struct frame_block *b;
+	unsigned int class;
+
+	AST_LIST_LOCK(&frame_pools);
+	AST_LIST_REMOVE(&frame_pools, pool, list);
+	for (class = 0; class < FRAME_POOL_CLASSES; class++) {
+		frame_pool_totals[class].hits += pool->stats[class].hits;
+		frame_pool_totals[class].misses += pool->stats[class].misses;
+		frame_pool_totals[class].remote += pool->stats[class].remote;
+		frame_pool_totals[class].frees += pool->stats[class].frees;
+	}
+	frame_pool_oversize += pool->oversize;
+	AST_LIST_UNLOCK(&frame_pools);
+
+	/* From here on, threads freeing our frames free them themselves */
+	ast_atomic_fetchadd_int(&pool->dead, 1);
+	for (class = 0; class < FRAME_POOL_CLASSES; class++) {
+		while ((b = pool->free[class])) {
+			pool->free[class] = b->next;
+			frame_block_destroy(b);
 		}
 	}
-	if (!(f = ast_calloc_cache(1, sizeof(*f))))
+	frame_pool_drain(pool);
+	frame_pool_unref(pool);
+
+	ast_free(ref);
+}
+
+/*!
+ * \brief Get a frame of at least len bytes from the thread's pool
+ * \return the frame, with only its header cleared, or NULL if it has to be
+ * malloc'd instead
+ */
+static struct ast_frame *frame_pool_alloc(size_t len)
+{
+	struct frame_pool_ref *ref;
+	struct frame_pool *pool;
+	struct frame_block *b, *next;
+	struct ast_frame *f;
+	unsigned int class;
+
+	if (!(ref = ast_threadstorage_get(&frame_pool_ts, sizeof(*ref))))
 		return NULL;
-#else
-	if (!(f = ast_calloc(1, sizeof(*f))))
+	pool = ref->pool;
+
+	for (class = 0; class < FRAME_POOL_CLASSES && frame_pool_size(class) < len; class++);
+	if (class == FRAME_POOL_CLASSES) {
+		pool->oversize++;
 		return NULL;
+	}
+
+	if (!pool->free[class]) {
+		for (b = frame_pool_take(pool); b; b = next) {
+			next = b->next;
+			pool->stats[b->class].remote++;
+			frame_pool_put(pool, b);
+		}
+	}
+
+	if ((b = pool->free[class])) {
+		pool->free[class] = b->next;
+		pool->count[class]--;
+		pool->stats[class].hits++;
+	} else {
+		if (!(b = ast_malloc(sizeof(*b) + frame_pool_size(class))))
+			return NULL;
+		b->pool = pool;
+		b->class = class;
+		ast_atomic_fetchadd_int(&pool->refs, 1);
+		pool->stats[class].misses++;
+	}
+
+	f = (struct ast_frame *) (b + 1);
+	memset(f, 0, sizeof(*f));
+	f->mallocd_hdr_len = frame_pool_size(class);
+	f->mallocd = AST_MALLOCD_HDR;
+	ast_set_flag(f, AST_FRFLAG_FROM_POOL);
+
+	return f;
+}
+
+/*! \brief Return a frame to the pool it came from */
+static void frame_pool_release(struct ast_frame *f, int cache)
+{
+	struct frame_block *b = (struct frame_block *) f - 1;
+	struct frame_pool *pool = b->pool;
+	struct frame_pool_ref *ref;
+
+	if (!cache) {
+		frame_block_destroy(b);
+		return;
+	}
+
+	if ((ref = ast_threadstorage_get(&frame_pool_ts, sizeof(*ref))) && ref->pool == pool) {
+		frame_pool_put(pool, b);
+		return;
+	}
+
+	/* Keep the pool around while giving the frame back, in case its
+	 * thread exits meanwhile */
+	ast_atomic_fetchadd_int(&pool->refs, 1);
+	frame_pool_push(pool, b);
+	if (pool->dead)
+		frame_pool_drain(pool);
+	frame_pool_unref(pool);
+}
 #endif
 
+/*! \brief Free a frame header, wherever it came from */
+static void frame_header_free(struct ast_frame *f, int cache)
+{
+#if !defined(LOW_MEMORY)
+	if (ast_test_flag(f, AST_FRFLAG_FROM_POOL)) {
+		frame_pool_release(f, cache);
+		return;
+	}
+#endif
+	ast_free(f);
+}
+
+static struct ast_frame *ast_frame_header_new(void)
+{
+	struct ast_frame *f;
+
+#if !defined(LOW_MEMORY)
+	if ((f = frame_pool_alloc(sizeof(*f))))
+		return f;
+#endif
+	if (!(f = ast_calloc(1, sizeof(*f))))
+		return NULL;
+
 	f->mallocd_hdr_len = sizeof(*f);
 #ifdef TRACE_FRAMES
 	AST_LIST_LOCK(&headerlist);
@@ -292,19 +567,6 @@ static struct ast_frame *ast_frame_header_new(void)
 	return f;
 }
 
-#if !defined(LOW_MEMORY)
-static void frame_cache_cleanup(void *data)
-{
-	struct ast_frame_cache *frames = data;
-	struct ast_frame *f;
-
-	while ((f = AST_LIST_REMOVE_HEAD(&frames->list, frame_list)))
-		ast_free(f);
-	
-	ast_free(frames);
-}
-#endif
-
 void ast_frame_free(struct ast_frame *fr, int cache)
 {
 	if (ast_test_flag(fr, AST_FRFLAG_FROM_TRANSLATOR))
@@ -315,21 +577,6 @@ void ast_frame_free(struct ast_frame *fr, int cache)
 	if (!fr->mallocd)
 		return;
 
-#if !defined(LOW_MEMORY)
-	if (cache && fr->mallocd == AST_MALLOCD_HDR) {
-		/* Cool, only the header is malloc'd, let's just cache those for now 
-		 * to keep things simple... */
-		struct ast_frame_cache *frames;
-
-		if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames))) 
-		    && frames->size < FRAME_CACHE_MAX_SIZE) {
-			AST_LIST_INSERT_HEAD(&frames->list, fr, frame_list);
-			frames->size++;
-			return;
-		}
-	}
-#endif
-	
 	if (fr->mallocd & AST_MALLOCD_DATA) {
 		if (fr->data) 
 			ast_free(fr->data - fr->offset);
@@ -345,7 +592,7 @@ void ast_frame_free(struct ast_frame *fr, int cache)
 		AST_LIST_REMOVE(&headerlist, fr, frame_list);
 		AST_LIST_UNLOCK(&headerlist);
 #endif			
-		ast_free(fr);
+		frame_header_free(fr, cache);
 	}
 }
 
@@ -386,7 +633,7 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 		if (fr->src) {
 			if (!(out->src = ast_strdup(fr->src))) {
 				if (out != fr)
-					ast_free(out);
+					frame_header_free(out, 1);
 				return NULL;
 			}
 		}
@@ -398,7 +645,7 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 			if (out->src != fr->src)
 				ast_free((void *) out->src);
 			if (out != fr)
-				ast_free(out);
+				frame_header_free(out, 1);
 			return NULL;
 		}
 		newdata += AST_FRIENDLY_OFFSET;
@@ -419,10 +666,6 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 	int len, srclen = 0;
 	void *buf = NULL;
 
-#if !defined(LOW_MEMORY)
-	struct ast_frame_cache *frames;
-#endif
-
 	/* Start with standard stuff */
 	len = sizeof(*out) + AST_FRIENDLY_OFFSET + f->datalen;
 	/* If we have a source, add space for it */
@@ -436,21 +679,8 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 		len += srclen + 1;
 	
 #if !defined(LOW_MEMORY)
-	if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames)))) {
-		AST_LIST_TRAVERSE_SAFE_BEGIN(&frames->list, out, frame_list) {
-			if (out->mallocd_hdr_len >= len) {
-				size_t mallocd_len = out->mallocd_hdr_len;
-
-				AST_LIST_REMOVE_CURRENT(frame_list);
-				memset(out, 0, sizeof(*out));
-				out->mallocd_hdr_len = mallocd_len;
-				buf = out;
-				frames->size--;
-				break;
-			}
-		}
-		AST_LIST_TRAVERSE_SAFE_END;
-	}
+	if ((out = frame_pool_alloc(len)))
+		buf = out;
 #endif
 
 	if (!buf) {
@@ -924,6 +1154,66 @@ static char *show_frame_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_a
 }
 #endif
 
+#if !defined(LOW_MEMORY)
+static char *show_frame_pools(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-6s %6s %8s %12s %12s %12s %12s\n"
+#define FORMAT2 "%-6u %6u %8u %12lu %12lu %12lu %12lu\n"
+	struct frame_pool_stats stats[FRAME_POOL_CLASSES];
+	unsigned int cached[FRAME_POOL_CLASSES];
+	struct frame_pool *pool;
+	unsigned long oversize;
+	unsigned int class;
+	int threads = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show frame pools";
+		e->usage =
+			"Usage: core show frame pools\n"
+			"       Shows how well the per-thread frame pools are doing, for\n"
+			"       each size class: frames kept for reuse, frames reused,\n"
+			"       frames malloc'd, frames returned by other threads, and\n"
+			"       frames freed because a thread already had enough.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4)
+		return CLI_SHOWUSAGE;
+
+	memset(cached, 0, sizeof(cached));
+	AST_LIST_LOCK(&frame_pools);
+	memcpy(stats, frame_pool_totals, sizeof(stats));
+	oversize = frame_pool_oversize;
+	AST_LIST_TRAVERSE(&frame_pools, pool, list) {
+		for (class = 0; class < FRAME_POOL_CLASSES; class++) {
+			cached[class] += pool->count[class];
+			stats[class].hits += pool->stats[class].hits;
+			stats[class].misses += pool->stats[class].misses;
+			stats[class].remote += pool->stats[class].remote;
+			stats[class].frees += pool->stats[class].frees;
+		}
+		oversize += pool->oversize;
+		threads++;
+	}
+	AST_LIST_UNLOCK(&frame_pools);
+
+	ast_cli(a->fd, FORMAT, "Class", "Size", "Cached", "Reused", "Malloc'd", "Returned", "Freed");
+	for (class = 0; class < FRAME_POOL_CLASSES; class++) {
+		ast_cli(a->fd, FORMAT2, class, (unsigned int) frame_pool_size(class), cached[class],
+			stats[class].hits, stats[class].misses, stats[class].remote, stats[class].frees);
+	}
+	ast_cli(a->fd, "%d thread%s with a frame pool, %lu frame%s too big for one\n",
+		threads, ESS(threads), oversize, ESS(oversize));
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+#endif
+
 /* Builtin Asterisk CLI-commands for debugging */
 static struct ast_cli_entry my_clis[] = {
 	AST_CLI_DEFINE(show_codecs, "Displays a list of codecs"),
@@ -931,6 +1221,9 @@ static struct ast_cli_entry my_clis[] = {
 #ifdef TRACE_FRAMES
 	AST_CLI_DEFINE(show_frame_stats, "Shows frame statistics"),
 #endif
+#if !defined(LOW_MEMORY)
+	AST_CLI_DEFINE(show_frame_pools, "Shows frame pool statistics"),
+#endif
 };
 
 int init_framer(void)
@@ -1481,34 +1774,109 @@ int ast_codec_get_len(int format, int samples)
 	return len;
 }
 
-int ast_frame_adjust_volume(struct ast_frame *f, int adjustment)
+#ifdef __SSE2__
+/*
+ * SSE2 is part of every x86_64 CPU, so these need no check at runtime.  The
+ * saturating helpers in utils.h clip to -32767, not -32768, hence the
+ * _mm_max_epi16() after each saturating instruction.
+ */
+
+/*! \brief Multiply eight samples, keeping the full products before clipping */
+static inline __m128i slin_multiply8(__m128i a, __m128i v)
 {
-	int count;
-	short *fdata = f->data;
-	short adjust_value = abs(adjustment);
+	__m128i lo = _mm_mullo_epi16(a, v), hi = _mm_mulhi_epi16(a, v);
 
-	if ((f->frametype != AST_FRAME_VOICE) || (f->subclass != AST_FORMAT_SLINEAR))
-		return -1;
+	return _mm_packs_epi32(_mm_unpacklo_epi16(lo, hi), _mm_unpackhi_epi16(lo, hi));
+}
+
+/*!
+ * \brief Divide eight samples, truncating like C does
+ *
+ * Single precision division is exact enough: a 16 bit dividend and divisor
+ * never give a quotient that rounds across an integer.
+ */
+static inline __m128i slin_divide8(__m128i a, __m128 v)
+{
+	__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16));
+	__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16));
+
+	return _mm_packs_epi32(_mm_cvttps_epi32(_mm_div_ps(lo, v)), _mm_cvttps_epi32(_mm_div_ps(hi, v)));
+}
+#endif
+
+void ast_slinear_adjust_volume(short *data, int samples, int adjustment)
+{
+	short adjust_value = abs(adjustment);
+	int count = 0;
 
 	if (!adjustment)
-		return 0;
+		return;
+
+#ifdef __SSE2__
+	if (adjustment > 0) {
+		__m128i v = _mm_set1_epi16(adjust_value), min = _mm_set1_epi16(-32767);
 
-	for (count = 0; count < f->samples; count++) {
-		if (adjustment > 0) {
-			ast_slinear_saturated_multiply(&fdata[count], &adjust_value);
-		} else if (adjustment < 0) {
-			ast_slinear_saturated_divide(&fdata[count], &adjust_value);
+		for (; count + 8 <= samples; count += 8) {
+			__m128i a = _mm_loadu_si128((__m128i *) (data + count));
+			_mm_storeu_si128((__m128i *) (data + count), _mm_max_epi16(slin_multiply8(a, v), min));
 		}
+	} else {
+		__m128 v = _mm_set1_ps(adjust_value);
+
+		for (; count + 8 <= samples; count += 8) {
+			__m128i a = _mm_loadu_si128((__m128i *) (data + count));
+			_mm_storeu_si128((__m128i *) (data + count), slin_divide8(a, v));
+		}
+	}
+#endif
+
+	for (; count < samples; count++) {
+		if (adjustment > 0)
+			ast_slinear_saturated_multiply(&data[count], &adjust_value);
+		else
+			ast_slinear_saturated_divide(&data[count], &adjust_value);
+	}
+}
+
+void ast_slinear_sum(short *dst, const short *src, int samples)
+{
+	ast_slinear_sum_multiple(dst, &src, 1, samples);
+}
+
+void ast_slinear_sum_multiple(short *dst, const short * const *src, int sources, int samples)
+{
+	int count = 0, i;
+
+#ifdef __SSE2__
+	__m128i min = _mm_set1_epi16(-32767);
+
+	/* Each block of dst stays in a register while every source is added in */
+	for (; count + 8 <= samples; count += 8) {
+		__m128i acc = _mm_loadu_si128((__m128i *) (dst + count));
+		for (i = 0; i < sources; i++)
+			acc = _mm_max_epi16(_mm_adds_epi16(acc, _mm_loadu_si128((__m128i *) (src[i] + count))), min);
+		_mm_storeu_si128((__m128i *) (dst + count), acc);
 	}
+#endif
+
+	for (; count < samples; count++) {
+		for (i = 0; i < sources; i++)
+			ast_slinear_saturated_add(&dst[count], (short *) &src[i][count]);
+	}
+}
+
+int ast_frame_adjust_volume(struct ast_frame *f, int adjustment)
+{
+	if ((f->frametype != AST_FRAME_VOICE) || (f->subclass != AST_FORMAT_SLINEAR))
+		return -1;
+
+	ast_slinear_adjust_volume(f->data, f->samples, adjustment);
 
 	return 0;
 }
 
 int ast_frame_slinear_sum(struct ast_frame *f1, struct ast_frame *f2)
 {
-	int count;
-	short *data1, *data2;
-
 	if ((f1->frametype != AST_FRAME_VOICE) || (f1->subclass != AST_FORMAT_SLINEAR))
 		return -1;
 
@@ -1518,10 +1886,7 @@ int ast_frame_slinear_sum(struct ast_frame *f1, struct ast_frame *f2)
 	if (f1->samples != f2->samples)
 		return -1;
 
-	for (count = 0, data1 = f1->data, data2 = f2->data;
-	     count < f1->samples;
-	     count++, data1++, data2++)
-		ast_slinear_saturated_add(data1, data2);
+	ast_slinear_sum(f1->data, f2->data, f1->samples);
 
 	return 0;
 }
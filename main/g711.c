@@ -0,0 +1,171 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief G.711 conversion of whole frames
+ *
+ * ast_ulaw_decode() and friends convert a buffer at a time with the
+ * fastest kernels the CPU can run, chosen once at startup.  SIMD kernels
+ * are only chosen after checking that they agree with the lookup tables
+ * for every possible input, so which ones run never changes the audio.
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/_private.h"
+#include "asterisk/ulaw.h"
+#include "asterisk/alaw.h"
+#include "asterisk/logger.h"
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+
+#include "g711.h"
+
+static void scalar_ulaw_decode(int16_t *dst, const unsigned char *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_MULAW(*src++);
+}
+
+static void scalar_ulaw_encode(unsigned char *dst, const int16_t *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_LIN2MU(*src++);
+}
+
+static void scalar_alaw_decode(int16_t *dst, const unsigned char *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_ALAW(*src++);
+}
+
+static void scalar_alaw_encode(unsigned char *dst, const int16_t *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_LIN2A(*src++);
+}
+
+const struct g711_kernels g711_scalar_kernels = {
+	.name = "scalar",
+	.ulaw_decode = scalar_ulaw_decode,
+	.ulaw_encode = scalar_ulaw_encode,
+	.alaw_decode = scalar_alaw_decode,
+	.alaw_encode = scalar_alaw_encode,
+};
+
+/*! The kernels in use; the scalar ones until ast_g711_init() picks */
+static const struct g711_kernels *kernels = &g711_scalar_kernels;
+
+/* __builtin_cpu_supports() checks that the OS saves the AVX registers, too */
+#if (defined(__i386__) || defined(__x86_64__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#define G711_CPU_DISPATCH
+#endif
+
+int g711_kernels_available(const struct g711_kernels **list, int len)
+{
+	const struct g711_kernels *k;
+	int count = 0;
+
+#ifdef G711_CPU_DISPATCH
+	__builtin_cpu_init();
+	if (count < len - 1 && __builtin_cpu_supports("avx2") && (k = g711_avx2_kernels()))
+		list[count++] = k;
+	if (count < len - 1 && __builtin_cpu_supports("sse2") && (k = g711_sse2_kernels()))
+		list[count++] = k;
+#endif
+	k = &g711_scalar_kernels;
+	if (count < len)
+		list[count++] = k;
+
+	return count;
+}
+
+int g711_kernels_verify(const struct g711_kernels *k)
+{
+	int16_t *lin, *res16;
+	unsigned char *res8, codes[257];
+	int i, j, ok = 1;
+
+	/* Every linear sample, then room for the results */
+	if (!(lin = ast_malloc(65536 * (2 * sizeof(*lin) + 1))))
+		return 0;
+	res16 = lin + 65536;
+	res8 = (unsigned char *) (res16 + 65536);
+
+	for (i = 0; i < 65536; i++)
+		lin[i] = i - 32768;
+	for (i = 0; i < 257; i++)
+		codes[i] = i & 0xff;
+
+	/* Odd lengths make the kernels run their tails too */
+	for (j = 0; j < 2; j++) {
+		k->ulaw_encode(res8, lin + j, 65536 - j);
+		for (i = 0; ok && i < 65536 - j; i++)
+			ok = (res8[i] == AST_LIN2MU(lin[i + j]));
+		k->alaw_encode(res8, lin + j, 65536 - j);
+		for (i = 0; ok && i < 65536 - j; i++)
+			ok = (res8[i] == AST_LIN2A(lin[i + j]));
+	}
+	k->ulaw_decode(res16, codes, 257);
+	for (i = 0; ok && i < 257; i++)
+		ok = (res16[i] == AST_MULAW(codes[i]));
+	k->alaw_decode(res16, codes, 257);
+	for (i = 0; ok && i < 257; i++)
+		ok = (res16[i] == AST_ALAW(codes[i]));
+
+	ast_free(lin);
+
+	return ok;
+}
+
+void ast_g711_init(void)
+{
+	const struct g711_kernels *list[4];
+	int i, count;
+
+	count = g711_kernels_available(list, ARRAY_LEN(list));
+	for (i = 0; i < count - 1; i++) {
+		if (g711_kernels_verify(list[i]))
+			break;
+		ast_log(LOG_WARNING, "%s G.711 kernels do not match the lookup tables, not using them\n", list[i]->name);
+	}
+	kernels = list[i];
+	ast_verb(2, "Using %s G.711 kernels\n", kernels->name);
+}
+
+void ast_ulaw_decode(int16_t *dst, const unsigned char *src, int samples)
+{
+	kernels->ulaw_decode(dst, src, samples);
+}
+
+void ast_ulaw_encode(unsigned char *dst, const int16_t *src, int samples)
+{
+	kernels->ulaw_encode(dst, src, samples);
+}
+
+void ast_alaw_decode(int16_t *dst, const unsigned char *src, int samples)
+{
+	kernels->alaw_decode(dst, src, samples);
+}
+
+void ast_alaw_encode(unsigned char *dst, const int16_t *src, int samples)
+{
+	kernels->alaw_encode(dst, src, samples);
+}
@@ -0,0 +1,68 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief G.711 frame conversion kernels
+ *
+ * Each set of kernels converts whole buffers, giving exactly the results
+ * of the AST_LIN2MU(), AST_MULAW(), AST_LIN2A() and AST_ALAW() tables.
+ */
+
+#ifndef _G711_H_
+#define _G711_H_
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+struct g711_kernels {
+	/*! Instruction set, for messages */
+	const char *name;
+	void (*ulaw_decode)(int16_t *dst, const unsigned char *src, int samples);
+	void (*ulaw_encode)(unsigned char *dst, const int16_t *src, int samples);
+	void (*alaw_decode)(int16_t *dst, const unsigned char *src, int samples);
+	void (*alaw_encode)(unsigned char *dst, const int16_t *src, int samples);
+};
+
+/*! One table lookup per sample; works everywhere */
+extern const struct g711_kernels g711_scalar_kernels;
+
+/*!
+ * \brief The SSE2 and AVX2 kernels
+ * \return the kernels, or NULL if the compiler could not build them.
+ * \note Only call these after checking that the CPU has the instructions.
+ */
+const struct g711_kernels *g711_sse2_kernels(void);
+const struct g711_kernels *g711_avx2_kernels(void);
+
+/*!
+ * \brief Every set of kernels the CPU can run, fastest first
+ *
+ * \param list where to put them, ending with g711_scalar_kernels
+ * \param len room in list
+ * \return how many were put in list
+ */
+int g711_kernels_available(const struct g711_kernels **list, int len);
+
+/*! \brief Whether kernels give the same results as the scalar ones for every input */
+int g711_kernels_verify(const struct g711_kernels *k);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _G711_H_ */
@@ -0,0 +1,193 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief AVX2 G.711 kernels
+ *
+ * The SSE2 kernels (see g711_sse2.c) widened to sixteen samples at a time.
+ *
+ * This file is built with -mavx2 when the compiler takes it; the kernels
+ * must only be run on CPUs that have AVX2.
+ */
+
+#include "asterisk.h"
+
+/* No ASTERISK_FILE_VERSION(): its constructor would be built for the same
+ * instruction set, and runs on every CPU */
+
+#include "asterisk/ulaw.h"
+#include "asterisk/alaw.h"
+
+#include "g711.h"
+
+#if defined(__AVX2__) && !defined(G711_NEW_ALGORITHM)
+
+#include <immintrin.h>
+
+#define U(x)	_mm256_set1_epi16(x)
+
+/*! \brief 2 to the power of each (0 to 7) of e */
+static inline __m256i pow2(__m256i e)
+{
+	__m256i one = U(1);
+	__m256i p1 = _mm256_add_epi16(one, _mm256_and_si256(e, one));
+	__m256i p2 = _mm256_add_epi16(one, _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_and_si256(e, U(2)), U(2)), U(3)));
+	__m256i p4 = _mm256_add_epi16(one, _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_and_si256(e, U(4)), U(4)), U(15)));
+
+	return _mm256_mullo_epi16(_mm256_mullo_epi16(p1, p2), p4);
+}
+
+/*!
+ * \brief The exponent and top mantissa bits of each of sixteen magnitudes
+ *
+ * Converting to float normalizes the value: the 8 bit exponent then holds
+ * where its leading 1 is, and the top 4 bits of the mantissa the bits
+ * after it, which is what the codes are made of.  So the result of each
+ * lane is (127 + log2(mag)) << 4, or'ed with those 4 bits.
+ */
+static inline __m256i float_bits(__m256i mag)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_unpacklo_epi16(mag, zero)));
+	__m256i hi = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_unpackhi_epi16(mag, zero)));
+
+	return _mm256_packs_epi32(_mm256_srli_epi32(lo, 19), _mm256_srli_epi32(hi, 19));
+}
+
+/*! \brief Encode sixteen samples to u-law, one code in each 16 bit lane */
+static inline __m256i ulaw_encode16(__m256i s)
+{
+	__m256i sign, mag, m;
+
+	s = _mm256_or_si256(s, U(3));
+	sign = _mm256_srai_epi16(s, 15);
+	mag = _mm256_sub_epi16(_mm256_xor_si256(s, sign), sign);
+	mag = _mm256_min_epi16(mag, U(32635));
+	/* At least 0x84, so the leading 1 is at bit 7 (exponent 0) or above */
+	m = _mm256_sub_epi16(float_bits(_mm256_add_epi16(mag, U(0x84))), U((127 + 7) << 4));
+	m = _mm256_or_si256(m, _mm256_and_si256(sign, U(0x80)));
+
+	return _mm256_xor_si256(m, U(0xff));
+}
+
+/*! \brief Encode sixteen samples to A-law, one code in each 16 bit lane */
+static inline __m256i alaw_encode16(__m256i s)
+{
+	__m256i neg, mag, m, small;
+
+	s = _mm256_or_si256(s, U(7));
+	neg = _mm256_srai_epi16(s, 15);
+	mag = _mm256_sub_epi16(_mm256_xor_si256(s, neg), neg);
+	/* Segment 0 is linear, the others are like u-law */
+	small = _mm256_cmpgt_epi16(U(0x100), mag);
+	m = _mm256_sub_epi16(float_bits(mag), U((127 + 7) << 4));
+	m = _mm256_or_si256(_mm256_andnot_si256(small, m), _mm256_and_si256(small, _mm256_srli_epi16(mag, 4)));
+
+	return _mm256_xor_si256(m, _mm256_or_si256(U(AST_ALAW_AMI_MASK), _mm256_andnot_si256(neg, U(0x80))));
+}
+
+/*! \brief Decode sixteen u-law codes, given in 16 bit lanes */
+static inline __m256i ulaw_decode16(__m256i c)
+{
+	__m256i mu = _mm256_xor_si256(c, U(0xff));
+	__m256i e = _mm256_and_si256(_mm256_srli_epi16(mu, 4), U(7));
+	__m256i y = _mm256_add_epi16(_mm256_slli_epi16(_mm256_and_si256(mu, U(0x0f)), 3), U(132));
+	__m256i neg = _mm256_cmpgt_epi16(mu, U(0x7f));
+
+	y = _mm256_sub_epi16(_mm256_mullo_epi16(y, pow2(e)), U(132));
+
+	return _mm256_sub_epi16(_mm256_xor_si256(y, neg), neg);
+}
+
+/*! \brief Decode sixteen A-law codes, given in 16 bit lanes */
+static inline __m256i alaw_decode16(__m256i c)
+{
+	__m256i a = _mm256_xor_si256(c, U(AST_ALAW_AMI_MASK));
+	__m256i i = _mm256_add_epi16(_mm256_slli_epi16(_mm256_and_si256(a, U(0x0f)), 4), U(8));
+	__m256i seg = _mm256_and_si256(_mm256_srli_epi16(a, 4), U(7));
+	__m256i nz = _mm256_cmpgt_epi16(seg, _mm256_setzero_si256());
+	__m256i neg = _mm256_cmpeq_epi16(_mm256_and_si256(a, U(0x80)), _mm256_setzero_si256());
+
+	i = _mm256_add_epi16(i, _mm256_and_si256(nz, U(0x100)));
+	i = _mm256_mullo_epi16(i, pow2(_mm256_add_epi16(seg, nz)));
+
+	return _mm256_sub_epi16(_mm256_xor_si256(i, neg), neg);
+}
+
+static void avx2_ulaw_decode(int16_t *dst, const unsigned char *src, int samples)
+{
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		__m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) src));
+		_mm256_storeu_si256((__m256i *) dst, ulaw_decode16(c));
+	}
+	while (samples--)
+		*dst++ = AST_MULAW(*src++);
+}
+
+/*! \brief Pack sixteen codes in 16 bit lanes to bytes, in order */
+static inline __m128i pack16(__m256i c)
+{
+	return _mm_packus_epi16(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1));
+}
+
+static void avx2_ulaw_encode(unsigned char *dst, const int16_t *src, int samples)
+{
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16)
+		_mm_storeu_si128((__m128i *) dst, pack16(ulaw_encode16(_mm256_loadu_si256((const __m256i *) src))));
+	while (samples--)
+		*dst++ = AST_LIN2MU(*src++);
+}
+
+static void avx2_alaw_decode(int16_t *dst, const unsigned char *src, int samples)
+{
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		__m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) src));
+		_mm256_storeu_si256((__m256i *) dst, alaw_decode16(c));
+	}
+	while (samples--)
+		*dst++ = AST_ALAW(*src++);
+}
+
+static void avx2_alaw_encode(unsigned char *dst, const int16_t *src, int samples)
+{
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16)
+		_mm_storeu_si128((__m128i *) dst, pack16(alaw_encode16(_mm256_loadu_si256((const __m256i *) src))));
+	while (samples--)
+		*dst++ = AST_LIN2A(*src++);
+}
+
+static const struct g711_kernels avx2_kernels = {
+	.name = "AVX2",
+	.ulaw_decode = avx2_ulaw_decode,
+	.ulaw_encode = avx2_ulaw_encode,
+	.alaw_decode = avx2_alaw_decode,
+	.alaw_encode = avx2_alaw_encode,
+};
+
+const struct g711_kernels *g711_avx2_kernels(void)
+{
+	return &avx2_kernels;
+}
+
+#else
+
+const struct g711_kernels *g711_avx2_kernels(void)
+{
+	return NULL;
+}
+
+#endif /* __AVX2__ */
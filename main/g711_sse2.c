@@ -0,0 +1,208 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief SSE2 G.711 kernels
+ *
+ * Eight samples at a time, computing what the lookup tables hold instead
+ * of looking it up.  The tables hold the coding of the highest sample each
+ * entry covers, so samples are rounded up to that (a | 3 for u-law, a | 7
+ * for A-law) before encoding.  Encoding finds the segment by converting to
+ * float; decoding does a shift by a per-sample amount, which SSE2 lacks, as
+ * a multiplication by a power of two.
+ *
+ * This file is built with -msse2 when the compiler takes it; the kernels
+ * must only be run on CPUs that have SSE2.
+ */
+
+#include "asterisk.h"
+
+/* No ASTERISK_FILE_VERSION(): its constructor would be built for the same
+ * instruction set, and runs on every CPU */
+
+#include "asterisk/ulaw.h"
+#include "asterisk/alaw.h"
+
+#include "g711.h"
+
+#if defined(__SSE2__) && !defined(G711_NEW_ALGORITHM)
+
+#include <emmintrin.h>
+
+#define U(x)	_mm_set1_epi16(x)
+
+/*! \brief 2 to the power of each (0 to 7) of e */
+static inline __m128i pow2(__m128i e)
+{
+	__m128i one = U(1);
+	__m128i p1 = _mm_add_epi16(one, _mm_and_si128(e, one));
+	__m128i p2 = _mm_add_epi16(one, _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(e, U(2)), U(2)), U(3)));
+	__m128i p4 = _mm_add_epi16(one, _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(e, U(4)), U(4)), U(15)));
+
+	return _mm_mullo_epi16(_mm_mullo_epi16(p1, p2), p4);
+}
+
+/*!
+ * \brief The exponent and top mantissa bits of each of eight magnitudes
+ *
+ * Converting to float normalizes the value: the 8 bit exponent then holds
+ * where its leading 1 is, and the top 4 bits of the mantissa the bits
+ * after it, which is what the codes are made of.  So the result of each
+ * lane is (127 + log2(mag)) << 4, or'ed with those 4 bits.
+ */
+static inline __m128i float_bits(__m128i mag)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpacklo_epi16(mag, zero)));
+	__m128i hi = _mm_castps_si128(_mm_cvtepi32_ps(_mm_unpackhi_epi16(mag, zero)));
+
+	return _mm_packs_epi32(_mm_srli_epi32(lo, 19), _mm_srli_epi32(hi, 19));
+}
+
+/*! \brief Encode eight samples to u-law, one code in each 16 bit lane */
+static inline __m128i ulaw_encode8(__m128i s)
+{
+	__m128i sign, mag, m;
+
+	s = _mm_or_si128(s, U(3));
+	sign = _mm_srai_epi16(s, 15);
+	mag = _mm_sub_epi16(_mm_xor_si128(s, sign), sign);
+	mag = _mm_min_epi16(mag, U(32635));
+	/* At least 0x84, so the leading 1 is at bit 7 (exponent 0) or above */
+	m = _mm_sub_epi16(float_bits(_mm_add_epi16(mag, U(0x84))), U((127 + 7) << 4));
+	m = _mm_or_si128(m, _mm_and_si128(sign, U(0x80)));
+
+	return _mm_xor_si128(m, U(0xff));
+}
+
+/*! \brief Encode eight samples to A-law, one code in each 16 bit lane */
+static inline __m128i alaw_encode8(__m128i s)
+{
+	__m128i neg, mag, m, small;
+
+	s = _mm_or_si128(s, U(7));
+	neg = _mm_srai_epi16(s, 15);
+	mag = _mm_sub_epi16(_mm_xor_si128(s, neg), neg);
+	/* Segment 0 is linear, the others are like u-law */
+	small = _mm_cmpgt_epi16(U(0x100), mag);
+	m = _mm_sub_epi16(float_bits(mag), U((127 + 7) << 4));
+	m = _mm_or_si128(_mm_andnot_si128(small, m), _mm_and_si128(small, _mm_srli_epi16(mag, 4)));
+
+	return _mm_xor_si128(m, _mm_or_si128(U(AST_ALAW_AMI_MASK), _mm_andnot_si128(neg, U(0x80))));
+}
+
+/*! \brief Decode eight u-law codes, given in 16 bit lanes */
+static inline __m128i ulaw_decode8(__m128i c)
+{
+	__m128i mu = _mm_xor_si128(c, U(0xff));
+	__m128i e = _mm_and_si128(_mm_srli_epi16(mu, 4), U(7));
+	__m128i y = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(mu, U(0x0f)), 3), U(132));
+	__m128i neg = _mm_cmpgt_epi16(mu, U(0x7f));
+
+	y = _mm_sub_epi16(_mm_mullo_epi16(y, pow2(e)), U(132));
+
+	return _mm_sub_epi16(_mm_xor_si128(y, neg), neg);
+}
+
+/*! \brief Decode eight A-law codes, given in 16 bit lanes */
+static inline __m128i alaw_decode8(__m128i c)
+{
+	__m128i a = _mm_xor_si128(c, U(AST_ALAW_AMI_MASK));
+	__m128i i = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(a, U(0x0f)), 4), U(8));
+	__m128i seg = _mm_and_si128(_mm_srli_epi16(a, 4), U(7));
+	__m128i nz = _mm_cmpgt_epi16(seg, _mm_setzero_si128());
+	__m128i neg = _mm_cmpeq_epi16(_mm_and_si128(a, U(0x80)), _mm_setzero_si128());
+
+	i = _mm_add_epi16(i, _mm_and_si128(nz, U(0x100)));
+	i = _mm_mullo_epi16(i, pow2(_mm_add_epi16(seg, nz)));
+
+	return _mm_sub_epi16(_mm_xor_si128(i, neg), neg);
+}
+
+static void sse2_ulaw_decode(int16_t *dst, const unsigned char *src, int samples)
+{
+	__m128i zero = _mm_setzero_si128(), c;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		c = _mm_loadu_si128((const __m128i *) src);
+		_mm_storeu_si128((__m128i *) dst, ulaw_decode8(_mm_unpacklo_epi8(c, zero)));
+		_mm_storeu_si128((__m128i *) (dst + 8), ulaw_decode8(_mm_unpackhi_epi8(c, zero)));
+	}
+	while (samples--)
+		*dst++ = AST_MULAW(*src++);
+}
+
+static void sse2_ulaw_encode(unsigned char *dst, const int16_t *src, int samples)
+{
+	__m128i lo, hi;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		lo = ulaw_encode8(_mm_loadu_si128((const __m128i *) src));
+		hi = ulaw_encode8(_mm_loadu_si128((const __m128i *) (src + 8)));
+		_mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+	}
+	while (samples--)
+		*dst++ = AST_LIN2MU(*src++);
+}
+
+static void sse2_alaw_decode(int16_t *dst, const unsigned char *src, int samples)
+{
+	__m128i zero = _mm_setzero_si128(), c;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		c = _mm_loadu_si128((const __m128i *) src);
+		_mm_storeu_si128((__m128i *) dst, alaw_decode8(_mm_unpacklo_epi8(c, zero)));
+		_mm_storeu_si128((__m128i *) (dst + 8), alaw_decode8(_mm_unpackhi_epi8(c, zero)));
+	}
+	while (samples--)
+		*dst++ = AST_ALAW(*src++);
+}
+
+static void sse2_alaw_encode(unsigned char *dst, const int16_t *src, int samples)
+{
+	__m128i lo, hi;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		lo = alaw_encode8(_mm_loadu_si128((const __m128i *) src));
+		hi = alaw_encode8(_mm_loadu_si128((const __m128i *) (src + 8)));
+		_mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+	}
+	while (samples--)
+		*dst++ = AST_LIN2A(*src++);
+}
+
+static const struct g711_kernels sse2_kernels = {
+	.name = "SSE2",
+	.ulaw_decode = sse2_ulaw_decode,
+	.ulaw_encode = sse2_ulaw_encode,
+	.alaw_decode = sse2_alaw_decode,
+	.alaw_encode = sse2_alaw_encode,
+};
+
+const struct g711_kernels *g711_sse2_kernels(void)
+{
+	return &sse2_kernels;
+}
+
+#else
+
+const struct g711_kernels *g711_sse2_kernels(void)
+{
+	return NULL;
+}
+
+#endif /* __SSE2__ */
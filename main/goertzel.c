@@ -0,0 +1,149 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Banks of Goertzel filters, for DTMF and MF detection
+ *
+ * goertzel_bank() runs all the filters of a detector over a block of
+ * samples with the fastest kernel the CPU can run, chosen once at startup.
+ * SIMD kernels are only chosen after checking that they agree with the
+ * scalar one, so which one runs never changes what is detected.
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <math.h>
+
+#include "asterisk/_private.h"
+#include "asterisk/utils.h"
+#include "asterisk/options.h"
+
+#include "goertzel.h"
+
+static void scalar_bank(goertzel_state_t *const *filters, int count, const int16_t *samps, int samples)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		goertzel_update(filters[i], (short *) samps, samples);
+}
+
+const struct goertzel_kernel goertzel_scalar_kernel = {
+	.name = "scalar",
+	.bank = scalar_bank,
+};
+
+/*! The kernel in use; the scalar one until ast_goertzel_init() picks */
+static const struct goertzel_kernel *kernel = &goertzel_scalar_kernel;
+
+/* __builtin_cpu_supports() checks that the OS saves the AVX registers, too */
+#if (defined(__i386__) || defined(__x86_64__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#define GOERTZEL_CPU_DISPATCH
+#endif
+
+int goertzel_kernels_available(const struct goertzel_kernel **list, int len)
+{
+	const struct goertzel_kernel *k;
+	int count = 0;
+
+#ifdef GOERTZEL_CPU_DISPATCH
+	__builtin_cpu_init();
+	if (count < len - 1 && __builtin_cpu_supports("avx2") && (k = goertzel_avx2_kernel()))
+		list[count++] = k;
+	if (count < len - 1 && __builtin_cpu_supports("sse2") && (k = goertzel_sse2_kernel()))
+		list[count++] = k;
+#endif
+	k = &goertzel_scalar_kernel;
+	if (count < len)
+		list[count++] = k;
+
+	return count;
+}
+
+/*! \brief Test signal for goertzel_kernel_verify() */
+static int16_t verify_sample(int signal, int i)
+{
+	switch (signal) {
+	case 0:	/* a loud DTMF digit, which makes the row and column filters scale */
+		return 16383 * sin(2 * M_PI * 697 * i / 8000) + 16383 * sin(2 * M_PI * 1209 * i / 8000);
+	case 1:	/* clipped square wave */
+		return (i / 3) & 1 ? 32767 : -32768;
+	case 2:	/* noise */
+		return ast_random();
+	default:	/* a quiet MF tone */
+		return 300 * sin(2 * M_PI * 1300 * i / 8000);
+	}
+}
+
+int goertzel_kernel_verify(const struct goertzel_kernel *k)
+{
+	/* DTMF rows and columns, then MF and some other frequencies, to cover
+	   both signs of fac */
+	static const float freqs[] = { 697, 770, 852, 941, 1209, 1336, 1477, 1633,
+		700, 900, 1100, 1300, 1500, 1700, 350, 3200 };
+	goertzel_state_t a[GOERTZEL_BANK_MAX], b[GOERTZEL_BANK_MAX], *pa[GOERTZEL_BANK_MAX], *pb[GOERTZEL_BANK_MAX];
+	int16_t samps[4000];
+	int signal, count, first, i, pos, len, ok = 1;
+
+	for (signal = 0; ok && signal < 4; signal++) {
+		for (i = 0; i < ARRAY_LEN(samps); i++)
+			samps[i] = verify_sample(signal, i);
+		for (count = 1; ok && count <= GOERTZEL_BANK_MAX; count++) {
+			first = (count * 3) % (ARRAY_LEN(freqs) - count + 1);
+			memset(a, 0, sizeof(a));
+			for (i = 0; i < count; i++) {
+				a[i].fac = (int)(32768.0 * 2.0 * cos(2.0 * M_PI * freqs[first + i] / 8000));
+				pa[i] = &a[i];
+				pb[i] = &b[i];
+			}
+			memcpy(b, a, sizeof(b));
+			/* Blocks of uneven lengths, without resetting the filters, so
+			   they scale down their input many times */
+			for (pos = 0; ok && pos < ARRAY_LEN(samps); pos += len) {
+				len = MIN(1 + (pos * 7) % 211, ARRAY_LEN(samps) - pos);
+				goertzel_scalar_kernel.bank(pa, count, samps + pos, len);
+				k->bank(pb, count, samps + pos, len);
+				ok = !memcmp(a, b, count * sizeof(a[0]));
+			}
+		}
+	}
+
+	return ok;
+}
+
+void ast_goertzel_init(void)
+{
+	const struct goertzel_kernel *list[4];
+	int i, count;
+
+	count = goertzel_kernels_available(list, ARRAY_LEN(list));
+	for (i = 0; i < count - 1; i++) {
+		if (goertzel_kernel_verify(list[i]))
+			break;
+		ast_log(LOG_WARNING, "%s Goertzel filters do not match the scalar ones, not using them\n", list[i]->name);
+	}
+	kernel = list[i];
+	ast_verb(2, "Using %s Goertzel filters\n", kernel->name);
+}
+
+void goertzel_bank(goertzel_state_t *const *filters, int count, const int16_t *samps, int samples)
+{
+	kernel->bank(filters, count, samps, samples);
+}
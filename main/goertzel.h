@@ -0,0 +1,114 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * Goertzel routines are borrowed from Steve Underwood's tremendous work on the
+ * DTMF detector.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Goertzel filters, for the tone detectors of dsp.c
+ *
+ * The filters run in Q15 fixed point.  Whenever the state of one would
+ * overflow, it is halved and its input scaled down by one more bit from
+ * then on (chunky).
+ *
+ * goertzel_bank() runs several filters over the same samples, all at once
+ * with the SIMD kernels, giving exactly the results of goertzel_sample().
+ */
+
+#ifndef _GOERTZEL_H_
+#define _GOERTZEL_H_
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+typedef struct {
+	int v2;
+	int v3;
+	int chunky;
+	int fac;
+	int samples;
+} goertzel_state_t;
+
+static inline void goertzel_sample(goertzel_state_t *s, short sample)
+{
+	int v1;
+
+	v1 = s->v2;
+	s->v2 = s->v3;
+
+	s->v3 = (s->fac * s->v2) >> 15;
+	s->v3 = s->v3 - v1 + (sample >> s->chunky);
+	if (abs(s->v3) > 32768) {
+		s->chunky++;
+		s->v3 = s->v3 >> 1;
+		s->v2 = s->v2 >> 1;
+		v1 = v1 >> 1;
+	}
+}
+
+static inline void goertzel_update(goertzel_state_t *s, short *samps, int count)
+{
+	int i;
+
+	for (i=0;i<count;i++)
+		goertzel_sample(s, samps[i]);
+}
+
+/*! Most filters a bank kernel takes at once: the rows and columns of DTMF */
+#define GOERTZEL_BANK_MAX	8
+
+struct goertzel_kernel {
+	/*! Instruction set, for messages */
+	const char *name;
+	/*! Run goertzel_sample() for every sample, on each of count
+	 * (at most GOERTZEL_BANK_MAX) filters */
+	void (*bank)(goertzel_state_t *const *filters, int count, const int16_t *samps, int samples);
+};
+
+/*! One filter after the other; works everywhere */
+extern const struct goertzel_kernel goertzel_scalar_kernel;
+
+/*!
+ * \brief The SSE2 and AVX2 kernels
+ * \return the kernel, or NULL if the compiler could not build it.
+ * \note Only call these after checking that the CPU has the instructions.
+ */
+const struct goertzel_kernel *goertzel_sse2_kernel(void);
+const struct goertzel_kernel *goertzel_avx2_kernel(void);
+
+/*!
+ * \brief Every kernel the CPU can run, fastest first
+ * \param list where to put them, ending with goertzel_scalar_kernel
+ * \param len room in list
+ * \return how many were put in list
+ */
+int goertzel_kernels_available(const struct goertzel_kernel **list, int len);
+
+/*! \brief Whether a kernel gives the same results as the scalar one, on
+ * signals that make the filters scale down their input */
+int goertzel_kernel_verify(const struct goertzel_kernel *k);
+
+/*! \brief Run several filters over the same samples, with the kernel
+ * chosen by ast_goertzel_init() */
+void goertzel_bank(goertzel_state_t *const *filters, int count, const int16_t *samps, int samples);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _GOERTZEL_H_ */
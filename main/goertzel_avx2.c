@@ -0,0 +1,100 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief AVX2 Goertzel filter bank
+ *
+ * All the filters of a detector (the eight rows and columns of DTMF, or the
+ * six tones of MF) in one register, updated together for each sample.
+ *
+ * This file is built with -mavx2 when the compiler takes it; the kernel
+ * must only be run on CPUs that have AVX2.
+ */
+
+#include "asterisk.h"
+
+/* No ASTERISK_FILE_VERSION(): its constructor would be built for the same
+ * instruction set, and runs on every CPU */
+
+#include "goertzel.h"
+
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+static void avx2_bank(goertzel_state_t *const *filters, int count, const int16_t *samps, int samples)
+{
+	int v2[8] __attribute__((aligned(32))) = { 0, }, v3[8] __attribute__((aligned(32))) = { 0, };
+	int fac[8] __attribute__((aligned(32))) = { 0, }, chunky[8] __attribute__((aligned(32))) = { 0, };
+	__m256i vv1, vv2, vv3, vfac, vchunky, over;
+	__m256i limit = _mm256_set1_epi32(32768);
+	int i;
+
+	for (i = 0; i < count; i++) {
+		v2[i] = filters[i]->v2;
+		v3[i] = filters[i]->v3;
+		fac[i] = filters[i]->fac;
+		chunky[i] = filters[i]->chunky;
+	}
+	vv2 = _mm256_load_si256((__m256i *) v2);
+	vv3 = _mm256_load_si256((__m256i *) v3);
+	vfac = _mm256_load_si256((__m256i *) fac);
+	vchunky = _mm256_load_si256((__m256i *) chunky);
+
+	for (i = 0; i < samples; i++) {
+		vv1 = vv2;
+		vv2 = vv3;
+		vv3 = _mm256_srai_epi32(_mm256_mullo_epi32(vfac, vv2), 15);
+		vv3 = _mm256_add_epi32(_mm256_sub_epi32(vv3, vv1),
+			_mm256_srav_epi32(_mm256_set1_epi32(samps[i]), vchunky));
+
+		over = _mm256_cmpgt_epi32(_mm256_abs_epi32(vv3), limit);
+		if (!_mm256_testz_si256(over, over)) {
+			vchunky = _mm256_sub_epi32(vchunky, over);
+			vv3 = _mm256_blendv_epi8(vv3, _mm256_srai_epi32(vv3, 1), over);
+			vv2 = _mm256_blendv_epi8(vv2, _mm256_srai_epi32(vv2, 1), over);
+		}
+	}
+
+	_mm256_store_si256((__m256i *) v2, vv2);
+	_mm256_store_si256((__m256i *) v3, vv3);
+	_mm256_store_si256((__m256i *) chunky, vchunky);
+	for (i = 0; i < count; i++) {
+		filters[i]->v2 = v2[i];
+		filters[i]->v3 = v3[i];
+		filters[i]->chunky = chunky[i];
+	}
+}
+
+static const struct goertzel_kernel avx2_kernel = {
+	.name = "AVX2",
+	.bank = avx2_bank,
+};
+
+const struct goertzel_kernel *goertzel_avx2_kernel(void)
+{
+	return &avx2_kernel;
+}
+
+#else
+
+const struct goertzel_kernel *goertzel_avx2_kernel(void)
+{
+	return NULL;
+}
+
+#endif /* __AVX2__ */
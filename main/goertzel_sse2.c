@@ -0,0 +1,154 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief SSE2 Goertzel filter bank
+ *
+ * Four filters in each register, so DTMF detection runs its eight filters
+ * in two.  SSE2 has neither a 32 bit multiplication nor a shift by a
+ * different amount in each lane; the former is made of two 32x32->64 bit
+ * ones, and the latter, for the input shifted right by chunky, done as a
+ * multiplication by 2^(16 - chunky) followed by a shift right by 16.
+ *
+ * This file is built with -msse2 when the compiler takes it; the kernel
+ * must only be run on CPUs that have SSE2.
+ */
+
+#include "asterisk.h"
+
+/* No ASTERISK_FILE_VERSION(): its constructor would be built for the same
+ * instruction set, and runs on every CPU */
+
+#include "goertzel.h"
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+
+/*! \brief The state of four filters */
+struct quad {
+	__m128i v2;
+	__m128i v3;
+	__m128i fac;
+	__m128i chunky;
+	/*! 2^(16 - chunky), or 1 once chunky is 16 or more */
+	__m128i scale;
+};
+
+/*! \brief Low 32 bits of the products of the four pairs of lanes */
+static inline __m128i mullo32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/*! \brief a where mask is set, b elsewhere */
+static inline __m128i select32(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*! \brief goertzel_sample() on four filters */
+static inline void quad_sample(struct quad *q, __m128i sample)
+{
+	__m128i v1 = q->v2, v3, sign, over;
+
+	q->v2 = q->v3;
+	v3 = _mm_srai_epi32(mullo32(q->fac, q->v2), 15);
+	v3 = _mm_add_epi32(_mm_sub_epi32(v3, v1), _mm_srai_epi32(mullo32(sample, q->scale), 16));
+
+	sign = _mm_srai_epi32(v3, 31);
+	over = _mm_cmpgt_epi32(_mm_sub_epi32(_mm_xor_si128(v3, sign), sign), _mm_set1_epi32(32768));
+	if (_mm_movemask_epi8(over)) {
+		__m128i one = _mm_set1_epi32(1);
+
+		q->chunky = _mm_sub_epi32(q->chunky, over);
+		v3 = select32(over, _mm_srai_epi32(v3, 1), v3);
+		q->v2 = select32(over, _mm_srai_epi32(q->v2, 1), q->v2);
+		q->scale = select32(over, _mm_or_si128(_mm_srli_epi32(q->scale, 1), _mm_and_si128(q->scale, one)), q->scale);
+	}
+	q->v3 = v3;
+}
+
+static void sse2_bank(goertzel_state_t *const *filters, int count, const int16_t *samps, int samples)
+{
+	int v2[8] __attribute__((aligned(16))) = { 0, }, v3[8] __attribute__((aligned(16))) = { 0, };
+	int fac[8] __attribute__((aligned(16))) = { 0, }, chunky[8] __attribute__((aligned(16))) = { 0, };
+	int scale[8] __attribute__((aligned(16))) = { 0, };
+	struct quad q[2];
+	__m128i sample;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		v2[i] = filters[i]->v2;
+		v3[i] = filters[i]->v3;
+		fac[i] = filters[i]->fac;
+		chunky[i] = filters[i]->chunky;
+		scale[i] = filters[i]->chunky < 16 ? 1 << (16 - filters[i]->chunky) : 1;
+	}
+	for (i = 0; i < 2; i++) {
+		q[i].v2 = _mm_load_si128((__m128i *) (v2 + 4 * i));
+		q[i].v3 = _mm_load_si128((__m128i *) (v3 + 4 * i));
+		q[i].fac = _mm_load_si128((__m128i *) (fac + 4 * i));
+		q[i].chunky = _mm_load_si128((__m128i *) (chunky + 4 * i));
+		q[i].scale = _mm_load_si128((__m128i *) (scale + 4 * i));
+	}
+
+	if (count > 4) {
+		for (i = 0; i < samples; i++) {
+			sample = _mm_set1_epi32(samps[i]);
+			quad_sample(&q[0], sample);
+			quad_sample(&q[1], sample);
+		}
+	} else {
+		for (i = 0; i < samples; i++)
+			quad_sample(&q[0], _mm_set1_epi32(samps[i]));
+	}
+
+	for (i = 0; i < 2; i++) {
+		_mm_store_si128((__m128i *) (v2 + 4 * i), q[i].v2);
+		_mm_store_si128((__m128i *) (v3 + 4 * i), q[i].v3);
+		_mm_store_si128((__m128i *) (chunky + 4 * i), q[i].chunky);
+	}
+	for (i = 0; i < count; i++) {
+		filters[i]->v2 = v2[i];
+		filters[i]->v3 = v3[i];
+		filters[i]->chunky = chunky[i];
+	}
+}
+
+static const struct goertzel_kernel sse2_kernel = {
+	.name = "SSE2",
+	.bank = sse2_bank,
+};
+
+const struct goertzel_kernel *goertzel_sse2_kernel(void)
+{
+	return &sse2_kernel;
+}
+
+#else
+
+const struct goertzel_kernel *goertzel_sse2_kernel(void)
+{
+	return NULL;
+}
+
+#endif /* __SSE2__ */
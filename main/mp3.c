@@ -0,0 +1,2342 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief MP3 playback support shared by STREAM MP3, MP3Player() and music on hold
+ *
+ * Local MP3 files are played through the file format layer (format_mp3).
+ * When the [general] section of mp3.conf lists renditions, the first play
+ * of a file writes a copy of it next to the MP3 in each of those formats,
+ * e.g. /var/lib/prompts/hold.ulaw for /var/lib/prompts/hold.mp3.  From
+ * then on the file format layer opens whichever copy the channel can take
+ * natively, so no decoding or transcoding happens while the call plays it.
+ *
+ * Everything else (URLs, relative names, or no format_mp3) is decoded by
+ * an external mpg123 process.  Its output is played by a channel generator,
+ * so frames go out on the channel's own clock: whenever the decoder has not
+ * produced a full frame in time, a frame of silence is sent in its place
+ * and counted as an underrun.
+ *
+ * Network streams are read ahead: a single I/O thread drains the pipes of
+ * all of them into ring buffers, and playback starts only once some audio
+ * has been buffered (pre-roll).  If a stream runs dry anyway, playback
+ * waits for the buffer to refill to a low-water mark before it resumes,
+ * rather than stuttering out each frame as it arrives.
+ *
+ * In broadcast mode, everyone playing the same URL shares one decoder and
+ * one ring buffer, each listener reading it at its own position, much as
+ * a music on hold class shares one mpg123.  The first listener starts the
+ * decoder and it is stopped when the last one leaves.
+ *
+ * All decoder processes, music on hold's included, are started here with
+ * vfork(), limited in number, and reaped by a single background thread
+ * once stopped, so stopping one never blocks the caller.
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include "asterisk/_private.h"
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include "asterisk/mp3.h"
+#include "asterisk/app.h"
+#include "asterisk/file.h"
+#include "asterisk/channel.h"
+#include "asterisk/frame.h"
+#include "asterisk/config.h"
+#include "asterisk/cli.h"
+#include "asterisk/io.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/linkedlists.h"
+#include "asterisk/lock.h"
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+
+static const char config[] = "mp3.conf";
+
+#define LOCAL_MPG_123 "/usr/local/bin/mpg123"
+#define MPG_123 "/usr/bin/mpg123"
+
+/*! Largest frame the player generator sends, in samples */
+#define MP3_MAX_SAMPLES		1280
+
+/*! Default read-ahead settings, in ms */
+#define DEFAULT_READAHEAD	5000
+#define DEFAULT_PREROLL		1000
+#define DEFAULT_LOWWATER	500
+
+/*! Bytes of 8kHz signed linear audio in ms milliseconds */
+#define MS_TO_BYTES(ms)		((ms) * 16)
+
+/*! Added to the name of an MP3 file to name its index file */
+#define INDEX_SUFFIX		".idx"
+
+/*! Most indexes kept open for the file layer to find */
+#define MAX_INDEXES		256
+
+/*! Default limit on decoder processes running at once */
+#define DEFAULT_MAX_DECODERS	256
+
+/*! Time between the signals sent to a decoder being stopped, in ms */
+#define DECODER_STOP_INTERVAL	100
+
+/*! Default requests allowed to wait for a busy decoder pool */
+#define DEFAULT_POOL_QUEUE	8
+
+/*! Longest a request waits for a pooled decoder to be freed, in ms */
+#define POOL_WAIT		1000
+
+/*! Longest a pooled decoder may take to stop playing, in ms */
+#define POOL_STOP_WAIT		500
+
+/*! Extensions of the formats to render MP3 files in, separated by commas */
+static char renditions[256];
+/*! Audio buffered ahead of playback for network streams, in ms */
+static int readahead_ms = DEFAULT_READAHEAD;
+/*! Audio buffered before playback of a network stream starts, in ms */
+static int preroll_ms = DEFAULT_PREROLL;
+/*! Audio buffered before playback resumes after running dry, in ms */
+static int lowwater_ms = DEFAULT_LOWWATER;
+/*! Share one decoder among everyone playing the same URL */
+static int broadcast = 1;
+/*! Most decoder processes running at once, or 0 for no limit */
+static int max_decoders = DEFAULT_MAX_DECODERS;
+/*! Decoders kept running for playback of local files, or 0 for none */
+static int pool_size;
+/*! Seconds a pooled decoder may sit idle before it is stopped, or 0 for ever */
+static int pool_idle;
+/*! Requests that may wait for a pooled decoder when all are busy */
+static int pool_queue = DEFAULT_POOL_QUEUE;
+AST_MUTEX_DEFINE_STATIC(config_lock);
+
+/*!
+ * \brief A process started by ast_mp3_decoder_spawn()
+ *
+ * It is kept on the list until it has been stopped and reaped.
+ */
+struct mp3_decoder {
+	AST_LIST_ENTRY(mp3_decoder) list;
+	pid_t pid;
+	/*! When ast_mp3_decoder_stop() was called, or zero if it was not yet */
+	struct timeval stopped;
+	/*! Signals sent since it was stopped */
+	int signals;
+};
+
+static AST_LIST_HEAD_STATIC(decoders, mp3_decoder);
+static int running_decoders;
+static int stopping_decoders;
+static int total_decoders;
+/*! Signalled when a decoder is stopped; waited on by the reaper thread */
+static ast_cond_t reaper_cond;
+static pthread_t reaper_thread = AST_PTHREADT_NULL;
+
+/*!
+ * \brief A decoder kept running between playbacks
+ *
+ * mpg123 in remote control mode (-R) takes LOAD commands on its standard
+ * input, writes the audio to its standard output and reports progress on
+ * its standard error.  The audio pipe stays open from one file to the next,
+ * so the end of a file is known from the "@P 0" status it is followed by.
+ */
+struct mp3_worker {
+	AST_LIST_ENTRY(mp3_worker) list;
+	pid_t pid;
+	/*! Audio from the decoder, non-blocking */
+	int audiofd;
+	/*! Commands to the decoder */
+	int cmdfd;
+	/*! Status reports from the decoder, non-blocking */
+	int statusfd;
+	/*! When it was last freed */
+	struct timeval idle_since;
+	/*! A player has it */
+	unsigned int busy:1;
+	/*! It reported the end of the file it was playing */
+	unsigned int finished:1;
+	/*! It exited */
+	unsigned int dead:1;
+	/*! Partial status line */
+	int statuslen;
+	char status[256];
+};
+
+/*! The decoder pool; pool_cond is signalled when a worker is freed */
+static AST_LIST_HEAD_STATIC(workers, mp3_worker);
+static ast_cond_t pool_cond;
+static pthread_t pool_thread = AST_PTHREADT_NULL;
+static int pool_workers;
+static int pool_waiting;
+/*! Pool totals since startup, for "mp3 show pool" */
+static int pool_requests;
+static int pool_waits;
+static int pool_fallbacks;
+
+struct mp3_player;
+
+/*!
+ * \brief Decoder output being read ahead of playback by the I/O thread
+ *
+ * Positions are counted in bytes from the start of the stream.  Audio at
+ * positions from written - size up to written is in the ring.  Each reader
+ * keeps its own position, and the I/O thread stops reading the decoder
+ * rather than overwrite audio the slowest reader has not had yet.
+ */
+struct mp3_readahead {
+	AST_LIST_ENTRY(mp3_readahead) list;
+	ast_mutex_t lock;
+	/*! Read end of the decoder pipe, closed by the I/O thread */
+	int fd;
+	/*! The decoder, killed when the last reader leaves */
+	pid_t pid;
+	/*! Registration with the I/O context, NULL when not being read */
+	int *id;
+	char *ring;
+	size_t size;
+	/*! Bytes written to ring since the stream started */
+	uint64_t written;
+	/*! Players reading from the ring */
+	AST_LIST_HEAD_NOLOCK(, mp3_player) readers;
+	/*! The decoder closed its end of the pipe */
+	unsigned int eof:1;
+	/*! The ring filled up, so the I/O thread stopped reading */
+	unsigned int paused:1;
+	/*! Playback is over; the I/O thread frees this */
+	unsigned int closing:1;
+	/*! URL being broadcast, or empty if this stream has only one reader */
+	char location[1];
+};
+
+/*! Streams served by the read-ahead I/O thread */
+static AST_LIST_HEAD_STATIC(readaheads, mp3_readahead);
+static struct io_context *readahead_io;
+static pthread_t readahead_thread = AST_PTHREADT_NULL;
+static int readahead_pipe[2] = { -1, -1 };
+
+/*! \brief State of one playback through an external decoder */
+struct mp3_player {
+	AST_LIST_ENTRY(mp3_player) entry;
+	/*! Read end of the pipe from the decoder, non-blocking */
+	int fd;
+	/*! Read-ahead buffer the audio comes from instead of fd, if any */
+	struct mp3_readahead *ra;
+	/*! Pooled decoder fd belongs to, if any */
+	struct mp3_worker *worker;
+	/*! Position of the next byte to read from ra */
+	uint64_t pos;
+	/*! Bytes to buffer before starting, and before resuming after an underrun */
+	size_t preroll;
+	size_t lowwater;
+	/*! Give up after this many samples in a row without audio */
+	int maxstarve;
+	int starved;
+	int origwfmt;
+	/*! Audio has been received from the decoder */
+	unsigned int started:1;
+	/*! The decoder closed its end of the pipe */
+	unsigned int eof:1;
+	/*! The generator has been released */
+	unsigned int done:1;
+	/*! Waiting for the read-ahead buffer to fill before sending audio */
+	unsigned int buffering:1;
+	unsigned int frames;
+	unsigned int underruns;
+	/*! Bytes of decoded audio waiting in buf */
+	int buffered;
+	/*! Bytes of decoded audio still to be dropped to reach the start offset */
+	uint64_t skip;
+	/*! Bytes of decoded audio sent */
+	uint64_t played;
+	struct ast_frame f;
+	char buf[AST_FRIENDLY_OFFSET + MP3_MAX_SAMPLES * 2];
+	char silence[AST_FRIENDLY_OFFSET + MP3_MAX_SAMPLES * 2];
+};
+
+/*! Playback totals since startup, for "mp3 show playback" */
+static int total_playbacks;
+static int active_playbacks;
+static int total_frames;
+static int total_underruns;
+
+/*! \brief A set of renditions of one MP3 file being written in the background */
+struct mp3_render {
+	AST_LIST_ENTRY(mp3_render) list;
+	/*! Extensions of the renditions to write, separated by commas */
+	char *exts;
+	/*! Name of the MP3 file, without its extension */
+	char base[1];
+};
+
+/*! Files whose renditions are being written right now */
+static AST_LIST_HEAD_STATIC(renders, mp3_render);
+
+/*!
+ * \brief Write one rendition of an MP3 file.
+ *
+ * The rendition is written under a temporary name and renamed into place
+ * once complete, so that no one ever plays a partial file.
+ */
+static int render_one(const char *base, const char *ext)
+{
+	struct ast_filestream *in, *out;
+	char *tmp, *src = NULL, *dst = NULL;
+	int res = -1, failed;
+
+	if (!(in = ast_readfile(base, "mp3", NULL, O_RDONLY, 0, 0)))
+		return -1;
+	if (ast_asprintf(&tmp, "%s.tmp%ld", base, ast_random()) < 0) {
+		ast_closestream(in);
+		return -1;
+	}
+	if (!(out = ast_writefile(tmp, ext, NULL, O_CREAT | O_TRUNC | O_WRONLY, 0, AST_FILE_MODE))) {
+		ast_log(LOG_WARNING, "Unable to write '%s' rendition of %s.mp3\n", ext, base);
+		ast_closestream(in);
+		ast_free(tmp);
+		return -1;
+	}
+
+	failed = ast_stream_convert(in, out);
+	ast_closestream(out);
+	ast_closestream(in);
+
+	if (failed) {
+		ast_log(LOG_WARNING, "Failed to convert %s.mp3 to %s\n", base, ext);
+		ast_filedelete(tmp, ext);
+	} else if (ast_asprintf(&src, "%s.%s", tmp, ext) >= 0 && ast_asprintf(&dst, "%s.%s", base, ext) >= 0) {
+		if (!(res = rename(src, dst)))
+			ast_verb(3, "Rendered %s.mp3 as %s\n", base, ext);
+		else {
+			ast_log(LOG_WARNING, "rename(%s,%s) failed: %s\n", src, dst, strerror(errno));
+			unlink(src);
+		}
+	}
+
+	if (src)
+		ast_free(src);
+	if (dst)
+		ast_free(dst);
+	ast_free(tmp);
+	return res;
+}
+
+static void *render_thread(void *data)
+{
+	struct mp3_render *job = data;
+	char *exts = job->exts, *ext;
+
+	while ((ext = strsep(&exts, ",")))
+		render_one(job->base, ext);
+
+	AST_LIST_LOCK(&renders);
+	AST_LIST_REMOVE(&renders, job, list);
+	AST_LIST_UNLOCK(&renders);
+	ast_free(job);
+
+	return NULL;
+}
+
+/*!
+ * \brief Make sure the configured renditions of an MP3 file are current.
+ *
+ * Renditions older than the MP3 are removed so they cannot be played,
+ * and a background thread is started to write whichever ones are
+ * missing, unless one is already at work on this file.
+ */
+static void check_renditions(const char *base, const struct stat *mp3st)
+{
+	char *wanted, *ext, *fn, *missing;
+	struct mp3_render *job;
+	struct stat st;
+	pthread_t thread;
+	size_t len = 0;
+
+	ast_mutex_lock(&config_lock);
+	wanted = ast_strdupa(renditions);
+	ast_mutex_unlock(&config_lock);
+
+	if (ast_strlen_zero(wanted))
+		return;
+
+	missing = alloca(strlen(wanted) + 1);
+	while ((ext = strsep(&wanted, ","))) {
+		ext = ast_strip(ext);
+		if (ast_strlen_zero(ext) || ast_asprintf(&fn, "%s.%s", base, ext) < 0)
+			continue;
+		if (!stat(fn, &st) && st.st_mtime >= mp3st->st_mtime) {
+			ast_free(fn);
+			continue;
+		}
+		if (!access(fn, F_OK))
+			unlink(fn);
+		ast_free(fn);
+		len += sprintf(missing + len, "%s%s", len ? "," : "", ext);
+	}
+	if (!len)
+		return;
+
+	AST_LIST_LOCK(&renders);
+	AST_LIST_TRAVERSE(&renders, job, list) {
+		if (!strcmp(job->base, base))
+			break;
+	}
+	if (job || !(job = ast_calloc(1, sizeof(*job) + strlen(base) + len + 1))) {
+		AST_LIST_UNLOCK(&renders);
+		return;
+	}
+	strcpy(job->base, base);
+	job->exts = job->base + strlen(base) + 1;
+	strcpy(job->exts, missing);
+	AST_LIST_INSERT_TAIL(&renders, job, list);
+	if (ast_pthread_create_detached_background(&thread, NULL, render_thread, job)) {
+		AST_LIST_REMOVE(&renders, job, list);
+		ast_free(job);
+	}
+	AST_LIST_UNLOCK(&renders);
+}
+
+/*! \brief An MP3 index, mapped from its file or built in memory */
+struct ast_mp3_index {
+	AST_LIST_ENTRY(ast_mp3_index) list;
+	/*! Identity of the MP3 file indexed */
+	dev_t dev;
+	ino_t ino;
+	const struct ast_mp3_index_header *hdr;
+	const uint64_t *offsets;
+	/*! The index file, if mapped */
+	void *map;
+	size_t maplen;
+};
+
+/*! Indexes of recently played files, most recently used first */
+static AST_LIST_HEAD_STATIC(indexes, ast_mp3_index);
+static int indexes_count;
+
+/*! \brief An MP3 file whose index is being built in the background */
+struct mp3_index_job {
+	AST_LIST_ENTRY(mp3_index_job) list;
+	/*! Identity of the MP3 file */
+	dev_t dev;
+	ino_t ino;
+	char filename[1];
+};
+
+/*! Files whose indexes are being built right now */
+static AST_LIST_HEAD_STATIC(index_jobs, mp3_index_job);
+
+/*! \brief What a frame header says about the frame */
+struct mp3_frame_info {
+	int mpeg1;
+	int mono;
+	int rate;
+	int samples;
+	int length;
+};
+
+/*! Bit rates in kbps, by MPEG-1 or not, layer and bit rate index */
+static const short mp3_bitrates[2][3][16] = {
+	{	/* MPEG-2 and 2.5 */
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+	}, {	/* MPEG-1 */
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },
+	},
+};
+
+/*! Sample rates of MPEG-1, by sample rate index; halved for MPEG-2, quartered for 2.5 */
+static const int mp3_rates[3] = { 44100, 48000, 32000 };
+
+/*!
+ * \brief Decode an MPEG audio frame header.
+ * \retval 0 if h is the header of a frame we can index
+ * \retval -1 if not
+ */
+static int parse_frame_header(const unsigned char *h, struct mp3_frame_info *fi)
+{
+	int version, layer, bitrate, rate;
+
+	if (h[0] != 0xff || (h[1] & 0xe0) != 0xe0)
+		return -1;
+	version = (h[1] >> 3) & 3;	/* 0 = 2.5, 2 = 2, 3 = 1 */
+	layer = 4 - ((h[1] >> 1) & 3);
+	bitrate = h[2] >> 4;
+	rate = (h[2] >> 2) & 3;
+	if (version == 1 || layer == 4 || !bitrate || bitrate == 15 || rate == 3)
+		return -1;
+
+	fi->mpeg1 = (version == 3);
+	fi->mono = ((h[3] >> 6) == 3);
+	fi->rate = mp3_rates[rate] >> (fi->mpeg1 ? 0 : (version == 2 ? 1 : 2));
+	bitrate = mp3_bitrates[fi->mpeg1][layer - 1][bitrate] * 1000;
+	if (layer == 1) {
+		fi->samples = 384;
+		fi->length = (12 * bitrate / fi->rate + ((h[2] >> 1) & 1)) * 4;
+	} else {
+		fi->samples = (layer == 3 && !fi->mpeg1) ? 576 : 1152;
+		fi->length = fi->samples / 8 * bitrate / fi->rate + ((h[2] >> 1) & 1);
+	}
+
+	return 0;
+}
+
+static unsigned int get_be32(const unsigned char *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static unsigned int get_be16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/*! \brief Append an entry to an index being built */
+static int index_add(struct ast_mp3_index_header **hdr, size_t *alloced, uint64_t offset)
+{
+	struct ast_mp3_index_header *tmp;
+	uint64_t *offsets;
+
+	if (sizeof(**hdr) + ((*hdr)->entries + 1) * sizeof(*offsets) > *alloced) {
+		if (!(tmp = ast_realloc(*hdr, *alloced * 2)))
+			return -1;
+		*hdr = tmp;
+		*alloced *= 2;
+	}
+	offsets = (uint64_t *) (*hdr + 1);
+	offsets[(*hdr)->entries++] = offset;
+
+	return 0;
+}
+
+/*!
+ * \brief Use the table of contents in a Xing or VBRI header, if any.
+ * \param data the MP3 file
+ * \param pos offset of its first frame
+ * \retval 0 if the index was filled from the header
+ */
+static int index_from_toc(struct ast_mp3_index_header **hdr, size_t *alloced,
+	const unsigned char *data, size_t size, size_t pos, const struct mp3_frame_info *fi)
+{
+	const unsigned char *x = data + pos + 4 + (fi->mpeg1 ? (fi->mono ? 17 : 32) : (fi->mono ? 9 : 17));
+	const unsigned char *v = data + pos + 4 + 32;
+	unsigned int flags, bytes, count, scale, width, i, j, entry;
+	uint64_t offset;
+
+	if (x + 120 <= data + size && (!memcmp(x, "Xing", 4) || !memcmp(x, "Info", 4))) {
+		flags = get_be32(x + 4);
+		/* Need the frame count, byte count and table of contents */
+		if ((flags & 7) != 7)
+			return -1;
+		(*hdr)->type = AST_MP3_INDEX_XING;
+		(*hdr)->frames = get_be32(x + 8);
+		bytes = get_be32(x + 12);
+		for (i = 0; i < 100; i++) {
+			if (index_add(hdr, alloced, pos + (uint64_t) x[16 + i] * bytes / 256))
+				return -1;
+		}
+		return 0;
+	}
+
+	if (v + 26 <= data + size && !memcmp(v, "VBRI", 4)) {
+		(*hdr)->type = AST_MP3_INDEX_VBRI;
+		(*hdr)->frames = get_be32(v + 14);
+		count = get_be16(v + 18);
+		scale = get_be16(v + 20);
+		width = get_be16(v + 22);
+		(*hdr)->step = get_be16(v + 24);
+		if (!(*hdr)->step || !width || width > 4 || v + 26 + count * width > data + size)
+			return -1;
+		offset = pos;
+		for (i = 0; i <= count; i++) {
+			if (index_add(hdr, alloced, offset))
+				return -1;
+			if (i == count)
+				break;
+			for (entry = 0, j = 0; j < width; j++)
+				entry = (entry << 8) | v[26 + i * width + j];
+			offset += (uint64_t) entry * scale;
+		}
+		return 0;
+	}
+
+	return -1;
+}
+
+/*!
+ * \brief Build the index of an MP3 file.
+ *
+ * The table of contents of a Xing or VBRI header is used when the file
+ * has one, so only its first frame is looked at.  Otherwise every frame
+ * header is parsed (the audio is not decoded), and the offset of about
+ * one frame per second recorded.
+ */
+static struct ast_mp3_index_header *index_build(const char *filename, const struct stat *st)
+{
+	struct ast_mp3_index_header *hdr;
+	struct mp3_frame_info first, fi;
+	const unsigned char *data;
+	size_t alloced = 4096, size = st->st_size, pos = 0;
+	int fd;
+
+	if (size < 4 || (fd = open(filename, O_RDONLY)) < 0)
+		return NULL;
+	data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	if (!(hdr = ast_calloc(1, alloced))) {
+		munmap((void *) data, size);
+		return NULL;
+	}
+	memcpy(hdr->magic, AST_MP3_INDEX_MAGIC, sizeof(hdr->magic));
+	hdr->size = st->st_size;
+	hdr->mtime = st->st_mtime;
+
+	/* Skip an ID3v2 tag, and its footer if any */
+	if (size >= 10 && !memcmp(data, "ID3", 3))
+		pos = 10 + ((data[6] & 0x7f) << 21 | (data[7] & 0x7f) << 14 | (data[8] & 0x7f) << 7 | (data[9] & 0x7f)) + ((data[5] & 0x10) ? 10 : 0);
+
+	/* The first frame is the first header followed by another one */
+	for (; pos + 4 <= size; pos++) {
+		if (parse_frame_header(data + pos, &first))
+			continue;
+		if (pos + first.length + 4 > size || !parse_frame_header(data + pos + first.length, &fi))
+			break;
+	}
+	if (pos + 4 > size) {
+		ast_log(LOG_WARNING, "No MPEG audio frames found in %s\n", filename);
+		goto fail;
+	}
+	hdr->rate = first.rate;
+	hdr->frame_samples = first.samples;
+
+	if (index_from_toc(&hdr, &alloced, data, size, pos, &first)) {
+		hdr->type = AST_MP3_INDEX_SCAN;
+		hdr->step = MAX(1, (first.rate + first.samples / 2) / first.samples);
+		hdr->frames = 0;
+		hdr->entries = 0;
+		while (pos + 4 <= size) {
+			/* Only frames like the first one count, so stray sync words in
+			 * the audio data (or a trailing ID3v1 tag) are skipped over */
+			if (parse_frame_header(data + pos, &fi) || fi.rate != first.rate || fi.samples != first.samples) {
+				pos++;
+				continue;
+			}
+			if (!(hdr->frames % hdr->step) && index_add(&hdr, &alloced, pos))
+				goto fail;
+			hdr->frames++;
+			pos += fi.length;
+		}
+	}
+	hdr->duration = (uint64_t) hdr->frames * hdr->frame_samples * 1000 / hdr->rate;
+
+	munmap((void *) data, size);
+	return hdr;
+
+fail:
+	munmap((void *) data, size);
+	ast_free(hdr);
+	return NULL;
+}
+
+/*! \brief Write an index next to its MP3 file, replacing any old one at once */
+static int index_write(const char *filename, const struct ast_mp3_index_header *hdr)
+{
+	char *fn, *tmp;
+	size_t len = sizeof(*hdr) + hdr->entries * sizeof(uint64_t);
+	int fd, res = -1;
+
+	if (ast_asprintf(&fn, "%s%s", filename, INDEX_SUFFIX) < 0)
+		return -1;
+	if (ast_asprintf(&tmp, "%s.tmp%ld", fn, ast_random()) < 0) {
+		ast_free(fn);
+		return -1;
+	}
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, AST_FILE_MODE)) > -1) {
+		if (write(fd, hdr, len) == len && !close(fd))
+			res = rename(tmp, fn);
+		else
+			close(fd);
+		if (res)
+			unlink(tmp);
+	}
+	if (res)
+		ast_debug(1, "Unable to write MP3 index %s: %s\n", fn, strerror(errno));
+	ast_free(tmp);
+	ast_free(fn);
+
+	return res;
+}
+
+/*! \brief Map the index file of an MP3, if there is one and it is current */
+static int index_map(struct ast_mp3_index *idx, const char *filename, const struct stat *st)
+{
+	const struct ast_mp3_index_header *hdr;
+	struct stat ist;
+	char *fn;
+	void *map;
+	int fd;
+
+	if (ast_asprintf(&fn, "%s%s", filename, INDEX_SUFFIX) < 0)
+		return -1;
+	fd = open(fn, O_RDONLY);
+	ast_free(fn);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &ist) || ist.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, ist.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	hdr = map;
+	if (memcmp(hdr->magic, AST_MP3_INDEX_MAGIC, sizeof(hdr->magic)) || hdr->size != st->st_size ||
+		hdr->mtime != st->st_mtime || ist.st_size < sizeof(*hdr) + hdr->entries * sizeof(uint64_t)) {
+		munmap(map, ist.st_size);
+		return -1;
+	}
+
+	idx->map = map;
+	idx->maplen = ist.st_size;
+	idx->hdr = hdr;
+
+	return 0;
+}
+
+static void index_destructor(void *obj)
+{
+	struct ast_mp3_index *idx = obj;
+
+	if (idx->map)
+		munmap(idx->map, idx->maplen);
+	else if (idx->hdr)
+		ast_free((void *) idx->hdr);
+}
+
+/*! \brief Find the index of a file among those in use.  Call with indexes locked. */
+static struct ast_mp3_index *index_find(const struct stat *st)
+{
+	struct ast_mp3_index *idx;
+
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&indexes, idx, list) {
+		if (idx->dev != st->st_dev || idx->ino != st->st_ino)
+			continue;
+		AST_LIST_REMOVE_CURRENT(list);
+		if (idx->hdr->size != st->st_size || idx->hdr->mtime != st->st_mtime) {
+			/* The file has changed since */
+			indexes_count--;
+			ao2_ref(idx, -1);
+			return NULL;
+		}
+		AST_LIST_INSERT_HEAD(&indexes, idx, list);
+		ao2_ref(idx, +1);
+		return idx;
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+
+	return NULL;
+}
+
+struct ast_mp3_index *ast_mp3_index_get(const char *filename, int build)
+{
+	struct ast_mp3_index *idx, *last;
+	struct ast_mp3_index_header *hdr;
+	struct stat st;
+
+	if (stat(filename, &st))
+		return NULL;
+
+	AST_LIST_LOCK(&indexes);
+	if ((idx = index_find(&st))) {
+		AST_LIST_UNLOCK(&indexes);
+		return idx;
+	}
+	AST_LIST_UNLOCK(&indexes);
+
+	if (!(idx = ao2_alloc(sizeof(*idx), index_destructor)))
+		return NULL;
+	idx->dev = st.st_dev;
+	idx->ino = st.st_ino;
+
+	if (index_map(idx, filename, &st)) {
+		if (!build || !(hdr = index_build(filename, &st))) {
+			ao2_ref(idx, -1);
+			return NULL;
+		}
+		/* Failing to save it only means building it again next time */
+		index_write(filename, hdr);
+		idx->hdr = hdr;
+	}
+	idx->offsets = (const uint64_t *) (idx->hdr + 1);
+
+	AST_LIST_LOCK(&indexes);
+	ao2_ref(idx, +1);
+	AST_LIST_INSERT_HEAD(&indexes, idx, list);
+	if (++indexes_count > MAX_INDEXES && (last = AST_LIST_LAST(&indexes))) {
+		AST_LIST_REMOVE(&indexes, last, list);
+		indexes_count--;
+		ao2_ref(last, -1);
+	}
+	AST_LIST_UNLOCK(&indexes);
+
+	return idx;
+}
+
+struct ast_mp3_index *ast_mp3_index_find(int fd)
+{
+	struct ast_mp3_index *idx;
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return NULL;
+
+	AST_LIST_LOCK(&indexes);
+	idx = index_find(&st);
+	AST_LIST_UNLOCK(&indexes);
+
+	return idx;
+}
+
+static void *index_thread(void *data)
+{
+	struct mp3_index_job *job = data;
+	struct ast_mp3_index *idx;
+
+	if ((idx = ast_mp3_index_get(job->filename, 1)))
+		ao2_ref(idx, -1);
+
+	AST_LIST_LOCK(&index_jobs);
+	AST_LIST_REMOVE(&index_jobs, job, list);
+	AST_LIST_UNLOCK(&index_jobs);
+	ast_free(job);
+
+	return NULL;
+}
+
+/*!
+ * \brief Start a background thread to build (and save) the index of an
+ * MP3 file, unless one is already at work on this file.
+ */
+static int index_queue(const char *filename, const struct stat *st)
+{
+	struct mp3_index_job *job;
+	pthread_t thread;
+	int res = 0;
+
+	AST_LIST_LOCK(&index_jobs);
+	AST_LIST_TRAVERSE(&index_jobs, job, list) {
+		if (job->dev == st->st_dev && job->ino == st->st_ino)
+			break;
+	}
+	if (!job) {
+		if (!(job = ast_calloc(1, sizeof(*job) + strlen(filename)))) {
+			AST_LIST_UNLOCK(&index_jobs);
+			return -1;
+		}
+		job->dev = st->st_dev;
+		job->ino = st->st_ino;
+		strcpy(job->filename, filename);
+		AST_LIST_INSERT_TAIL(&index_jobs, job, list);
+		if (ast_pthread_create_detached_background(&thread, NULL, index_thread, job)) {
+			AST_LIST_REMOVE(&index_jobs, job, list);
+			ast_free(job);
+			res = -1;
+		}
+	}
+	AST_LIST_UNLOCK(&index_jobs);
+
+	return res;
+}
+
+int ast_mp3_index_queue_file(const char *filename)
+{
+	struct stat st;
+
+	if (filename[0] != '/' || stat(filename, &st))
+		return -1;
+
+	return index_queue(filename, &st);
+}
+
+int ast_mp3_index_queue(int fd)
+{
+	struct stat st, fst;
+	char link[64], filename[PATH_MAX];
+	ssize_t len;
+
+	if (fstat(fd, &fst))
+		return -1;
+
+	/* Find the file's name again, making sure it still is this file */
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	if ((len = readlink(link, filename, sizeof(filename) - 1)) < 1 || filename[0] != '/')
+		return -1;
+	filename[len] = '\0';
+	if (stat(filename, &st) || st.st_dev != fst.st_dev || st.st_ino != fst.st_ino)
+		return -1;
+
+	return index_queue(filename, &st);
+}
+
+const struct ast_mp3_index_header *ast_mp3_index_header(const struct ast_mp3_index *idx)
+{
+	return idx->hdr;
+}
+
+const uint64_t *ast_mp3_index_entries(const struct ast_mp3_index *idx)
+{
+	return idx->offsets;
+}
+
+off_t ast_mp3_index_offset(const struct ast_mp3_index *idx, unsigned int ms)
+{
+	const struct ast_mp3_index_header *hdr = idx->hdr;
+	uint64_t entry;
+
+	if (!hdr->entries)
+		return 0;
+	if (hdr->type == AST_MP3_INDEX_XING)
+		entry = hdr->duration ? (uint64_t) ms * hdr->entries / hdr->duration : 0;
+	else
+		entry = (uint64_t) ms * hdr->rate / 1000 / hdr->frame_samples / hdr->step;
+
+	return idx->offsets[MIN(entry, hdr->entries - 1)];
+}
+
+/*!
+ * \brief Find the name the file layer knows a local MP3 file by.
+ *
+ * \param filename full path to the file, including its .mp3 extension
+ * \param base where to put filename without its extension
+ *
+ * Renditions of the file are checked as well, as it is about to be played,
+ * and its index is loaded for format_mp3 to seek with, or built in the
+ * background if it has none.
+ *
+ * \retval 0 if the file can be played through the file layer
+ * \retval -1 if not
+ */
+static int local_base(const char *filename, char *base, size_t len)
+{
+	char *ext;
+	struct stat st;
+	struct ast_mp3_index *idx;
+
+	if (filename[0] != '/' || strlen(filename) >= len)
+		return -1;
+	strcpy(base, filename);
+	if (!(ext = strrchr(base, '.')) || strcmp(ext, ".mp3"))
+		return -1;
+	*ext = '\0';
+	if (stat(filename, &st) || ast_fileexists(base, "mp3", NULL) < 1)
+		return -1;
+
+	check_renditions(base, &st);
+
+	/* Kept among the indexes in use, where format_mp3 looks it up */
+	if ((idx = ast_mp3_index_get(filename, 0)))
+		ao2_ref(idx, -1);
+	else
+		index_queue(filename, &st);
+
+	return 0;
+}
+
+struct ast_filestream *ast_mp3_openstream(struct ast_channel *chan, const char *filename)
+{
+	char base[PATH_MAX];
+
+	if (local_base(filename, base, sizeof(base)))
+		return NULL;
+
+	return ast_openstream_full(chan, base, NULL, 0);
+}
+
+/*! \brief Close whichever ends of a pipe are open */
+static void close_pipe(int fds[2])
+{
+	int x;
+
+	for (x = 0; x < 2; x++) {
+		if (fds[x] > -1)
+			close(fds[x]);
+		fds[x] = -1;
+	}
+}
+
+/*!
+ * \brief Start a decoder process
+ *
+ * Like ast_mp3_decoder_spawn(), but if cmdfd and statusfd are not NULL,
+ * they get pipes to the decoder's standard input and from its standard
+ * error as well.
+ */
+static int decoder_spawn(const char *path, char *const argv[], const char *dir, pid_t *pid, int *cmdfd, int *statusfd)
+{
+	struct mp3_decoder *d;
+	sigset_t fullset, oldset;
+	int fds[2] = { -1, -1 }, in[2] = { -1, -1 }, st[2] = { -1, -1 }, errpipe[2] = { -1, -1 };
+	int err = 0, x, limit, errfd = STDERR_FILENO + 1;
+#ifndef HAVE_CLOSEFROM
+	long maxfd = sysconf(_SC_OPEN_MAX);
+#endif
+
+	ast_mutex_lock(&config_lock);
+	limit = max_decoders;
+	ast_mutex_unlock(&config_lock);
+
+	if (!(d = ast_calloc(1, sizeof(*d))))
+		return -1;
+
+	AST_LIST_LOCK(&decoders);
+	if (limit && running_decoders + stopping_decoders >= limit) {
+		AST_LIST_UNLOCK(&decoders);
+		ast_log(LOG_WARNING, "Already running %d MP3 decoders, not starting another (see maxdecoders in %s)\n", limit, config);
+		ast_free(d);
+		return -1;
+	}
+	running_decoders++;
+	AST_LIST_UNLOCK(&decoders);
+
+	/* Close on exec, so no other process started meanwhile holds the
+	 * write end open, and the child only has to close what it inherited */
+	if (pipe(fds) || pipe(errpipe) || (cmdfd && (pipe(in) || pipe(st)))) {
+		ast_log(LOG_WARNING, "Unable to create pipe: %s\n", strerror(errno));
+		goto failed;
+	}
+	for (x = 0; x < 2; x++) {
+		fcntl(fds[x], F_SETFD, FD_CLOEXEC);
+		fcntl(errpipe[x], F_SETFD, FD_CLOEXEC);
+		if (cmdfd) {
+			fcntl(in[x], F_SETFD, FD_CLOEXEC);
+			fcntl(st[x], F_SETFD, FD_CLOEXEC);
+		}
+	}
+
+	/* No signal handler may run in the child: with vfork() it shares our memory */
+	sigfillset(&fullset);
+	pthread_sigmask(SIG_BLOCK, &fullset, &oldset);
+
+#ifdef HAVE_WORKING_VFORK
+	d->pid = vfork();
+#else
+	d->pid = fork();
+#endif
+	if (!d->pid) {
+		/* Only system calls from here on; ast_log() and friends could
+		 * deadlock on a lock held by another thread of the parent */
+		if (ast_opt_high_priority)
+			ast_set_priority(0);
+		signal(SIGPIPE, SIG_DFL);
+		pthread_sigmask(SIG_UNBLOCK, &fullset, NULL);
+
+		dup2(fds[1], STDOUT_FILENO);
+		if (cmdfd) {
+			dup2(in[0], STDIN_FILENO);
+			dup2(st[1], STDERR_FILENO);
+		}
+		/* Keep the error pipe just above stderr and close everything
+		 * else it inherited, however high the descriptors go */
+		if (errpipe[1] != errfd)
+			dup2(errpipe[1], errfd);
+		fcntl(errfd, F_SETFD, FD_CLOEXEC);
+#ifdef HAVE_CLOSEFROM
+		closefrom(STDERR_FILENO + 2);
+#else
+		for (x = STDERR_FILENO + 2; x < maxfd; x++)
+			close(x);
+#endif
+		if (dir && chdir(dir))
+			goto exec_failed;
+		if (path) {
+			execv(path, argv);
+		} else {
+			/* Most commonly installed in /usr/local/bin */
+			execv(LOCAL_MPG_123, argv);
+			/* But many places has it in /usr/bin */
+			execv(MPG_123, argv);
+			/* As a last-ditch effort, try to use PATH */
+			execvp("mpg123", argv);
+		}
+exec_failed:
+		err = errno;
+		write(errfd, &err, sizeof(err));
+		_exit(1);
+	}
+	if (d->pid < 0)
+		err = errno;
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	close(fds[1]);
+	fds[1] = -1;
+	close(errpipe[1]);
+	errpipe[1] = -1;
+	/* Once the child has exec'd, its copy of errpipe is closed and this
+	 * reads nothing; otherwise it reads why it could not */
+	if (d->pid > 0 && read(errpipe[0], &err, sizeof(err)) != sizeof(err))
+		err = 0;
+	close_pipe(errpipe);
+
+	if (d->pid < 0 || err) {
+		ast_log(LOG_WARNING, "Unable to run %s: %s\n", path ? path : "mpg123", strerror(err));
+		if (d->pid > 0) {
+			/* It already exited; let the reaper collect it */
+			close_pipe(fds);
+			close_pipe(in);
+			close_pipe(st);
+			AST_LIST_LOCK(&decoders);
+			AST_LIST_INSERT_TAIL(&decoders, d, list);
+			AST_LIST_UNLOCK(&decoders);
+			ast_mp3_decoder_stop(d->pid);
+			return -1;
+		}
+		goto failed;
+	}
+
+	AST_LIST_LOCK(&decoders);
+	AST_LIST_INSERT_TAIL(&decoders, d, list);
+	total_decoders++;
+	AST_LIST_UNLOCK(&decoders);
+
+	if (cmdfd) {
+		close(in[0]);
+		close(st[1]);
+		*cmdfd = in[1];
+		*statusfd = st[0];
+	}
+	*pid = d->pid;
+	return fds[0];
+
+failed:
+	close_pipe(fds);
+	close_pipe(errpipe);
+	close_pipe(in);
+	close_pipe(st);
+	AST_LIST_LOCK(&decoders);
+	running_decoders--;
+	AST_LIST_UNLOCK(&decoders);
+	ast_free(d);
+	return -1;
+}
+
+int ast_mp3_decoder_spawn(const char *path, char *const argv[], const char *dir, pid_t *pid)
+{
+	return decoder_spawn(path, argv, dir, pid, NULL, NULL);
+}
+
+/*!
+ * \brief Reap stopped decoders, signalling those that do not exit.
+ *
+ * A decoder is sent SIGHUP when stopped, then SIGTERM and SIGKILL in turn
+ * every DECODER_STOP_INTERVAL ms for as long as it keeps running, which
+ * gives a custom player time to stop its own children.
+ */
+static void *reaper_main(void *data)
+{
+	struct mp3_decoder *d;
+	struct timeval tv;
+	struct timespec ts;
+	int res;
+
+	AST_LIST_LOCK(&decoders);
+	for (;;) {
+		AST_LIST_TRAVERSE_SAFE_BEGIN(&decoders, d, list) {
+			if (ast_tvzero(d->stopped))
+				continue;
+			/* It may already have been reaped by the SIGCHLD handler */
+			if ((res = waitpid(d->pid, NULL, WNOHANG)) && (res > 0 || errno != EINTR)) {
+				AST_LIST_REMOVE_CURRENT(list);
+				stopping_decoders--;
+				ast_free(d);
+				continue;
+			}
+			if (d->signals < 3 && ast_tvdiff_ms(ast_tvnow(), d->stopped) >= d->signals * DECODER_STOP_INTERVAL) {
+				kill(d->pid, d->signals == 1 ? SIGTERM : SIGKILL);
+				d->signals++;
+			}
+		}
+		AST_LIST_TRAVERSE_SAFE_END;
+
+		if (!stopping_decoders) {
+			ast_cond_wait(&reaper_cond, &decoders.lock);
+			continue;
+		}
+		tv = ast_tvadd(ast_tvnow(), ast_samp2tv(DECODER_STOP_INTERVAL, 1000));
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000;
+		ast_cond_timedwait(&reaper_cond, &decoders.lock, &ts);
+	}
+	AST_LIST_UNLOCK(&decoders);
+
+	return NULL;
+}
+
+void ast_mp3_decoder_stop(pid_t pid)
+{
+	struct mp3_decoder *d;
+
+	AST_LIST_LOCK(&decoders);
+	AST_LIST_TRAVERSE(&decoders, d, list) {
+		if (d->pid == pid && ast_tvzero(d->stopped))
+			break;
+	}
+	if (!d) {
+		AST_LIST_UNLOCK(&decoders);
+		return;
+	}
+	if (reaper_thread == AST_PTHREADT_NULL &&
+	    ast_pthread_create_background(&reaper_thread, NULL, reaper_main, NULL)) {
+		ast_log(LOG_WARNING, "Unable to start the MP3 decoder reaper thread\n");
+		reaper_thread = AST_PTHREADT_NULL;
+	}
+	d->stopped = ast_tvnow();
+	d->signals = 1;
+	kill(d->pid, SIGHUP);
+	running_decoders--;
+	stopping_decoders++;
+	ast_cond_signal(&reaper_cond);
+	AST_LIST_UNLOCK(&decoders);
+}
+
+/*!
+ * \brief Start mpg123 decoding location to 8kHz mono signed linear
+ * \return the read end of the pipe the audio comes out of, or -1
+ */
+static int mp3_spawn(const char *location, pid_t *pid)
+{
+	char *argv[] = { "mpg123", "-q", "-s", "-f", "8192", "--mono", "-r", "8000", NULL, NULL, NULL, NULL };
+	int argc = 8;
+
+	/* Buffer if it's a net connection */
+	if (!strncasecmp(location, "http://", 7)) {
+		argv[argc++] = "-b";
+		argv[argc++] = "1024";
+	}
+	argv[argc++] = (char *) location;
+
+	return ast_mp3_decoder_spawn(NULL, argv, NULL, pid);
+}
+
+/*!
+ * \brief Read what a pooled decoder has to say about its progress.
+ *
+ * Only the end of the file matters: "@P 0" once it stopped, or "@E" if it
+ * could not play the file at all.
+ */
+static void worker_status(struct mp3_worker *w)
+{
+	char *line, *next;
+	int res;
+
+	while ((res = read(w->statusfd, w->status + w->statuslen, sizeof(w->status) - 1 - w->statuslen)) != 0) {
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				w->dead = 1;
+			break;
+		}
+		w->statuslen += res;
+		w->status[w->statuslen] = '\0';
+		for (line = w->status; (next = strchr(line, '\n')); line = next + 1) {
+			*next = '\0';
+			if (!strncmp(line, "@P 0", 4) || !strncmp(line, "@P 3", 4))
+				w->finished = 1;
+			else if (!strncmp(line, "@E", 2)) {
+				ast_debug(1, "MP3 decoder %d: %s\n", (int) w->pid, line);
+				w->finished = 1;
+			}
+		}
+		/* Keep a partial line for next time, unless it can never end */
+		w->statuslen = strlen(line);
+		if (w->statuslen == sizeof(w->status) - 1)
+			w->statuslen = 0;
+		memmove(w->status, line, w->statuslen);
+	}
+	if (!res)
+		w->dead = 1;
+	if (w->dead)
+		w->finished = 1;
+}
+
+/*! \brief Start a decoder for the pool */
+static struct mp3_worker *worker_start(void)
+{
+	char *argv[] = { "mpg123", "-R", "--remote-err", "-s", "-f", "8192", "--mono", "-r", "8000", NULL };
+	struct mp3_worker *w;
+
+	if (!(w = ast_calloc(1, sizeof(*w))))
+		return NULL;
+	if ((w->audiofd = decoder_spawn(NULL, argv, NULL, &w->pid, &w->cmdfd, &w->statusfd)) < 0) {
+		ast_free(w);
+		return NULL;
+	}
+	fcntl(w->audiofd, F_SETFL, fcntl(w->audiofd, F_GETFL) | O_NONBLOCK);
+	fcntl(w->statusfd, F_SETFL, fcntl(w->statusfd, F_GETFL) | O_NONBLOCK);
+	/* No progress reports; nobody reads them while it is idle */
+	write(w->cmdfd, "SILENCE\n", 8);
+	w->idle_since = ast_tvnow();
+
+	return w;
+}
+
+static void worker_free(struct mp3_worker *w)
+{
+	close(w->audiofd);
+	close(w->cmdfd);
+	close(w->statusfd);
+	ast_mp3_decoder_stop(w->pid);
+	ast_free(w);
+}
+
+/*! \brief Take a busy worker out of the pool and stop it */
+static void worker_retire(struct mp3_worker *w)
+{
+	AST_LIST_LOCK(&workers);
+	AST_LIST_REMOVE(&workers, w, list);
+	pool_workers--;
+	ast_cond_broadcast(&pool_cond);
+	AST_LIST_UNLOCK(&workers);
+
+	worker_free(w);
+}
+
+/*!
+ * \brief Get a pooled decoder playing location
+ *
+ * If all are busy and the pool is full, waits a while for one to be freed,
+ * as long as no more than poolqueue requests are waiting already.
+ *
+ * \return the worker, or NULL if the caller needs a decoder of its own
+ */
+static struct mp3_worker *pool_get(const char *location)
+{
+	struct mp3_worker *w;
+	struct timeval tv;
+	struct timespec ts;
+	char cmd[PATH_MAX + 8];
+	int size, queue, waited = 0, len;
+
+	/* A newline would end the command early */
+	if (strchr(location, '\n') || strlen(location) > PATH_MAX)
+		return NULL;
+
+	ast_mutex_lock(&config_lock);
+	size = pool_size;
+	queue = pool_queue;
+	ast_mutex_unlock(&config_lock);
+	if (!size)
+		return NULL;
+
+	AST_LIST_LOCK(&workers);
+	pool_requests++;
+	for (;;) {
+		AST_LIST_TRAVERSE(&workers, w, list) {
+			if (!w->busy)
+				break;
+		}
+		if (w)
+			break;
+		if (pool_workers < size) {
+			/* Hold its place in the pool, but start it without the lock:
+			 * the other players need the pool meanwhile */
+			pool_workers++;
+			AST_LIST_UNLOCK(&workers);
+			w = worker_start();
+			AST_LIST_LOCK(&workers);
+			if (w)
+				AST_LIST_INSERT_TAIL(&workers, w, list);
+			else {
+				pool_workers--;
+				ast_cond_broadcast(&pool_cond);
+			}
+			break;
+		}
+		if (waited || pool_waiting >= queue)
+			break;
+		pool_waiting++;
+		pool_waits++;
+		tv = ast_tvadd(ast_tvnow(), ast_samp2tv(POOL_WAIT, 1000));
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000;
+		ast_cond_timedwait(&pool_cond, &workers.lock, &ts);
+		pool_waiting--;
+		waited = 1;
+	}
+	if (w)
+		w->busy = 1;
+	else
+		pool_fallbacks++;
+	AST_LIST_UNLOCK(&workers);
+
+	if (!w)
+		return NULL;
+
+	/* Forget anything it said while idle */
+	worker_status(w);
+	w->finished = 0;
+	len = snprintf(cmd, sizeof(cmd), "LOAD %s\n", location);
+	if (w->dead || write(w->cmdfd, cmd, len) != len) {
+		worker_retire(w);
+		AST_LIST_LOCK(&workers);
+		pool_fallbacks++;
+		AST_LIST_UNLOCK(&workers);
+		return NULL;
+	}
+
+	return w;
+}
+
+/*!
+ * \brief Give a worker back to the pool once it has stopped playing
+ *
+ * Audio it wrote that was not played is thrown away, so the next player
+ * starts with its own file.  A worker that does not stop is replaced.
+ */
+static void pool_put(struct mp3_worker *w)
+{
+	struct pollfd pfds[2];
+	struct timeval start = ast_tvnow();
+	char buf[4096];
+	int ms;
+
+	if (!w->finished)
+		write(w->cmdfd, "STOP\n", 5);
+	while (!w->finished && (ms = POOL_STOP_WAIT - ast_tvdiff_ms(ast_tvnow(), start)) > 0) {
+		pfds[0].fd = w->audiofd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = w->statusfd;
+		pfds[1].events = POLLIN;
+		if (poll(pfds, 2, ms) < 0 && errno != EINTR)
+			break;
+		/* It may be blocked writing audio nobody wants any more */
+		while (read(w->audiofd, buf, sizeof(buf)) > 0);
+		worker_status(w);
+	}
+	while (read(w->audiofd, buf, sizeof(buf)) > 0);
+
+	if (!w->finished || w->dead) {
+		worker_retire(w);
+		return;
+	}
+
+	AST_LIST_LOCK(&workers);
+	w->busy = 0;
+	w->idle_since = ast_tvnow();
+	ast_cond_broadcast(&pool_cond);
+	AST_LIST_UNLOCK(&workers);
+}
+
+/*!
+ * \brief Keep the decoder pool at its configured size
+ *
+ * Starts decoders ahead of need, unless poolidle is set, in which case
+ * they are started as needed and stopped after sitting idle that long.
+ * Idle decoders that exited, or that exceed the pool size after a reload,
+ * are stopped too.
+ */
+static void *pool_thread_main(void *data)
+{
+	AST_LIST_HEAD_NOLOCK(, mp3_worker) dead = AST_LIST_HEAD_NOLOCK_INIT_VALUE;
+	struct mp3_worker *w;
+	struct timeval tv, retry = { 0, };
+	struct timespec ts;
+	int size, idle;
+
+	AST_LIST_LOCK(&workers);
+	for (;;) {
+		ast_mutex_lock(&config_lock);
+		size = pool_size;
+		idle = pool_idle;
+		ast_mutex_unlock(&config_lock);
+
+		AST_LIST_TRAVERSE_SAFE_BEGIN(&workers, w, list) {
+			if (w->busy)
+				continue;
+			worker_status(w);
+			if (w->dead || pool_workers > size ||
+			    (idle && ast_tvdiff_ms(ast_tvnow(), w->idle_since) >= idle * 1000)) {
+				AST_LIST_REMOVE_CURRENT(list);
+				pool_workers--;
+				AST_LIST_INSERT_TAIL(&dead, w, list);
+			}
+		}
+		AST_LIST_TRAVERSE_SAFE_END;
+
+		while (!idle && pool_workers < size && ast_tvcmp(ast_tvnow(), retry) >= 0) {
+			/* Started without the lock, as in pool_get() */
+			pool_workers++;
+			AST_LIST_UNLOCK(&workers);
+			w = worker_start();
+			AST_LIST_LOCK(&workers);
+			if (!w) {
+				pool_workers--;
+				/* Don't flood the log if it keeps failing */
+				retry = ast_tvadd(ast_tvnow(), ast_samp2tv(30, 1));
+				break;
+			}
+			AST_LIST_INSERT_TAIL(&workers, w, list);
+			ast_cond_broadcast(&pool_cond);
+		}
+
+		AST_LIST_UNLOCK(&workers);
+		while ((w = AST_LIST_REMOVE_HEAD(&dead, list)))
+			worker_free(w);
+		AST_LIST_LOCK(&workers);
+
+		tv = ast_tvadd(ast_tvnow(), ast_samp2tv(1, 1));
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000;
+		ast_cond_timedwait(&pool_cond, &workers.lock, &ts);
+	}
+	AST_LIST_UNLOCK(&workers);
+
+	return NULL;
+}
+
+static void readahead_wake(void)
+{
+	write(readahead_pipe[1], "", 1);
+}
+
+/*! \brief Position of the reader furthest behind.  Call with ra locked. */
+static uint64_t readahead_minpos(struct mp3_readahead *ra)
+{
+	struct mp3_player *p;
+	uint64_t pos = ra->written;
+
+	AST_LIST_TRAVERSE(&ra->readers, p, entry) {
+		if (p->pos < pos)
+			pos = p->pos;
+	}
+
+	return pos;
+}
+
+/*! \brief Read decoder output into the ring, called by the I/O thread */
+static int readahead_read(int *id, int fd, short events, void *cbdata)
+{
+	struct mp3_readahead *ra = cbdata;
+	size_t tail, space;
+	int res;
+
+	ast_mutex_lock(&ra->lock);
+	tail = ra->written % ra->size;
+	space = MIN(ra->size - (ra->written - readahead_minpos(ra)), ra->size - tail);
+	if (!space)
+		ra->paused = 1;
+	ast_mutex_unlock(&ra->lock);
+
+	if (!space) {
+		/* Stop watching the pipe until the readers have made room */
+		ra->id = NULL;
+		return 0;
+	}
+
+	/* No reader looks at this space until written moves past it */
+	res = read(fd, ra->ring + tail, space);
+	if (res < 0 && (errno == EAGAIN || errno == EINTR))
+		return 1;
+
+	ast_mutex_lock(&ra->lock);
+	if (res > 0)
+		ra->written += res;
+	else
+		ra->eof = 1;
+	ast_mutex_unlock(&ra->lock);
+
+	if (res > 0)
+		return 1;
+	ra->id = NULL;
+	return 0;
+}
+
+/*! \brief Add new and resumed streams to the I/O context, and free finished ones */
+static int readahead_update(int *id, int fd, short events, void *cbdata)
+{
+	struct mp3_readahead *ra;
+	char buf[32];
+	int watch;
+
+	while (read(fd, buf, sizeof(buf)) > 0);
+
+	AST_LIST_LOCK(&readaheads);
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&readaheads, ra, list) {
+		if (ra->closing) {
+			AST_LIST_REMOVE_CURRENT(list);
+			if (ra->id)
+				ast_io_remove(readahead_io, ra->id);
+			close(ra->fd);
+			ast_mutex_destroy(&ra->lock);
+			ast_free(ra->ring);
+			ast_free(ra);
+			continue;
+		}
+		if (ra->id)
+			continue;
+		ast_mutex_lock(&ra->lock);
+		watch = !ra->eof && !ra->paused;
+		ast_mutex_unlock(&ra->lock);
+		if (watch)
+			ra->id = ast_io_add(readahead_io, ra->fd, readahead_read, AST_IO_IN, ra);
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+	AST_LIST_UNLOCK(&readaheads);
+
+	return 1;
+}
+
+static void *readahead_thread_main(void *data)
+{
+	for (;;)
+		ast_io_wait(readahead_io, -1);
+
+	return NULL;
+}
+
+/*! \brief Start the I/O thread if it is not running yet.  Call with readaheads locked. */
+static int readahead_start(void)
+{
+	int x, flags;
+
+	if (readahead_thread != AST_PTHREADT_NULL)
+		return 0;
+	if (!readahead_io && !(readahead_io = io_context_create()))
+		return -1;
+	if (readahead_pipe[0] < 0) {
+		if (pipe(readahead_pipe)) {
+			ast_log(LOG_WARNING, "Unable to create read-ahead wakeup pipe: %s\n", strerror(errno));
+			return -1;
+		}
+		for (x = 0; x < 2; x++) {
+			flags = fcntl(readahead_pipe[x], F_GETFL);
+			fcntl(readahead_pipe[x], F_SETFL, flags | O_NONBLOCK);
+		}
+		ast_io_add(readahead_io, readahead_pipe[0], readahead_update, AST_IO_IN, NULL);
+	}
+	if (ast_pthread_create_background(&readahead_thread, NULL, readahead_thread_main, NULL)) {
+		ast_log(LOG_WARNING, "Unable to start MP3 read-ahead thread\n");
+		readahead_thread = AST_PTHREADT_NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Attach a player to the read-ahead stream of location.
+ *
+ * A broadcast of location already running is joined, with the player
+ * starting up to its pre-roll behind the live position.  Otherwise a
+ * decoder is started and its output handed to the I/O thread; if
+ * broadcasting it is listed so later players of location find it.
+ *
+ * \retval 0 if p is now reading from a ring
+ * \retval -1 if the decoder must be read directly
+ */
+static int readahead_attach(struct mp3_player *p, const char *location, int ms, int shared)
+{
+	struct mp3_readahead *ra = NULL;
+	AST_LIST_LOCK(&readaheads);
+	if (shared) {
+		AST_LIST_TRAVERSE(&readaheads, ra, list) {
+			if (!ra->closing && !ra->eof && !strcmp(ra->location, location))
+				break;
+		}
+	}
+	if (!ra) {
+		if (readahead_start() || !(ra = ast_calloc(1, sizeof(*ra) + (shared ? strlen(location) : 0)))) {
+			AST_LIST_UNLOCK(&readaheads);
+			return -1;
+		}
+		ra->size = MS_TO_BYTES(ms);
+		if (!(ra->ring = ast_malloc(ra->size))) {
+			ast_free(ra);
+			AST_LIST_UNLOCK(&readaheads);
+			return -1;
+		}
+		if ((ra->fd = mp3_spawn(location, &ra->pid)) < 0) {
+			ast_free(ra->ring);
+			ast_free(ra);
+			AST_LIST_UNLOCK(&readaheads);
+			return -1;
+		}
+		fcntl(ra->fd, F_SETFL, fcntl(ra->fd, F_GETFL) | O_NONBLOCK);
+		if (shared) {
+			strcpy(ra->location, location);
+			ast_verb(3, "Starting MP3 broadcast of '%s'\n", location);
+		}
+		ast_mutex_init(&ra->lock);
+		AST_LIST_INSERT_TAIL(&readaheads, ra, list);
+		readahead_wake();
+	}
+
+	ast_mutex_lock(&ra->lock);
+	p->pos = ra->written - MIN(ra->written, MIN(p->preroll, ra->size));
+	AST_LIST_INSERT_TAIL(&ra->readers, p, entry);
+	ast_mutex_unlock(&ra->lock);
+	p->ra = ra;
+	AST_LIST_UNLOCK(&readaheads);
+
+	return 0;
+}
+
+/*! \brief Detach a player; the last one out stops the decoder and frees the stream */
+static void readahead_detach(struct mp3_player *p)
+{
+	struct mp3_readahead *ra = p->ra;
+	int wake = 0;
+
+	AST_LIST_LOCK(&readaheads);
+	ast_mutex_lock(&ra->lock);
+	AST_LIST_REMOVE(&ra->readers, p, entry);
+	if (AST_LIST_EMPTY(&ra->readers)) {
+		if (!ast_strlen_zero(ra->location))
+			ast_verb(3, "Stopping MP3 broadcast of '%s'\n", ra->location);
+		ast_mp3_decoder_stop(ra->pid);
+		ra->closing = 1;
+		wake = 1;
+	} else if (ra->paused && ra->written - readahead_minpos(ra) <= ra->size / 2) {
+		/* p may have been what held the stream back */
+		ra->paused = 0;
+		wake = 1;
+	}
+	ast_mutex_unlock(&ra->lock);
+	AST_LIST_UNLOCK(&readaheads);
+	p->ra = NULL;
+
+	if (wake)
+		readahead_wake();
+}
+
+/*!
+ * \brief Move buffered audio from the ring to the player.
+ *
+ * Nothing is taken while the player is waiting for the ring to fill to
+ * its pre-roll or low-water mark, unless the stream has ended.
+ */
+static void readahead_fill(struct mp3_player *p, int len)
+{
+	struct mp3_readahead *ra = p->ra;
+	char *audio = p->buf + AST_FRIENDLY_OFFSET;
+	size_t n, chunk, offset;
+	int wake = 0;
+
+	ast_mutex_lock(&ra->lock);
+	if (p->skip) {
+		n = MIN(p->skip, ra->written - p->pos);
+		p->pos += n;
+		p->skip -= n;
+	}
+	if (!p->skip && (!p->buffering || ra->eof || ra->written - p->pos >= (p->started ? p->lowwater : p->preroll))) {
+		p->buffering = 0;
+		n = MIN(ra->written - p->pos, len - p->buffered);
+		while (n) {
+			offset = p->pos % ra->size;
+			chunk = MIN(n, ra->size - offset);
+			memcpy(audio + p->buffered, ra->ring + offset, chunk);
+			p->buffered += chunk;
+			p->pos += chunk;
+			n -= chunk;
+		}
+	}
+	if (p->pos == ra->written && ra->eof)
+		p->eof = 1;
+	if (ra->paused && ra->written - readahead_minpos(ra) <= ra->size / 2) {
+		ra->paused = 0;
+		wake = 1;
+	}
+	ast_mutex_unlock(&ra->lock);
+
+	if (wake)
+		readahead_wake();
+}
+
+/*!
+ * \brief Whether a pooled decoder has no more audio for the player
+ *
+ * A pooled decoder keeps its pipe open, but reports the end of the file
+ * after writing all of it.  So once the report has been seen, a read that
+ * would block means the end.
+ */
+static int pipe_ended(struct mp3_player *p)
+{
+	int finished;
+
+	if (!p->worker)
+		return 0;
+	finished = p->worker->finished;
+	worker_status(p->worker);
+
+	return finished;
+}
+
+/*! \brief Read what the decoder has ready straight from its pipe */
+static void pipe_fill(struct mp3_player *p, int len)
+{
+	char *audio = p->buf + AST_FRIENDLY_OFFSET;
+	int res;
+
+	/* Drop audio before the start offset as fast as the decoder makes it */
+	while (!p->eof && p->skip) {
+		res = read(p->fd, audio, MIN(p->skip, MP3_MAX_SAMPLES * 2));
+		if (res > 0)
+			p->skip -= res;
+		else if (!res || (errno != EAGAIN && errno != EINTR))
+			p->eof = 1;
+		else if (errno == EAGAIN) {
+			if (pipe_ended(p))
+				p->eof = 1;
+			return;
+		}
+	}
+
+	while (!p->eof && p->buffered < len) {
+		res = read(p->fd, audio + p->buffered, len - p->buffered);
+		if (res > 0)
+			p->buffered += res;
+		else if (!res || (errno != EAGAIN && errno != EINTR))
+			p->eof = 1;
+		else if (errno == EAGAIN) {
+			if (pipe_ended(p))
+				p->eof = 1;
+			break;
+		}
+	}
+}
+
+static void *mp3gen_alloc(struct ast_channel *chan, void *params)
+{
+	struct mp3_player *p = params;
+
+	p->origwfmt = chan->writeformat;
+	if (ast_set_write_format(chan, AST_FORMAT_SLINEAR)) {
+		ast_log(LOG_WARNING, "Unable to set '%s' to signed linear format (write)\n", chan->name);
+		return NULL;
+	}
+	ast_atomic_fetchadd_int(&total_playbacks, 1);
+	ast_atomic_fetchadd_int(&active_playbacks, 1);
+
+	return p;
+}
+
+static void mp3gen_release(struct ast_channel *chan, void *data)
+{
+	struct mp3_player *p = data;
+
+	if (p->origwfmt && ast_set_write_format(chan, p->origwfmt))
+		ast_log(LOG_WARNING, "Unable to restore channel '%s' to format %d\n", chan->name, p->origwfmt);
+	ast_atomic_fetchadd_int(&active_playbacks, -1);
+	ast_atomic_fetchadd_int(&total_frames, p->frames);
+	ast_atomic_fetchadd_int(&total_underruns, p->underruns);
+	ast_debug(1, "MP3 playback on %s done: %u frames, %u underruns\n", chan->name, p->frames, p->underruns);
+	p->done = 1;
+}
+
+/*!
+ * \brief Send one frame of decoded audio, or silence if there is none yet.
+ *
+ * Called on the channel's timing, so it never waits for the decoder.
+ */
+static int mp3gen_generate(struct ast_channel *chan, void *data, int len, int samples)
+{
+	struct mp3_player *p = data;
+	char *audio = p->buf + AST_FRIENDLY_OFFSET;
+	int res;
+
+	if (samples > MP3_MAX_SAMPLES)
+		samples = MP3_MAX_SAMPLES;
+	len = samples * 2;
+
+	if (p->ra)
+		readahead_fill(p, len);
+	else
+		pipe_fill(p, len);
+
+	p->f.frametype = AST_FRAME_VOICE;
+	p->f.subclass = AST_FORMAT_SLINEAR;
+	p->f.offset = AST_FRIENDLY_OFFSET;
+	p->f.src = "mp3";
+
+	if (p->buffered >= len || (p->eof && p->buffered > 1)) {
+		/* A full frame, or what is left at the end of the stream */
+		p->f.datalen = MIN(len, p->buffered & ~1);
+		p->f.samples = p->f.datalen / 2;
+		p->f.data = audio;
+		p->started = 1;
+		p->starved = 0;
+		p->frames++;
+		p->played += p->f.datalen;
+		res = ast_write(chan, &p->f);
+		p->buffered -= p->f.datalen;
+		if (p->buffered > 0)
+			memmove(audio, audio + p->f.datalen, p->buffered);
+		return res < 0 ? -1 : 0;
+	}
+
+	if (p->eof)
+		return -1;
+
+	/* The decoder is behind; keep the clock going with silence */
+	if (p->started) {
+		p->underruns++;
+		/* Let a read-ahead buffer refill some before resuming */
+		p->buffering = 1;
+	}
+	p->starved += samples;
+	if (p->starved > p->maxstarve) {
+		ast_log(LOG_NOTICE, "No audio from MP3 decoder for %d ms, giving up\n", p->starved / 8);
+		return -1;
+	}
+	p->f.datalen = len;
+	p->f.samples = samples;
+	p->f.data = p->silence + AST_FRIENDLY_OFFSET;
+	return ast_write(chan, &p->f) < 0 ? -1 : 0;
+}
+
+static struct ast_generator mp3gen = {
+	alloc: mp3gen_alloc,
+	release: mp3gen_release,
+	generate: mp3gen_generate,
+};
+
+/*! \brief Run the player generator until the stream ends or the caller breaks out */
+static int mp3_generate_wait(struct ast_channel *chan, struct mp3_player *p, const char *breakon, int audiofd, int cmdfd)
+{
+	struct ast_frame *fr;
+	int res = 0, ms;
+
+	ast_stopstream(chan);
+	if (ast_activate_generator(chan, &mp3gen, p))
+		return -1;
+
+	ast_set_flag(chan, AST_FLAG_END_DTMF_ONLY);
+
+	while (!p->done) {
+		ms = 1000;
+		if (cmdfd < 0) {
+			res = ast_waitfor(chan, ms);
+		} else {
+			int outfd;
+			struct ast_channel *rchan = ast_waitfor_nandfds(&chan, 1, &cmdfd, 1, NULL, &outfd, &ms);
+			if (!rchan && outfd < 0 && ms) {
+				if (errno == EINTR)
+					continue;
+				res = -1;
+			} else if (outfd > -1) {
+				/* Something is waiting on the command fd */
+				res = 1;
+				break;
+			} else
+				res = rchan ? 1 : 0;
+		}
+		if (res < 0) {
+			ast_log(LOG_WARNING, "Wait failed (%s)\n", strerror(errno));
+			break;
+		}
+		if (!res)
+			continue;
+		if (!(fr = ast_read(chan))) {
+			res = -1;
+			break;
+		}
+		res = 0;
+		if (fr->frametype == AST_FRAME_DTMF_END && strchr(breakon, fr->subclass)) {
+			res = fr->subclass;
+		} else if (fr->frametype == AST_FRAME_CONTROL) {
+			if (fr->subclass == AST_CONTROL_HANGUP || fr->subclass == AST_CONTROL_BUSY || fr->subclass == AST_CONTROL_CONGESTION)
+				res = -1;
+		} else if (fr->frametype == AST_FRAME_VOICE && audiofd > -1) {
+			write(audiofd, fr->data, fr->datalen);
+		}
+		ast_frfree(fr);
+		if (res)
+			break;
+	}
+
+	ast_clear_flag(chan, AST_FLAG_END_DTMF_ONLY);
+	if (!p->done)
+		ast_deactivate_generator(chan);
+
+	if (!res && chan->_softhangup)
+		res = -1;
+
+	return res;
+}
+
+int ast_mp3_play(struct ast_channel *chan, const char *location, const char *breakon, int audiofd, int cmdfd, long *offset)
+{
+	struct ast_filestream *fs;
+	struct mp3_player *p;
+	int res, readahead, shared, remote;
+	pid_t pid = -1;
+	long start = 0, max_length = 0;
+
+	if (!breakon)
+		breakon = "";
+	if (offset && *offset > 0)
+		start = *offset;
+
+	if ((fs = ast_mp3_openstream(chan, location))) {
+		if (offset) {
+			ast_seekstream(fs, 0, SEEK_END);
+			max_length = ast_tellstream(fs);
+			ast_seekstream(fs, start, SEEK_SET);
+		}
+		ast_applystream(chan, fs);
+		ast_playstream(fs);
+		res = ast_waitstream_full(chan, breakon, audiofd, cmdfd);
+		/* If the stream is gone, it played to the end */
+		if (offset)
+			*offset = chan->stream ? ast_tellstream(fs) : max_length;
+		ast_stopstream(chan);
+		return res;
+	}
+
+	if (!(p = ast_calloc(1, sizeof(*p))))
+		return -1;
+
+	/* Read ahead, with a 10 sec timeout, when streaming from a URL */
+	remote = !strncasecmp(location, "http://", 7);
+	p->maxstarve = (remote ? 10000 : 2000) * 8;
+
+	ast_mutex_lock(&config_lock);
+	readahead = remote ? readahead_ms : 0;
+	shared = broadcast;
+	p->preroll = MS_TO_BYTES(preroll_ms);
+	p->lowwater = MS_TO_BYTES(lowwater_ms);
+	ast_mutex_unlock(&config_lock);
+
+	/* A broadcast has no start to be offset from */
+	if (readahead && shared)
+		start = 0;
+	p->skip = (uint64_t) start * 2;
+
+	if (readahead && !readahead_attach(p, location, readahead, shared)) {
+		p->buffering = 1;
+	} else if (!remote && (p->worker = pool_get(location))) {
+		p->fd = p->worker->audiofd;
+	} else {
+		if ((p->fd = mp3_spawn(location, &pid)) < 0) {
+			ast_free(p);
+			return -1;
+		}
+		fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	res = mp3_generate_wait(chan, p, breakon, audiofd, cmdfd);
+	if (offset)
+		*offset = start + p->played / 2;
+
+	if (p->ra)
+		readahead_detach(p);
+	else if (p->worker)
+		pool_put(p->worker);
+	else {
+		close(p->fd);
+		ast_mp3_decoder_stop(pid);
+	}
+	ast_free(p);
+
+	return res;
+}
+
+int ast_mp3_control(struct ast_channel *chan, const char *location, const char *fwd, const char *rev,
+	const char *stop, const char *pause, int skipms)
+{
+	char base[PATH_MAX];
+
+	if (local_base(location, base, sizeof(base)))
+		return ast_mp3_play(chan, location, stop, -1, -1, NULL);
+
+	return ast_control_streamfile(chan, base, fwd, rev, stop, pause, NULL, skipms, NULL);
+}
+
+static char *handle_cli_mp3_show_playback(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct mp3_readahead *ra;
+	struct mp3_player *p;
+	int frames, underruns, listeners;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "mp3 show playback";
+		e->usage =
+			"Usage: mp3 show playback\n"
+			"       Shows statistics of MP3 playback through external decoders:\n"
+			"       frames sent and how many of them were silence because\n"
+			"       the decoder fell behind (underruns), the decoder processes\n"
+			"       started and running, and the broadcasts currently running.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	frames = total_frames;
+	underruns = total_underruns;
+	ast_cli(a->fd, "Playbacks: %d (%d active)\n", total_playbacks, active_playbacks);
+	ast_cli(a->fd, "Frames sent: %d\n", frames + underruns);
+	ast_cli(a->fd, "Underruns: %d (%.2f%%)\n", underruns, frames + underruns ? 100.0 * underruns / (frames + underruns) : 0.0);
+	AST_LIST_LOCK(&decoders);
+	ast_cli(a->fd, "Decoders: %d started, %d running, %d stopping\n", total_decoders, running_decoders, stopping_decoders);
+	AST_LIST_UNLOCK(&decoders);
+
+	AST_LIST_LOCK(&readaheads);
+	AST_LIST_TRAVERSE(&readaheads, ra, list) {
+		if (ra->closing || ast_strlen_zero(ra->location))
+			continue;
+		listeners = 0;
+		ast_mutex_lock(&ra->lock);
+		AST_LIST_TRAVERSE(&ra->readers, p, entry)
+			listeners++;
+		ast_mutex_unlock(&ra->lock);
+		ast_cli(a->fd, "Broadcast: %s (%d listener%s)\n", ra->location, listeners, ESS(listeners));
+	}
+	AST_LIST_UNLOCK(&readaheads);
+
+	return CLI_SUCCESS;
+}
+
+/*! \brief Index an MP3 file, or every MP3 file under a directory */
+static void index_path(int fd, const char *path, int *indexed, int *failed)
+{
+	struct ast_mp3_index *idx;
+	struct dirent *de;
+	struct stat st;
+	char child[PATH_MAX];
+	const char *ext;
+	DIR *dir;
+
+	if (stat(path, &st)) {
+		ast_cli(fd, "Unable to stat '%s': %s\n", path, strerror(errno));
+		(*failed)++;
+		return;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		if (!(dir = opendir(path))) {
+			ast_cli(fd, "Unable to open directory '%s': %s\n", path, strerror(errno));
+			(*failed)++;
+			return;
+		}
+		while ((de = readdir(dir))) {
+			if (de->d_name[0] == '.')
+				continue;
+			snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+			if (stat(child, &st))
+				continue;
+			ext = strrchr(de->d_name, '.');
+			if (S_ISDIR(st.st_mode) || (ext && !strcasecmp(ext, ".mp3")))
+				index_path(fd, child, indexed, failed);
+		}
+		closedir(dir);
+		return;
+	}
+
+	if (!(idx = ast_mp3_index_get(path, 1))) {
+		ast_cli(fd, "Unable to index '%s'\n", path);
+		(*failed)++;
+		return;
+	}
+	ao2_ref(idx, -1);
+	(*indexed)++;
+}
+
+static char *handle_cli_mp3_index(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	int i, indexed = 0, failed = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "mp3 index";
+		e->usage =
+			"Usage: mp3 index <file or directory> [...]\n"
+			"       Writes the index files used to seek in MP3 files and\n"
+			"       to find their length, for each file given and every\n"
+			"       .mp3 file under each directory given.  Indexes that\n"
+			"       are up to date are left alone.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc < 3)
+		return CLI_SHOWUSAGE;
+
+	for (i = 2; i < a->argc; i++)
+		index_path(a->fd, a->argv[i], &indexed, &failed);
+	ast_cli(a->fd, "Indexed %d file%s, %d failed\n", indexed, ESS(indexed), failed);
+
+	return CLI_SUCCESS;
+}
+
+static char *handle_cli_mp3_show_pool(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct mp3_worker *w;
+	int size, idle, queue, busy = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "mp3 show pool";
+		e->usage =
+			"Usage: mp3 show pool\n"
+			"       Shows the settings and state of the pool of mpg123\n"
+			"       processes kept running to decode local MP3 files, and\n"
+			"       how often playback had to wait for one or start its own.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	ast_mutex_lock(&config_lock);
+	size = pool_size;
+	idle = pool_idle;
+	queue = pool_queue;
+	ast_mutex_unlock(&config_lock);
+
+	ast_cli(a->fd, "Pool size: %d\n", size);
+	if (idle)
+		ast_cli(a->fd, "Idle timeout: %d sec\n", idle);
+	else
+		ast_cli(a->fd, "Idle timeout: none\n");
+	ast_cli(a->fd, "Queue depth: %d\n", queue);
+
+	AST_LIST_LOCK(&workers);
+	AST_LIST_TRAVERSE(&workers, w, list) {
+		if (w->busy)
+			busy++;
+	}
+	ast_cli(a->fd, "Decoders: %d (%d busy, %d idle)\n", pool_workers, busy, pool_workers - busy);
+	ast_cli(a->fd, "Waiting: %d\n", pool_waiting);
+	ast_cli(a->fd, "Requests: %d (%d waited, %d fell back to their own decoder)\n", pool_requests, pool_waits, pool_fallbacks);
+	AST_LIST_UNLOCK(&workers);
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry cli_mp3[] = {
+	AST_CLI_DEFINE(handle_cli_mp3_show_playback, "Show MP3 playback statistics"),
+	AST_CLI_DEFINE(handle_cli_mp3_show_pool, "Show the MP3 decoder pool"),
+	AST_CLI_DEFINE(handle_cli_mp3_index, "Index MP3 files"),
+};
+
+/*! \brief Parse a count or length that cannot be negative, warning about bad values */
+static void parse_int(struct ast_variable *var, int *value)
+{
+	int res;
+
+	if (sscanf(var->value, "%d", &res) == 1 && res >= 0)
+		*value = res;
+	else
+		ast_log(LOG_WARNING, "Invalid %s '%s' at line %d of %s\n", var->name, var->value, var->lineno, config);
+}
+
+static int load_config(int reload)
+{
+	struct ast_flags config_flags = { reload ? CONFIG_FLAG_FILEUNCHANGED : 0 };
+	struct ast_config *cfg;
+	struct ast_variable *var;
+	int size;
+
+	if ((cfg = ast_config_load(config, config_flags)) == CONFIG_STATUS_FILEUNCHANGED)
+		return 0;
+
+	ast_mutex_lock(&config_lock);
+	renditions[0] = '\0';
+	readahead_ms = DEFAULT_READAHEAD;
+	preroll_ms = DEFAULT_PREROLL;
+	lowwater_ms = DEFAULT_LOWWATER;
+	broadcast = 1;
+	max_decoders = DEFAULT_MAX_DECODERS;
+	pool_size = 0;
+	pool_idle = 0;
+	pool_queue = DEFAULT_POOL_QUEUE;
+	if (cfg) {
+		for (var = ast_variable_browse(cfg, "general"); var; var = var->next) {
+			if (!strcasecmp(var->name, "renditions"))
+				ast_copy_string(renditions, var->value, sizeof(renditions));
+			else if (!strcasecmp(var->name, "readahead"))
+				parse_int(var, &readahead_ms);
+			else if (!strcasecmp(var->name, "preroll"))
+				parse_int(var, &preroll_ms);
+			else if (!strcasecmp(var->name, "lowwater"))
+				parse_int(var, &lowwater_ms);
+			else if (!strcasecmp(var->name, "broadcast"))
+				broadcast = ast_true(var->value);
+			else if (!strcasecmp(var->name, "maxdecoders"))
+				parse_int(var, &max_decoders);
+			else if (!strcasecmp(var->name, "decoderpool"))
+				parse_int(var, &pool_size);
+			else if (!strcasecmp(var->name, "poolidle"))
+				parse_int(var, &pool_idle);
+			else if (!strcasecmp(var->name, "poolqueue"))
+				parse_int(var, &pool_queue);
+		}
+		ast_config_destroy(cfg);
+	}
+	/* Never wait for more audio than the buffer can hold */
+	if (preroll_ms > readahead_ms)
+		preroll_ms = readahead_ms;
+	if (lowwater_ms > readahead_ms)
+		lowwater_ms = readahead_ms;
+	size = pool_size;
+	ast_mutex_unlock(&config_lock);
+
+	/* Let the pool thread grow or shrink the pool to its new size */
+	AST_LIST_LOCK(&workers);
+	if (size && pool_thread == AST_PTHREADT_NULL &&
+	    ast_pthread_create_background(&pool_thread, NULL, pool_thread_main, NULL)) {
+		ast_log(LOG_WARNING, "Unable to start the MP3 decoder pool thread\n");
+		pool_thread = AST_PTHREADT_NULL;
+	}
+	ast_cond_broadcast(&pool_cond);
+	AST_LIST_UNLOCK(&workers);
+
+	return 0;
+}
+
+int ast_mp3_init(void)
+{
+	ast_cond_init(&reaper_cond, NULL);
+	ast_cond_init(&pool_cond, NULL);
+	ast_cli_register_multiple(cli_mp3, ARRAY_LEN(cli_mp3));
+
+	return load_config(0);
+}
+
+int ast_mp3_reload(void)
+{
+	return load_config(1);
+}
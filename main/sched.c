@@ -43,10 +43,37 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 134706 $")
 #include "asterisk/lock.h"
 #include "asterisk/utils.h"
 #include "asterisk/linkedlists.h"
+#include "asterisk/cli.h"
+#include "asterisk/_private.h"
+
+/*! Buckets of the id hash of a new context; a power of two */
+#define SCHED_HASH_INITIAL	64
+
+/*! \name Timing wheel
+ * A context given a tick by sched_context_set_wheel() keeps its events in a
+ * hierarchy of wheels instead of the heap, as in "Hashed and Hierarchical
+ * Timing Wheels" (Varghese and Lauck).  Level 0 has a slot for each of the
+ * next 256 ticks; each slot of level n (n > 0) covers 2^(8 + 6(n - 1))
+ * ticks, and its events move down a level (cascade) when that stretch of
+ * time comes round.  Adding and deleting an event take constant time, and
+ * all the events due in a tick are taken off the wheel in one go.
+ * @{
+ */
+#define WHEEL_LEVELS	5
+#define WHEEL_BITS0	8	/*!< Level 0 has 2^WHEEL_BITS0 slots */
+#define WHEEL_BITS	6	/*!< The other levels have 2^WHEEL_BITS slots */
+#define WHEEL_SLOTS	((1 << WHEEL_BITS0) + (WHEEL_LEVELS - 1) * (1 << WHEEL_BITS))
+/*! @} */
 
 struct sched {
-	AST_LIST_ENTRY(sched) list;
+	AST_LIST_ENTRY(sched) list;   /*!< In the cache of unused entries */
+	struct sched *next_id;        /*!< Next entry in the same id hash bucket */
 	int id;                       /*!< ID number of event */
+	unsigned int heap_index;      /*!< Where the entry is in the heap */
+	struct sched *wheel_next;     /*!< Next entry in the same wheel slot */
+	struct sched **wheel_pprev;   /*!< What points to this entry in the wheel */
+	uint64_t tick;                /*!< Wheel tick the event is due in */
+	unsigned int seq;             /*!< Order of scheduling, among entries due at the same time */
 	struct timeval when;          /*!< Absolute time event should take place */
 	int resched;                  /*!< When to reschedule */
 	int variable;                 /*!< Use return value from callback to reschedule */
@@ -54,11 +81,34 @@ struct sched {
 	ast_sched_cb callback;        /*!< Callback */
 };
 
+struct sched_wheel {
+	unsigned int tick;                      /*!< Length of a tick (us) */
+	struct timeval base;                    /*!< When tick 0 started */
+	uint64_t current;                       /*!< Next tick to take off the wheel */
+	struct sched *due;                      /*!< Taken off the wheel, and not run yet */
+	/*! Level 0, then each of the other levels */
+	struct sched *slots[WHEEL_SLOTS];
+};
+
 struct sched_context {
 	ast_mutex_t lock;
 	unsigned int eventcnt;                  /*!< Number of events processed */
 	unsigned int schedcnt;                  /*!< Number of outstanding schedule events */
-	AST_LIST_HEAD_NOLOCK(, sched) schedq;   /*!< Schedule entry and main queue */
+	unsigned int seqcnt;                    /*!< Number of times events were put in the heap */
+	/*! Outstanding events, as a binary heap ordered by when they are due:
+	 * the children of heap[i] are heap[2i + 1] and heap[2i + 2] */
+	struct sched **heap;
+	unsigned int heapsize;                  /*!< Room in heap */
+	/*! Outstanding events by id, in hashsize buckets (a power of two) */
+	struct sched **hash;
+	unsigned int hashsize;
+	struct sched_wheel *wheel;              /*!< Used instead of the heap, if set */
+
+	const char *name;                       /*!< Set by sched_context_set_name() */
+	AST_LIST_ENTRY(sched_context) list;     /*!< In the list of named contexts */
+	unsigned int runcnt;                    /*!< Number of callbacks run */
+	int64_t lag;                            /*!< Sum of how late (us) callbacks ran */
+	int64_t maxlag;                         /*!< Latest a callback ran (us) */
 
 #ifdef SCHED_MAX_CACHE
 	AST_LIST_HEAD_NOLOCK(, sched) schedc;   /*!< Cache of unused schedule structures and how many */
@@ -66,6 +116,9 @@ struct sched_context {
 #endif
 };
 
+/*! Contexts that have been given a name, for "core show sched" */
+static AST_RWLIST_HEAD_STATIC(contexts, sched_context);
+
 struct sched_context *sched_context_create(void)
 {
 	struct sched_context *tmp;
@@ -73,15 +126,60 @@ struct sched_context *sched_context_create(void)
 	if (!(tmp = ast_calloc(1, sizeof(*tmp))))
 		return NULL;
 
+	if (!(tmp->hash = ast_calloc(SCHED_HASH_INITIAL, sizeof(*tmp->hash)))) {
+		ast_free(tmp);
+		return NULL;
+	}
+	tmp->hashsize = SCHED_HASH_INITIAL;
+
 	ast_mutex_init(&tmp->lock);
 	tmp->eventcnt = 1;
 	
 	return tmp;
 }
 
+void sched_context_set_name(struct sched_context *con, const char *name)
+{
+	AST_RWLIST_WRLOCK(&contexts);
+	if (!con->name)
+		AST_RWLIST_INSERT_TAIL(&contexts, con, list);
+	con->name = name;
+	AST_RWLIST_UNLOCK(&contexts);
+}
+
+int sched_context_set_wheel(struct sched_context *con, unsigned int tick)
+{
+	struct sched_wheel *wheel = NULL;
+	int res = -1;
+
+	ast_mutex_lock(&con->lock);
+	if (con->schedcnt) {
+		ast_log(LOG_WARNING, "Cannot change how a scheduler context keeps its events while it has some\n");
+	} else if (!tick || (wheel = ast_calloc(1, sizeof(*wheel)))) {
+		if (wheel) {
+			wheel->tick = tick * 1000;
+			wheel->base = ast_tvnow();
+		}
+		if (con->wheel)
+			ast_free(con->wheel);
+		con->wheel = wheel;
+		res = 0;
+	}
+	ast_mutex_unlock(&con->lock);
+
+	return res;
+}
+
 void sched_context_destroy(struct sched_context *con)
 {
 	struct sched *s;
+	unsigned int i;
+
+	if (con->name) {
+		AST_RWLIST_WRLOCK(&contexts);
+		AST_RWLIST_REMOVE(&contexts, con, list);
+		AST_RWLIST_UNLOCK(&contexts);
+	}
 
 	ast_mutex_lock(&con->lock);
 
@@ -91,9 +189,18 @@ void sched_context_destroy(struct sched_context *con)
 		ast_free(s);
 #endif
 
-	/* And the queue */
-	while ((s = AST_LIST_REMOVE_HEAD(&con->schedq, list)))
-		ast_free(s);
+	/* And the queue; every event in it is in the id hash */
+	for (i = 0; i < con->hashsize; i++) {
+		while ((s = con->hash[i])) {
+			con->hash[i] = s->next_id;
+			ast_free(s);
+		}
+	}
+	if (con->heap)
+		ast_free(con->heap);
+	if (con->wheel)
+		ast_free(con->wheel);
+	ast_free(con->hash);
 	
 	/* And the context */
 	ast_mutex_unlock(&con->lock);
@@ -135,6 +242,248 @@ static void sched_release(struct sched_context *con, struct sched *tmp)
 		ast_free(tmp);
 }
 
+/*! \brief Put an entry in the id hash, doubling the buckets when there
+ * are more entries than buckets */
+static void hash_add(struct sched_context *con, struct sched *s)
+{
+	struct sched **hash, *cur, *next;
+	unsigned int i, bucket;
+
+	if (con->schedcnt >= con->hashsize && (hash = ast_calloc(con->hashsize * 2, sizeof(*hash)))) {
+		for (i = 0; i < con->hashsize; i++) {
+			for (cur = con->hash[i]; cur; cur = next) {
+				next = cur->next_id;
+				bucket = cur->id & (con->hashsize * 2 - 1);
+				cur->next_id = hash[bucket];
+				hash[bucket] = cur;
+			}
+		}
+		ast_free(con->hash);
+		con->hash = hash;
+		con->hashsize *= 2;
+	}
+
+	bucket = s->id & (con->hashsize - 1);
+	s->next_id = con->hash[bucket];
+	con->hash[bucket] = s;
+}
+
+/*! \brief Find an entry by id, and optionally take it out of the id hash */
+static struct sched *hash_find(struct sched_context *con, int id, int remove)
+{
+	struct sched **prev, *s;
+
+	for (prev = &con->hash[id & (con->hashsize - 1)]; (s = *prev); prev = &s->next_id) {
+		if (s->id == id) {
+			if (remove)
+				*prev = s->next_id;
+			break;
+		}
+	}
+
+	return s;
+}
+
+/*! \brief Whether a is due before b; entries due at the same time are
+ * run in the order they were scheduled */
+static inline int sched_before(const struct sched *a, const struct sched *b)
+{
+	int res = ast_tvcmp(a->when, b->when);
+
+	return res < 0 || (!res && (int) (a->seq - b->seq) < 0);
+}
+
+static void heap_set(struct sched_context *con, unsigned int i, struct sched *s)
+{
+	con->heap[i] = s;
+	s->heap_index = i;
+}
+
+/*! \brief Move the entry at i towards the root, to where it belongs */
+static void heap_up(struct sched_context *con, unsigned int i)
+{
+	struct sched *s = con->heap[i];
+	unsigned int parent;
+
+	for (; i; i = parent) {
+		parent = (i - 1) / 2;
+		if (!sched_before(s, con->heap[parent]))
+			break;
+		heap_set(con, i, con->heap[parent]);
+	}
+	heap_set(con, i, s);
+}
+
+/*! \brief Move the entry at i towards the leaves, to where it belongs */
+static void heap_down(struct sched_context *con, unsigned int i)
+{
+	struct sched *s = con->heap[i];
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < con->schedcnt) {
+		if (child + 1 < con->schedcnt && sched_before(con->heap[child + 1], con->heap[child]))
+			child++;
+		if (!sched_before(con->heap[child], s))
+			break;
+		heap_set(con, i, con->heap[child]);
+		i = child;
+	}
+	heap_set(con, i, s);
+}
+
+/*! \brief Take an entry out of the heap */
+static void heap_remove(struct sched_context *con, struct sched *s)
+{
+	unsigned int i = s->heap_index;
+	struct sched *last = con->heap[--con->schedcnt];
+
+	if (last == s)
+		return;
+
+	/* Fill the hole with the last entry, and move that up or down */
+	heap_set(con, i, last);
+	if (i && sched_before(last, con->heap[(i - 1) / 2]))
+		heap_up(con, i);
+	else
+		heap_down(con, i);
+}
+
+/*! \brief log2 of how many ticks a slot of level covers */
+static inline unsigned int wheel_shift(int level)
+{
+	return level ? WHEEL_BITS0 + (level - 1) * WHEEL_BITS : 0;
+}
+
+/*! \brief The slot of level for the events due in tick */
+static inline struct sched **wheel_slot(struct sched_wheel *wheel, int level, uint64_t tick)
+{
+	if (!level)
+		return &wheel->slots[tick & ((1 << WHEEL_BITS0) - 1)];
+	return &wheel->slots[(1 << WHEEL_BITS0) + (level - 1) * (1 << WHEEL_BITS) +
+		((tick >> wheel_shift(level)) & ((1 << WHEEL_BITS) - 1))];
+}
+
+/*! \brief The first tick that starts at or after tv (round_up), or that tv is in */
+static uint64_t wheel_tick(const struct sched_wheel *wheel, struct timeval tv, int round_up)
+{
+	int64_t us = ast_tvdiff_us(tv, wheel->base);
+
+	if (us <= 0)
+		return 0;
+	return (us + (round_up ? wheel->tick - 1 : 0)) / wheel->tick;
+}
+
+static void wheel_link(struct sched **slot, struct sched *s)
+{
+	if ((s->wheel_next = *slot))
+		s->wheel_next->wheel_pprev = &s->wheel_next;
+	s->wheel_pprev = slot;
+	*slot = s;
+}
+
+static void wheel_unlink(struct sched *s)
+{
+	if ((*s->wheel_pprev = s->wheel_next))
+		s->wheel_next->wheel_pprev = s->wheel_pprev;
+}
+
+/*! \brief Put an entry in the slot for its tick, on the lowest level that
+ * reaches that far.  Events already due go in the slot of the next tick. */
+static void wheel_insert(struct sched_wheel *wheel, struct sched *s)
+{
+	uint64_t delta;
+	int level;
+
+	if ((int64_t) (s->tick - wheel->current) < 0)
+		s->tick = wheel->current;
+	delta = s->tick - wheel->current;
+	for (level = 0; level < WHEEL_LEVELS - 1 && delta >> wheel_shift(level + 1); level++);
+	wheel_link(wheel_slot(wheel, level, s->tick), s);
+}
+
+/*! \brief Move the events of a slot down to where they now belong */
+static void wheel_cascade(struct sched_wheel *wheel, int level)
+{
+	struct sched **slot = wheel_slot(wheel, level, wheel->current), *s, *next;
+
+	/* Events too far off for the top level go back in the same slot */
+	for (s = *slot, *slot = NULL; s; s = next) {
+		next = s->wheel_next;
+		wheel_insert(wheel, s);
+	}
+}
+
+/*! \brief Take every event due up to tick off the wheel, onto the due list */
+static void wheel_advance(struct sched_wheel *wheel, uint64_t tick)
+{
+	struct sched **slot, *s;
+	int level;
+
+	for (; wheel->current <= tick; wheel->current++) {
+		/* Each time a level comes round, cascade the next slot of the level above */
+		for (level = 1; level < WHEEL_LEVELS && !(wheel->current & ((1ULL << wheel_shift(level)) - 1)); level++)
+			wheel_cascade(wheel, level);
+		for (slot = wheel_slot(wheel, 0, wheel->current); (s = *slot); ) {
+			wheel_unlink(s);
+			wheel_link(&wheel->due, s);
+		}
+	}
+}
+
+/*! \brief The earliest tick an event on the wheel can be due in: exact for
+ * level 0, and for the other levels when their next busy slot cascades */
+static uint64_t wheel_next_tick(struct sched_wheel *wheel)
+{
+	uint64_t next = UINT64_MAX, period, tick;
+	unsigned int i;
+	int level;
+
+	for (i = 0; i < (1 << WHEEL_BITS0); i++) {
+		if (*wheel_slot(wheel, 0, wheel->current + i)) {
+			next = wheel->current + i;
+			break;
+		}
+	}
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		period = wheel->current >> wheel_shift(level);
+		/* The slot for this period has been cascaded already, unless it
+		   is just starting; if not, its events are 2^WHEEL_BITS periods away */
+		i = (wheel->current & ((1ULL << wheel_shift(level)) - 1)) ? 1 : 0;
+		for (; i <= (1 << WHEEL_BITS); i++) {
+			if (*wheel_slot(wheel, level, (period + i) << wheel_shift(level))) {
+				tick = (period + i) << wheel_shift(level);
+				if (tick < next)
+					next = tick;
+				break;
+			}
+		}
+	}
+
+	return next;
+}
+
+/*! \brief Milliseconds until the next event is due, with the lock held */
+static int sched_wait(struct sched_context *con)
+{
+	struct timeval when;
+	uint64_t us;
+	int ms;
+
+	if (!con->schedcnt)
+		return -1;
+	if (!con->wheel) {
+		when = con->heap[0]->when;
+	} else if (con->wheel->due) {
+		return 0;
+	} else {
+		us = wheel_next_tick(con->wheel) * con->wheel->tick;
+		when = ast_tvadd(con->wheel->base, ast_tv(us / 1000000, us % 1000000));
+	}
+	ms = ast_tvdiff_ms(when, ast_tvnow());
+
+	return ms < 0 ? 0 : ms;
+}
+
 /*! \brief
  * Return the number of milliseconds 
  * until the next scheduled event
@@ -146,13 +495,7 @@ int ast_sched_wait(struct sched_context *con)
 	DEBUG(ast_debug(1, "ast_sched_wait()\n"));
 
 	ast_mutex_lock(&con->lock);
-	if (AST_LIST_EMPTY(&con->schedq)) {
-		ms = -1;
-	} else {
-		ms = ast_tvdiff_ms(AST_LIST_FIRST(&con->schedq)->when, ast_tvnow());
-		if (ms < 0)
-			ms = 0;
-	}
+	ms = sched_wait(con);
 	ast_mutex_unlock(&con->lock);
 
 	return ms;
@@ -161,25 +504,45 @@ int ast_sched_wait(struct sched_context *con)
 
 /*! \brief
  * Take a sched structure and put it in the
- * queue, such that the soonest event is
- * first in the list. 
+ * heap, such that the soonest event is
+ * at the top, or on the wheel.
+ * \return 0 on success, -1 if there is no memory for the heap to grow
  */
-static void schedule(struct sched_context *con, struct sched *s)
+static int schedule(struct sched_context *con, struct sched *s)
 {
-	 
-	struct sched *cur = NULL;
-	
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&con->schedq, cur, list) {
-		if (ast_tvcmp(s->when, cur->when) == -1) {
-			AST_LIST_INSERT_BEFORE_CURRENT(s, list);
-			break;
-		}
+	struct sched **heap;
+	unsigned int size;
+
+	if (con->wheel) {
+		s->tick = wheel_tick(con->wheel, s->when, 1);
+		wheel_insert(con->wheel, s);
+		con->schedcnt++;
+		return 0;
 	}
-	AST_LIST_TRAVERSE_SAFE_END;
-	if (!cur)
-		AST_LIST_INSERT_TAIL(&con->schedq, s, list);
-	
-	con->schedcnt++;
+
+	if (con->schedcnt == con->heapsize) {
+		size = con->heapsize ? con->heapsize * 2 : 64;
+		if (!(heap = ast_realloc(con->heap, size * sizeof(*heap))))
+			return -1;
+		con->heap = heap;
+		con->heapsize = size;
+	}
+
+	s->seq = con->seqcnt++;
+	heap_set(con, con->schedcnt++, s);
+	heap_up(con, s->heap_index);
+
+	return 0;
+}
+
+/*! \brief Take an entry out of the heap or off the wheel */
+static void unschedule(struct sched_context *con, struct sched *s)
+{
+	if (con->wheel) {
+		wheel_unlink(s);
+		con->schedcnt--;
+	} else
+		heap_remove(con, s);
 }
 
 /*! \brief
@@ -229,10 +592,10 @@ int ast_sched_add_variable(struct sched_context *con, int when, ast_sched_cb cal
 		tmp->resched = when;
 		tmp->variable = variable;
 		tmp->when = ast_tv(0, 0);
-		if (sched_settime(&tmp->when, when)) {
+		if (sched_settime(&tmp->when, when) || schedule(con, tmp)) {
 			sched_release(con, tmp);
 		} else {
-			schedule(con, tmp);
+			hash_add(con, tmp);
 			res = tmp->id;
 		}
 	}
@@ -260,7 +623,7 @@ int ast_sched_add(struct sched_context *con, int when, ast_sched_cb callback, co
 /*! \brief
  * Delete the schedule entry with number
  * "id".  It's nearly impossible that there
- * would be two or more in the list with that
+ * would be two or more in the queue with that
  * id.
  */
 #ifndef AST_DEVMODE
@@ -274,15 +637,10 @@ int _ast_sched_del(struct sched_context *con, int id, const char *file, int line
 	DEBUG(ast_debug(1, "ast_sched_del()\n"));
 	
 	ast_mutex_lock(&con->lock);
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&con->schedq, s, list) {
-		if (s->id == id) {
-			AST_LIST_REMOVE_CURRENT(list);
-			con->schedcnt--;
-			sched_release(con, s);
-			break;
-		}
+	if ((s = hash_find(con, id, 1))) {
+		unschedule(con, s);
+		sched_release(con, s);
 	}
-	AST_LIST_TRAVERSE_SAFE_END;
 
 #ifdef DUMP_SCHEDULER
 	/* Dump contents of the context while we have the lock so nothing gets screwed up by accident. */
@@ -304,11 +662,19 @@ int _ast_sched_del(struct sched_context *con, int id, const char *file, int line
 	return 0;
 }
 
+static int sched_cmp(const void *a, const void *b)
+{
+	const struct sched *x = *(struct sched * const *) a, *y = *(struct sched * const *) b;
+
+	return sched_before(x, y) ? -1 : sched_before(y, x);
+}
+
 /*! \brief Dump the contents of the scheduler to LOG_DEBUG */
 void ast_sched_dump(const struct sched_context *con)
 {
-	struct sched *q;
+	struct sched *q, **sorted;
 	struct timeval tv = ast_tvnow();
+	unsigned int i, count = 0;
 #ifdef SCHED_MAX_CACHE
 	ast_debug(1, "Asterisk Schedule Dump (%d in Q, %d Total, %d Cache)\n", con->schedcnt, con->eventcnt - 1, con->schedccnt);
 #else
@@ -318,8 +684,20 @@ void ast_sched_dump(const struct sched_context *con)
 	ast_debug(1, "=============================================================\n");
 	ast_debug(1, "|ID    Callback          Data              Time  (sec:ms)   |\n");
 	ast_debug(1, "+-----+-----------------+-----------------+-----------------+\n");
-	AST_LIST_TRAVERSE(&con->schedq, q, list) {
-		struct timeval delta = ast_tvsub(q->when, tv);
+	/* Neither the heap nor the wheel is in order; show the events in the
+	   order they will run */
+	if (!(sorted = ast_malloc((con->schedcnt + 1) * sizeof(*sorted))))
+		return;
+	for (i = 0; i < con->hashsize; i++) {
+		for (q = con->hash[i]; q && count < con->schedcnt; q = q->next_id)
+			sorted[count++] = q;
+	}
+	qsort(sorted, count, sizeof(*sorted), sched_cmp);
+	for (i = 0; i < count; i++) {
+		struct timeval delta;
+
+		q = sorted[i];
+		delta = ast_tvsub(q->when, tv);
 
 		ast_debug(1, "|%.4d | %-15p | %-15p | %.6ld : %.6ld |\n", 
 			q->id,
@@ -328,9 +706,53 @@ void ast_sched_dump(const struct sched_context *con)
 			delta.tv_sec,
 			(long int)delta.tv_usec);
 	}
+	ast_free(sorted);
 	ast_debug(1, "=============================================================\n");
 }
 
+/*! \brief Run the callback of an event taken out of the queue, and
+ * schedule it again if it asks to be */
+static void sched_run(struct sched_context *con, struct sched *current, struct timeval tv)
+{
+	int res;
+	int64_t lag;
+
+	if ((lag = ast_tvdiff_us(tv, current->when) - 1000) < 0)
+		lag = 0;
+	if (lag > con->maxlag)
+		con->maxlag = lag;
+	con->lag += lag;
+	con->runcnt++;
+
+	/*
+	 * At this point, the schedule queue is still intact.  We
+	 * have removed the first event and the rest is still there,
+	 * so it's permissible for the callback to add new events, but
+	 * trying to delete itself won't work because it isn't in
+	 * the schedule queue.  If that's what it wants to do, it 
+	 * should return 0.
+	 */
+		
+	ast_mutex_unlock(&con->lock);
+	res = current->callback(current->data);
+	ast_mutex_lock(&con->lock);
+		
+	if (res) {
+	 	/*
+		 * If they return non-zero, we should schedule them to be
+		 * run again.
+		 */
+		if (sched_settime(&current->when, current->variable? res : current->resched) ||
+		    schedule(con, current)) {
+			sched_release(con, current);
+		} else
+			hash_add(con, current);
+	} else {
+		/* No longer needed, so release it */
+	 	sched_release(con, current);
+	}
+}
+
 /*! \brief
  * Launch all events which need to be run at this time.
  */
@@ -339,51 +761,43 @@ int ast_sched_runq(struct sched_context *con)
 	struct sched *current;
 	struct timeval tv;
 	int numevents;
-	int res;
 
 	DEBUG(ast_debug(1, "ast_sched_runq()\n"));
 		
 	ast_mutex_lock(&con->lock);
 
-	for (numevents = 0; !AST_LIST_EMPTY(&con->schedq); numevents++) {
+	if (con->wheel) {
+		/* Take everything due within 1ms off the wheel in one go.  Events
+		   scheduled by the callbacks go back on the wheel, so they wait for
+		   the next run even if they are due already. */
+		tv = ast_tvadd(ast_tvnow(), ast_tv(0, 1000));
+		if (con->schedcnt)
+			wheel_advance(con->wheel, wheel_tick(con->wheel, tv, 0));
+		else	/* Nothing to cascade; skip the idle ticks */
+			con->wheel->current = wheel_tick(con->wheel, tv, 0) + 1;
+		for (numevents = 0; (current = con->wheel->due); numevents++) {
+			unschedule(con, current);
+			hash_find(con, current->id, 1);
+			sched_run(con, current, tv);
+		}
+		ast_mutex_unlock(&con->lock);
+		return numevents;
+	}
+
+	for (numevents = 0; con->schedcnt; numevents++) {
 		/* schedule all events which are going to expire within 1ms.
 		 * We only care about millisecond accuracy anyway, so this will
 		 * help us get more than one event at one time if they are very
 		 * close together.
 		 */
 		tv = ast_tvadd(ast_tvnow(), ast_tv(0, 1000));
-		if (ast_tvcmp(AST_LIST_FIRST(&con->schedq)->when, tv) != -1)
+		if (ast_tvcmp(con->heap[0]->when, tv) != -1)
 			break;
 		
-		current = AST_LIST_REMOVE_HEAD(&con->schedq, list);
-		con->schedcnt--;
-
-		/*
-		 * At this point, the schedule queue is still intact.  We
-		 * have removed the first event and the rest is still there,
-		 * so it's permissible for the callback to add new events, but
-		 * trying to delete itself won't work because it isn't in
-		 * the schedule queue.  If that's what it wants to do, it 
-		 * should return 0.
-		 */
-			
-		ast_mutex_unlock(&con->lock);
-		res = current->callback(current->data);
-		ast_mutex_lock(&con->lock);
-			
-		if (res) {
-		 	/*
-			 * If they return non-zero, we should schedule them to be
-			 * run again.
-			 */
-			if (sched_settime(&current->when, current->variable? res : current->resched)) {
-				sched_release(con, current);
-			} else
-				schedule(con, current);
-		} else {
-			/* No longer needed, so release it */
-		 	sched_release(con, current);
-		}
+		current = con->heap[0];
+		heap_remove(con, current);
+		hash_find(con, current->id, 1);
+		sched_run(con, current, tv);
 	}
 
 	ast_mutex_unlock(&con->lock);
@@ -398,11 +812,7 @@ long ast_sched_when(struct sched_context *con,int id)
 	DEBUG(ast_debug(1, "ast_sched_when()\n"));
 
 	ast_mutex_lock(&con->lock);
-	AST_LIST_TRAVERSE(&con->schedq, s, list) {
-		if (s->id == id)
-			break;
-	}
-	if (s) {
+	if ((s = hash_find(con, id, 0))) {
 		struct timeval now = ast_tvnow();
 		secs = s->when.tv_sec - now.tv_sec;
 	}
@@ -410,3 +820,71 @@ long ast_sched_when(struct sched_context *con,int id)
 	
 	return secs;
 }
+
+static char *handle_show_sched(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-20s %-10s %8s %12s %10s %10s %10s\n"
+#define FORMAT2 "%-20s %-10s %8u %12u %10.1f %10.1f %10s\n"
+	struct sched_context *con;
+	char queue[16], next[16];
+	unsigned int depth, runcnt;
+	int64_t lag, maxlag;
+	int count = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show sched";
+		e->usage =
+			"Usage: core show sched\n"
+			"       Shows, for each named scheduler context, whether it keeps its\n"
+			"       events in a heap or on a timing wheel (and the tick of the wheel),\n"
+			"       how many events are queued, how many callbacks have run, how late\n"
+			"       they ran on average and at most (in ms), and when the next one is\n"
+			"       due.  On a wheel, events further off than 256 ticks are only\n"
+			"       known to be due after the time shown.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3)
+		return CLI_SHOWUSAGE;
+
+	ast_cli(a->fd, FORMAT, "Context", "Queue", "Queued", "Run", "Avg lag", "Max lag", "Next in");
+	AST_RWLIST_RDLOCK(&contexts);
+	AST_RWLIST_TRAVERSE(&contexts, con, list) {
+		ast_mutex_lock(&con->lock);
+		depth = con->schedcnt;
+		runcnt = con->runcnt;
+		lag = con->lag;
+		maxlag = con->maxlag;
+		if (con->wheel)
+			snprintf(queue, sizeof(queue), "wheel/%ums", con->wheel->tick / 1000);
+		else
+			ast_copy_string(queue, "heap", sizeof(queue));
+		if (depth)
+			snprintf(next, sizeof(next), "%d", sched_wait(con));
+		else
+			ast_copy_string(next, "-", sizeof(next));
+		ast_mutex_unlock(&con->lock);
+
+		ast_cli(a->fd, FORMAT2, con->name, queue, depth, runcnt,
+			runcnt ? lag / runcnt / 1000.0 : 0.0, maxlag / 1000.0, next);
+		count++;
+	}
+	AST_RWLIST_UNLOCK(&contexts);
+	ast_cli(a->fd, "%d scheduler context%s\n", count, ESS(count));
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+static struct ast_cli_entry cli_sched[] = {
+	AST_CLI_DEFINE(handle_show_sched, "Show scheduler queue depths and lag"),
+};
+
+void ast_sched_init(void)
+{
+	ast_cli_register_multiple(cli_sched, ARRAY_LEN(cli_sched));
+}
@@ -31,30 +31,101 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 112127 $")
 #include "asterisk/frame.h"
 #include "asterisk/slinfactory.h"
 #include "asterisk/translate.h"
+#include "asterisk/utils.h"
+
+/*! Where the free-running head and tail counters fall in the ring */
+#define RING_MASK (AST_SLINFACTORY_SIZE - 1)
 
 void ast_slinfactory_init(struct ast_slinfactory *sf) 
 {
 	memset(sf, 0, sizeof(*sf));
-	sf->offset = sf->hold;
 }
 
 void ast_slinfactory_destroy(struct ast_slinfactory *sf) 
 {
-	struct ast_frame *f;
-
 	if (sf->trans) {
 		ast_translator_free_path(sf->trans);
 		sf->trans = NULL;
 	}
 
-	while ((f = AST_LIST_REMOVE_HEAD(&sf->queue, frame_list)))
-		ast_frfree(f);
+	if (sf->ring) {
+		ast_free(sf->ring);
+		sf->ring = NULL;
+	}
+}
+
+/*! \brief Make room for samples more samples, dropping the oldest ones if
+ * the ring would overflow */
+static void ring_reserve(struct ast_slinfactory *sf, unsigned int samples)
+{
+	if (sf->tail - sf->head + samples > AST_SLINFACTORY_SIZE)
+		sf->head = sf->tail + samples - AST_SLINFACTORY_SIZE;
+}
+
+/*!
+ * \brief Add samples (at most AST_SLINFACTORY_MAX_HOLD) just put at the tail
+ *
+ * Samples that ran past the end of the ring, into the copy of its start,
+ * are copied to the start; samples put at the start are copied past the end.
+ */
+static void ring_commit(struct ast_slinfactory *sf, unsigned int samples)
+{
+	unsigned int pos = sf->tail & RING_MASK, end = pos + samples;
+
+	if (end > AST_SLINFACTORY_SIZE)
+		memcpy(sf->ring, sf->ring + AST_SLINFACTORY_SIZE, (end - AST_SLINFACTORY_SIZE) * sizeof(*sf->ring));
+	else if (pos < AST_SLINFACTORY_MAX_HOLD)
+		memcpy(sf->ring + AST_SLINFACTORY_SIZE + pos, sf->ring + pos, (MIN(end, AST_SLINFACTORY_MAX_HOLD) - pos) * sizeof(*sf->ring));
+
+	sf->tail += samples;
+}
+
+static void ring_write(struct ast_slinfactory *sf, const short *data, unsigned int samples)
+{
+	unsigned int len;
+
+	if (samples > AST_SLINFACTORY_SIZE) {
+		data += samples - AST_SLINFACTORY_SIZE;
+		samples = AST_SLINFACTORY_SIZE;
+	}
+
+	ring_reserve(sf, samples);
+
+	while (samples) {
+		len = MIN(samples, AST_SLINFACTORY_MAX_HOLD);
+		memcpy(sf->ring + (sf->tail & RING_MASK), data, len * sizeof(*data));
+		ring_commit(sf, len);
+		data += len;
+		samples -= len;
+	}
+}
+
+/*! \brief Whether a frame can go through ast_translate_batch(), straight
+ * into the ring */
+static int can_batch(struct ast_slinfactory *sf, struct ast_frame *f)
+{
+	struct ast_trans_pvt *step;
+
+	if (!sf->batch || !f->datalen || f->samples > AST_SLINFACTORY_MAX_HOLD ||
+	    f->samples % sf->batch || ast_codec_get_samples(f) != f->samples)
+		return 0;
+
+	/* Not while a step holds on to audio from earlier frames */
+	for (step = sf->trans; step; step = step->next) {
+		if (step->samples)
+			return 0;
+	}
+
+	return 1;
 }
 
 int ast_slinfactory_feed(struct ast_slinfactory *sf, struct ast_frame *f)
 {
-	struct ast_frame *begin_frame = f, *duped_frame = NULL, *frame_ptr;
-	unsigned int x;
+	struct ast_frame *out;
+	int samples;
+
+	if (!sf->ring && !(sf->ring = ast_malloc((AST_SLINFACTORY_SIZE + AST_SLINFACTORY_MAX_HOLD) * sizeof(*sf->ring))))
+		return 0;
 
 	if (f->subclass != AST_FORMAT_SLINEAR && f->subclass != AST_FORMAT_SLINEAR16) {
 		if (sf->trans && f->subclass != sf->format) {
@@ -68,110 +139,72 @@ int ast_slinfactory_feed(struct ast_slinfactory *sf, struct ast_frame *f)
 				return 0;
 			}
 			sf->format = f->subclass;
+			sf->batch = ast_translator_batch_samples(sf->trans);
 		}
 
-		if (!(begin_frame = ast_translate(sf->trans, f, 0))) 
-			return 0;
-		
-		duped_frame = ast_frdup(begin_frame);
-
-		ast_frfree(begin_frame);
-
-		if (!duped_frame)
-			return 0;
+		if (can_batch(sf, f)) {
+			ring_reserve(sf, f->samples);
+			if ((samples = ast_translate_batch(sf->trans, sf->ring + (sf->tail & RING_MASK), f->data, f->samples)) < 0)
+				return 0;
+			ring_commit(sf, samples);
+		} else {
+			if (!(out = ast_translate(sf->trans, f, 0)))
+				return 0;
+			ring_write(sf, out->data, MIN(out->samples, out->datalen / 2));
+			ast_frfree(out);
+		}
 	} else {
 		if (sf->trans) {
 			ast_translator_free_path(sf->trans);
 			sf->trans = NULL;
 		}
-		if (!(duped_frame = ast_frdup(f)))
-			return 0;
+		ring_write(sf, f->data, MIN(f->samples, f->datalen / 2));
 	}
 
-	x = 0;
-	AST_LIST_TRAVERSE(&sf->queue, frame_ptr, frame_list)
-		x++;
+	return ast_slinfactory_available(sf);
+}
 
-	AST_LIST_INSERT_TAIL(&sf->queue, duped_frame, frame_list);
+unsigned int ast_slinfactory_peek(struct ast_slinfactory *sf, short **buf, size_t samples)
+{
+	unsigned int len = MIN(samples, MIN(ast_slinfactory_available(sf), AST_SLINFACTORY_MAX_HOLD));
 
-	sf->size += duped_frame->samples;
+	*buf = len ? sf->ring + (sf->head & RING_MASK) : NULL;
 
-	return x;
+	return len;
+}
+
+void ast_slinfactory_consume(struct ast_slinfactory *sf, size_t samples)
+{
+	sf->head += MIN(samples, ast_slinfactory_available(sf));
 }
 
 int ast_slinfactory_read(struct ast_slinfactory *sf, short *buf, size_t samples) 
 {
-	struct ast_frame *frame_ptr;
-	unsigned int sofar = 0, ineed, remain;
-	short *frame_data, *offset = buf;
-
-	while (sofar < samples) {
-		ineed = samples - sofar;
-
-		if (sf->holdlen) {
-			if (sf->holdlen <= ineed) {
-				memcpy(offset, sf->hold, sf->holdlen * sizeof(*offset));
-				sofar += sf->holdlen;
-				offset += sf->holdlen;
-				sf->holdlen = 0;
-				sf->offset = sf->hold;
-			} else {
-				remain = sf->holdlen - ineed;
-				memcpy(offset, sf->offset, ineed * sizeof(*offset));
-				sofar += ineed;
-				sf->offset += ineed;
-				sf->holdlen = remain;
-			}
-			continue;
-		}
-		
-		if ((frame_ptr = AST_LIST_REMOVE_HEAD(&sf->queue, frame_list))) {
-			frame_data = frame_ptr->data;
-			
-			if (frame_ptr->samples <= ineed) {
-				memcpy(offset, frame_data, frame_ptr->samples * sizeof(*offset));
-				sofar += frame_ptr->samples;
-				offset += frame_ptr->samples;
-			} else {
-				remain = frame_ptr->samples - ineed;
-				memcpy(offset, frame_data, ineed * sizeof(*offset));
-				sofar += ineed;
-				frame_data += ineed;
-				if (remain > (AST_SLINFACTORY_MAX_HOLD - sf->holdlen)) {
-					remain = AST_SLINFACTORY_MAX_HOLD - sf->holdlen;
-				}
-				memcpy(sf->hold, frame_data, remain * sizeof(*offset));
-				sf->holdlen = remain;
-			}
-			ast_frfree(frame_ptr);
-		} else {
-			break;
-		}
+	unsigned int sofar = 0, len;
+	short *data;
+
+	while (sofar < samples && (len = ast_slinfactory_peek(sf, &data, samples - sofar))) {
+		memcpy(buf + sofar, data, len * sizeof(*buf));
+		ast_slinfactory_consume(sf, len);
+		sofar += len;
 	}
 
-	sf->size -= sofar;
 	return sofar;
 }
 
 unsigned int ast_slinfactory_available(const struct ast_slinfactory *sf)
 {
-	return sf->size;
+	return sf->tail - sf->head;
 }
 
 void ast_slinfactory_flush(struct ast_slinfactory *sf)
 {
-	struct ast_frame *fr = NULL;
-
 	if (sf->trans) {
 		ast_translator_free_path(sf->trans);
 		sf->trans = NULL;
 	}
 
-	while ((fr = AST_LIST_REMOVE_HEAD(&sf->queue, frame_list)))
-		ast_frfree(fr);
-
-	sf->size = sf->holdlen = 0;
-	sf->offset = sf->hold;
+	sf->head = sf->tail = 0;
 
 	return;
 }
@@ -27,8 +27,10 @@
 
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 135942 $")
 
+#include "asterisk/_private.h"
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/utsname.h>
 
 #include "asterisk/lock.h"
 #include "asterisk/channel.h"
@@ -38,9 +40,30 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 135942 $")
 #include "asterisk/sched.h"
 #include "asterisk/cli.h"
 #include "asterisk/term.h"
+#include "asterisk/astdb.h"
+#include "asterisk/ast_version.h"
 
 #define MAX_RECALC 1000 /* max sample recalc */
 
+/*! \brief Number of timed runs when measuring the cost of a translator;
+ * the median is used */
+#define COST_RUNS 5
+
+/*! \brief astdb family the measured costs are kept in, so that they need
+ * not be measured again at each start */
+#define COST_FAMILY "TranslatorCosts"
+
+#ifdef RUSAGE_THREAD
+#define COST_RUSAGE RUSAGE_THREAD
+#else
+#define COST_RUSAGE RUSAGE_SELF
+#endif
+
+/*! \brief What a saved cost is only good for: this version of Asterisk on
+ * this CPU.  Empty until astdb is open, so costs are neither loaded nor
+ * saved for translators registered before (in preloaded modules). */
+static char cost_key[256];
+
 /*! \brief the list of translators */
 static AST_RWLIST_HEAD_STATIC(translators, ast_translator);
 
@@ -62,6 +85,27 @@ struct translator_path {
  */
 static struct translator_path tr_matrix[MAX_FORMAT][MAX_FORMAT];
 
+/*! \brief Most descriptors kept for reuse by each translator */
+#define TRANS_POOL_MAX 16
+
+/*!
+ * \brief Protects the descriptor pools of the translators, and path_stats
+ *
+ * Descriptors are freed by whatever thread drops the last frame of theirs,
+ * with or without the translators list locked, so this is separate.
+ */
+AST_MUTEX_DEFINE_STATIC(pool_lock);
+
+/*! \brief How long building a path took, for the CLI */
+struct path_stats {
+	unsigned int builds;
+	unsigned int max;	/*!< Longest, in microseconds */
+	uint64_t total;		/*!< In microseconds */
+};
+
+/*! \brief Path building times for each source and destination format */
+static struct path_stats path_stats[MAX_FORMAT][MAX_FORMAT];
+
 /*! \todo
  * TODO: sample frames for each supported input format.
  * We build this on the fly, by taking an SLIN frame and using
@@ -85,13 +129,31 @@ static force_inline int powerof(unsigned int d)
  * wrappers around the translator routines.
  */
 
+/*! \brief Free the descriptors a translator keeps for reuse */
+static void pool_drain(struct ast_translator *t)
+{
+	struct ast_trans_pvt *pvt;
+
+	ast_mutex_lock(&pool_lock);
+	while ((pvt = t->pool)) {
+		t->pool = pvt->next;
+		ast_free(pvt);
+	}
+	t->pool_size = 0;
+	ast_mutex_unlock(&pool_lock);
+}
+
 /*!
  * \brief Allocate the descriptor, required outbuf space,
  * and possibly also plc and desc.
+ *
+ * Descriptors of destroyed paths are reused, so format changes do not
+ * need a new (possibly large) allocation for each step.  A reused
+ * descriptor is cleared and initialized exactly like a new one.
  */
 static void *newpvt(struct ast_translator *t)
 {
-	struct ast_trans_pvt *pvt;
+	struct ast_trans_pvt *pvt, *prev = NULL;
 	int len;
 	int useplc = t->plc_samples > 0 && t->useplc;	/* cache, because it can change on the fly */
 	char *ofs;
@@ -105,9 +167,30 @@ static void *newpvt(struct ast_translator *t)
 		len += sizeof(plc_state_t);
 	if (t->buf_size)
 		len += AST_FRIENDLY_OFFSET + t->buf_size;
-	pvt = ast_calloc(1, len);
-	if (!pvt)
+
+	/* Anything pooled is the same size, unless useplc has changed since */
+	ast_mutex_lock(&pool_lock);
+	for (pvt = t->pool; pvt && !pvt->plc != !useplc; prev = pvt, pvt = pvt->next);
+	if (pvt) {
+		if (prev)
+			prev->next = pvt->next;
+		else
+			t->pool = pvt->next;
+		t->pool_size--;
+		t->reused++;
+	} else
+		t->created++;
+	t->inuse++;
+	ast_mutex_unlock(&pool_lock);
+
+	if (pvt)
+		memset(pvt, 0, len);
+	else if (!(pvt = ast_calloc(1, len))) {
+		ast_mutex_lock(&pool_lock);
+		t->inuse--;
+		ast_mutex_unlock(&pool_lock);
 		return NULL;
+	}
 	pvt->t = t;
 	ofs = (char *)(pvt + 1);	/* pointer to data space */
 	if (t->desc_size) {		/* first comes the descriptor */
@@ -122,6 +205,9 @@ static void *newpvt(struct ast_translator *t)
 		pvt->outbuf = ofs + AST_FRIENDLY_OFFSET;
 	/* call local init routine, if present */
 	if (t->newpvt && t->newpvt(pvt)) {
+		ast_mutex_lock(&pool_lock);
+		t->inuse--;
+		ast_mutex_unlock(&pool_lock);
 		ast_free(pvt);
 		return NULL;
 	}
@@ -132,6 +218,7 @@ static void *newpvt(struct ast_translator *t)
 static void destroy(struct ast_trans_pvt *pvt)
 {
 	struct ast_translator *t = pvt->t;
+	int pooled = 0;
 
 	if (ast_test_flag(&pvt->f, AST_FRFLAG_FROM_TRANSLATOR)) {
 		/* If this flag is still set, that means that the translation path has
@@ -146,7 +233,19 @@ static void destroy(struct ast_trans_pvt *pvt)
 
 	if (t->destroy)
 		t->destroy(pvt);
-	ast_free(pvt);
+
+	ast_mutex_lock(&pool_lock);
+	t->inuse--;
+	if (t->pool_size < TRANS_POOL_MAX) {
+		pvt->next = t->pool;
+		t->pool = pvt;
+		t->pool_size++;
+		pooled = 1;
+	}
+	ast_mutex_unlock(&pool_lock);
+
+	if (!pooled)
+		ast_free(pvt);
 	ast_module_unref(t->module);
 }
 
@@ -262,6 +361,9 @@ void ast_translator_free_path(struct ast_trans_pvt *p)
 struct ast_trans_pvt *ast_translator_build_path(int dest, int source)
 {
 	struct ast_trans_pvt *head = NULL, *tail = NULL;
+	struct timeval start = ast_tvnow();
+	unsigned int usecs;
+	int src;
 	
 	source = powerof(source);
 	dest = powerof(dest);
@@ -273,6 +375,7 @@ struct ast_trans_pvt *ast_translator_build_path(int dest, int source)
 
 	AST_RWLIST_RDLOCK(&translators);
 
+	src = source;
 	while (source != dest) {
 		struct ast_trans_pvt *cur;
 		struct ast_translator *t = tr_matrix[source][dest].step;
@@ -300,6 +403,15 @@ struct ast_trans_pvt *ast_translator_build_path(int dest, int source)
 	}
 
 	AST_RWLIST_UNLOCK(&translators);
+
+	usecs = ast_tvdiff_us(ast_tvnow(), start);
+	ast_mutex_lock(&pool_lock);
+	path_stats[src][dest].builds++;
+	path_stats[src][dest].total += usecs;
+	if (usecs > path_stats[src][dest].max)
+		path_stats[src][dest].max = usecs;
+	ast_mutex_unlock(&pool_lock);
+
 	return head;
 }
 
@@ -379,15 +491,113 @@ struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f,
 	return out;
 }
 
-/*! \brief compute the cost of a single translation step */
-static void calc_cost(struct ast_translator *t, int seconds)
+int ast_translator_batch_samples(struct ast_trans_pvt *path)
+{
+	struct ast_trans_pvt *p;
+	int multiple = 1, step, a, b, r;
+
+	if (!path)
+		return 0;
+
+	for (p = path; p; p = p->next) {
+		if (!p->t->framein_batch)
+			return 0;
+		step = p->t->batch_samples ? p->t->batch_samples : 1;
+		/* least common multiple of the block sizes so far */
+		for (a = multiple, b = step; b; a = b, b = r)
+			r = a % b;
+		multiple = multiple / a * step;
+	}
+
+	return multiple;
+}
+
+int ast_translate_batch(struct ast_trans_pvt *path, void *out, const void *in, int samples)
+{
+	struct ast_trans_pvt *p;
+	const void *src = in;
+	void *dst, *tmp[2] = { NULL, NULL };
+	int which = 0, len;
+
+	for (p = path; p && samples > 0; p = p->next) {
+		if (p->next) {
+			/* Steps before the last one write to a scratch buffer, two
+			   of which are used in turn */
+			len = ast_codec_get_len(1 << p->t->dstfmt, samples);
+			if (!(dst = ast_realloc(tmp[which], len))) {
+				samples = -1;
+				break;
+			}
+			tmp[which] = dst;
+			which = !which;
+		} else
+			dst = out;
+		samples = p->t->framein_batch(p, dst, src, samples);
+		src = dst;
+	}
+
+	ast_free(tmp[0]);
+	ast_free(tmp[1]);
+
+	return samples;
+}
+
+/*! \brief CPU time used by this thread (or process, where threads are not
+ * accounted for separately) so far, in microseconds */
+static int64_t cpu_usecs(void)
+{
+	struct rusage ru;
+
+	getrusage(COST_RUSAGE, &ru);
+
+	return ((int64_t) ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*! \brief Feed sample frames to a translator until it has put out at least
+ * samples samples */
+static int run_samples(struct ast_trans_pvt *pvt, int samples)
 {
+	struct ast_translator *t = pvt->t;
 	int num_samples = 0;
+
+	while (num_samples < samples) {
+		struct ast_frame *f = t->sample();
+		if (!f) {
+			ast_log(LOG_WARNING, "Translator '%s' failed to produce a sample frame.\n", t->name);
+			return -1;
+		}
+		framein(pvt, f);
+		ast_frfree(f);
+		while ((f = t->frameout(pvt))) {
+			num_samples += f->samples;
+			ast_frfree(f);
+		}
+	}
+
+	return 0;
+}
+
+static int cmp_cost(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*!
+ * \brief compute the cost of a single translation step
+ *
+ * After a tenth of a second of untimed warm up, seconds of audio are
+ * translated in COST_RUNS runs, each timed on this thread's CPU time, and
+ * the median run gives the cost, so a run disturbed by something else
+ * running does not skew it.
+ */
+static void calc_cost(struct ast_translator *t, int seconds)
+{
 	struct ast_trans_pvt *pvt;
-	struct rusage start;
-	struct rusage end;
-	int cost;
+	int64_t runs[COST_RUNS], start;
 	int out_rate = ast_format_rate(t->dstfmt);
+	int cost, i;
 
 	if (!seconds)
 		seconds = 1;
@@ -406,110 +616,182 @@ static void calc_cost(struct ast_translator *t, int seconds)
 		return;
 	}
 
-	getrusage(RUSAGE_SELF, &start);
+	if (run_samples(pvt, out_rate / 10)) {
+		destroy(pvt);
+		t->cost = 999999;
+		return;
+	}
 
-	/* Call the encoder until we've processed the required number of samples */
-	while (num_samples < seconds * out_rate) {
-		struct ast_frame *f = t->sample();
-		if (!f) {
-			ast_log(LOG_WARNING, "Translator '%s' failed to produce a sample frame.\n", t->name);
+	for (i = 0; i < COST_RUNS; i++) {
+		start = cpu_usecs();
+		if (run_samples(pvt, seconds * out_rate / COST_RUNS)) {
 			destroy(pvt);
 			t->cost = 999999;
 			return;
 		}
-		framein(pvt, f);
-		ast_frfree(f);
-		while ((f = t->frameout(pvt))) {
-			num_samples += f->samples;
-			ast_frfree(f);
+		runs[i] = cpu_usecs() - start;
+	}
+
+	destroy(pvt);
+
+	qsort(runs, COST_RUNS, sizeof(runs[0]), cmp_cost);
+	cost = runs[COST_RUNS / 2] * COST_RUNS / seconds;
+
+	t->cost = cost ? cost : 1;
+}
+
+/*! \brief Get the cost of a translator measured by an earlier run of this
+ * version of Asterisk on the same CPU */
+static int load_cost(struct ast_translator *t)
+{
+	char buf[sizeof(cost_key) + 32];
+	int cost, len = 0;
+
+	if (ast_strlen_zero(cost_key) || ast_db_get(COST_FAMILY, t->name, buf, sizeof(buf)))
+		return -1;
+	if (sscanf(buf, "%30d %n", &cost, &len) < 1 || !len || cost < 1 || strcmp(buf + len, cost_key))
+		return -1;
+
+	t->cost = cost;
+
+	return 0;
+}
+
+static void save_cost(struct ast_translator *t)
+{
+	char buf[sizeof(cost_key) + 32];
+
+	if (ast_strlen_zero(cost_key))
+		return;
+	snprintf(buf, sizeof(buf), "%d %s", t->cost, cost_key);
+	ast_db_put(COST_FAMILY, t->name, buf);
+}
+
+/*! \brief Name the CPU, as /proc/cpuinfo does if there is one */
+static void cpu_name(char *buf, size_t size)
+{
+	struct utsname uts;
+	char line[256], *val;
+	FILE *f;
+
+	if ((f = fopen("/proc/cpuinfo", "r"))) {
+		while (fgets(line, sizeof(line), f)) {
+			if (strncmp(line, "model name", 10) || !(val = strchr(line, ':')))
+				continue;
+			ast_copy_string(buf, ast_strip(val + 1), size);
+			fclose(f);
+			return;
 		}
+		fclose(f);
 	}
 
-	getrusage(RUSAGE_SELF, &end);
+	if (!uname(&uts))
+		ast_copy_string(buf, uts.machine, size);
+	else
+		ast_copy_string(buf, "unknown", size);
+}
+
+/*! \brief Start keeping measured costs in astdb, now that it is open */
+void ast_translate_init(void)
+{
+	struct ast_translator *t;
+	char cpu[128];
 
-	cost = ((end.ru_utime.tv_sec - start.ru_utime.tv_sec) * 1000000) + end.ru_utime.tv_usec - start.ru_utime.tv_usec;
-	cost += ((end.ru_stime.tv_sec - start.ru_stime.tv_sec) * 1000000) + end.ru_stime.tv_usec - start.ru_stime.tv_usec;
+	cpu_name(cpu, sizeof(cpu));
 
-	destroy(pvt);
+	AST_RWLIST_WRLOCK(&translators);
+	snprintf(cost_key, sizeof(cost_key), "%s %s", ast_get_version(), cpu);
+	/* Keep what was measured for those registered before astdb was open */
+	AST_RWLIST_TRAVERSE(&translators, t, list)
+		save_cost(t);
+	AST_RWLIST_UNLOCK(&translators);
+}
+
+/*!
+ * \brief Update the matrix for a translator that has become usable
+ * \note This function expects the list of translators to be locked
+ *
+ * A new shortest path can only use the new step once, so for each x and z
+ * the path x -> srcfmt -> dstfmt -> z just has to be compared with the
+ * current one; nothing else changes.
+ */
+static void matrix_add(struct ast_translator *t)
+{
+	int u = t->srcfmt, v = t->dstfmt;
+	int x;      /* source format index */
+	int z;      /* destination format index */
+	unsigned int to_u, from_v, newcost;
+
+	for (x = 0; x < MAX_FORMAT; x++) {
+		if (x != u && !tr_matrix[x][u].step)
+			continue;
+		to_u = (x == u) ? 0 : tr_matrix[x][u].cost;
+
+		for (z = 0; z < MAX_FORMAT; z++) {
+			if (z == x)
+				continue;
+			if (z != v && !tr_matrix[v][z].step)
+				continue;
+			from_v = (z == v) ? 0 : tr_matrix[v][z].cost;
+
+			newcost = to_u + t->cost + from_v;
+			if (tr_matrix[x][z].step && newcost >= tr_matrix[x][z].cost)
+				continue;
+
+			tr_matrix[x][z].step = (x == u) ? t : tr_matrix[x][u].step;
+			tr_matrix[x][z].cost = newcost;
+			tr_matrix[x][z].multistep = (x != u || z != v);
+			ast_debug(3, "Discovered %d cost path from %s to %s, via %s\n", newcost,
+				ast_getformatname(1 << x), ast_getformatname(1 << z), t->name);
+		}
+	}
+}
+
+/*!
+ * \brief Whether any path in the matrix goes through a translator
+ * \note This function expects the list of translators to be locked
+ */
+static int matrix_uses(struct ast_translator *t)
+{
+	int x, y, z;
 
-	t->cost = cost / seconds;
+	for (x = 0; x < MAX_FORMAT; x++) {
+		for (z = 0; z < MAX_FORMAT; z++) {
+			for (y = x; y != z && tr_matrix[y][z].step; y = tr_matrix[y][z].step->dstfmt) {
+				if (tr_matrix[y][z].step == t)
+					return 1;
+			}
+		}
+	}
 
-	if (!t->cost)
-		t->cost = 1;
+	return 0;
 }
 
 /*!
  * \brief rebuild a translation matrix.
  * \note This function expects the list of translators to be locked
+ *
+ * \param samples if not 0, measure the cost of each translator again, with
+ *        this many seconds of audio, and save it
 */
 static void rebuild_matrix(int samples)
 {
 	struct ast_translator *t;
-	int x;      /* source format index */
-	int y;      /* intermediate format index */
-	int z;      /* destination format index */
 
 	ast_debug(1, "Resetting translation matrix\n");
 
 	bzero(tr_matrix, sizeof(tr_matrix));
 
-	/* first, compute all direct costs */
 	AST_RWLIST_TRAVERSE(&translators, t, list) {
 		if (!t->active)
 			continue;
 
-		x = t->srcfmt;
-		z = t->dstfmt;
-
-		if (samples)
+		if (samples) {
 			calc_cost(t, samples);
-	  
-		if (!tr_matrix[x][z].step || t->cost < tr_matrix[x][z].cost) {
-			tr_matrix[x][z].step = t;
-			tr_matrix[x][z].cost = t->cost;
+			save_cost(t);
 		}
-	}
 
-	/*
-	 * For each triple x, y, z of distinct formats, check if there is
-	 * a path from x to z through y which is cheaper than what is
-	 * currently known, and in case, update the matrix.
-	 * Repeat until the matrix is stable.
-	 */
-	for (;;) {
-		int changed = 0;
-		for (x = 0; x < MAX_FORMAT; x++) {      /* source format */
-			for (y = 0; y < MAX_FORMAT; y++) {    /* intermediate format */
-				if (x == y)                     /* skip ourselves */
-					continue;
-
-				for (z = 0; z<MAX_FORMAT; z++) {  /* dst format */
-					int newcost;
-
-					if (z == x || z == y)       /* skip null conversions */
-						continue;
-					if (!tr_matrix[x][y].step)  /* no path from x to y */
-						continue;
-					if (!tr_matrix[y][z].step)  /* no path from y to z */
-						continue;
-					newcost = tr_matrix[x][y].cost + tr_matrix[y][z].cost;
-					if (tr_matrix[x][z].step && newcost >= tr_matrix[x][z].cost)
-						continue;               /* x->y->z is more expensive than
-						                         * the existing path */
-					/* ok, we can get from x to z via y with a cost that
-					   is the sum of the transition from x to y and
-					   from y to z */
-						 
-					tr_matrix[x][z].step = tr_matrix[x][y].step;
-					tr_matrix[x][z].cost = newcost;
-					tr_matrix[x][z].multistep = 1;
-					ast_debug(3, "Discovered %d cost path from %s to %s, via %d\n", tr_matrix[x][z].cost, ast_getformatname(x), ast_getformatname(z), y);
-					changed++;
-				}
-			}
-		}
-		if (!changed)
-			break;
+		matrix_add(t);
 	}
 }
 
@@ -527,7 +809,8 @@ static char *handle_cli_core_show_translation(struct ast_cli_entry *e, int cmd,
 			"       Displays known codec translators and the cost associated\n"
 			"       with each conversion.  If the argument 'recalc' is supplied along\n"
 			"       with optional number of seconds to test a new test will be performed\n"
-			"       as the chart is being displayed.\n";
+			"       as the chart is being displayed.  The new costs are saved, and\n"
+			"       used instead of testing again when Asterisk next starts.\n";
 		return NULL;
 	case CLI_GENERATE:
 		return NULL;
@@ -603,8 +886,66 @@ static char *handle_cli_core_show_translation(struct ast_cli_entry *e, int cmd,
 	return CLI_SUCCESS;
 }
 
+static char *handle_cli_core_show_translation_pools(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+#define FORMAT "%-20s %-8s %-8s %6s %6s %10s %10s\n"
+#define FORMAT2 "%-20s %-8s %-8s %6d %6d %10u %10u\n"
+#define FORMAT3 "%-8s %-8s %10s %10s %10s\n"
+#define FORMAT4 "%-8s %-8s %10u %10u %10u\n"
+	struct ast_translator *t;
+	struct path_stats stats;
+	int x, y;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "core show translation pools";
+		e->usage =
+			"Usage: core show translation pools\n"
+			"       Shows, for each translator, how many descriptors are in use,\n"
+			"       kept for reuse, were reused and were allocated, and for each\n"
+			"       pair of formats, how many translation paths were built, and\n"
+			"       how long that took on average and at most.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 4)
+		return CLI_SHOWUSAGE;
+
+	ast_cli(a->fd, FORMAT, "Translator", "From", "To", "In use", "Pooled", "Reused", "Allocated");
+	AST_RWLIST_RDLOCK(&translators);
+	ast_mutex_lock(&pool_lock);
+	AST_RWLIST_TRAVERSE(&translators, t, list) {
+		ast_cli(a->fd, FORMAT2, t->name, ast_getformatname(1 << t->srcfmt), ast_getformatname(1 << t->dstfmt),
+			t->inuse, t->pool_size, t->reused, t->created);
+	}
+	ast_mutex_unlock(&pool_lock);
+	AST_RWLIST_UNLOCK(&translators);
+
+	ast_cli(a->fd, "\n" FORMAT3, "From", "To", "Builds", "Avg (us)", "Max (us)");
+	for (x = 0; x < MAX_FORMAT; x++) {
+		for (y = 0; y < MAX_FORMAT; y++) {
+			ast_mutex_lock(&pool_lock);
+			stats = path_stats[x][y];
+			ast_mutex_unlock(&pool_lock);
+			if (!stats.builds)
+				continue;
+			ast_cli(a->fd, FORMAT4, ast_getformatname(1 << x), ast_getformatname(1 << y),
+				stats.builds, (unsigned int) (stats.total / stats.builds), stats.max);
+		}
+	}
+
+	return CLI_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+#undef FORMAT3
+#undef FORMAT4
+}
+
 static struct ast_cli_entry cli_translate[] = {
-	AST_CLI_DEFINE(handle_cli_core_show_translation, "Display translation matrix")
+	AST_CLI_DEFINE(handle_cli_core_show_translation, "Display translation matrix"),
+	AST_CLI_DEFINE(handle_cli_core_show_translation_pools, "Display translator descriptor pools"),
 };
 
 /*! \brief register codec translator */
@@ -613,6 +954,7 @@ int __ast_register_translator(struct ast_translator *t, struct ast_module *mod)
 	static int added_cli = 0;
 	struct ast_translator *u;
 	char tmp[80];
+	int cached, inserted = 0;
 
 	if (!mod) {
 		ast_log(LOG_WARNING, "Missing module pointer, you need to supply one\n");
@@ -625,6 +967,9 @@ int __ast_register_translator(struct ast_translator *t, struct ast_module *mod)
 	}
 
 	t->module = mod;
+	t->pool = NULL;
+	t->pool_size = t->inuse = 0;
+	t->reused = t->created = 0;
 
 	t->srcfmt = powerof(t->srcfmt);
 	t->dstfmt = powerof(t->dstfmt);
@@ -668,11 +1013,15 @@ int __ast_register_translator(struct ast_translator *t, struct ast_module *mod)
 	if (t->frameout == NULL)
 		t->frameout = default_frameout;
   
-	calc_cost(t, 1);
+	if (!(cached = !load_cost(t))) {
+		calc_cost(t, 1);
+		save_cost(t);
+	}
 
-	ast_verb(2, "Registered translator '%s' from format %s to %s, cost %d\n",
+	ast_verb(2, "Registered translator '%s' from format %s to %s, cost %d%s\n",
 			    term_color(tmp, t->name, COLOR_MAGENTA, COLOR_BLACK, sizeof(tmp)),
-			    ast_getformatname(1 << t->srcfmt), ast_getformatname(1 << t->dstfmt), t->cost);
+			    ast_getformatname(1 << t->srcfmt), ast_getformatname(1 << t->dstfmt), t->cost,
+			    cached ? " (measured earlier)" : "");
 
 	if (!added_cli) {
 		ast_cli_register_multiple(cli_translate, sizeof(cli_translate) / sizeof(struct ast_cli_entry));
@@ -688,17 +1037,18 @@ int __ast_register_translator(struct ast_translator *t, struct ast_module *mod)
 		    (u->dstfmt == t->dstfmt) &&
 		    (u->cost > t->cost)) {
 			AST_RWLIST_INSERT_BEFORE_CURRENT(t, list);
-			t = NULL;
+			inserted = 1;
+			break;
 		}
 	}
 	AST_RWLIST_TRAVERSE_SAFE_END;
 
 	/* if no existing translator was found for this format combination,
 	   add it to the beginning of the list */
-	if (t)
+	if (!inserted)
 		AST_RWLIST_INSERT_HEAD(&translators, t, list);
 
-	rebuild_matrix(0);
+	matrix_add(t);
 
 	AST_RWLIST_UNLOCK(&translators);
 
@@ -723,19 +1073,25 @@ int ast_unregister_translator(struct ast_translator *t)
 	}
 	AST_RWLIST_TRAVERSE_SAFE_END;
 
-	if (found)
+	/* Paths not going through it stay the shortest */
+	if (found && matrix_uses(t))
 		rebuild_matrix(0);
 
 	AST_RWLIST_UNLOCK(&translators);
 
+	if (found)
+		pool_drain(t);
+
 	return (u ? 0 : -1);
 }
 
 void ast_translator_activate(struct ast_translator *t)
 {
 	AST_RWLIST_WRLOCK(&translators);
-	t->active = 1;
-	rebuild_matrix(0);
+	if (!t->active) {
+		t->active = 1;
+		matrix_add(t);
+	}
 	AST_RWLIST_UNLOCK(&translators);
 }
 
@@ -743,7 +1099,8 @@ void ast_translator_deactivate(struct ast_translator *t)
 {
 	AST_RWLIST_WRLOCK(&translators);
 	t->active = 0;
-	rebuild_matrix(0);
+	if (matrix_uses(t))
+		rebuild_matrix(0);
 	AST_RWLIST_UNLOCK(&translators);
 }
 
@@ -0,0 +1,227 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Batched UDP reads and writes
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/uio.h>
+
+#include "asterisk/udpbatch.h"
+#include "asterisk/logger.h"
+#include "asterisk/utils.h"
+#include "asterisk/threadstorage.h"
+
+/*! Most datagrams a queue holds */
+#define BATCH_MSGS	64
+/*! Most bytes a queue holds */
+#define BATCH_BYTES	65536
+
+struct ast_udp_batch {
+	int count;				/*!< Datagrams queued */
+	size_t used;				/*!< Bytes of buf they take */
+	int fd[BATCH_MSGS];			/*!< Socket each goes out on */
+	struct sockaddr_in sin[BATCH_MSGS];	/*!< Where each goes */
+	struct iovec iov[BATCH_MSGS];		/*!< Where each is in buf */
+	char buf[BATCH_BYTES];
+};
+
+/*! The queue the thread sends through, if it has one */
+AST_THREADSTORAGE(udp_batch_buf);
+
+#ifdef HAVE_RECVMMSG
+/*! Cleared if the kernel lacks recvmmsg() although the C library has it */
+static int have_recvmmsg = 1;
+#endif
+#ifdef HAVE_SENDMMSG
+/*! Cleared if the kernel lacks sendmmsg() although the C library has it */
+static int have_sendmmsg = 1;
+#endif
+
+int ast_udp_recv(int fd, struct ast_udp_msg *msgs, int count, int flags)
+{
+	socklen_t len;
+	int i, res;
+
+	if (count > AST_UDP_RECV_MAX)
+		count = AST_UDP_RECV_MAX;
+
+#ifdef HAVE_RECVMMSG
+	if (have_recvmmsg && count > 1) {
+		struct mmsghdr hdr[AST_UDP_RECV_MAX];
+		struct iovec iov[AST_UDP_RECV_MAX];
+
+		memset(hdr, 0, count * sizeof(hdr[0]));
+		for (i = 0; i < count; i++) {
+			iov[i].iov_base = msgs[i].buf;
+			iov[i].iov_len = msgs[i].size;
+			hdr[i].msg_hdr.msg_iov = &iov[i];
+			hdr[i].msg_hdr.msg_iovlen = 1;
+			hdr[i].msg_hdr.msg_name = &msgs[i].sin;
+			hdr[i].msg_hdr.msg_namelen = sizeof(msgs[i].sin);
+		}
+		/* Only the first one is waited for */
+		if ((res = recvmmsg(fd, hdr, count, flags | MSG_WAITFORONE, NULL)) > 0) {
+			for (i = 0; i < res; i++)
+				msgs[i].len = hdr[i].msg_len;
+			return res;
+		}
+		if (errno != ENOSYS)
+			return -1;
+		have_recvmmsg = 0;
+	}
+#endif
+
+	for (i = 0; i < count; i++) {
+		len = sizeof(msgs[i].sin);
+		res = recvfrom(fd, msgs[i].buf, msgs[i].size, i ? flags | MSG_DONTWAIT : flags, (struct sockaddr *) &msgs[i].sin, &len);
+		if (res < 0)
+			break;
+		msgs[i].len = res;
+	}
+
+	return i ? i : -1;
+}
+
+struct ast_udp_batch *ast_udp_batch_create(void)
+{
+	return ast_calloc(1, sizeof(struct ast_udp_batch));
+}
+
+void ast_udp_batch_destroy(struct ast_udp_batch *batch)
+{
+	ast_free(batch);
+}
+
+static void send_failed(struct ast_udp_batch *batch, int i)
+{
+	ast_debug(1, "Queued UDP send of %d bytes to %s:%d failed: %s\n", (int) batch->iov[i].iov_len,
+		ast_inet_ntoa(batch->sin[i].sin_addr), ntohs(batch->sin[i].sin_port), strerror(errno));
+}
+
+/*! \brief Send the queued datagrams from start up to end, which all go out
+ * on the same socket
+ * \return Returns the number sent
+ */
+static int send_run(struct ast_udp_batch *batch, int start, int end)
+{
+	int i = start, sent = 0;
+
+#ifdef HAVE_SENDMMSG
+	if (have_sendmmsg && end - start > 1) {
+		struct mmsghdr hdr[BATCH_MSGS];
+		int res;
+
+		memset(hdr, 0, (end - start) * sizeof(hdr[0]));
+		for (i = start; i < end; i++) {
+			hdr[i - start].msg_hdr.msg_iov = &batch->iov[i];
+			hdr[i - start].msg_hdr.msg_iovlen = 1;
+			hdr[i - start].msg_hdr.msg_name = &batch->sin[i];
+			hdr[i - start].msg_hdr.msg_namelen = sizeof(batch->sin[i]);
+		}
+		for (i = start; i < end; ) {
+			if ((res = sendmmsg(batch->fd[start], hdr + i - start, end - i, 0)) > 0) {
+				sent += res;
+				i += res;
+			} else if (errno == ENOSYS) {
+				have_sendmmsg = 0;
+				break;
+			} else {
+				/* Stopped at one that failed; skip it and go on */
+				send_failed(batch, i++);
+			}
+		}
+	}
+#endif
+
+	for (; i < end; i++) {
+		if (sendto(batch->fd[i], batch->iov[i].iov_base, batch->iov[i].iov_len, 0, (struct sockaddr *) &batch->sin[i], sizeof(batch->sin[i])) < 0)
+			send_failed(batch, i);
+		else
+			sent++;
+	}
+
+	return sent;
+}
+
+static int batch_flush(struct ast_udp_batch *batch)
+{
+	int start, end, sent = 0;
+
+	for (start = 0; start < batch->count; start = end) {
+		for (end = start + 1; end < batch->count && batch->fd[end] == batch->fd[start]; end++)
+			;
+		sent += send_run(batch, start, end);
+	}
+	batch->count = 0;
+	batch->used = 0;
+
+	return sent;
+}
+
+void ast_udp_batch_use(struct ast_udp_batch *batch)
+{
+	struct ast_udp_batch **cur;
+
+	if (!(cur = ast_threadstorage_get(&udp_batch_buf, sizeof(*cur))))
+		return;
+	if (*cur)
+		batch_flush(*cur);
+	*cur = batch;
+}
+
+int ast_udp_batch_flush(void)
+{
+	struct ast_udp_batch **cur;
+
+	if (!(cur = ast_threadstorage_get(&udp_batch_buf, sizeof(*cur))) || !*cur)
+		return 0;
+
+	return batch_flush(*cur);
+}
+
+int ast_udp_sendto(int fd, const void *data, size_t len, const struct sockaddr_in *sin)
+{
+	struct ast_udp_batch **cur, *batch;
+
+	if (!(cur = ast_threadstorage_get(&udp_batch_buf, sizeof(*cur))) || !(batch = *cur) || len > sizeof(batch->buf))
+		return sendto(fd, data, len, 0, (const struct sockaddr *) sin, sizeof(*sin));
+
+	if (batch->count == BATCH_MSGS || batch->used + len > sizeof(batch->buf))
+		batch_flush(batch);
+	batch->fd[batch->count] = fd;
+	batch->sin[batch->count] = *sin;
+	batch->iov[batch->count].iov_base = batch->buf + batch->used;
+	batch->iov[batch->count].iov_len = len;
+	memcpy(batch->buf + batch->used, data, len);
+	batch->used += len;
+	batch->count++;
+
+	return len;
+}
+
+int ast_udp_sendto_now(int fd, const void *data, size_t len, const struct sockaddr_in *sin)
+{
+	/* What was queued first still goes out first */
+	ast_udp_batch_flush();
+
+	return sendto(fd, data, len, 0, (const struct sockaddr *) sin, sizeof(*sin));
+}
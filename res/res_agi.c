@@ -56,6 +56,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 141505 $")
 #include "asterisk/ast_version.h"
 #include "asterisk/speech.h"
 #include "asterisk/manager.h"
+#include "asterisk/mp3.h"
 
 #define MAX_ARGS 128
 #define AGI_NANDFS_RETRY 3
@@ -986,184 +987,59 @@ static int handle_streamfile(struct ast_channel *chan, AGI *agi, int argc, char
 	return (res >= 0) ? RESULT_SUCCESS : RESULT_FAILURE;
 }
 
-/* Copied in from app_mp3.c */
-
-#define LOCAL_MPG_123 "/usr/local/bin/mpg123"
-#define MPG_123 "/usr/bin/mpg123"
-
-static int mp3play(char *filename, int fd)
+static int handle_streammp3(struct ast_channel *chan, AGI *agi, int argc, char *argv[])
 {
 	int res;
-	int x;
-	sigset_t fullset, oldset;
+	long sample_offset = 0;
+	char *edigits = "";
 
-	sigfillset(&fullset);
-	pthread_sigmask(SIG_BLOCK, &fullset, &oldset);
+	if (argc < 3 || argc > 5)
+		return RESULT_SHOWUSAGE;
 
-	res = fork();
-	if (res < 0)
-		ast_log(LOG_WARNING, "Fork failed\n");
-	if (res) {
-		pthread_sigmask(SIG_SETMASK, &oldset, NULL);
-		return res;
-	}
-	if (ast_opt_high_priority)
-		ast_set_priority(0);
-	signal(SIGPIPE, SIG_DFL);
-	pthread_sigmask(SIG_UNBLOCK, &fullset, NULL);
+	if (argv[3])
+		edigits = argv[3];
 
-	dup2(fd, STDOUT_FILENO);
-	for (x=STDERR_FILENO + 1;x<256;x++) {
-		if (x != STDOUT_FILENO)
-			close(x);
-	}
-	/* Execute mpg123, but buffer if it's a net connection */
-	if (!strncasecmp(filename, "http://", 7)) {
-		/* Most commonly installed in /usr/local/bin */
-	    execl(LOCAL_MPG_123, "mpg123", "-q", "-s", "-b", "1024", "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-		/* But many places has it in /usr/bin */
-	    execl(MPG_123, "mpg123", "-q", "-s", "-b", "1024","-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-		/* As a last-ditch effort, try to use PATH */
-	    execlp("mpg123", "mpg123", "-q", "-s", "-b", "1024",  "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-	}
-	else {
-		/* Most commonly installed in /usr/local/bin */
-	    execl(LOCAL_MPG_123, "mpg123", "-q", "-s", "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-		/* But many places has it in /usr/bin */
-	    execl(MPG_123, "mpg123", "-q", "-s", "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-		/* As a last-ditch effort, try to use PATH */
-	    execlp("mpg123", "mpg123", "-q", "-s", "-f", "8192", "--mono", "-r", "8000", filename, (char *)NULL);
-	}
-	ast_log(LOG_WARNING, "Execute of mpg123 failed\n");
-	_exit(0);
-}
+	if ((argc > 4) && (sscanf(argv[4], "%ld", &sample_offset) != 1))
+		return RESULT_SHOWUSAGE;
 
-/* Copied in from app_mp3.c */
-static int timed_read(int fd, void *data, int datalen, int timeout)
-{
-	int res;
-	struct pollfd fds[1];
-	fds[0].fd = fd;
-	fds[0].events = POLLIN;
-	res = poll(fds, 1, timeout);
-	if (res < 1) {
-		ast_log(LOG_NOTICE, "Poll timed out/errored out with %d\n", res);
-		return -1;
+	ast_verb(3, "Playing '%s' (escape_digits=%s) (sample_offset %ld)\n", argv[2], edigits, sample_offset);
+
+	res = ast_mp3_play(chan, argv[2], edigits, agi->audio, agi->ctrl, &sample_offset);
+	if (res == 1) {
+		/* Stop this command, don't print a result line, as there is a new command */
+		return RESULT_SUCCESS;
 	}
-	return read(fd, data, datalen);
-	
+	ast_agi_fdprintf(chan, agi->fd, "200 result=%d endpos=%ld\n", res, sample_offset);
+	return (res >= 0) ? RESULT_SUCCESS : RESULT_FAILURE;
 }
 
-static int handle_streammp3(struct ast_channel *chan, AGI *agi, int argc, char *argv[])
+static int handle_controlstreammp3(struct ast_channel *chan, AGI *agi, int argc, char *argv[])
 {
-	int res;
-	int fds[2];
-	char *edigits = "";
-	int ms = -1;
-	int pid = -1;
-	int owriteformat;
-	int timeout = 2000;
-	struct timeval next;
-	struct ast_frame *f;
-	struct myframe {
-		struct ast_frame f;
-		char offset[AST_FRIENDLY_OFFSET];
-		short frdata[160];
-	} myf;
+	int res = 0, skipms = 3000;
+	char *fwd = "#", *rev = "*", *pause = NULL, *stop = NULL;
 
-	if (argv[3])
-		edigits = argv[3];
+	if (argc < 5 || argc > 9)
+		return RESULT_SHOWUSAGE;
+
+	if (!ast_strlen_zero(argv[4]))
+		stop = argv[4];
 
-	ast_verb(3, "Playing '%s' (escape_digits=%s)\n", argv[2], edigits);
+	if ((argc > 5) && (sscanf(argv[5], "%d", &skipms) != 1))
+		return RESULT_SHOWUSAGE;
 
-	if (pipe(fds)) {
-		ast_log(LOG_WARNING, "Unable to create pipe\n");
-		return -1;
-	}
-	
-	ast_stopstream(chan);
+	if (argc > 6 && !ast_strlen_zero(argv[6]))
+		fwd = argv[6];
 
-	owriteformat = chan->writeformat;
-	res = ast_set_write_format(chan, AST_FORMAT_SLINEAR);
-	if (res < 0) {
-		ast_log(LOG_WARNING, "Unable to set write format to signed linear\n");
-		return -1;
-	}
-	
-	res = mp3play(argv[2], fds[1]);
-
-	if (!strncasecmp(argv[2], "http://", 7)) {
-		/* 10 sec timeout when streaming from a URL */
-		timeout = 10000;
-	}
-
-	next = ast_tvnow();
-	next.tv_sec += 1;
-
-	if (res >= 0) {
-		pid = res;
-		/* Order is important -- there's almost always going to be mp3...  we want to prioritize the user */
-		for (;;) {
-			ms = ast_tvdiff_ms(next, ast_tvnow());
-			if (ms <= 0) {
-				res = timed_read(fds[0], myf.frdata, sizeof(myf.frdata), timeout);
-				if (res > 0) {
-					myf.f.frametype = AST_FRAME_VOICE;
-					myf.f.subclass = AST_FORMAT_SLINEAR;
-					myf.f.datalen = res;
-					myf.f.samples = res / 2;
-					myf.f.mallocd = 0;
-					myf.f.offset = AST_FRIENDLY_OFFSET;
-					myf.f.src = __PRETTY_FUNCTION__;
-					myf.f.delivery.tv_sec = 0;
-					myf.f.delivery.tv_usec = 0;
-					myf.f.data = myf.frdata;
-					if (ast_write(chan, &myf.f) < 0) {
-						res = -1;
-						break;
-					}
-				} else {
-					ast_debug(1, "No more mp3\n");
-					res = 0;
-					break;
-				}
-				next = ast_tvadd(next, ast_samp2tv(myf.f.samples, 8000));
-			} else {
-				ms = ast_waitfor(chan, ms);
-				if (ms < 0) {
-					ast_debug(1, "Hangup detected\n");
-					res = -1;
-					break;
-				}
-				if (ms) {
-					f = ast_read(chan);
-					if (!f) {
-						ast_debug(1, "Null frame == hangup() detected\n");
-						res = -1;
-						break;
-					}
-					if (f->frametype == AST_FRAME_DTMF) {
-						ast_debug(1, "User pressed a key\n");
-						res = f->subclass;
-						if ( strchr(edigits, res) ) {
-							ast_frfree(f);
-							break;
-						}
-					}
-					ast_frfree(f);
-				}
-			}
-		}
-	}
-	close(fds[0]);
-	close(fds[1]);
+	if (argc > 7 && !ast_strlen_zero(argv[7]))
+		rev = argv[7];
+
+	if (argc > 8 && !ast_strlen_zero(argv[8]))
+		pause = argv[8];
+
+	res = ast_mp3_control(chan, argv[3], fwd, rev, stop, pause, skipms);
 
-	if (pid > -1)
-		kill(pid, SIGKILL);
-	if (!res && owriteformat)
-		ast_set_write_format(chan, owriteformat);
+	ast_agi_fdprintf(chan, agi->fd, "200 result=%d\n", res);
 
-	ast_agi_fdprintf(chan, agi->fd, "200 result=%d", res);
 	return (res >= 0) ? RESULT_SUCCESS : RESULT_FAILURE;
 }
 
@@ -1470,7 +1346,8 @@ static int handle_recordfile(struct ast_channel *chan, AGI *agi, int argc, char
 
 	if (silence > 0) {
 		rfmt = chan->readformat;
-		res = ast_set_read_format(chan, AST_FORMAT_SLINEAR);
+		/* The silence detector takes ulaw and alaw frames as they are */
+		res = ast_set_read_format(chan, DSP_SILENCE_FORMATS);
 		if (res < 0) {
 			ast_log(LOG_WARNING, "Unable to set to linear mode, giving up\n");
 			return -1;
@@ -2326,6 +2203,33 @@ static char usage_streamfile[] =
 " or -1 on error or if the channel was disconnected. Remember, the file\n"
 " extension must not be included in the filename.\n";
 
+static char usage_streammp3[] =
+" Usage: STREAM MP3 <location> <escape digits> [sample offset]\n"
+"	Send the given MP3 file or stream, allowing playback to be interrupted\n"
+" by the given digits, if any. Use double quotes for the digits if you wish\n"
+" none to be permitted. If sample offset is provided then the audio will\n"
+" seek to sample offset before play starts. The location is the full path\n"
+" to an MP3 file, including its extension, or an http:// URL. Local files\n"
+" are decoded in-process when format_mp3 is loaded; anything else is played\n"
+" through mpg123, shared with other channels playing the same URL (see\n"
+" broadcast in mp3.conf), in which case the offset is ignored.  Returns 0 if\n"
+" playback completes without a digit being pressed, or the ASCII numerical\n"
+" value of the digit if one was pressed, or -1 on error or if the channel\n"
+" was disconnected. Remember, the file extension must be included in the\n"
+" location.  The sample position where playback stopped is returned as\n"
+" endpos, and can be passed back as the offset to resume there.\n";
+
+static char usage_controlstreammp3[] =
+" Usage: CONTROL STREAM MP3 <location> <escape digits> [skipms] [ffchar] [rewchr] [pausechr]\n"
+"	Send the given MP3 file, allowing playback to be controled by the given\n"
+" digits, if any. Use double quotes for the digits if you wish none to be\n"
+" permitted.  The location is the full path to an MP3 file, including its\n"
+" extension.  Skipping needs the file to be played in-process by format_mp3;\n"
+" other locations can only be stopped.  Returns 0 if playback completes\n"
+" without a digit being pressed, or the ASCII numerical value of the digit\n"
+" if one was pressed, or -1 on error or if the channel was disconnected.\n\n"
+" Note: ffchar and rewchr default to # and * respectively.\n";
+
 static char usage_controlstreamfile[] =
 " Usage: CONTROL STREAM FILE <filename> <escape digits> [skipms] [ffchar] [rewchr] [pausechr]\n"
 "	Send the given file, allowing playback to be controled by the given\n"
@@ -2508,8 +2412,9 @@ static struct agi_command commands[] = {
 	{ { "set", "priority", NULL }, handle_setpriority, "Set channel dialplan priority", usage_setpriority , 0 },
 	{ { "set", "variable", NULL }, handle_setvariable, "Sets a channel variable", usage_setvariable , 1 },
 	{ { "stream", "file", NULL }, handle_streamfile, "Sends audio file on channel", usage_streamfile , 0 },
-	{ { "stream", "mp3", NULL }, handle_streammp3, "Sends MP3 on channel", usage_streamfile , 0 },
+	{ { "stream", "mp3", NULL }, handle_streammp3, "Sends MP3 on channel", usage_streammp3 , 0 },
 	{ { "control", "stream", "file", NULL }, handle_controlstreamfile, "Sends audio file on channel and allows the listner to control the stream", usage_controlstreamfile , 0 },
+	{ { "control", "stream", "mp3", NULL }, handle_controlstreammp3, "Sends MP3 on channel and allows the listner to control the stream", usage_controlstreammp3 , 0 },
 	{ { "tdd", "mode", NULL }, handle_tddmode, "Toggles TDD mode (for the deaf)", usage_tddmode , 0 },
 	{ { "verbose", NULL }, handle_verbose, "Logs a message to the asterisk verbose log", usage_verbose , 1 },
 	{ { "wait", "for", "digit", NULL }, handle_waitfordigit, "Waits for a digit to be pressed", usage_waitfordigit , 0 },
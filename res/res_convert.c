@@ -30,10 +30,33 @@
 
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 89424 $")
 
+#include <sys/stat.h>
+#include <glob.h>
+
+#include "asterisk/paths.h"	/* use ast_config_AST_DATA_DIR */
 #include "asterisk/channel.h"
 #include "asterisk/module.h"
 #include "asterisk/cli.h"
 #include "asterisk/file.h"
+#include "asterisk/lock.h"
+#include "asterisk/utils.h"
+
+/*! \brief One file converted by "file convert batch" */
+struct convert_job {
+	char *name;		/*!< file name, without extension */
+	char *ext;		/*!< extension of the file */
+	int format;		/*!< format of the file, for its sample rate */
+	off_t samples;		/*!< samples converted */
+	const char *error;	/*!< why the file was not converted, NULL if it was */
+};
+
+/*! \brief The files of a "file convert batch", shared by its worker threads */
+struct convert_batch {
+	struct convert_job *jobs;
+	int count;
+	int next;		/*!< next job to take, with ast_atomic_fetchadd_int() */
+	const char *ext;	/*!< extension of the format to convert to */
+};
 
 /*! \brief Split the filename to basename and extension */
 static int split_ext(char *filename, char **name, char **ext)
@@ -63,7 +86,6 @@ static char *handle_cli_file_convert(struct ast_cli_entry *e, int cmd, struct as
 {
 	char *ret = CLI_FAILURE;
 	struct ast_filestream *fs_in = NULL, *fs_out = NULL;
-	struct ast_frame *f;
 	struct timeval start;
 	int cost;
 	char *file_in = NULL, *file_out = NULL;
@@ -99,7 +121,7 @@ static char *handle_cli_file_convert(struct ast_cli_entry *e, int cmd, struct as
 		ast_cli(a->fd, "'%s' is an invalid filename!\n", a->argv[2]);
 		goto fail_out;
 	}
-	if (!(fs_in = ast_readfile(name_in, ext_in, NULL, O_RDONLY, 0, 0))) {
+	if (!(fs_in = ast_readfile_mapped(name_in, ext_in))) {
 		ast_cli(a->fd, "Unable to open input file: %s\n", a->argv[2]);
 		goto fail_out;
 	}
@@ -115,11 +137,9 @@ static char *handle_cli_file_convert(struct ast_cli_entry *e, int cmd, struct as
 
 	start = ast_tvnow();
 	
-	while ((f = ast_readframe(fs_in))) {
-		if (ast_writestream(fs_out, f)) {
-			ast_cli(a->fd, "Failed to convert %s.%s to %s.%s!\n", name_in, ext_in, name_out, ext_out);
-			goto fail_out;
-		}
+	if (ast_stream_convert(fs_in, fs_out)) {
+		ast_cli(a->fd, "Failed to convert %s.%s to %s.%s!\n", name_in, ext_in, name_out, ext_out);
+		goto fail_out;
 	}
 
 	cost = ast_tvdiff_ms(ast_tvnow(), start);
@@ -141,8 +161,206 @@ fail_out:
 	return ret;
 }
 
+/*! \brief Convert one file of a batch, next to the original */
+static void convert_one(struct convert_job *job, const char *ext)
+{
+	struct ast_filestream *in, *out;
+
+	/* Left out of the batch, e.g. as another job writes the same file */
+	if (job->error)
+		return;
+
+	if (!(in = ast_readfile_mapped(job->name, job->ext))) {
+		job->error = "unable to open the file";
+		return;
+	}
+	if (!(out = ast_writefile(job->name, ext, NULL, O_CREAT|O_TRUNC|O_WRONLY, 0, AST_FILE_MODE))) {
+		job->error = "unable to create the converted file";
+		ast_closestream(in);
+		return;
+	}
+
+	if (ast_stream_convert(in, out))
+		job->error = "conversion failed";
+	job->samples = ast_tellstream(in);
+
+	ast_closestream(out);
+	ast_closestream(in);
+	if (job->error)
+		ast_filedelete(job->name, ext);
+}
+
+static void *convert_worker(void *data)
+{
+	struct convert_batch *batch = data;
+	int i;
+
+	while ((i = ast_atomic_fetchadd_int(&batch->next, 1)) < batch->count)
+		convert_one(&batch->jobs[i], batch->ext);
+
+	return NULL;
+}
+
+/*! \brief Fill in the files of a batch, from what a pattern matches */
+static int convert_batch_files(struct convert_batch *batch, const char *pattern)
+{
+	struct convert_job *job;
+	struct stat st;
+	glob_t globbuf;
+	char *name, *ext;
+	int i, j, format;
+
+	if (glob(pattern, 0, NULL, &globbuf))
+		return 0;
+
+	if (!(batch->jobs = ast_calloc(globbuf.gl_pathc, sizeof(*batch->jobs)))) {
+		globfree(&globbuf);
+		return -1;
+	}
+
+	for (i = 0; i < globbuf.gl_pathc; i++) {
+		if (stat(globbuf.gl_pathv[i], &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (!(name = ast_strdup(globbuf.gl_pathv[i])))
+			break;
+		/* Files of no known format (e.g. voicemail's .txt files) are not
+		   part of the batch, nor are those already in the wanted one */
+		if (split_ext(name, &name, &ext) || !strcmp(ext, batch->ext) ||
+		    (format = ast_fileexists(name, ext, NULL)) <= 0) {
+			ast_free(name);
+			continue;
+		}
+		job = &batch->jobs[batch->count++];
+		job->name = name;
+		job->ext = ext;
+		job->format = format;
+		/* msg0000.wav and msg0000.gsm would both be written to msg0000.<ext> */
+		for (j = 0; j < batch->count - 1; j++) {
+			if (!strcmp(batch->jobs[j].name, name)) {
+				job->error = "a file with the same name is converted";
+				break;
+			}
+		}
+	}
+	globfree(&globbuf);
+
+	return batch->count;
+}
+
+/*!
+ * \brief Convert many files to one format, on several threads
+ * \param e CLI entry
+ * \param cmd command number
+ * \param a list of cli arguments
+ * \retval NULL on success, or
+ * \retval CLI_SHOWUSAGE or CLI_FAILURE on failure.
+ */
+static char *handle_cli_file_convert_batch(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	struct convert_batch batch = { NULL, };
+	pthread_t *threads;
+	struct timeval start;
+	char *pattern;
+	struct stat st;
+	double elapsed, audio = 0;
+	int i, count = 0, failed = 0;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "file convert batch";
+		e->usage =
+			"Usage: file convert batch <directory|pattern> <format> [threads]\n"
+			"       Convert every file in a directory, or matching a shell\n"
+			"       pattern, to the format with the given extension.  The\n"
+			"       converted files are written next to the originals.  If\n"
+			"       an absolute path is not given, the default Asterisk sounds\n"
+			"       directory will be used.  The files are shared by as many\n"
+			"       threads as there are processors, or the number given.\n\n"
+			"       Example:\n"
+			"           file convert batch /var/spool/asterisk/voicemail/default/*/INBOX gsm\n"
+			"           file convert batch 'digits/*.wav' ulaw 4\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc < 5 || a->argc > 6 || ast_strlen_zero(a->argv[3]) || ast_strlen_zero(a->argv[4]))
+		return CLI_SHOWUSAGE;
+
+	if (a->argc == 6) {
+		if (sscanf(a->argv[5], "%d", &count) != 1 || count < 1)
+			return CLI_SHOWUSAGE;
+	} else if ((count = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		count = 1;
+
+	if (a->argv[3][0] == '/')
+		pattern = ast_strdupa(a->argv[3]);
+	else {
+		pattern = alloca(strlen(ast_config_AST_DATA_DIR) + strlen(a->argv[3]) + 10);
+		sprintf(pattern, "%s/sounds/%s", ast_config_AST_DATA_DIR, a->argv[3]);
+	}
+	if (!stat(pattern, &st) && S_ISDIR(st.st_mode)) {
+		char *dir = pattern;
+
+		pattern = alloca(strlen(dir) + 3);
+		sprintf(pattern, "%s/*", dir);
+	}
+
+	/* ugly, can be removed when CLI entries have ast_module pointers */
+	ast_module_ref(ast_module_info->self);
+
+	batch.ext = a->argv[4];
+	if (convert_batch_files(&batch, pattern) <= 0) {
+		ast_cli(a->fd, "No files to convert in %s\n", a->argv[3]);
+		ast_free(batch.jobs);
+		ast_module_unref(ast_module_info->self);
+		return CLI_FAILURE;
+	}
+	if (count > batch.count)
+		count = batch.count;
+
+	start = ast_tvnow();
+
+	/* This thread is one of the workers */
+	threads = alloca(count * sizeof(*threads));
+	for (i = 1; i < count; i++) {
+		if (ast_pthread_create(&threads[i], NULL, convert_worker, &batch))
+			break;
+	}
+	count = i;
+	convert_worker(&batch);
+	for (i = 1; i < count; i++)
+		pthread_join(threads[i], NULL);
+
+	elapsed = ast_tvdiff_ms(ast_tvnow(), start) / 1000.0;
+
+	for (i = 0; i < batch.count; i++) {
+		struct convert_job *job = &batch.jobs[i];
+
+		if (job->error) {
+			ast_cli(a->fd, "Failed to convert %s.%s: %s\n", job->name, job->ext, job->error);
+			failed++;
+		} else
+			audio += (double) job->samples / ast_format_rate(job->format);
+		ast_free(job->name);
+	}
+	ast_free(batch.jobs);
+
+	ast_cli(a->fd, "Converted %d of %d files to %s in %.3f seconds, on %d thread%s\n",
+		batch.count - failed, batch.count, batch.ext, elapsed, count, ESS(count));
+	if (elapsed > 0) {
+		ast_cli(a->fd, "%.1f files/s, %.1f seconds of audio/s\n",
+			(batch.count - failed) / elapsed, audio / elapsed);
+	}
+
+	ast_module_unref(ast_module_info->self);
+
+	return failed ? CLI_FAILURE : CLI_SUCCESS;
+}
+
 static struct ast_cli_entry cli_convert[] = {
-	AST_CLI_DEFINE(handle_cli_file_convert, "Convert audio file")
+	AST_CLI_DEFINE(handle_cli_file_convert, "Convert audio file"),
+	AST_CLI_DEFINE(handle_cli_file_convert_batch, "Convert many audio files, on several threads"),
 };
 
 static int unload_module(void)
@@ -64,6 +64,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 125280 $")
 #include "asterisk/cli.h"
 #include "asterisk/stringfields.h"
 #include "asterisk/linkedlists.h"
+#include "asterisk/mp3.h"
 
 #define INITIAL_NUM_FILES   8
 
@@ -153,7 +154,7 @@ struct mohclass {
 	/*! The format from the MOH source, not applicable to "files" mode */
 	int format;
 	/*! The pid of the external application delivering MOH */
-	int pid;
+	pid_t pid;
 	time_t start;
 	pthread_t thread;
 	/*! Source of audio */
@@ -179,8 +180,6 @@ struct mohdata {
 
 AST_RWLIST_HEAD_STATIC(mohclasses, mohclass);
 
-#define LOCAL_MPG_123 "/usr/local/bin/mpg123"
-#define MPG_123 "/usr/bin/mpg123"
 #define MAX_MP3S 256
 
 static int ast_moh_destroy_one(struct mohclass *moh);
@@ -397,7 +396,7 @@ static struct ast_generator moh_file_stream =
 
 static int spawn_mp3(struct mohclass *class)
 {
-	int fds[2];
+	int fd;
 	int files = 0;
 	char fns[MAX_MP3S][80];
 	char *argv[MAX_MP3S + 50];
@@ -406,9 +405,7 @@ static int spawn_mp3(struct mohclass *class)
 	int argc = 0;
 	DIR *dir = NULL;
 	struct dirent *de;
-	sigset_t signal_set, old_set;
 
-	
 	if (!strcasecmp(class->dir, "nodir")) {
 		files = 1;
 	} else {
@@ -478,72 +475,22 @@ static int spawn_mp3(struct mohclass *class)
 	if (dir) {
 		closedir(dir);
 	}
-	if (pipe(fds)) {	
-		ast_log(LOG_WARNING, "Pipe failed\n");
-		return -1;
-	}
 	if (!files) {
 		ast_log(LOG_WARNING, "Found no files in '%s'\n", class->dir);
-		close(fds[0]);
-		close(fds[1]);
 		return -1;
 	}
 	if (time(NULL) - class->start < respawn_time) {
 		sleep(respawn_time - (time(NULL) - class->start));
 	}
 
-	/* Block signals during the fork() */
-	sigfillset(&signal_set);
-	pthread_sigmask(SIG_BLOCK, &signal_set, &old_set);
-
 	time(&class->start);
-	class->pid = fork();
-	if (class->pid < 0) {
-		close(fds[0]);
-		close(fds[1]);
-		ast_log(LOG_WARNING, "Fork failed: %s\n", strerror(errno));
+	/* Run in the directory, so the file names need no path */
+	fd = ast_mp3_decoder_spawn(ast_test_flag(class, MOH_CUSTOM) ? argv[0] : NULL, argv, dir ? class->dir : NULL, &class->pid);
+	if (fd < 0) {
+		class->pid = 0;
 		return -1;
 	}
-	if (!class->pid) {
-		int x;
-
-		if (ast_opt_high_priority)
-			ast_set_priority(0);
-
-		/* Reset ignored signals back to default */
-		signal(SIGPIPE, SIG_DFL);
-		pthread_sigmask(SIG_UNBLOCK, &signal_set, NULL);
-
-		close(fds[0]);
-		/* Stdout goes to pipe */
-		dup2(fds[1], STDOUT_FILENO);
-		/* Close unused file descriptors */
-		for (x=3;x<8192;x++) {
-			if (-1 != fcntl(x, F_GETFL)) {
-				close(x);
-			}
-		}
-		/* Child */
-		chdir(class->dir);
-		if (ast_test_flag(class, MOH_CUSTOM)) {
-			execv(argv[0], argv);
-		} else {
-			/* Default install is /usr/local/bin */
-			execv(LOCAL_MPG_123, argv);
-			/* Many places have it in /usr/bin */
-			execv(MPG_123, argv);
-			/* Check PATH as a last-ditch effort */
-			execvp("mpg123", argv);
-		}
-		ast_log(LOG_WARNING, "Exec failed: %s\n", strerror(errno));
-		close(fds[1]);
-		_exit(1);
-	} else {
-		/* Parent */
-		pthread_sigmask(SIG_SETMASK, &old_set, NULL);
-		close(fds[1]);
-	}
-	return fds[0];
+	return fd;
 }
 
 static void *monmp3thread(void *data)
@@ -606,11 +553,7 @@ static void *monmp3thread(void *data)
 				class->srcfd = -1;
 				pthread_testcancel();
 				if (class->pid > 1) {
-					kill(class->pid, SIGHUP);
-					usleep(100000);
-					kill(class->pid, SIGTERM);
-					usleep(100000);
-					kill(class->pid, SIGKILL);
+					ast_mp3_decoder_stop(class->pid);
 					class->pid = 0;
 				}
 			} else {
@@ -1441,12 +1384,8 @@ static int ast_moh_destroy_one(struct mohclass *moh)
 			moh->pid = 0;
 			/* Back when this was just mpg123, SIGKILL was fine.  Now we need
 			 * to give the process a reason and time enough to kill off its
-			 * children. */
-			kill(pid, SIGHUP);
-			usleep(100000);
-			kill(pid, SIGTERM);
-			usleep(100000);
-			kill(pid, SIGKILL);
+			 * children, which the decoder reaper does. */
+			ast_mp3_decoder_stop(pid);
 			while ((ast_wait_for_input(moh->srcfd, 100) > 0) && (bytes = read(moh->srcfd, buff, 8192)) && time(NULL) < stime)
 				tbytes = tbytes + bytes;
 			ast_debug(1, "mpg123 pid %d and child died after %d bytes read\n", pid, tbytes);
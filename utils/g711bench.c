@@ -0,0 +1,174 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Measure the speed of each set of G.711 kernels this CPU can run
+ *
+ * Converts 20ms (160 sample) frames, as the codec_ulaw and codec_alaw
+ * translators do, and reports samples converted per second.  Kernels that
+ * do not match the lookup tables are reported, and not timed.
+ *
+ * Usage: g711bench [seconds per test]
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/time.h>
+
+#include "asterisk/ulaw.h"
+#include "asterisk/alaw.h"
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+
+#include "g711.h"
+
+#define FRAME_SAMPLES	160
+#define FRAMES		64
+
+/* Needed by ast_verb() in g711.c */
+int option_verbose;
+struct ast_flags ast_options;
+
+static int16_t lin[FRAMES * FRAME_SAMPLES];
+static unsigned char codes[FRAMES * FRAME_SAMPLES];
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*! \brief Run one kernel over the buffers for about secs seconds
+ * \return samples per second */
+static double bench(const struct g711_kernels *k, int op, double secs)
+{
+	double start = now(), elapsed;
+	long samples = 0;
+	int i, j;
+
+	do {
+		/* Check the clock every 1000 passes over the buffers */
+		for (j = 0; j < 1000; j++) {
+			for (i = 0; i < FRAMES; i++) {
+				switch (op) {
+				case 0:
+					k->ulaw_decode(lin + i * FRAME_SAMPLES, codes + i * FRAME_SAMPLES, FRAME_SAMPLES);
+					break;
+				case 1:
+					k->ulaw_encode(codes + i * FRAME_SAMPLES, lin + i * FRAME_SAMPLES, FRAME_SAMPLES);
+					break;
+				case 2:
+					k->alaw_decode(lin + i * FRAME_SAMPLES, codes + i * FRAME_SAMPLES, FRAME_SAMPLES);
+					break;
+				case 3:
+					k->alaw_encode(codes + i * FRAME_SAMPLES, lin + i * FRAME_SAMPLES, FRAME_SAMPLES);
+					break;
+				}
+			}
+		}
+		samples += 1000L * FRAMES * FRAME_SAMPLES;
+	} while ((elapsed = now() - start) < secs);
+
+	return samples / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *ops[] = { "ulaw decode", "ulaw encode", "alaw decode", "alaw encode" };
+	const struct g711_kernels *list[4];
+	double secs = 1.0, rate[ARRAY_LEN(ops)], scalar[ARRAY_LEN(ops)];
+	int count, i, j;
+
+	if (argc > 2 || (argc == 2 && (secs = atof(argv[1])) <= 0)) {
+		fprintf(stderr, "Usage: g711bench [seconds per test]\n");
+		exit(1);
+	}
+
+	ast_ulaw_init();
+	ast_alaw_init();
+
+	srandom(time(NULL));
+	for (i = 0; i < ARRAY_LEN(lin); i++) {
+		lin[i] = random();
+		codes[i] = random();
+	}
+
+	count = g711_kernels_available(list, ARRAY_LEN(list));
+
+	printf("%-8s", "");
+	for (j = 0; j < ARRAY_LEN(ops); j++)
+		printf(" %16s", ops[j]);
+	printf("\n");
+
+	/* The scalar kernels are always last; time them first, to compare */
+	for (j = 0; j < ARRAY_LEN(ops); j++)
+		scalar[j] = bench(list[count - 1], j, secs);
+
+	for (i = 0; i < count; i++) {
+		if (!g711_kernels_verify(list[i])) {
+			printf("%-8s do not match the lookup tables\n", list[i]->name);
+			continue;
+		}
+		printf("%-8s", list[i]->name);
+		for (j = 0; j < ARRAY_LEN(ops); j++) {
+			rate[j] = (i == count - 1) ? scalar[j] : bench(list[i], j, secs);
+			printf(" %9.1fM %4.1fx", rate[j] / 1000000, rate[j] / scalar[j]);
+		}
+		printf("\n");
+	}
+	printf("(million samples/sec, and speed relative to scalar)\n");
+
+	return 0;
+}
+
+void ast_register_file_version(const char *file, const char *version);
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file);
+void ast_unregister_file_version(const char *file)
+{
+}
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	vfprintf(stderr, fmt, vars);
+	va_end(vars);
+}
+
+unsigned int ast_verbose_get_by_file(const char *file)
+{
+	return 0;
+}
+
+void ast_verbose(const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	vprintf(fmt, vars);
+	va_end(vars);
+}
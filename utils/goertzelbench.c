@@ -0,0 +1,230 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Measure the speed of each Goertzel filter kernel this CPU can run
+ *
+ * Runs the DTMF (8 filter) and MF (6 filter) banks over blocks of the
+ * lengths dsp.c uses, on DTMF digits, MF tones, noise and silence, and
+ * reports microseconds of CPU per second of audio of one channel.  Kernels
+ * whose filter states differ from the scalar ones are reported, and not
+ * timed.
+ *
+ * Usage: goertzelbench [seconds per test]
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/time.h>
+#include <math.h>
+
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+
+#include "goertzel.h"
+
+#define SAMPLES		(8000 * 4)
+
+/* Needed by ast_verb() in goertzel.c */
+int option_verbose;
+struct ast_flags ast_options;
+
+static int16_t audio[SAMPLES];
+
+static const struct bank {
+	const char *name;
+	int block;
+	int count;
+	float freqs[GOERTZEL_BANK_MAX];
+} banks[] = {
+	{ "DTMF", 102, 8, { 697, 770, 852, 941, 1209, 1336, 1477, 1633 } },
+	{ "MF", 120, 6, { 700, 900, 1100, 1300, 1500, 1700 } },
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*! \brief A second each of DTMF digits, MF tones, noise and silence */
+static void make_audio(void)
+{
+	static const float rows[] = { 697, 770, 852, 941 }, cols[] = { 1209, 1336, 1477, 1633 };
+	static const float mf[] = { 700, 900, 1100, 1300, 1500, 1700 };
+	int i, n;
+	double level;
+
+	for (i = 0; i < 8000; i++) {
+		/* 50ms digits at -3 to -30dBm, with up to 6dB of twist */
+		n = i / 400;
+		level = 23000 * pow(10, -(n % 10) * 3 / 20.0);
+		audio[i] = level * sin(2 * M_PI * rows[n % 4] * i / 8000) +
+			level * pow(10, -((n / 4) % 3) * 3 / 20.0) * sin(2 * M_PI * cols[(n / 3) % 4] * i / 8000);
+	}
+	for (; i < 16000; i++) {
+		n = i / 480;
+		level = 16000 * pow(10, -(n % 7) * 3 / 20.0);
+		audio[i] = level * sin(2 * M_PI * mf[n % 6] * i / 8000) + level * sin(2 * M_PI * mf[(n + 2) % 6] * i / 8000);
+	}
+	for (; i < 24000; i++)
+		audio[i] = (random() % 20000) - 10000;
+	for (; i < SAMPLES; i++)
+		audio[i] = 0;
+}
+
+static void reset(const struct bank *b, goertzel_state_t *s, goertzel_state_t **p)
+{
+	int i;
+
+	memset(s, 0, GOERTZEL_BANK_MAX * sizeof(*s));
+	for (i = 0; i < b->count; i++) {
+		s[i].fac = (int)(32768.0 * 2.0 * cos(2.0 * M_PI * b->freqs[i] / 8000));
+		p[i] = &s[i];
+	}
+}
+
+/*! \brief Run a bank over the audio, a block at a time as dsp.c does,
+ * keeping the state after each block in out, if given */
+static void run(const struct goertzel_kernel *k, const struct bank *b, goertzel_state_t *out)
+{
+	goertzel_state_t s[GOERTZEL_BANK_MAX], *p[GOERTZEL_BANK_MAX];
+	int pos;
+
+	for (pos = 0; pos + b->block <= SAMPLES; pos += b->block) {
+		reset(b, s, p);
+		k->bank(p, b->count, audio + pos, b->block);
+		if (out) {
+			memcpy(out, s, b->count * sizeof(*s));
+			out += b->count;
+		}
+	}
+}
+
+/*! \return microseconds of CPU per second of audio */
+static double bench(const struct goertzel_kernel *k, const struct bank *b, double secs)
+{
+	double start = now(), elapsed;
+	long passes = 0;
+
+	do {
+		run(k, b, NULL);
+		passes++;
+	} while ((elapsed = now() - start) < secs);
+
+	return elapsed * 1000000 / (passes * (SAMPLES / b->block) * b->block / 8000.0);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct goertzel_kernel *list[4];
+	goertzel_state_t *want, *got;
+	double secs = 1.0, t, scalar[ARRAY_LEN(banks)];
+	size_t size = (SAMPLES / 100 + 1) * GOERTZEL_BANK_MAX * sizeof(goertzel_state_t);
+	int count, i, j, same;
+
+	if (argc > 2 || (argc == 2 && (secs = atof(argv[1])) <= 0)) {
+		fprintf(stderr, "Usage: goertzelbench [seconds per test]\n");
+		exit(1);
+	}
+
+	srandom(time(NULL));
+	make_audio();
+	want = calloc(1, size);
+	got = calloc(1, size);
+
+	count = goertzel_kernels_available(list, ARRAY_LEN(list));
+
+	printf("%-8s", "");
+	for (j = 0; j < ARRAY_LEN(banks); j++)
+		printf(" %16s", banks[j].name);
+	printf("\n");
+
+	/* The scalar kernel is always last; time it first, to compare */
+	for (j = 0; j < ARRAY_LEN(banks); j++)
+		scalar[j] = bench(list[count - 1], &banks[j], secs);
+
+	for (i = 0; i < count; i++) {
+		same = goertzel_kernel_verify(list[i]);
+		for (j = 0; same && j < ARRAY_LEN(banks); j++) {
+			memset(want, 0, size);
+			memset(got, 0, size);
+			run(list[count - 1], &banks[j], want);
+			run(list[i], &banks[j], got);
+			same = !memcmp(want, got, size);
+		}
+		if (!same) {
+			printf("%-8s does not match the scalar filters\n", list[i]->name);
+			continue;
+		}
+		printf("%-8s", list[i]->name);
+		for (j = 0; j < ARRAY_LEN(banks); j++) {
+			t = (i == count - 1) ? scalar[j] : bench(list[i], &banks[j], secs);
+			printf(" %9.1fus %4.1fx", t, scalar[j] / t);
+		}
+		printf("\n");
+	}
+	printf("(microseconds per second of audio, and speed relative to scalar)\n");
+
+	free(want);
+	free(got);
+
+	return 0;
+}
+
+long int ast_random(void)
+{
+	return random();
+}
+
+void ast_register_file_version(const char *file, const char *version);
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file);
+void ast_unregister_file_version(const char *file)
+{
+}
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	vfprintf(stderr, fmt, vars);
+	va_end(vars);
+}
+
+unsigned int ast_verbose_get_by_file(const char *file)
+{
+	return 0;
+}
+
+void ast_verbose(const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	vprintf(fmt, vars);
+	va_end(vars);
+}
@@ -0,0 +1,351 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Measure the scheduler with many outstanding events
+ *
+ * Gives each of a number of SIP peers a registration that expires within
+ * the hour and a qualify due within the next minute, as chan_sip does,
+ * then has random peers re-register and answer qualifies, each of which
+ * cancels a timer and adds a new one, and finally runs a batch of
+ * retransmission timers that are due.  Reports the time each operation
+ * takes with the events in a heap and on timing wheels, and in the sorted
+ * list every context used before, which runs a thousandth of the
+ * operations as each takes time in proportion to the events queued.
+ *
+ * Usage: schedbench [peers] [operations]
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/time.h>
+
+#include "asterisk/sched.h"
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+#include "asterisk/linkedlists.h"
+
+/* Needed by ast_debug() in sched.c */
+int option_verbose;
+int option_debug;
+struct ast_flags ast_options;
+
+/*! Wheel tick (ms) of each queue measured; 0 for the heap, -1 for the list */
+static const int ticks[] = { -1, 0, 1, 10 };
+
+/*! How many times fewer operations the list runs */
+#define LIST_OPS_DIV	1000
+
+enum {
+	ADD,
+	CHURN,
+	LOOKUP,
+	WAIT,
+	RUN,
+	TESTS
+};
+
+static const char *tests[TESTS] = {
+	[ADD] = "add",
+	[CHURN] = "delete + add",
+	[LOOKUP] = "look up by id",
+	[WAIT] = "time to next",
+	[RUN] = "run due",
+};
+
+static int runs;
+
+static int callback(const void *data)
+{
+	runs++;
+	return 0;
+}
+
+/*! \brief An event in the sorted list, as sched.c kept them before the heap */
+struct list_event {
+	AST_LIST_ENTRY(list_event) list;
+	int id;
+	struct timeval when;
+};
+
+static AST_LIST_HEAD_NOLOCK_STATIC(list_queue, list_event);
+static int list_ids;
+
+static int list_add(int when)
+{
+	struct list_event *e, *cur;
+
+	if (!(e = ast_calloc(1, sizeof(*e))))
+		return -1;
+	e->id = list_ids++;
+	e->when = ast_tvadd(ast_tvnow(), ast_samp2tv(when, 1000));
+	/* Soonest first, after those due at the same time */
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&list_queue, cur, list) {
+		if (ast_tvcmp(e->when, cur->when) == -1) {
+			AST_LIST_INSERT_BEFORE_CURRENT(e, list);
+			break;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+	if (!cur)
+		AST_LIST_INSERT_TAIL(&list_queue, e, list);
+
+	return e->id;
+}
+
+static int list_del(int id)
+{
+	struct list_event *e;
+
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&list_queue, e, list) {
+		if (e->id == id) {
+			AST_LIST_REMOVE_CURRENT(list);
+			ast_free(e);
+			return 0;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+
+	return -1;
+}
+
+static long list_when(int id)
+{
+	struct list_event *e;
+
+	AST_LIST_TRAVERSE(&list_queue, e, list) {
+		if (e->id == id)
+			return e->when.tv_sec - ast_tvnow().tv_sec;
+	}
+
+	return -1;
+}
+
+static int list_wait(void)
+{
+	int ms;
+
+	if (AST_LIST_EMPTY(&list_queue))
+		return -1;
+	ms = ast_tvdiff_ms(AST_LIST_FIRST(&list_queue)->when, ast_tvnow());
+
+	return ms < 0 ? 0 : ms;
+}
+
+static int list_runq(void)
+{
+	struct list_event *e;
+	int n;
+
+	for (n = 0; !AST_LIST_EMPTY(&list_queue); n++) {
+		if (ast_tvcmp(AST_LIST_FIRST(&list_queue)->when, ast_tvadd(ast_tvnow(), ast_tv(0, 1000))) != -1)
+			break;
+		e = AST_LIST_REMOVE_HEAD(&list_queue, list);
+		callback(NULL);
+		ast_free(e);
+	}
+
+	return n;
+}
+
+static void list_destroy(void)
+{
+	struct list_event *e;
+
+	while ((e = AST_LIST_REMOVE_HEAD(&list_queue, list)))
+		ast_free(e);
+}
+
+/* The queue measured: a scheduler context, or the list if NULL */
+
+static int queue_add(struct sched_context *con, int when)
+{
+	return con ? ast_sched_add(con, when, callback, NULL) : list_add(when);
+}
+
+static int queue_del(struct sched_context *con, int id)
+{
+	return con ? ast_sched_del(con, id) : list_del(id);
+}
+
+static long queue_when(struct sched_context *con, int id)
+{
+	return con ? ast_sched_when(con, id) : list_when(id);
+}
+
+static int queue_wait(struct sched_context *con)
+{
+	return con ? ast_sched_wait(con) : list_wait();
+}
+
+static int queue_runq(struct sched_context *con)
+{
+	return con ? ast_sched_runq(con) : list_runq();
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*! \brief Run every test on a queue, putting ns per operation in res */
+static void bench(struct sched_context *con, int peers, int ops, double *res)
+{
+	int timers = 2 * peers, *ids, i, slot;
+	double start;
+
+	if (!(ids = calloc(timers, sizeof(*ids)))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	/* Even slots are registrations, odd ones qualifies */
+	start = now();
+	for (i = 0; i < timers; i++)
+		ids[i] = queue_add(con, (i & 1) ? 1000 + random() % 60000 : 60000 + random() % 3540000);
+	res[ADD] = (now() - start) * 1e9 / timers;
+
+	start = now();
+	for (i = 0; i < ops; i++) {
+		slot = random() % timers;
+		if (queue_del(con, ids[slot]))
+			fprintf(stderr, "Could not delete timer %d\n", ids[slot]);
+		ids[slot] = queue_add(con, (slot & 1) ? 60000 : 3600000);
+	}
+	res[CHURN] = (now() - start) * 1e9 / ops;
+
+	start = now();
+	for (i = 0; i < ops; i++)
+		queue_when(con, ids[random() % timers]);
+	res[LOOKUP] = (now() - start) * 1e9 / ops;
+
+	/* What the monitor thread does before waiting for packets */
+	start = now();
+	for (i = 0; i < ops; i++)
+		queue_wait(con);
+	res[WAIT] = (now() - start) * 1e9 / ops;
+
+	/* Retransmissions that are due, among all the others */
+	for (i = 0; i < peers / 10; i++)
+		queue_add(con, 1 + i % 5);
+	usleep(20000);
+	runs = 0;
+	start = now();
+	queue_runq(con);
+	res[RUN] = (now() - start) * 1e9 / (runs ? runs : 1);
+
+	free(ids);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sched_context *con;
+	double res[ARRAY_LEN(ticks)][TESTS];
+	char name[32];
+	int peers = 50000, ops = 1000000, i, j;
+
+	if (argc > 3 || (argc > 1 && (peers = atoi(argv[1])) < 1) || (argc > 2 && (ops = atoi(argv[2])) < 1)) {
+		fprintf(stderr, "Usage: schedbench [peers] [operations]\n");
+		exit(1);
+	}
+
+	srandom(time(NULL));
+	for (i = 0; i < ARRAY_LEN(ticks); i++) {
+		if (ticks[i] < 0) {
+			bench(NULL, peers, ops / LIST_OPS_DIV ? ops / LIST_OPS_DIV : 1, res[i]);
+			list_destroy();
+			continue;
+		}
+		if (!(con = sched_context_create()) || sched_context_set_wheel(con, ticks[i])) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		bench(con, peers, ops, res[i]);
+		sched_context_destroy(con);
+	}
+
+	printf("%d peers, %d timers\n%-14s", peers, 2 * peers, "");
+	for (i = 0; i < ARRAY_LEN(ticks); i++) {
+		if (ticks[i] > 0)
+			snprintf(name, sizeof(name), "wheel/%dms", ticks[i]);
+		else
+			ast_copy_string(name, ticks[i] ? "list" : "heap", sizeof(name));
+		printf(" %12s", name);
+	}
+	printf("\n");
+	for (j = 0; j < TESTS; j++) {
+		printf("%-14s", tests[j]);
+		for (i = 0; i < ARRAY_LEN(ticks); i++)
+			printf(" %12.0f", res[i][j]);
+		printf("\n");
+	}
+	printf("(ns per operation)\n");
+
+	return 0;
+}
+
+void ast_register_file_version(const char *file, const char *version);
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file);
+void ast_unregister_file_version(const char *file)
+{
+}
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	vfprintf(stderr, fmt, vars);
+	va_end(vars);
+}
+
+unsigned int ast_debug_get_by_file(const char *file)
+{
+	return 0;
+}
+
+unsigned int ast_verbose_get_by_file(const char *file)
+{
+	return 0;
+}
+
+void ast_verbose(const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	vprintf(fmt, vars);
+	va_end(vars);
+}
+
+void ast_register_thread(char *name)
+{
+}
+
+void ast_unregister_thread(void *id)
+{
+}
@@ -0,0 +1,535 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Measure batched UDP reads and writes against one call per packet
+ *
+ * Replays traffic to loopback at the pace it was captured: either a number
+ * of RTP streams of 20ms G.711 packets, started evenly over the first 20ms,
+ * or the UDP over IPv4 in a pcap capture file.  Relays it as chan_sip's
+ * monitor thread does, going round a poll loop, reading what is waiting and
+ * sending each packet on from the socket it came in on.  Relays once with
+ * every stream coming in on one socket, as SIP does, and once with a socket
+ * per stream, as RTP does; each both with one read and one write per
+ * packet, and with ast_udp_recv() and a queue of writes flushed once per
+ * loop.  Reports the packets relayed, the reads and poll wakeups it took,
+ * and the CPU time of the relaying thread per packet.  Run it under
+ * strace -c -f to count every system call.
+ *
+ * Usage: udpbench [streams] [seconds] [capture.pcap]
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "asterisk/udpbatch.h"
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+#include "asterisk/unaligned.h"
+
+/* Needed by ast_debug() in udpbatch.c */
+int option_verbose;
+int option_debug;
+struct ast_flags ast_options;
+
+#define PTIME		20000	/*!< us between the packets of a stream */
+#define RTP_LEN		172	/*!< 12 bytes of RTP header and 20ms of G.711 */
+#define PKT_MAX		2048	/*!< Longest packet relayed */
+
+/*! \brief A packet to replay */
+struct packet {
+	unsigned int when;		/*!< us from the start */
+	unsigned int stream;
+	unsigned int len;
+	const unsigned char *data;	/*!< NULL to make up an RTP packet */
+};
+
+static struct packet *packets;
+static int npackets;
+static int nstreams;
+
+enum {
+	ONE_SOCKET,
+	SOCKET_PER_STREAM,
+	LAYOUTS
+};
+
+static const char *layouts[LAYOUTS] = {
+	[ONE_SOCKET] = "one socket",
+	[SOCKET_PER_STREAM] = "socket/stream",
+};
+
+struct result {
+	unsigned long relayed;
+	unsigned long reads;
+	unsigned long wakeups;
+	double cpu;			/*!< us */
+};
+
+/*! \brief What the sender replays to */
+struct replay {
+	struct sockaddr_in *dst;	/*!< Address of the socket of each stream */
+	volatile int done;
+};
+
+static int add_packet(unsigned int when, unsigned int stream, unsigned int len, const unsigned char *data)
+{
+	static int size;
+	struct packet *p;
+
+	if (npackets == size) {
+		size = size ? size * 2 : 65536;
+		if (!(p = realloc(packets, size * sizeof(*p))))
+			return -1;
+		packets = p;
+	}
+	p = &packets[npackets++];
+	p->when = when;
+	p->stream = stream;
+	p->len = len;
+	p->data = data;
+
+	return 0;
+}
+
+static void make_streams(int streams, double secs)
+{
+	unsigned int frame, s, frames = secs * 1000000 / PTIME;
+
+	for (frame = 0; frame < frames; frame++) {
+		for (s = 0; s < streams; s++) {
+			if (add_packet(frame * PTIME + (unsigned long long) s * PTIME / streams, s, RTP_LEN, NULL)) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+	}
+	nstreams = streams;
+}
+
+static unsigned int get32(const unsigned char *p, int swap)
+{
+	return swap ? p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24 : (unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/*! \brief A flow in a capture: its addresses and ports */
+struct flow {
+	unsigned char key[12];
+	unsigned int stream;
+	int used;
+};
+
+static unsigned int flow_hash(const unsigned char *key)
+{
+	unsigned int hash = 5381, i;
+
+	for (i = 0; i < 12; i++)
+		hash = hash * 33 ^ key[i];
+
+	return hash;
+}
+
+/*! \brief Find the stream of a flow, numbering new flows as they come */
+static unsigned int flow_stream(const unsigned char *ip, const unsigned char *udp)
+{
+	static struct flow *flows;
+	static unsigned int size;
+	struct flow *old = flows;
+	unsigned char key[12];
+	unsigned int i, j, oldsize = size;
+
+	memcpy(key, ip + 12, 8);	/* source and destination addresses */
+	memcpy(key + 8, udp, 4);	/* and ports */
+
+	/* Keep the table at most half full */
+	if ((nstreams + 1) * 2 > size) {
+		size = size ? size * 2 : 1024;
+		if (!(flows = calloc(size, sizeof(*flows)))) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		for (i = 0; i < oldsize; i++) {
+			if (!old[i].used)
+				continue;
+			for (j = flow_hash(old[i].key) % size; flows[j].used; j = (j + 1) % size)
+				;
+			flows[j] = old[i];
+		}
+		free(old);
+	}
+	for (i = flow_hash(key) % size; flows[i].used; i = (i + 1) % size) {
+		if (!memcmp(flows[i].key, key, sizeof(key)))
+			return flows[i].stream;
+	}
+	memcpy(flows[i].key, key, sizeof(key));
+	flows[i].used = 1;
+
+	return flows[i].stream = nstreams++;
+}
+
+/*! \brief Take the UDP over IPv4 from a pcap file, up to secs into it */
+static void read_capture(const char *file, double secs)
+{
+	unsigned char *buf, *rec, *ip, *udp;
+	unsigned int magic, linktype, caplen, len, when, hdrlen;
+	unsigned long long first = 0, ts;
+	size_t size = 0, got, off;
+	int swap, nsec;
+	FILE *f;
+
+	if (!(f = fopen(file, "r"))) {
+		fprintf(stderr, "Unable to open %s: %s\n", file, strerror(errno));
+		exit(1);
+	}
+	buf = NULL;
+	do {
+		if (!(buf = realloc(buf, size + 1048576))) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		size += got = fread(buf + size, 1, 1048576, f);
+	} while (got);
+	fclose(f);
+
+	if (size < 24) {
+		fprintf(stderr, "%s is not a pcap file\n", file);
+		exit(1);
+	}
+	magic = get32(buf, 0);
+	if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d)
+		swap = 0;
+	else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+		swap = 1;
+	else {
+		fprintf(stderr, "%s is not a pcap file\n", file);
+		exit(1);
+	}
+	nsec = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1);
+	linktype = get32(buf + 20, swap);
+
+	for (off = 24; off + 16 <= size; off += 16 + caplen) {
+		rec = buf + off;
+		caplen = get32(rec + 8, swap);
+		if (off + 16 + caplen > size)
+			break;
+		ts = get32(rec, swap) * 1000000ULL + get32(rec + 4, swap) / (nsec ? 1000 : 1);
+		ip = rec + 16;
+		switch (linktype) {
+		case 0:		/* BSD loopback */
+			hdrlen = 4;
+			break;
+		case 1:		/* Ethernet */
+			hdrlen = 14;
+			if (caplen >= 18 && ip[12] == 0x81 && ip[13] == 0x00)
+				hdrlen = 18;	/* 802.1Q */
+			if (caplen < hdrlen || ip[hdrlen - 2] != 0x08 || ip[hdrlen - 1] != 0x00)
+				continue;
+			break;
+		case 12:	/* raw IP */
+		case 101:
+			hdrlen = 0;
+			break;
+		case 113:	/* Linux cooked */
+			hdrlen = 16;
+			if (caplen < hdrlen || ip[14] != 0x08 || ip[15] != 0x00)
+				continue;
+			break;
+		default:
+			fprintf(stderr, "%s has link type %u, which we cannot read\n", file, linktype);
+			exit(1);
+		}
+		if (caplen < hdrlen + 28)
+			continue;
+		ip += hdrlen;
+		/* IPv4, UDP, not a fragment */
+		if ((ip[0] >> 4) != 4 || ip[9] != 17 || ((ip[6] & 0x3f) | ip[7]))
+			continue;
+		udp = ip + (ip[0] & 0xf) * 4;
+		if (udp + 8 > rec + 16 + caplen)
+			continue;
+		len = (udp[4] << 8 | udp[5]) - 8;
+		if (len > PKT_MAX || udp + 8 + len > rec + 16 + caplen)
+			continue;
+		if (!npackets)
+			first = ts;
+		if (ts < first)
+			ts = first;
+		if ((when = ts - first) > secs * 1000000)
+			break;
+		if (add_packet(when, flow_stream(ip, udp), len, udp + 8)) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	if (!npackets) {
+		fprintf(stderr, "No UDP over IPv4 in %s\n", file);
+		exit(1);
+	}
+}
+
+static long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static double cpu_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int udp_socket(struct sockaddr_in *sin)
+{
+	socklen_t len = sizeof(*sin);
+	int fd;
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || bind(fd, (struct sockaddr *) sin, sizeof(*sin)) || getsockname(fd, (struct sockaddr *) sin, &len)) {
+		fprintf(stderr, "Unable to open a UDP socket: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	return fd;
+}
+
+/*! \brief Send the packets to loopback when they are due, in batches */
+static void *sender(void *data)
+{
+	struct replay *replay = data;
+	struct ast_udp_batch *batch = ast_udp_batch_create();
+	struct sockaddr_in sin;
+	unsigned char rtp[RTP_LEN];
+	struct packet *p;
+	long long start, wait;
+	unsigned int frame;
+	int fd = udp_socket(&sin), i;
+
+	ast_udp_batch_use(batch);
+	memset(rtp, 0xff, sizeof(rtp));
+	start = now_us();
+	for (i = 0; i < npackets; i++) {
+		p = &packets[i];
+		if ((wait = p->when - (now_us() - start)) > 0) {
+			ast_udp_batch_flush();
+			usleep(wait);
+		}
+		if (!p->data) {
+			frame = p->when / PTIME;
+			rtp[0] = 0x80;
+			rtp[1] = 0;
+			rtp[2] = frame >> 8;
+			rtp[3] = frame;
+			put_unaligned_uint32(rtp + 4, htonl(frame * 160));
+			put_unaligned_uint32(rtp + 8, htonl(p->stream));
+		}
+		ast_udp_sendto(fd, p->data ? p->data : rtp, p->len, &replay->dst[p->stream]);
+	}
+	ast_udp_batch_use(NULL);
+	ast_udp_batch_destroy(batch);
+	close(fd);
+	replay->done = 1;
+
+	return NULL;
+}
+
+/*! \brief Replay the packets and relay them from the sockets they come in on */
+static void relay(int layout, int batched, struct result *res)
+{
+	static unsigned char bufs[AST_UDP_RECV_MAX][PKT_MAX];
+	struct ast_udp_msg msgs[AST_UDP_RECV_MAX];
+	struct ast_udp_batch *batch = NULL;
+	struct sockaddr_in sink, sin;
+	struct replay replay = { NULL, 0 };
+	struct pollfd *fds;
+	pthread_t thread;
+	socklen_t len;
+	double cpu;
+	int nfds = layout == ONE_SOCKET ? 1 : nstreams, sinkfd, i, j, k, n;
+
+	memset(res, 0, sizeof(*res));
+	if (!(fds = calloc(nfds, sizeof(*fds))) || !(replay.dst = calloc(nstreams, sizeof(*replay.dst)))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < nfds; i++) {
+		fds[i].fd = udp_socket(&replay.dst[i]);
+		fds[i].events = POLLIN;
+	}
+	for (; i < nstreams; i++)
+		replay.dst[i] = replay.dst[0];
+	/* Nobody reads what is relayed; the kernel drops it once this fills */
+	sinkfd = udp_socket(&sink);
+	for (i = 0; i < AST_UDP_RECV_MAX; i++) {
+		msgs[i].buf = bufs[i];
+		msgs[i].size = sizeof(bufs[i]);
+	}
+	if (batched) {
+		batch = ast_udp_batch_create();
+		ast_udp_batch_use(batch);
+	}
+
+	cpu = cpu_us();
+	ast_pthread_create(&thread, NULL, sender, &replay);
+	for (;;) {
+		/* Stop once the sender is done and nothing came for a while */
+		if ((n = poll(fds, nfds, 100)) <= 0) {
+			if (replay.done)
+				break;
+			continue;
+		}
+		res->wakeups++;
+		for (i = 0; i < nfds && n; i++) {
+			if (!(fds[i].revents & POLLIN))
+				continue;
+			n--;
+			res->reads++;
+			if (batched) {
+				if ((j = ast_udp_recv(fds[i].fd, msgs, AST_UDP_RECV_MAX, MSG_DONTWAIT)) < 0)
+					continue;
+				res->relayed += j;
+				for (k = 0; k < j; k++)
+					ast_udp_sendto(fds[i].fd, msgs[k].buf, msgs[k].len, &sink);
+			} else {
+				len = sizeof(sin);
+				if ((j = recvfrom(fds[i].fd, bufs[0], sizeof(bufs[0]), MSG_DONTWAIT, (struct sockaddr *) &sin, &len)) < 0)
+					continue;
+				res->relayed++;
+				sendto(fds[i].fd, bufs[0], j, 0, (struct sockaddr *) &sink, sizeof(sink));
+			}
+		}
+		if (batched)
+			ast_udp_batch_flush();
+	}
+	pthread_join(thread, NULL);
+	res->cpu = cpu_us() - cpu;
+
+	if (batched) {
+		ast_udp_batch_use(NULL);
+		ast_udp_batch_destroy(batch);
+	}
+	for (i = 0; i < nfds; i++)
+		close(fds[i].fd);
+	close(sinkfd);
+	free(fds);
+	free(replay.dst);
+}
+
+int main(int argc, char *argv[])
+{
+	struct result res[LAYOUTS][2];
+	struct rlimit rl;
+	double secs = 5;
+	int streams = 1000, i, j;
+
+	if (argc > 4 || (argc > 1 && (streams = atoi(argv[1])) < 1) || (argc > 2 && (secs = atof(argv[2])) <= 0)) {
+		fprintf(stderr, "Usage: udpbench [streams] [seconds] [capture.pcap]\n");
+		exit(1);
+	}
+
+	if (argc > 3)
+		read_capture(argv[3], secs);
+	else
+		make_streams(streams, secs);
+
+	/* A socket per stream, and a few more */
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < nstreams + 16) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if (rl.rlim_cur < nstreams + 16) {
+			fprintf(stderr, "%d streams need more files open than the limit of %d\n", nstreams, (int) rl.rlim_cur);
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < LAYOUTS; i++) {
+		for (j = 0; j < 2; j++)
+			relay(i, j, &res[i][j]);
+	}
+
+	printf("%d streams, %d packets over %.1fs\n", nstreams, npackets, packets[npackets - 1].when / 1e6);
+	printf("%-14s %-10s %10s %10s %10s %10s %10s\n", "", "", "relayed", "reads", "wakeups", "reads/pkt", "cpu us/pkt");
+	for (i = 0; i < LAYOUTS; i++) {
+		for (j = 0; j < 2; j++) {
+			printf("%-14s %-10s %10lu %10lu %10lu %10.3f %10.2f\n", layouts[i], j ? "batched" : "per packet",
+				res[i][j].relayed, res[i][j].reads, res[i][j].wakeups,
+				res[i][j].relayed ? (double) res[i][j].reads / res[i][j].relayed : 0,
+				res[i][j].relayed ? res[i][j].cpu / res[i][j].relayed : 0);
+		}
+	}
+
+	return 0;
+}
+
+void ast_register_file_version(const char *file, const char *version);
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file);
+void ast_unregister_file_version(const char *file)
+{
+}
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	vfprintf(stderr, fmt, vars);
+	va_end(vars);
+}
+
+unsigned int ast_debug_get_by_file(const char *file)
+{
+	return 0;
+}
+
+unsigned int ast_verbose_get_by_file(const char *file)
+{
+	return 0;
+}
+
+void ast_verbose(const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	vprintf(fmt, vars);
+	va_end(vars);
+}
+
+void ast_register_thread(char *name)
+{
+}
+
+void ast_unregister_thread(void *id)
+{
+}